@@ -7,6 +7,7 @@
 #include "../../include/embree2/rtcore.h"
 #include "../../kernels/bvh/bvh.h"
 #include "../../kernels/geometry/trianglev.h"
+#include "../../common/algorithms/parallel_for.h"
 
 #include <unordered_map>
 
@@ -85,19 +86,27 @@ protected:
     { 
       m_convertedLayout.clear(); 
       m_convertedTrinagles.clear(); 
+      m_quantizedLayout.clear();
+      m_compactLeafOffsets.clear();
       m_totalMeshTriangleCount = 0; 
       embreeFormat = ""; 
+      resultFormat = "";
     }
 
     bool empty() const { return (m_convertedLayout.size() <= 4); }
 
     std::vector<BVHNode> m_convertedLayout;
     std::vector<float4>  m_convertedTrinagles;
+    std::vector<float4>  m_quantizedLayout;    ///< compressed copy of m_convertedLayout, see BVH4_QUANTIZED_LAYOUT_TAG
+    std::vector<size_t>  m_compactLeafOffsets; ///< headers of compact leaves in m_convertedTrinagles, see BVH_COMPACT_LEAF_TAG
     size_t               m_totalMeshTriangleCount;
     std::string          embreeFormat;
+    std::string          resultFormat;       ///< embreeFormat with "_q8" suffix for compressed layout
   };
 
   bool m_earlySplit;
+  bool m_quantizedBVH;
+  bool m_compactLeaves;
 
   std::vector<LinearTree>   m_ltrees;
   int                       m_ltreeId;
@@ -105,8 +114,14 @@ protected:
   std::vector<BVHNode>      m_dummy4bvh;
   std::vector<float4>       m_dummy3f4;
 
-  size_t ConvertBvh4TwoLevel(BVH4::NodeRef node, size_t currNodeOffset, int depth, int instDepth, int a_meshId, const char* a_treeType, int a_treeId);
+  size_t ConvertBvh4TwoLevel(LinearTree& lt, BVH4::NodeRef node, size_t currNodeOffset, int depth, int instDepth, int a_meshId, const char* a_treeType, int a_treeId);
+  BVHNode AppendSubtree(LinearTree& lt, const LinearTree& a_subtree);
   void InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef node, EmbreeBVH4_2::LinearTree& lt, int a_meshId, const char* a_treeType);
+  void CompactLeaf(EmbreeBVH4_2::LinearTree& lt, size_t a_objListOffset);
+
+  void         QuantizeLayout(LinearTree& lt);
+  unsigned int QuantizeNode(const std::vector<BVHNode>& a_in, unsigned int a_blockId, std::vector<float4>& a_out, std::unordered_map<unsigned int, unsigned int>& a_unitByBlock);
+  unsigned int QuantizeInstance(const std::vector<BVHNode>& a_in, unsigned int a_blockId, std::vector<float4>& a_out, std::unordered_map<unsigned int, unsigned int>& a_unitByBlock);
 
 
   /////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -121,7 +136,6 @@ protected:
   };
 
   std::vector<InstanceNode>            m_instNodesConnections;
-  std::unordered_map<int32_t, size_t>  m_instNodeMeshesRef;
 
   std::vector<BVH4*> ExtractBVH4Pointers();
 
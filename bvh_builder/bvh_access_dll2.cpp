@@ -1,6 +1,8 @@
 #include "bvh_access.h"
 
 #include<memory>
+#include<cmath>
+#include<algorithm>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -28,6 +30,8 @@ EmbreeBVH4_2::EmbreeBVH4_2() : m_device(nullptr), m_algorithmFlags(RTC_INTERSECT
   m_ltrees[0].m_totalMeshTriangleCount = 0;
   m_ltreeId    = 0;
   m_earlySplit = false;
+  m_quantizedBVH = false;
+  m_compactLeaves = false;
 }
 
 EmbreeBVH4_2::~EmbreeBVH4_2()
@@ -52,6 +56,9 @@ void EmbreeBVH4_2::Init(const char* cfg)
   //  m_allowInsertCopies = true;
   //else
   //  m_allowInsertCopies = false;
+
+  m_quantizedBVH  = (cfg != nullptr && std::string(cfg).find("-quantized_bvh 1")  != std::string::npos);
+  m_compactLeaves = (cfg != nullptr && std::string(cfg).find("-compact_leaves 1") != std::string::npos);
 }
 
 void EmbreeBVH4_2::Destroy()
@@ -281,8 +288,8 @@ void EmbreeBVH4_2::InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef no
     using PrimType = embree::sse2::ObjectIntersector1<0>::Primitive;
     const PrimType* pdata = (const PrimType*)node.leaf(num);
 
-    auto& triRefs       = m_refsHash[a_meshId];
-    auto& inputMeshData = m_inputMeshData[a_meshId];
+    auto& triRefs       = m_refsHash.at(a_meshId);      // at() is used because leaves are converted in parallel
+    auto& inputMeshData = m_inputMeshData.at(a_meshId);
 
     const float4* vert4f = (const float4*)inputMeshData.vert4f;
     const int*    ind    = inputMeshData.indices;
@@ -348,15 +355,93 @@ void EmbreeBVH4_2::InsertTrainglesInLeaf(size_t currNodeOffset, BVH4::NodeRef no
   (*(pTriNumber + 2)) = -1;
   (*(pTriNumber + 3)) = -1;
 
+  if (m_compactLeaves)
+    CompactLeaf(lt, objListOffset);
+}
+
+void EmbreeBVH4_2::CompactLeaf(EmbreeBVH4_2::LinearTree& lt, size_t a_objListOffset)
+{
+  const int* pHeader = (const int*)(&lt.m_convertedTrinagles[a_objListOffset]);
+  const int triNum   = pHeader[1];
+
+  if (triNum == 0 || a_objListOffset + 1 + 3 * size_t(triNum) != lt.m_convertedTrinagles.size())
+    return;
+
+  const float4* pTris = &lt.m_convertedTrinagles[a_objListOffset + 1];
+  const int geomId    = as_int(pTris[1].w);
+
+  std::vector<float4> verts;
+  std::vector<int>    prims(triNum), packed(triNum);
+  verts.reserve(triNum * 3);
+
+  for (int triId = 0; triId < triNum; triId++)
+  {
+    if (as_int(pTris[triId * 3 + 1].w) != geomId || as_int(pTris[triId * 3 + 2].w) != -1) // mixed meshes or instance id inside leaf; keep plain format
+      return;
+
+    int indices[3];
+    for (int k = 0; k < 3; k++)
+    {
+      const float4 v = pTris[triId * 3 + k];
+
+      int found = -1;
+      for (size_t j = 0; j < verts.size(); j++) // exact match only, so hits are the same as for plain leaves
+      {
+        if (verts[j].x == v.x && verts[j].y == v.y && verts[j].z == v.z)
+        {
+          found = int(j);
+          break;
+        }
+      }
+
+      if (found == -1)
+      {
+        found = int(verts.size());
+        verts.push_back(v);
+      }
+
+      indices[k] = found;
+    }
+
+    prims [triId] = as_int(pTris[triId * 3 + 0].w);
+    packed[triId] = indices[0] | (indices[1] << 8) | (indices[2] << 16);
+  }
+
+  if (verts.size() > BVH_COMPACT_LEAF_MAXVERT)
+    return;
+
+  const int4 header   = make_int4(0, triNum, BVH_COMPACT_LEAF_TAG | int(verts.size()), geomId); // alphaBase is set in ConvertMap when all leaves are done
+  const int  vertF4   = CompactLeafVertOffset(header);
+  const int  totalF4  = CompactLeafSizeInF4(header);
+
+  std::vector<float4> leaf(totalF4, float4(0, 0, 0, 0));
+  leaf[0] = float4(as_float(header.x), as_float(header.y), as_float(header.z), as_float(header.w));
+
+  int* pRecords = (int*)&leaf[1];
+  for (int triId = 0; triId < triNum; triId++)
+  {
+    pRecords[triId * 2 + 0] = prims [triId];
+    pRecords[triId * 2 + 1] = packed[triId];
+  }
+
+  float* pVerts = (float*)&leaf[vertF4];
+  for (size_t j = 0; j < verts.size(); j++)
+  {
+    pVerts[j * 3 + 0] = verts[j].x;
+    pVerts[j * 3 + 1] = verts[j].y;
+    pVerts[j * 3 + 2] = verts[j].z;
+  }
+
+  lt.m_convertedTrinagles.resize(a_objListOffset);
+  lt.m_convertedTrinagles.insert(lt.m_convertedTrinagles.end(), leaf.begin(), leaf.end());
+  lt.m_compactLeafOffsets.push_back(a_objListOffset);
 }
 
-size_t EmbreeBVH4_2::ConvertBvh4TwoLevel(BVH4::NodeRef node, size_t currNodeOffset, int a_depth, int a_level, int a_meshId, const char* a_treeType, int a_treeId)
+size_t EmbreeBVH4_2::ConvertBvh4TwoLevel(LinearTree& lt, BVH4::NodeRef node, size_t currNodeOffset, int a_depth, int a_level, int a_meshId, const char* a_treeType, int a_treeId)
 {
   if (m_ltrees.size() == 0)
     return 0;
 
-  auto& lt = m_ltrees[m_ltreeId];
-
   size_t treeOffset = size_t(-1);
 
   auto nodeType = node.type();
@@ -386,12 +471,32 @@ size_t EmbreeBVH4_2::ConvertBvh4TwoLevel(BVH4::NodeRef node, size_t currNodeOffs
     lt.m_convertedLayout[currNodeOffset].SetLeaf(0);
     lt.m_convertedLayout[currNodeOffset].SetLeftOffset((unsigned int)(offsets[0] / 4));
 
+    // go to bigger children first, so their subtrees are placed right after this node
+    //
+    float area [4] = { -1.0f, -1.0f, -1.0f, -1.0f };
+    int   order[4] = { 0, 1, 2, 3 };
+
     for (size_t i = 0; i < 4; i++)
     {
       if (n->child(i) == BVH4::emptyNode)
         continue;
 
-      ConvertBvh4TwoLevel(n->child(i), offsets[i], a_depth + 1, a_level, a_meshId, a_treeType, a_treeId);
+      const auto box  = n->bounds(i);
+      const float dx  = box.upper.x - box.lower.x;
+      const float dy  = box.upper.y - box.lower.y;
+      const float dz  = box.upper.z - box.lower.z;
+      area[i]         = dx*dy + dy*dz + dz*dx;
+    }
+
+    std::stable_sort(order, order + 4, [&area](int a, int b) { return area[a] > area[b]; });
+
+    for (size_t j = 0; j < 4; j++)
+    {
+      const int i = order[j];
+      if (n->child(i) == BVH4::emptyNode)
+        continue;
+
+      ConvertBvh4TwoLevel(lt, n->child(i), offsets[i], a_depth + 1, a_level, a_meshId, a_treeType, a_treeId);
     }
 
     treeOffset = offsets[0];
@@ -511,6 +616,54 @@ size_t EmbreeBVH4_2::ConvertBvh4TwoLevel(BVH4::NodeRef node, size_t currNodeOffs
   return treeOffset;
 }
 
+BVHNode EmbreeBVH4_2::AppendSubtree(LinearTree& lt, const LinearTree& a_subtree)
+{
+  const size_t nodeBase = lt.m_convertedLayout.size() - 4; // first block of a_subtree holds only its root and is not copied
+  const size_t triBase  = lt.m_convertedTrinagles.size();
+
+  auto relocate = [nodeBase, triBase](BVHNode a_node)
+  {
+    if (!IsValidNode(a_node))
+      return a_node;
+
+    if (a_node.Leaf())
+      a_node.SetLeftOffset((unsigned int)(a_node.GetLeftOffset() + triBase));
+    else
+      a_node.SetLeftOffset((unsigned int)(a_node.GetLeftOffset() + nodeBase / 4));
+
+    return a_node;
+  };
+
+  lt.m_convertedLayout.reserve(lt.m_convertedLayout.size() + a_subtree.m_convertedLayout.size());
+  for (size_t i = 4; i < a_subtree.m_convertedLayout.size(); i++)
+    lt.m_convertedLayout.push_back(relocate(a_subtree.m_convertedLayout[i]));
+
+  lt.m_convertedTrinagles.insert(lt.m_convertedTrinagles.end(), a_subtree.m_convertedTrinagles.begin(), a_subtree.m_convertedTrinagles.end());
+
+  // fix object list headers; plain leaf header is (start, triNum, -1, -1), compact leaf gets its alphaBase later
+  //
+  const int4* pTriData = (const int4*)&lt.m_convertedTrinagles[0];
+  for (size_t offset = triBase; offset < lt.m_convertedTrinagles.size();)
+  {
+    const int4 header = pTriData[offset];
+    if (header.z == -1 && header.w == -1)
+    {
+      int* pHeader = (int*)&lt.m_convertedTrinagles[offset];
+      pHeader[0]  += int(triBase);
+      offset++;
+    }
+    else if (IsCompactLeaf(header))
+      offset += CompactLeafSizeInF4(header);
+    else
+      offset += 3;
+  }
+
+  for (auto leafOffset : a_subtree.m_compactLeafOffsets)
+    lt.m_compactLeafOffsets.push_back(leafOffset + triBase);
+
+  return relocate(a_subtree.m_convertedLayout[0]);
+}
+
 std::vector<BVH4*> EmbreeBVH4_2::ExtractBVH4Pointers()
 {
   std::vector<BVH4*> trees2;
@@ -568,6 +721,160 @@ std::vector<BVH4*> EmbreeBVH4_2::ExtractBVH4Pointers()
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+static inline unsigned int QuantizeBoxLo(float a_val, float a_origin, float a_scale)
+{
+  if (a_scale <= 0.0f)
+    return 0;
+
+  int q = int(floorf((a_val - a_origin) / a_scale)) - 1; // one extra step against rounding differences in traversal code
+  q     = (q < 0) ? 0 : ((q > 255) ? 255 : q);
+  while (q > 0 && a_origin + a_scale*float(q) > a_val)
+    q--;
+
+  return (unsigned int)q;
+}
+
+static inline unsigned int QuantizeBoxHi(float a_val, float a_origin, float a_scale)
+{
+  if (a_scale <= 0.0f)
+    return 0;
+
+  int q = int(ceilf((a_val - a_origin) / a_scale)) + 1;  // one extra step against rounding differences in traversal code
+  q     = (q < 0) ? 0 : ((q > 255) ? 255 : q);
+  while (q < 255 && a_origin + a_scale*float(q) < a_val)
+    q++;
+
+  return (unsigned int)q;
+}
+
+static inline bool IsFiniteBox(const BVHNode& a_node)
+{
+  return std::isfinite(a_node.m_boxMin.x) && std::isfinite(a_node.m_boxMin.y) && std::isfinite(a_node.m_boxMin.z) &&
+         std::isfinite(a_node.m_boxMax.x) && std::isfinite(a_node.m_boxMax.y) && std::isfinite(a_node.m_boxMax.z) &&
+         (a_node.m_boxMin.x <= a_node.m_boxMax.x) && (a_node.m_boxMin.y <= a_node.m_boxMax.y) && (a_node.m_boxMin.z <= a_node.m_boxMax.z);
+}
+
+unsigned int EmbreeBVH4_2::QuantizeNode(const std::vector<BVHNode>& a_in, unsigned int a_blockId, std::vector<float4>& a_out, std::unordered_map<unsigned int, unsigned int>& a_unitByBlock)
+{
+  auto p = a_unitByBlock.find(a_blockId);
+  if (p != a_unitByBlock.end())
+    return p->second;
+
+  const unsigned int unitId = (unsigned int)(a_out.size() / 4);
+  a_unitByBlock[a_blockId]  = unitId;
+  a_out.resize(a_out.size() + 4, float4(0, 0, 0, 0));
+
+  const BVHNode* nodes = &a_in[4 * a_blockId];
+
+  bool  valid[4];
+  float bMin[3] = { +INFINITY, +INFINITY, +INFINITY };
+  float bMax[3] = { -INFINITY, -INFINITY, -INFINITY };
+
+  for (int i = 0; i < 4; i++)
+  {
+    valid[i] = IsValidNode(nodes[i]) && IsFiniteBox(nodes[i]);
+    if (!valid[i])
+      continue;
+
+    bMin[0] = fminf(bMin[0], nodes[i].m_boxMin.x); bMax[0] = fmaxf(bMax[0], nodes[i].m_boxMax.x);
+    bMin[1] = fminf(bMin[1], nodes[i].m_boxMin.y); bMax[1] = fmaxf(bMax[1], nodes[i].m_boxMax.y);
+    bMin[2] = fminf(bMin[2], nodes[i].m_boxMin.z); bMax[2] = fmaxf(bMax[2], nodes[i].m_boxMax.z);
+  }
+
+  float origin[3] = { 0, 0, 0 };
+  float scale [3] = { 0, 0, 0 };
+
+  for (int axis = 0; axis < 3; axis++)
+  {
+    if (bMin[axis] > bMax[axis]) // no valid children at all
+      continue;
+
+    const float extent = bMax[axis] - bMin[axis];
+    origin[axis]       = bMin[axis];
+    scale [axis]       = (extent > 0.0f) ? fmaxf(extent / 253.0f, 1e-30f) : 0.0f; // leave 2 steps for conservative rounding
+  }
+
+  unsigned int q[6]        = { 0, 0, 0, 0, 0, 0 }; // minX, maxX, minY, maxY, minZ, maxZ; one byte per child
+  unsigned int children[4] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+
+  for (int i = 0; i < 4; i++)
+  {
+    if (!valid[i])
+      continue;
+
+    const BVHNode node = nodes[i];
+
+    q[0] |= QuantizeBoxLo(node.m_boxMin.x, origin[0], scale[0]) << (8 * i);
+    q[1] |= QuantizeBoxHi(node.m_boxMax.x, origin[0], scale[0]) << (8 * i);
+    q[2] |= QuantizeBoxLo(node.m_boxMin.y, origin[1], scale[1]) << (8 * i);
+    q[3] |= QuantizeBoxHi(node.m_boxMax.y, origin[1], scale[1]) << (8 * i);
+    q[4] |= QuantizeBoxLo(node.m_boxMin.z, origin[2], scale[2]) << (8 * i);
+    q[5] |= QuantizeBoxHi(node.m_boxMax.z, origin[2], scale[2]) << (8 * i);
+
+    if (!node.Leaf())
+      children[i] = QuantizeNode(a_in, node.GetLeftOffset(), a_out, a_unitByBlock);
+    else if (node.Instance())
+      children[i] = 0x80000000 | QuantizeInstance(a_in, node.GetLeftOffset(), a_out, a_unitByBlock);
+    else
+      children[i] = node.m_leftOffsetAndLeaf; // triangle list offset does not change
+  }
+
+  // a_out may be reallocated by recursive calls, so write node data only at the end
+  //
+  a_out[4 * unitId + 0] = float4(origin[0], origin[1], origin[2], scale[0]);
+  a_out[4 * unitId + 1] = float4(scale[1], scale[2], as_float(int(q[0])), as_float(int(q[1])));
+  a_out[4 * unitId + 2] = float4(as_float(int(q[2])), as_float(int(q[3])), as_float(int(q[4])), as_float(int(q[5])));
+  a_out[4 * unitId + 3] = float4(as_float(int(children[0])), as_float(int(children[1])), as_float(int(children[2])), as_float(int(children[3])));
+
+  return unitId;
+}
+
+unsigned int EmbreeBVH4_2::QuantizeInstance(const std::vector<BVHNode>& a_in, unsigned int a_blockId, std::vector<float4>& a_out, std::unordered_map<unsigned int, unsigned int>& a_unitByBlock)
+{
+  auto p = a_unitByBlock.find(a_blockId);
+  if (p != a_unitByBlock.end())
+    return p->second;
+
+  const unsigned int unitId = (unsigned int)(a_out.size() / 4);
+  a_unitByBlock[a_blockId]  = unitId;
+
+  // instance block (next offset, matrix, instance id) is copied as is; it takes 2 units
+  //
+  const float4* pInstData = (const float4*)&a_in[4 * a_blockId];
+  for (int k = 0; k < 8; k++)
+    a_out.push_back(pInstData[k]);
+
+  const BVHNode subtreeRoot = a_in[4 * a_blockId];
+  if (subtreeRoot.m_leftOffsetAndLeaf != 0xFFFFFFFF && !subtreeRoot.Leaf())
+  {
+    const unsigned int subtreeUnit = QuantizeNode(a_in, subtreeRoot.GetLeftOffset(), a_out, a_unitByBlock);
+    a_out[4 * unitId + 0].w = as_float(int(subtreeUnit));
+  }
+
+  return unitId;
+}
+
+void EmbreeBVH4_2::QuantizeLayout(LinearTree& lt)
+{
+  const std::vector<BVHNode>& nodes = lt.m_convertedLayout;
+  std::unordered_map<unsigned int, unsigned int> unitByBlock;
+
+  lt.m_quantizedLayout.resize(0);
+  lt.m_quantizedLayout.reserve(nodes.size() + 4);
+
+  // unit 0 is a header: root box and layout tag; traversal always starts from unit 1
+  //
+  const BVHNode root = nodes[0];
+  lt.m_quantizedLayout.push_back(float4(root.m_boxMin.x, root.m_boxMin.y, root.m_boxMin.z, as_float(1)));
+  lt.m_quantizedLayout.push_back(float4(root.m_boxMax.x, root.m_boxMax.y, root.m_boxMax.z, as_float(BVH4_QUANTIZED_LAYOUT_TAG)));
+  lt.m_quantizedLayout.push_back(float4(0, 0, 0, 0));
+  lt.m_quantizedLayout.push_back(float4(0, 0, 0, 0));
+
+  QuantizeNode(nodes, root.GetLeftOffset(), lt.m_quantizedLayout, unitByBlock);
+
+  lt.resultFormat = lt.embreeFormat + "_q8";
+}
+
 ConvertionResult EmbreeBVH4_2::ConvertMap()
 {
   std::vector<BVH4*> trees = ExtractBVH4Pointers();
@@ -595,6 +902,7 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
 
     lt.m_convertedTrinagles.resize(0);
     lt.m_convertedTrinagles.reserve(3 * lt.m_totalMeshTriangleCount * 2);
+    lt.m_compactLeafOffsets.resize(0);
 
     m_instNodesConnections.resize(0);
     m_instNodesConnections.reserve(m_tree[realTreeId].m_matByInstId.size() + 10);
@@ -612,46 +920,55 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
 
     // convert top level tree first
     //
-    ConvertBvh4TwoLevel(root, rootOffset, 0, 0, -1, bvh4->primTy->name.c_str(), realTreeId);
+    ConvertBvh4TwoLevel(lt, root, rootOffset, 0, 0, -1, bvh4->primTy->name.c_str(), realTreeId);
   
-    // convert bottom level instances
+    // convert bottom level instances; every unique mesh is converted by separate task to its own buffers, 
+    // then they are appended in order of first appearance, so the result does not depend on task scheduling
     //
-    m_instNodeMeshesRef.clear();
-    
-    for (auto subtree : m_instNodesConnections)
+    std::vector<InstanceNode>       meshSubtrees;
+    std::unordered_map<int, size_t> taskByMeshId;
+
+    for (const auto& subtree : m_instNodesConnections)
     {
-      auto p = m_instNodeMeshesRef.find(subtree.meshId);
-      if (p != m_instNodeMeshesRef.end())
-      {
-        const size_t  instNodeOffset = subtree.leftNodeOffset; // 4 'float8' nodes with matrix at [1] and [2]
-        const size_t  subtreeOffset  = p->second;
+      if (taskByMeshId.find(subtree.meshId) != taskByMeshId.end())
+        continue;
+      taskByMeshId[subtree.meshId] = meshSubtrees.size();
+      meshSubtrees.push_back(subtree);
+    }
 
-        if (subtree.tree.isAlignedNode())
-        {
-          lt.m_convertedLayout[instNodeOffset].SetLeaf(0);
-          lt.m_convertedLayout[instNodeOffset].SetLeftOffset((unsigned int)(subtreeOffset / 4));
-        }
-        else
-        {
-          lt.m_convertedLayout[instNodeOffset].SetLeaf(1);
-          InsertTrainglesInLeaf(instNodeOffset, subtree.tree, m_ltrees[m_ltreeId], subtree.meshId, ""); // don't pass bvh4->primTy.name.c_str() !
-        }
-    
-      }
-      else
-      {
-        size_t treeOffset = ConvertBvh4TwoLevel(subtree.tree, subtree.leftNodeOffset, 0, 1, subtree.meshId, "", realTreeId); // don't pass bvh4->primTy.name.c_str() !
-        m_instNodeMeshesRef[subtree.meshId] = treeOffset;
+    std::vector<LinearTree> meshTrees(meshSubtrees.size());
 
-        if (treeOffset == size_t(-1))
-        {
-          lt.m_convertedLayout[subtree.leftNodeOffset].SetLeaf(1);
-          InsertTrainglesInLeaf(subtree.leftNodeOffset, subtree.tree, lt, subtree.meshId, ""); // don't pass bvh4->primTy.name.c_str() !
-        }
-        else
-          lt.m_convertedLayout[subtree.leftNodeOffset].SetLeaf(0);
+    parallel_for(meshSubtrees.size(), [&](const size_t taskId)
+    {
+      const InstanceNode& subtree = meshSubtrees[taskId];
+      LinearTree& mt              = meshTrees[taskId];
+      
+      Alloc4BVHNodes(mt.m_convertedLayout); // node 0 is a subtree root; it is moved to instance node when stitching
+      ConvertBvh4TwoLevel(mt, subtree.tree, 0, 0, 1, subtree.meshId, "", realTreeId); // don't pass bvh4->primTy.name.c_str() !
+    });
 
-      }
+    std::vector<BVHNode> meshRoots(meshTrees.size());
+    for (size_t taskId = 0; taskId < meshTrees.size(); taskId++)
+    {
+      meshRoots[taskId] = AppendSubtree(lt, meshTrees[taskId]);
+      meshTrees[taskId] = LinearTree();
+    }
+
+    for (const auto& subtree : m_instNodesConnections)
+    {
+      const BVHNode& meshRoot = meshRoots[taskByMeshId[subtree.meshId]];
+      lt.m_convertedLayout[subtree.leftNodeOffset].m_leftOffsetAndLeaf = meshRoot.m_leftOffsetAndLeaf;
+      lt.m_convertedLayout[subtree.leftNodeOffset].m_escapeIndex       = meshRoot.m_escapeIndex;
+    }
+
+    // alpha test records of compact leaves are placed after the end of triangle data (see CreateAlphaTestTable)
+    //
+    int alphaBase = int(lt.m_convertedTrinagles.size());
+    for (auto leafOffset : lt.m_compactLeafOffsets)
+    {
+      int* pHeader = (int*)(&lt.m_convertedTrinagles[leafOffset]);
+      pHeader[0]   = alphaBase;
+      alphaBase   += 3 * pHeader[1];
     }
 
     realTreeId++;
@@ -669,11 +986,21 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
     if (m_ltrees[i].empty())
       continue;
 
-    res.bvhType[finalBvhNumber]       = m_ltrees[i].embreeFormat.c_str();
-    res.pBVH   [finalBvhNumber]       = &(m_ltrees[i].m_convertedLayout[0]);
+    if (m_quantizedBVH)
+    {
+      QuantizeLayout(m_ltrees[i]);
+      res.bvhType[finalBvhNumber]     = m_ltrees[i].resultFormat.c_str();
+      res.pBVH   [finalBvhNumber]     = (const BVHNode*)&(m_ltrees[i].m_quantizedLayout[0]);
+      res.nodesNum[finalBvhNumber]    = int(m_ltrees[i].m_quantizedLayout.size()/2); // in BVHNode units, 2 float4 per node
+    }
+    else
+    {
+      res.bvhType[finalBvhNumber]     = m_ltrees[i].embreeFormat.c_str();
+      res.pBVH   [finalBvhNumber]     = &(m_ltrees[i].m_convertedLayout[0]);
+      res.nodesNum[finalBvhNumber]    = int(m_ltrees[i].m_convertedLayout.size());
+    }
+
     res.pTriangleData[finalBvhNumber] = (float*)&(m_ltrees[i].m_convertedTrinagles[0]);
-    
-    res.nodesNum[finalBvhNumber]      = int(m_ltrees[i].m_convertedLayout.size());
     res.trif4Num[finalBvhNumber]      = int(m_ltrees[i].m_convertedTrinagles.size());
     
     finalBvhNumber++;
@@ -686,7 +1013,10 @@ ConvertionResult EmbreeBVH4_2::ConvertMap()
 void EmbreeBVH4_2::ConvertUnmap()
 {
   for (auto& lt : m_ltrees)
+  {
     lt.m_convertedLayout.clear();
+    lt.m_quantizedLayout = std::vector<float4>();
+  }
 
   m_instNodesConnections = std::vector<InstanceNode>();
 }
@@ -27,6 +27,14 @@ Input::Input()
   cpuFB         = true; ///< store frame buffer on CPU. Automaticly enabled if
   enableMLT     = false; ///< if use MMLT, you MUST enable it early, when render process just started (here or via command line).
   boxMode       = false; ///< special 'in the box' mode when render don't react to any commands
+  quantizedBVH  = false; ///< compressed BVH layout with 8-bit child boxes; less memory traffic during traversal
+  compactLeaves = false; ///< BVH leaves with shared vertices instead of 3 float4 per triangle; for scenes that don't fit device memory
+  nativeBVH     = false; ///< built-in multithreaded SAH builder; does not need bvh_builder dll
+  reorderRays   = false; ///< sort rays by direction octant and origin for bounces >= 1; helps scenes with a lot of diffuse interreflection
+  bvhAnalytics  = false; ///< write z_bvh_analytics.txt after scene commit and node/triangle heatmaps on the first frame (CPU path only)
+  shortStack    = false; ///< closest hit traversal with 8-entry stack and restart trail; reduces private memory and may raise occupancy
+  warmServer    = false; ///< don't exit after job; each new '-action start' session reopens scene and driver uploads only changed meshes and textures
+  denoise       = false; ///< filter final frames with G-buffer guided NLM; G-buffer must be evaluated (-evalgbuffer)
 
   winWidth      = 1024;  ///<
   winHeight     = 1024;  ///<
@@ -38,6 +46,8 @@ Input::Input()
   camMoveSpeed     = 2.5f;
   mouseSensitivity = 0.1f;
   saveInterval     = 0.0f;
+  checkpointInterval = 300.0f;
+  exrInterval        = 0.0f;
 
   // dynamic data
   //
@@ -171,6 +181,14 @@ void Input::ParseCommandLineParams(const std::unordered_map<std::string, std::st
   ReadBoolCmd(a_params,   "-alloc_image_b",   &allocInternalImageB);
   ReadBoolCmd(a_params,   "-evalgbuffer",     &getGBufferBeforeRender);
   ReadBoolCmd(a_params,   "-boxmode",         &boxMode);
+  ReadBoolCmd(a_params,   "-quantized_bvh",   &quantizedBVH);
+  ReadBoolCmd(a_params,   "-compact_leaves",  &compactLeaves);
+  ReadBoolCmd(a_params,   "-native_bvh",      &nativeBVH);
+  ReadBoolCmd(a_params,   "-reorder_rays",    &reorderRays);
+  ReadBoolCmd(a_params,   "-bvh_analytics",   &bvhAnalytics);
+  ReadBoolCmd(a_params,   "-short_stack",     &shortStack);
+  ReadBoolCmd(a_params,   "-warm_server",     &warmServer);
+  ReadBoolCmd(a_params,   "-denoise",         &denoise);
  
   if (listDevicesAndExit)
     noWindow = true;
@@ -178,6 +196,8 @@ void Input::ParseCommandLineParams(const std::unordered_map<std::string, std::st
   ReadIntCmd (a_params,   "-seed",         &inSeed);
   ReadIntCmd (a_params,   "-cl_device_id", &inDeviceId);
   ReadFloatCmd(a_params,  "-saveinterval", &saveInterval);
+  ReadFloatCmd(a_params,  "-checkpoint_interval", &checkpointInterval);
+  ReadFloatCmd(a_params,  "-outexr_interval",     &exrInterval);
 
   ReadIntCmd(a_params,    "-width",        &winWidth);
   ReadIntCmd(a_params,    "-height",       &winHeight);
@@ -195,6 +215,9 @@ void Input::ParseCommandLineParams(const std::unordered_map<std::string, std::st
   ReadStringCmd(a_params, "-outall",      &outAllDir);
   ReadStringCmd(a_params, "-logdir",      &inLogDirCust);
   ReadStringCmd(a_params, "-sharedimage", &inSharedImageName);
+  ReadStringCmd(a_params, "-checkpoint",  &checkpointFile);
+  ReadStringCmd(a_params, "-crop",        &cropWindow);
+  ReadStringCmd(a_params, "-outexr",      &outEXRImage);
   
   if(inTargetState != "")
     inLibraryPath = inLibraryPath + "/" + inTargetState;
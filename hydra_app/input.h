@@ -20,6 +20,14 @@ struct Input
   bool inDevelopment;
   bool getGBufferBeforeRender;
   bool boxMode;
+  bool quantizedBVH; ///< use compressed BVH layout
+  bool compactLeaves; ///< use compact BVH leaves with shared vertices
+  bool nativeBVH;     ///< use built-in BVH builder instead of embree
+  bool reorderRays;   ///< sort secondary rays before tracing
+  bool bvhAnalytics;  ///< save BVH quality report and traversal heatmaps
+  bool shortStack;    ///< use short stack traversal in trace kernels
+  bool warmServer;    ///< keep scene resident between render jobs
+  bool denoise;       ///< G-buffer guided denoise of the final image
 
   std::string   inLibraryPath;
   std::string   inTargetState;
@@ -27,6 +35,9 @@ struct Input
   
   std::string   inLogDirCust;
   std::string   inSharedImageName;
+  std::string   checkpointFile;     ///< save render state periodically and continue from it after restart
+  std::string   cropWindow;         ///< "minX,minY,maxX,maxY" in pixels; render only this part of the frame
+  std::string   outEXRImage;        ///< half float EXR with HDR frame and G-buffer channels, written in background
 
   std::wstring  inTestsFolder;
   std::string   inMethod;     // override for rendering method
@@ -49,6 +60,8 @@ struct Input
   float camMoveSpeed;
   float mouseSensitivity;
   float saveInterval;
+  float checkpointInterval;  ///< seconds between render state checkpoints
+  float exrInterval;         ///< seconds between progressive EXR snapshots; 0 - final frame only
 
   // dynamic data
   //
@@ -241,6 +241,27 @@ int main(int argc, const char** argv)
       if(g_input.inDevelopment)
         flags |= GPU_RT_IN_DEVELOPMENT;
 
+      if (g_input.quantizedBVH)
+        flags |= GPU_RT_QUANTIZED_BVH;
+
+      if (g_input.compactLeaves)
+        flags |= GPU_RT_COMPACT_BVH_LEAVES;
+
+      if (g_input.nativeBVH)
+        flags |= GPU_RT_NATIVE_BVH_BUILDER;
+
+      if (g_input.reorderRays)
+        flags |= GPU_RT_RAY_REORDER;
+
+      if (g_input.bvhAnalytics)
+        flags |= GPU_RT_BVH_ANALYTICS;
+
+      if (g_input.shortStack)
+        flags |= GPU_RT_SHORT_STACK_TRAVERSAL;
+
+      if (g_input.warmServer)
+        flags |= GPU_RT_KEEP_SCENE_RESIDENT;
+
       if (g_input.enableMLT)
       {
         flags |= GPU_MLT_ENABLED_AT_START;
@@ -291,6 +312,24 @@ int main(int argc, const char** argv)
       if(g_input.inDevelopment)
         flags |= GPU_RT_IN_DEVELOPMENT;
 
+      if (g_input.quantizedBVH)
+        flags |= GPU_RT_QUANTIZED_BVH;
+
+      if (g_input.compactLeaves)
+        flags |= GPU_RT_COMPACT_BVH_LEAVES;
+
+      if (g_input.nativeBVH)
+        flags |= GPU_RT_NATIVE_BVH_BUILDER;
+
+      if (g_input.reorderRays)
+        flags |= GPU_RT_RAY_REORDER;
+
+      if (g_input.bvhAnalytics)
+        flags |= GPU_RT_BVH_ANALYTICS;
+
+      if (g_input.shortStack)
+        flags |= GPU_RT_SHORT_STACK_TRAVERSAL;
+
       if (g_input.enableMLT)
         flags |= GPU_MLT_ENABLED_AT_START;
       
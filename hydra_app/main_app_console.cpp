@@ -3,6 +3,7 @@
 
 #include "main.h"
 
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
@@ -26,6 +27,9 @@ static RENDERSTATE g_state = STATE_WAIT;
 static int g_sessionId = 0;
 static int g_commandId = 0;
 
+static bool g_firstCall     = true;
+static bool g_startTimerNow = false;
+
 
 HAPI void hrDrawPassOnly(HRSceneInstRef a_pScn, HRRenderRef a_pRender, HRCameraRef a_pCam);
 HAPI void hrRenderEvalGbuffer(HRRenderRef a_pRender);
@@ -77,9 +81,15 @@ static void DispatchCommand(const char* message)
 
       if (action == "start")
       {
+        const int newSessionId = atoi(sessId.c_str());
+        if (g_input.warmServer && newSessionId != g_sessionId) // new job; reopen scene library, driver will upload only changed objects
+          g_firstCall = true;
+
         g_state     = STATE_RENDER;
-        g_sessionId = atoi(sessId.c_str());
+        g_sessionId = newSessionId;
       }
+      else if (action == "stop" && g_input.warmServer) // job is finished; keep scene resident and wait for the next one
+        g_state = STATE_WAIT;
       else if (action == "exitnow")
         g_input.exitStatus = true;
     }
@@ -199,9 +209,6 @@ bool InitSceneLibAndRTE(HRCameraRef& a_camRef, HRSceneInstRef& a_scnRef, HRRende
   return true;
 }
 
-static bool g_firstCall     = true;
-static bool g_startTimerNow = false;
-
 //
 static void Draw(std::shared_ptr<IHRRenderDriver> a_pDetachedRenderDriverPointer)
 {
@@ -227,6 +234,29 @@ static void Draw(std::shared_ptr<IHRRenderDriver> a_pDetachedRenderDriverPointer
       }
       else
         paramNode.force_child(L"boxmode").text() = g_input.boxMode ? 1 : 0;
+
+      if(g_input.checkpointFile != "")
+      {
+        paramNode.force_child(L"checkpoint_file").text()     = std::wstring(g_input.checkpointFile.begin(), g_input.checkpointFile.end()).c_str();
+        paramNode.force_child(L"checkpoint_interval").text() = g_input.checkpointInterval;
+      }
+
+      if(g_input.denoise)
+        paramNode.force_child(L"denoise").text() = 1;
+
+      if(g_input.cropWindow != "")
+      {
+        std::wstring cropStr(g_input.cropWindow.begin(), g_input.cropWindow.end());
+        std::replace(cropStr.begin(), cropStr.end(), L',', L' ');
+        paramNode.force_child(L"crop_window").text() = cropStr.c_str();
+      }
+
+      if(g_input.outEXRImage != "")
+      {
+        paramNode.force_child(L"output_exr").text()          = std::wstring(g_input.outEXRImage.begin(), g_input.outEXRImage.end()).c_str();
+        paramNode.force_child(L"output_exr_interval").text() = g_input.exrInterval;
+        paramNode.force_child(L"output_exr_aovs").text()     = g_input.getGBufferBeforeRender ? 1 : 0;
+      }
     }
     hrRenderClose(renderRef);
     std::cout << "[main]: commit scene ... " << std::endl;
@@ -414,7 +444,12 @@ void console_main(std::shared_ptr<IHRRenderDriver> a_pDetachedRenderDriverPointe
     else
       std::this_thread::sleep_for(std::chrono::milliseconds(50));
   
-    if(g_exitDueToSamplesLimit)
+    if(g_exitDueToSamplesLimit && g_input.warmServer) // job is done; wait for the next one with scene still resident
+    {
+      g_exitDueToSamplesLimit = false;
+      g_state                 = STATE_WAIT;
+    }
+    else if(g_exitDueToSamplesLimit)
       g_input.exitStatus = true;
   }
 
@@ -0,0 +1,291 @@
+#include "AsyncImageWriter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+constexpr static int EXR_MAGIC          = 20000630;
+constexpr static int EXR_VERSION_TILED  = 2 | 0x200;  ///< version 2, single part tiled file
+constexpr static int EXR_PIXEL_HALF     = 1;
+constexpr static int EXR_RANDOM_Y       = 2;          ///< tiles may be stored in any order
+
+uint16_t FloatToHalf(float a_val)
+{
+  uint32_t f;
+  memcpy(&f, &a_val, sizeof(float));
+
+  const uint32_t sign = (f >> 16) & 0x8000;
+  f &= 0x7FFFFFFF;
+
+  if (f >= 0x7F800000)                                    // inf or nan
+    return uint16_t(sign | 0x7C00 | ((f > 0x7F800000) ? 0x0200 : 0));
+
+  if (f >= 0x477FF000)                                    // would be rounded to inf
+    return uint16_t(sign | 0x7BFF);
+
+  if (f < 0x38800000)                                     // half denormals
+  {
+    if (f < 0x33000000)
+      return uint16_t(sign);
+
+    const uint32_t shift = 126 - (f >> 23);
+    const uint32_t mant  = (f & 0x007FFFFF) | 0x00800000;
+    const uint32_t res   = mant >> shift;
+    const uint32_t rem   = mant & ((1u << shift) - 1);
+    const uint32_t mid   = 1u << (shift - 1);
+    return uint16_t(sign | (res + ((rem > mid || (rem == mid && (res & 1))) ? 1 : 0)));
+  }
+
+  const uint32_t res = (f - 0x38000000) >> 13;            // rebias exponent from 127 to 15
+  const uint32_t rem = f & 0x00001FFF;
+  return uint16_t(sign | (res + ((rem > 0x1000 || (rem == 0x1000 && (res & 1))) ? 1 : 0)));
+}
+
+template<typename T>
+static inline void PutValue(std::vector<char>& a_out, T a_val)
+{
+  const char* pData = (const char*)&a_val;
+  a_out.insert(a_out.end(), pData, pData + sizeof(T));
+}
+
+static inline void PutString(std::vector<char>& a_out, const std::string& a_str)
+{
+  a_out.insert(a_out.end(), a_str.c_str(), a_str.c_str() + a_str.size() + 1);
+}
+
+static void PutAttribute(std::vector<char>& a_out, const char* a_name, const char* a_type, const std::vector<char>& a_value)
+{
+  PutString(a_out, a_name);
+  PutString(a_out, a_type);
+  PutValue<int32_t>(a_out, int32_t(a_value.size()));
+  a_out.insert(a_out.end(), a_value.begin(), a_value.end());
+}
+
+bool TiledEXRWriter::Open(const std::string& a_path, int w, int h, const std::vector<std::string>& a_channels, int a_tileSize)
+{
+  Close();
+
+  // channels in file must be sorted by name
+  //
+  std::vector< std::pair<std::string, int> > sorted;
+  for (size_t i = 0; i < a_channels.size(); i++)
+  {
+    if (!a_channels[i].empty())
+      sorted.push_back(std::make_pair(a_channels[i], int(i)));
+  }
+  std::sort(sorted.begin(), sorted.end());
+
+  if (sorted.empty() || w <= 0 || h <= 0 || a_tileSize <= 0)
+  {
+    std::cerr << "TiledEXRWriter::Open: bad image parameters for " << a_path.c_str() << std::endl;
+    return false;
+  }
+
+  m_file.open(a_path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open())
+  {
+    std::cerr << "TiledEXRWriter::Open: can't open file " << a_path.c_str() << std::endl;
+    return false;
+  }
+
+  m_width    = w;
+  m_height   = h;
+  m_tileSize = a_tileSize;
+  m_tilesX   = (w + a_tileSize - 1) / a_tileSize;
+  m_tilesY   = (h + a_tileSize - 1) / a_tileSize;
+
+  m_channelSrc.resize(sorted.size());
+  for (size_t i = 0; i < sorted.size(); i++)
+    m_channelSrc[i] = sorted[i].second;
+
+  m_tileOffsets.assign(size_t(m_tilesX)*size_t(m_tilesY), 0);
+  m_tileData.resize(size_t(a_tileSize)*size_t(a_tileSize)*m_channelSrc.size());
+
+  // (1) header
+  //
+  std::vector<char> header, value;
+  PutValue<int32_t>(header, EXR_MAGIC);
+  PutValue<int32_t>(header, EXR_VERSION_TILED);
+
+  value.clear();
+  for (const auto& channel : sorted)
+  {
+    PutString(value, channel.first);
+    PutValue<int32_t>(value, EXR_PIXEL_HALF);
+    PutValue<int32_t>(value, 0);                // pLinear and reserved
+    PutValue<int32_t>(value, 1);                // x sampling
+    PutValue<int32_t>(value, 1);                // y sampling
+  }
+  value.push_back(0);
+  PutAttribute(header, "channels", "chlist", value);
+
+  value.assign(1, 0);                           // NO_COMPRESSION
+  PutAttribute(header, "compression", "compression", value);
+
+  value.clear();
+  PutValue<int32_t>(value, 0);
+  PutValue<int32_t>(value, 0);
+  PutValue<int32_t>(value, w - 1);
+  PutValue<int32_t>(value, h - 1);
+  PutAttribute(header, "dataWindow",    "box2i", value);
+  PutAttribute(header, "displayWindow", "box2i", value);
+
+  value.assign(1, char(EXR_RANDOM_Y));
+  PutAttribute(header, "lineOrder", "lineOrder", value);
+
+  value.clear();
+  PutValue<float>(value, 1.0f);
+  PutAttribute(header, "pixelAspectRatio", "float", value);
+  PutAttribute(header, "screenWindowWidth", "float", value);
+
+  value.clear();
+  PutValue<float>(value, 0.0f);
+  PutValue<float>(value, 0.0f);
+  PutAttribute(header, "screenWindowCenter", "v2f", value);
+
+  value.clear();
+  PutValue<uint32_t>(value, uint32_t(a_tileSize));
+  PutValue<uint32_t>(value, uint32_t(a_tileSize));
+  value.push_back(0);                           // ONE_LEVEL, ROUND_DOWN
+  PutAttribute(header, "tiles", "tiledesc", value);
+
+  header.push_back(0);
+
+  // (2) reserve offset table; it is filled in Close when all tiles are written
+  //
+  m_tableOffset = header.size();
+  m_file.write(header.data(), header.size());
+  m_file.write((const char*)m_tileOffsets.data(), m_tileOffsets.size()*sizeof(uint64_t));
+
+  return m_file.good();
+}
+
+bool TiledEXRWriter::WriteTile(int tx, int ty, const float4* a_layers)
+{
+  if (!m_file.is_open() || tx < 0 || ty < 0 || tx >= m_tilesX || ty >= m_tilesY)
+    return false;
+
+  const int x0 = tx*m_tileSize;
+  const int y0 = ty*m_tileSize;
+  const int tw = std::min(m_tileSize, m_width  - x0);
+  const int th = std::min(m_tileSize, m_height - y0);
+
+  const size_t frameSize = size_t(m_width)*size_t(m_height);
+
+  // each line of tile stores all pixels of the first channel, then all pixels of the second one and so on
+  //
+  uint16_t* out = m_tileData.data();
+  for (int y = y0; y < y0 + th; y++)
+  {
+    for (int src : m_channelSrc)
+    {
+      const float* layer = (const float*)(a_layers + frameSize*size_t(src / 4)) + (src % 4);
+      const float* line  = layer + (size_t(y)*size_t(m_width) + size_t(x0))*4;
+      for (int x = 0; x < tw; x++)
+        (*out++) = FloatToHalf(line[x*4]);
+    }
+  }
+
+  const int32_t dataSize = int32_t((out - m_tileData.data())*sizeof(uint16_t));
+  const int32_t chunkHeader[5] = { tx, ty, 0, 0, dataSize };
+
+  m_tileOffsets[ty*m_tilesX + tx] = uint64_t(m_file.tellp());
+  m_file.write((const char*)chunkHeader, sizeof(chunkHeader));
+  m_file.write((const char*)m_tileData.data(), dataSize);
+
+  return m_file.good();
+}
+
+bool TiledEXRWriter::Close()
+{
+  if (!m_file.is_open())
+    return true;
+
+  // missing tiles are stored as zeros, otherwise file can't be read at all
+  //
+  for (int ty = 0; ty < m_tilesY; ty++)
+  {
+    for (int tx = 0; tx < m_tilesX; tx++)
+    {
+      if (m_tileOffsets[ty*m_tilesX + tx] != 0)
+        continue;
+
+      const int32_t tw       = std::min(m_tileSize, m_width  - tx*m_tileSize);
+      const int32_t th       = std::min(m_tileSize, m_height - ty*m_tileSize);
+      const int32_t dataSize = int32_t(tw*th*m_channelSrc.size()*sizeof(uint16_t));
+      const int32_t chunkHeader[5] = { tx, ty, 0, 0, dataSize };
+
+      std::fill(m_tileData.begin(), m_tileData.end(), uint16_t(0));
+      m_tileOffsets[ty*m_tilesX + tx] = uint64_t(m_file.tellp());
+      m_file.write((const char*)chunkHeader, sizeof(chunkHeader));
+      m_file.write((const char*)m_tileData.data(), dataSize);
+    }
+  }
+
+  m_file.seekp(std::streamoff(m_tableOffset));
+  m_file.write((const char*)m_tileOffsets.data(), m_tileOffsets.size()*sizeof(uint64_t));
+
+  const bool good = m_file.good();
+  m_file.close();
+  return good;
+}
+
+bool SaveTiledEXR(const std::string& a_path, int w, int h, const float4* a_layers, const std::vector<std::string>& a_channels, int a_tileSize)
+{
+  const std::string tmpPath = a_path + ".tmp";
+  {
+    TiledEXRWriter writer;
+    if (!writer.Open(tmpPath, w, h, a_channels, a_tileSize))
+      return false;
+
+    bool good = true;
+    for (int ty = 0; ty < writer.TilesY() && good; ty++)
+      for (int tx = 0; tx < writer.TilesX() && good; tx++)
+        good = writer.WriteTile(tx, ty, a_layers);
+
+    good = writer.Close() && good;
+    if (!good)
+    {
+      std::cerr << "SaveTiledEXR: can't write file " << tmpPath.c_str() << std::endl;
+      std::remove(tmpPath.c_str());
+      return false;
+    }
+  }
+
+  std::remove(a_path.c_str()); // rename does not overwrite existing file on windows
+  return std::rename(tmpPath.c_str(), a_path.c_str()) == 0;
+}
+
+bool AsyncImageWriter::IsBusy() const
+{
+  return m_job.valid() && m_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+float4* AsyncImageWriter::FrontBuffer(int w, int h, int a_layersNum)
+{
+  m_buffers[m_front].resize(size_t(w)*size_t(h)*size_t(a_layersNum));
+  return m_buffers[m_front].data();
+}
+
+bool AsyncImageWriter::Start(const std::string& a_path, int w, int h, const std::vector<std::string>& a_channels)
+{
+  if (IsBusy())
+    return false;
+
+  Wait(); // get result of previous job to release it
+
+  const float4* pData = m_buffers[m_front].data();
+  m_front = 1 - m_front; // render thread fills the other buffer while this one is written
+
+  m_job = std::async(std::launch::async, [a_path, w, h, pData, a_channels]() { return SaveTiledEXR(a_path, w, h, pData, a_channels); });
+  return true;
+}
+
+void AsyncImageWriter::Wait()
+{
+  if (m_job.valid() && !m_job.get())
+    std::cerr << "AsyncImageWriter: failed to write image" << std::endl;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <future>
+
+#include "cglobals.h"
+
+/**
+\brief convert float to IEEE half with round to nearest even; values greater than 65504 are clamped to 65504, inf and nan are preserved.
+*/
+uint16_t FloatToHalf(float a_val);
+
+/**
+\brief Streaming writer of multi-channel half float OpenEXR images in tiled layout (uncompressed, single level, RANDOM_Y tile order).
+       Header and offset table are written in Open, each tile is converted and appended to file in WriteTile, so the whole image
+       is never kept in half precision. Offset table is filled in Close; tiles that were not written are filled with zeros.
+*/
+struct TiledEXRWriter
+{
+  TiledEXRWriter() : m_width(0), m_height(0), m_tileSize(0), m_tilesX(0), m_tilesY(0), m_tableOffset(0) {}
+  ~TiledEXRWriter() { Close(); }
+
+  bool Open(const std::string& a_path, int w, int h, const std::vector<std::string>& a_channels, int a_tileSize = 64);
+
+  /**
+  \brief convert and write single tile.
+  \param tx            - tile x index
+  \param ty            - tile y index
+  \param a_layers      - float4 images of full frame size; channel 'i' of Open is taken from component (i%4) of layer (i/4)
+  */
+  bool WriteTile(int tx, int ty, const float4* a_layers);
+  bool Close();
+
+  int TilesX() const { return m_tilesX; }
+  int TilesY() const { return m_tilesY; }
+
+protected:
+
+  std::ofstream m_file;
+  int           m_width;
+  int           m_height;
+  int           m_tileSize;
+  int           m_tilesX;
+  int           m_tilesY;
+  uint64_t      m_tableOffset;
+
+  std::vector<int>      m_channelSrc;   ///< index of source channel (layer*4 + component) for each channel in alphabetical order
+  std::vector<uint64_t> m_tileOffsets;
+  std::vector<uint16_t> m_tileData;
+};
+
+/**
+\brief Write float4 layers of a frame to OpenEXR file tile by tile. File is written to temporary one and renamed, so viewers never see partial image.
+\param a_channels - 4 names per layer for xyzw components; empty name means component is not saved
+*/
+bool SaveTiledEXR(const std::string& a_path, int w, int h, const float4* a_layers, const std::vector<std::string>& a_channels, int a_tileSize = 64);
+
+/**
+\brief Write frames in a background thread with double buffering. Render thread fills front buffer while the back one is being written;
+       if previous frame is still being written, progressive snapshot should be skipped (see IsBusy), so render loop never waits for disk.
+*/
+struct AsyncImageWriter
+{
+  AsyncImageWriter() : m_front(0) {}
+  ~AsyncImageWriter() { Wait(); }
+
+  bool    IsBusy() const;
+  float4* FrontBuffer(int w, int h, int a_layersNum); ///< buffer for a_layersNum float4 images; valid until next Start
+  bool    Start(const std::string& a_path, int w, int h, const std::vector<std::string>& a_channels); ///< return false if previous frame is not finished yet
+  void    Wait();
+
+protected:
+
+  std::vector<float4> m_buffers[2];
+  int                 m_front;
+  std::future<bool>   m_job;
+};
@@ -0,0 +1,729 @@
+#include "BVHBuilderNative.h"
+
+#include <algorithm>
+#include <memory>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+  typedef BVHBuilderNative::Box3f   Box3f;
+  typedef BVHBuilderNative::PrimRef PrimRef;
+
+  constexpr int   SAH_BINS            = 16;
+  constexpr int   PARALLEL_TASK_PRIMS = 4096;  ///< smaller subtrees are built by the thread that splits them
+  constexpr int   EARLY_SPLIT_DEPTH   = 3;     ///< at most 8 references per triangle
+  constexpr float EARLY_SPLIT_RATIO   = 16.0f; ///< split reference if its box area is that much bigger than triangle area
+  constexpr int   MEDIAN_SPLIT_DEPTH  = 16;    ///< deeper nodes use median splits; each 4-wide level then divides references by 4
+  constexpr int   MAX_BUILD_DEPTH     = 32;    ///< top and bottom trees share 64 levels of traversal trail (TRAIL_WORDS in ctrace.h)
+
+  inline float GetAxis(const float3& v, int a) { return (a == 0) ? v.x : ((a == 1) ? v.y : v.z); }
+
+  inline void SetAxis(float3& v, int a, float val)
+  {
+    if (a == 0)      v.x = val;
+    else if (a == 1) v.y = val;
+    else             v.z = val;
+  }
+
+  inline bool IsEmpty(const Box3f& a_box) { return (a_box.vmin.x > a_box.vmax.x) || (a_box.vmin.y > a_box.vmax.y) || (a_box.vmin.z > a_box.vmax.z); }
+
+  inline void Include(Box3f& a_box, const float3 a_point)
+  {
+    a_box.vmin = float3(fminf(a_box.vmin.x, a_point.x), fminf(a_box.vmin.y, a_point.y), fminf(a_box.vmin.z, a_point.z));
+    a_box.vmax = float3(fmaxf(a_box.vmax.x, a_point.x), fmaxf(a_box.vmax.y, a_point.y), fmaxf(a_box.vmax.z, a_point.z));
+  }
+
+  inline void Include(Box3f& a_box, const Box3f& a_other)
+  {
+    Include(a_box, a_other.vmin);
+    Include(a_box, a_other.vmax);
+  }
+
+  inline float HalfArea(const Box3f& a_box)
+  {
+    if (IsEmpty(a_box))
+      return 0.0f;
+    const float dx = a_box.vmax.x - a_box.vmin.x;
+    const float dy = a_box.vmax.y - a_box.vmin.y;
+    const float dz = a_box.vmax.z - a_box.vmin.z;
+    return dx*dy + dy*dz + dz*dx;
+  }
+
+  inline float3 Center(const Box3f& a_box) { return 0.5f*(a_box.vmin + a_box.vmax); }
+
+  inline int LargestAxis(const Box3f& a_box)
+  {
+    const float3 size = a_box.vmax - a_box.vmin;
+    if (size.x >= size.y && size.x >= size.z)
+      return 0;
+    else if (size.y >= size.z)
+      return 1;
+    else
+      return 2;
+  }
+
+  inline void CopyBox(BVHNode& a_node, const Box3f& a_box)
+  {
+    a_node.m_boxMin = a_box.vmin;
+    a_node.m_boxMax = a_box.vmax;
+  }
+
+  inline float3 GetVertex(const InstanceInputData& a_data, int a_index)
+  {
+    const float* v = a_data.vert4f + 4*a_index;
+    return float3(v[0], v[1], v[2]);
+  }
+
+  struct BuildNode
+  {
+    BuildNode() : first(0), count(0), childNum(0) {}
+
+    Box3f box;
+    int   first;
+    int   count;
+    int   childNum;                     ///< 0 for leaf
+    std::unique_ptr<BuildNode> child[4];
+  };
+
+  struct Range
+  {
+    int   first;
+    int   count;
+    Box3f box;
+  };
+
+  Box3f RangeBounds(const std::vector<PrimRef>& a_refs, int a_first, int a_count)
+  {
+    Box3f box;
+    for (int i = a_first; i < a_first + a_count; i++)
+      Include(box, a_refs[i].box);
+    return box;
+  }
+
+  inline int BinId(float a_center, float a_min, float a_scale)
+  {
+    const int bin = int((a_center - a_min)*a_scale);
+    return std::max(0, std::min(bin, SAH_BINS - 1));
+  }
+
+  /**
+  \brief split references in the middle along the largest axis of their bounds.
+  \return number of references in the left part
+  */
+  int MedianSplit(std::vector<PrimRef>::iterator begin, std::vector<PrimRef>::iterator end, const Range& a_range)
+  {
+    const int axis = LargestAxis(a_range.box);
+    const int half = a_range.count/2;
+    std::nth_element(begin, begin + half, end, [=](const PrimRef& a, const PrimRef& b)
+    {
+      const float ca = GetAxis(Center(a.box), axis);
+      const float cb = GetAxis(Center(b.box), axis);
+      return (ca < cb) || (ca == cb && a.primId < b.primId);
+    });
+
+    return half;
+  }
+
+  /**
+  \brief split range with binned SAH over reference centers and partition references in place.
+  \param a_median - skip SAH and split at the median; guarantees balanced split for degenerate input 
+  \return number of references in the left part; median split along the largest axis is used if binning failed.
+  */
+  int SplitRange(std::vector<PrimRef>& a_refs, const Range& a_range, bool a_median)
+  {
+    auto begin = a_refs.begin() + a_range.first;
+    auto end   = begin + a_range.count;
+
+    if (a_median)
+      return MedianSplit(begin, end, a_range);
+
+    Box3f centers;
+    for (int i = a_range.first; i < a_range.first + a_range.count; i++)
+      Include(centers, Center(a_refs[i].box));
+
+    float bestCost  = 1e38f;
+    int   bestAxis  = -1;
+    int   bestBin   = -1;
+    float bestMin   = 0.0f;
+    float bestScale = 0.0f;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+      const float cmin = GetAxis(centers.vmin, axis);
+      const float cmax = GetAxis(centers.vmax, axis);
+      if (!(cmax > cmin))
+        continue;
+
+      const float scale = float(SAH_BINS)*0.99999f/(cmax - cmin);
+
+      Box3f bins  [SAH_BINS];
+      int   counts[SAH_BINS] = {0};
+
+      for (int i = a_range.first; i < a_range.first + a_range.count; i++)
+      {
+        const int bin = BinId(GetAxis(Center(a_refs[i].box), axis), cmin, scale);
+        counts[bin]++;
+        Include(bins[bin], a_refs[i].box);
+      }
+
+      float rightArea [SAH_BINS];
+      int   rightCount[SAH_BINS];
+
+      Box3f acc;
+      int   num = 0;
+      for (int bin = SAH_BINS - 1; bin > 0; bin--)
+      {
+        Include(acc, bins[bin]);
+        num            += counts[bin];
+        rightArea [bin] = HalfArea(acc);
+        rightCount[bin] = num;
+      }
+
+      acc = Box3f();
+      num = 0;
+      for (int bin = 0; bin < SAH_BINS - 1; bin++)
+      {
+        Include(acc, bins[bin]);
+        num += counts[bin];
+
+        if (num == 0 || rightCount[bin + 1] == 0)
+          continue;
+
+        const float cost = HalfArea(acc)*float(num) + rightArea[bin + 1]*float(rightCount[bin + 1]);
+        if (cost < bestCost)
+        {
+          bestCost  = cost;
+          bestAxis  = axis;
+          bestBin   = bin + 1;
+          bestMin   = cmin;
+          bestScale = scale;
+        }
+      }
+    }
+
+    if (bestAxis != -1)
+    {
+      auto middle = std::partition(begin, end, [=](const PrimRef& a_ref) { return BinId(GetAxis(Center(a_ref.box), bestAxis), bestMin, bestScale) < bestBin; });
+      return int(middle - begin);
+    }
+
+    // all centers are in the same point, split in the middle
+    //
+    return MedianSplit(begin, end, a_range);
+  }
+
+  std::unique_ptr<BuildNode> BuildRec(std::vector<PrimRef>& a_refs, int a_first, int a_count, int a_leafSize, int a_depth)
+  {
+    std::unique_ptr<BuildNode> node(new BuildNode);
+    node->box   = RangeBounds(a_refs, a_first, a_count);
+    node->first = a_first;
+    node->count = a_count;
+
+    if (a_count <= a_leafSize)
+      return node;
+
+    if (a_depth >= MAX_BUILD_DEPTH - 1) // should never happen after median splits; big leaf is better than broken traversal
+    {
+      std::cerr << "BVHBuilderNative: max depth reached, leaf with " << a_count << " references" << std::endl;
+      return node;
+    }
+
+    const bool median = (a_depth >= MEDIAN_SPLIT_DEPTH);
+
+    // collapse binary splits to 4-wide node; always split the child with the largest area (the largest count for median splits)
+    //
+    Range ranges[4];
+    ranges[0].first = a_first;
+    ranges[0].count = a_count;
+    ranges[0].box   = node->box;
+    int rangeNum    = 1;
+
+    while (rangeNum < 4)
+    {
+      int   toSplit = -1;
+      float maxArea = -1.0f;
+      for (int i = 0; i < rangeNum; i++)
+      {
+        const float area = median ? float(ranges[i].count) : HalfArea(ranges[i].box);
+        if (ranges[i].count > a_leafSize && area > maxArea)
+        {
+          maxArea = area;
+          toSplit = i;
+        }
+      }
+
+      if (toSplit == -1)
+        break;
+
+      const int leftNum = SplitRange(a_refs, ranges[toSplit], median);
+      if (leftNum <= 0 || leftNum >= ranges[toSplit].count)
+        break;
+
+      ranges[rangeNum].first = ranges[toSplit].first + leftNum;
+      ranges[rangeNum].count = ranges[toSplit].count - leftNum;
+      ranges[rangeNum].box   = RangeBounds(a_refs, ranges[rangeNum].first, ranges[rangeNum].count);
+      ranges[toSplit].count  = leftNum;
+      ranges[toSplit].box    = RangeBounds(a_refs, ranges[toSplit].first, ranges[toSplit].count);
+      rangeNum++;
+    }
+
+    if (rangeNum == 1)
+      return node;
+
+    node->childNum = rangeNum;
+
+    BuildNode* pNode = node.get();
+    for (int i = 0; i < rangeNum; i++)
+    {
+      const Range range = ranges[i];
+      if (range.count > PARALLEL_TASK_PRIMS)
+      {
+        #pragma omp task shared(a_refs) firstprivate(pNode, range, i, a_leafSize, a_depth)
+        pNode->child[i] = BuildRec(a_refs, range.first, range.count, a_leafSize, a_depth + 1);
+      }
+      else
+        pNode->child[i] = BuildRec(a_refs, range.first, range.count, a_leafSize, a_depth + 1);
+    }
+
+    #pragma omp taskwait
+
+    return node;
+  }
+
+  std::unique_ptr<BuildNode> BuildTree(std::vector<PrimRef>& a_refs, int a_leafSize)
+  {
+    std::unique_ptr<BuildNode> root;
+
+    #pragma omp parallel
+    {
+      #pragma omp single
+      root = BuildRec(a_refs, 0, int(a_refs.size()), a_leafSize, 0);
+    }
+
+    return root;
+  }
+
+  /**
+  \brief bounding box of the part of triangle that lies on one side of the plane, clipped by the box of current reference.
+  */
+  Box3f ClipTriangle(const float3 a_v[3], const Box3f& a_box, int a_axis, float a_pos, bool a_left)
+  {
+    Box3f res;
+    for (int i = 0; i < 3; i++)
+    {
+      const float3 a  = a_v[i];
+      const float3 b  = a_v[(i + 1) % 3];
+      const float  da = GetAxis(a, a_axis) - a_pos;
+      const float  db = GetAxis(b, a_axis) - a_pos;
+
+      if (a_left ? (da <= 0.0f) : (da >= 0.0f))
+        Include(res, a);
+
+      if ((da < 0.0f && db > 0.0f) || (da > 0.0f && db < 0.0f))
+        Include(res, a + (da/(da - db))*(b - a));
+    }
+
+    if (IsEmpty(res))
+      return res;
+
+    res.vmin = float3(fmaxf(res.vmin.x, a_box.vmin.x), fmaxf(res.vmin.y, a_box.vmin.y), fmaxf(res.vmin.z, a_box.vmin.z));
+    res.vmax = float3(fminf(res.vmax.x, a_box.vmax.x), fminf(res.vmax.y, a_box.vmax.y), fminf(res.vmax.z, a_box.vmax.z));
+
+    if (a_left)
+      SetAxis(res.vmax, a_axis, fminf(GetAxis(res.vmax, a_axis), a_pos));
+    else
+      SetAxis(res.vmin, a_axis, fmaxf(GetAxis(res.vmin, a_axis), a_pos));
+
+    return res;
+  }
+
+  void EarlySplit(const float3 a_v[3], const PrimRef& a_ref, float a_triArea, int a_depth, std::vector<PrimRef>& a_out)
+  {
+    if (a_depth >= EARLY_SPLIT_DEPTH || HalfArea(a_ref.box) <= EARLY_SPLIT_RATIO*a_triArea)
+    {
+      a_out.push_back(a_ref);
+      return;
+    }
+
+    const int   axis = LargestAxis(a_ref.box);
+    const float pos  = 0.5f*(GetAxis(a_ref.box.vmin, axis) + GetAxis(a_ref.box.vmax, axis));
+
+    PrimRef left  = a_ref;
+    PrimRef right = a_ref;
+    left.box      = ClipTriangle(a_v, a_ref.box, axis, pos, true);
+    right.box     = ClipTriangle(a_v, a_ref.box, axis, pos, false);
+
+    if (IsEmpty(left.box) || IsEmpty(right.box))
+    {
+      a_out.push_back(a_ref);
+      return;
+    }
+
+    EarlySplit(a_v, left,  a_triArea, a_depth + 1, a_out);
+    EarlySplit(a_v, right, a_triArea, a_depth + 1, a_out);
+  }
+
+  /**
+  \brief write node and its subtree in DFS order; children with bigger area are placed first to keep hot paths close in memory.
+  \param a_onLeaf - functor that writes leaf data; called as a_onLeaf(const BuildNode*, BVHNode&)
+  */
+  template<typename LeafFunc>
+  void EmitNode(const BuildNode* a_node, size_t a_nodeId, std::vector<BVHNode>& a_nodes, LeafFunc& a_onLeaf)
+  {
+    CopyBox(a_nodes[a_nodeId], a_node->box);
+
+    if (a_node->childNum == 0)
+    {
+      a_onLeaf(a_node, a_nodeId);
+      return;
+    }
+
+    const size_t block = a_nodes.size();
+    a_nodes.resize(block + 4);
+    a_nodes[a_nodeId].SetLeaf(0);
+    a_nodes[a_nodeId].SetLeftOffset((unsigned int)(block / 4));
+
+    int order[4] = { 0, 1, 2, 3 };
+    std::stable_sort(order, order + a_node->childNum, [a_node](int a, int b) { return HalfArea(a_node->child[a]->box) > HalfArea(a_node->child[b]->box); });
+
+    for (int i = 0; i < a_node->childNum; i++)
+      EmitNode(a_node->child[order[i]].get(), block + order[i], a_nodes, a_onLeaf);
+  }
+
+  Box3f TransformBox(const float4x4& a_matrix, const Box3f& a_box)
+  {
+    Box3f res;
+    for (int i = 0; i < 8; i++)
+    {
+      const float3 corner((i & 1) ? a_box.vmax.x : a_box.vmin.x,
+                          (i & 2) ? a_box.vmax.y : a_box.vmin.y,
+                          (i & 4) ? a_box.vmax.z : a_box.vmin.z);
+      Include(res, mul4x3(a_matrix, corner));
+    }
+    return res;
+  }
+
+  /**
+  \brief append bottom level tree to the end of layout and relocate its node and object list offsets.
+  \return root node of appended tree that should be copied to instance block
+  */
+  BVHNode AppendMesh(std::vector<BVHNode>& a_layout, std::vector<float4>& a_tris, const std::vector<BVHNode>& a_nodes, const std::vector<float4>& a_meshTris)
+  {
+    const unsigned int nodeBase = (unsigned int)(a_layout.size() - 4);  // node 0 of mesh tree is placed to instance block, nodes 1-3 are skipped
+    const unsigned int triBase  = (unsigned int)(a_tris.size());
+
+    a_layout.insert(a_layout.end(), a_nodes.begin() + 4, a_nodes.end());
+    a_tris.insert(a_tris.end(), a_meshTris.begin(), a_meshTris.end());
+
+    auto relocate = [=](BVHNode& a_node)
+    {
+      if (!IsValidNode(a_node))
+        return;
+      if (a_node.Leaf())
+        a_node.SetLeftOffset(a_node.GetLeftOffset() + triBase);
+      else
+        a_node.SetLeftOffset(a_node.GetLeftOffset() + nodeBase / 4);
+    };
+
+    for (size_t i = nodeBase + 4; i < a_layout.size(); i++)
+      relocate(a_layout[i]);
+
+    size_t leafOffset = triBase;
+    while (leafOffset < a_tris.size())
+    {
+      int4* pHeader = (int4*)&a_tris[leafOffset];
+      pHeader->x   += int(triBase);
+      leafOffset   += 1 + 3*size_t(pHeader->y);
+    }
+
+    BVHNode root = a_nodes[0];
+    relocate(root);
+    return root;
+  }
+
+}
+
+BVHBuilderNative::BVHBuilderNative() : m_leafSize(4), m_earlySplit(false)
+{
+
+}
+
+BVHBuilderNative::~BVHBuilderNative()
+{
+  Destroy();
+}
+
+void BVHBuilderNative::Init(const char* cfg)
+{
+  const std::string config = (cfg != nullptr) ? std::string(cfg) : std::string("");
+
+  const size_t leafPos = config.find("-leaf_size ");
+  if (leafPos != std::string::npos)
+    m_leafSize = std::max(1, std::min(atoi(config.c_str() + leafPos + 11), 64));
+
+  m_earlySplit = (config.find("-early_split 1") != std::string::npos);
+}
+
+void BVHBuilderNative::Destroy()
+{
+  ClearScene();
+}
+
+void BVHBuilderNative::ClearScene()
+{
+  for (int i = 0; i < MAXBVHTREES; i++)
+    m_trees[i] = Tree();
+}
+
+void BVHBuilderNative::CommitScene()
+{
+
+}
+
+void BVHBuilderNative::GetBounds(float a_bMin[3], float a_bMax[3])
+{
+  Box3f sceneBox;
+
+  for (int i = 0; i < MAXBVHTREES; i++)
+  {
+    for (const auto& inst : m_trees[i].instances)
+      Include(sceneBox, TransformBox(inst.matrix, m_trees[i].meshes.at(inst.meshId).box));
+  }
+
+  a_bMin[0] = sceneBox.vmin.x; a_bMin[1] = sceneBox.vmin.y; a_bMin[2] = sceneBox.vmin.z;
+  a_bMax[0] = sceneBox.vmax.x; a_bMax[1] = sceneBox.vmax.y; a_bMax[2] = sceneBox.vmax.z;
+}
+
+int BVHBuilderNative::InstanceTriangleMeshes(InstanceInputData a_data, int a_treeId, int a_realInstIdBase)
+{
+  if (a_treeId < 0 || a_treeId >= MAXBVHTREES || a_data.numIndices < 3)
+    return -1;
+
+  Tree& tree = m_trees[a_treeId];
+
+  if (tree.meshes.find(a_data.meshId) == tree.meshes.end())
+    BuildMesh(a_data, &tree.meshes[a_data.meshId]);
+
+  for (int matrixId = 0; matrixId < a_data.numInst; matrixId++)
+  {
+    Instance inst;
+    inst.matrix     = float4x4(a_data.matrices + 16*matrixId);
+    inst.meshId     = a_data.meshId;
+    inst.realInstId = a_realInstIdBase + matrixId;
+    tree.instances.push_back(inst);
+  }
+
+  return int(tree.instances.size());
+}
+
+void BVHBuilderNative::BuildMesh(const InstanceInputData& a_data, MeshBVH* a_pOut) const
+{
+  const int triNum = a_data.numIndices / 3;
+
+  std::vector<PrimRef> refs(triNum);
+
+  #pragma omp parallel for
+  for (int triId = 0; triId < triNum; triId++)
+  {
+    Box3f box;
+    Include(box, GetVertex(a_data, a_data.indices[triId * 3 + 0]));
+    Include(box, GetVertex(a_data, a_data.indices[triId * 3 + 1]));
+    Include(box, GetVertex(a_data, a_data.indices[triId * 3 + 2]));
+    refs[triId].box    = box;
+    refs[triId].primId = triId;
+  }
+
+  if (m_earlySplit)
+  {
+    std::vector<PrimRef> splitted;
+    splitted.reserve(refs.size() + refs.size() / 4);
+
+    for (const auto& ref : refs)
+    {
+      const float3 v[3] = { GetVertex(a_data, a_data.indices[ref.primId * 3 + 0]),
+                            GetVertex(a_data, a_data.indices[ref.primId * 3 + 1]),
+                            GetVertex(a_data, a_data.indices[ref.primId * 3 + 2]) };
+      const float triArea = 0.5f*length(cross(v[1] - v[0], v[2] - v[0]));
+      EarlySplit(v, ref, triArea, 0, splitted);
+    }
+
+    refs.swap(splitted);
+  }
+
+  std::unique_ptr<BuildNode> root = BuildTree(refs, m_leafSize);
+
+  a_pOut->box = root->box;
+  a_pOut->nodes.resize(4);
+  a_pOut->tris.clear();
+
+  // leaf is an object list header (start, triNum, -1, -1) followed by 3 float4 per triangle: (A, primId), (B, geomId), (C, -1)
+  //
+  std::vector<int> prims;
+  auto writeLeaf = [&](const BuildNode* a_node, size_t a_nodeId)
+  {
+    prims.clear();
+    for (int i = a_node->first; i < a_node->first + a_node->count; i++)
+      prims.push_back(refs[i].primId);
+
+    std::sort(prims.begin(), prims.end());                          // early split may put several references of the same triangle to one leaf
+    prims.erase(std::unique(prims.begin(), prims.end()), prims.end());
+
+    const int objListOffset = int(a_pOut->tris.size());
+
+    BVHNode& node = a_pOut->nodes[a_nodeId];
+    node.SetLeaf(1);
+    node.SetInstance(0);
+    node.SetLeftOffset((unsigned int)objListOffset);
+
+    a_pOut->tris.push_back(float4(as_float(objListOffset + 1), as_float(int(prims.size())), as_float(-1), as_float(-1)));
+
+    for (int primId : prims)
+    {
+      const float3 A = GetVertex(a_data, a_data.indices[primId * 3 + 0]);
+      const float3 B = GetVertex(a_data, a_data.indices[primId * 3 + 1]);
+      const float3 C = GetVertex(a_data, a_data.indices[primId * 3 + 2]);
+
+      a_pOut->tris.push_back(float4(A.x, A.y, A.z, as_float(primId)));
+      a_pOut->tris.push_back(float4(B.x, B.y, B.z, as_float(a_data.meshId)));
+      a_pOut->tris.push_back(float4(C.x, C.y, C.z, as_float(-1)));
+    }
+  };
+
+  EmitNode(root.get(), 0, a_pOut->nodes, writeLeaf);
+}
+
+void BVHBuilderNative::BuildTopLevel(Tree& a_tree) const
+{
+  a_tree.layout.clear();
+  a_tree.tris.clear();
+
+  if (a_tree.instances.empty())
+    return;
+
+  std::vector<PrimRef> refs(a_tree.instances.size());
+  for (size_t instId = 0; instId < a_tree.instances.size(); instId++)
+  {
+    const Instance& inst = a_tree.instances[instId];
+    refs[instId].box     = TransformBox(inst.matrix, a_tree.meshes.at(inst.meshId).box);
+    refs[instId].primId  = int(instId);
+  }
+
+  std::unique_ptr<BuildNode> root = BuildTree(refs, 1);
+
+  // block 0 is a header: root node and identity matrix that is not used actually
+  //
+  a_tree.layout.resize(4);
+  float4x4 mIdentityMatrix;
+  (*(float4x4*)(&a_tree.layout[1])) = mIdentityMatrix;
+  CopyBox(a_tree.layout[0], root->box);
+
+  // instance block: node 0 is a root of mesh tree, nodes 1-2 are inverse matrix, node 3 is (realInstId, meshId, 0, 0)
+  //
+  std::vector<size_t> instBlocks(a_tree.instances.size());
+  auto writeInstance = [&](const BuildNode* a_node, size_t a_nodeId)
+  {
+    const size_t    block  = a_tree.layout.size();
+    const int       instId = refs[a_node->first].primId;
+    const Instance& inst   = a_tree.instances[instId];
+
+    a_tree.layout.resize(block + 4);
+
+    BVHNode& node = a_tree.layout[a_nodeId];
+    node.SetLeaf(1);
+    node.SetInstance(1);
+    node.SetLeftOffset((unsigned int)(block / 4));
+
+    CopyBox(a_tree.layout[block + 0], a_tree.meshes.at(inst.meshId).box);
+    (*(float4x4*)(&a_tree.layout[block + 1])) = inverse4x4(inst.matrix);
+    (*(int4*)(&a_tree.layout[block + 3]))     = int4(inst.realInstId, inst.meshId, 0, 0);
+
+    instBlocks[instId] = block;
+  };
+
+  if (root->childNum == 0) // single instance; top level root must be an inner node
+  {
+    a_tree.layout.resize(8);
+    a_tree.layout[0].SetLeaf(0);
+    a_tree.layout[0].SetLeftOffset(1);
+    EmitNode(root.get(), 4, a_tree.layout, writeInstance);
+  }
+  else
+    EmitNode(root.get(), 0, a_tree.layout, writeInstance);
+
+  // append each mesh tree once in order of first instance, then link instance blocks to it
+  //
+  std::unordered_map<int, BVHNode> meshRoots;
+  for (const auto& inst : a_tree.instances)
+  {
+    if (meshRoots.find(inst.meshId) != meshRoots.end())
+      continue;
+    const MeshBVH& mesh     = a_tree.meshes.at(inst.meshId);
+    meshRoots[inst.meshId]  = AppendMesh(a_tree.layout, a_tree.tris, mesh.nodes, mesh.tris);
+  }
+
+  for (size_t instId = 0; instId < a_tree.instances.size(); instId++)
+  {
+    const BVHNode& meshRoot = meshRoots[a_tree.instances[instId].meshId];
+    BVHNode& node           = a_tree.layout[instBlocks[instId]];
+    node.m_leftOffsetAndLeaf = meshRoot.m_leftOffsetAndLeaf;
+    node.m_escapeIndex       = meshRoot.m_escapeIndex;
+  }
+
+  a_tree.type = "object";
+}
+
+ConvertionResult BVHBuilderNative::ConvertMap()
+{
+  ConvertionResult res;
+
+  int finalBvhNumber = 0;
+
+  for (int i = 0; i < MAXBVHTREES; i++)
+  {
+    Tree& tree = m_trees[i];
+    BuildTopLevel(tree);
+
+    if (tree.layout.empty() || tree.tris.empty())
+      continue;
+
+    res.bvhType      [finalBvhNumber] = tree.type.c_str();
+    res.pBVH         [finalBvhNumber] = &tree.layout[0];
+    res.nodesNum     [finalBvhNumber] = int(tree.layout.size());
+    res.pTriangleData[finalBvhNumber] = (float*)&tree.tris[0];
+    res.trif4Num     [finalBvhNumber] = int(tree.tris.size());
+
+    finalBvhNumber++;
+  }
+
+  res.treesNum = finalBvhNumber;
+  return res;
+}
+
+void BVHBuilderNative::ConvertUnmap()
+{
+  for (int i = 0; i < MAXBVHTREES; i++)
+  {
+    m_trees[i].layout = std::vector<BVHNode>();
+    m_trees[i].tris   = std::vector<float4>();
+  }
+}
+
+Lite_Hit BVHBuilderNative::RayTrace(float3 ray_pos, float3 ray_dir)
+{
+  return Make_Lite_Hit(1e38f, 0);
+}
+
+float3 BVHBuilderNative::ShadowTrace(float3 ray_pos, float3 ray_dir, float t_far)
+{
+  return float3(1, 1, 1);
+}
+
+IBVHBuilder2* CreateNativeBVHBuilder(const char* a_cfg)
+{
+  IBVHBuilder2* pBuilder = new BVHBuilderNative;
+  if (a_cfg != nullptr)
+    pBuilder->Init(a_cfg);
+  return pBuilder;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "IBVHBuilderAPI.h"
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+/**
+\brief Native multithreaded binned SAH builder; emits two-level ("object") converted layout directly, without embree.
+       Bottom level trees are built when mesh is instanced, top level trees are built in ConvertMap.
+       Config string: "-leaf_size N" - max triangles in leaf (4 by default); "-early_split 1" - split references of big triangles before build.
+*/
+struct BVHBuilderNative : public IBVHBuilder2
+{
+  BVHBuilderNative();
+  ~BVHBuilderNative() override;
+
+  void Init(const char* cfg) override;
+  void Destroy() override;
+  void GetBounds(float a_bMin[3], float a_bMax[3]) override;
+
+  void ClearScene() override;
+  void CommitScene() override;
+
+  int  InstanceTriangleMeshes(InstanceInputData a_data, int a_treeId, int a_realInstIdBase) override;
+
+  Lite_Hit RayTrace(float3 ray_pos, float3 ray_dir) override;                   // not supported, use converted layout
+  float3   ShadowTrace(float3 ray_pos, float3 ray_dir, float t_far) override;   // not supported, use converted layout
+
+  ConvertionResult ConvertMap() override;
+  void             ConvertUnmap() override;
+
+  struct Box3f
+  {
+    Box3f() : vmin(1e38f, 1e38f, 1e38f), vmax(-1e38f, -1e38f, -1e38f) {}
+    float3 vmin;
+    float3 vmax;
+  };
+
+  struct PrimRef
+  {
+    Box3f box;
+    int   primId;
+  };
+
+protected:
+
+  struct MeshBVH      ///< bottom level tree; node 0 is a root, nodes 1-3 are not used
+  {
+    std::vector<BVHNode> nodes;
+    std::vector<float4>  tris;
+    Box3f                box;
+  };
+
+  struct Instance
+  {
+    float4x4 matrix;
+    int      meshId;
+    int      realInstId;
+  };
+
+  struct Tree
+  {
+    std::unordered_map<int, MeshBVH> meshes;
+    std::vector<Instance>            instances;
+
+    std::vector<BVHNode>             layout;
+    std::vector<float4>              tris;
+    std::string                      type;
+  } m_trees[MAXBVHTREES];
+
+  void BuildMesh(const InstanceInputData& a_data, MeshBVH* a_pOut) const;
+  void BuildTopLevel(Tree& a_tree) const;
+
+  int  m_leafSize;
+  bool m_earlySplit;
+};
+
+IBVHBuilder2* CreateNativeBVHBuilder(const char* a_cfg);
@@ -47,37 +47,42 @@ GBufferAll IntegratorCommon::gbufferEval(int x, int y)
     samples[i] = gbufferSample(ray_pos, ray_dir);
   }
 
-  // (3) find biggest cluster and eval coverage
+  // (3) find biggest cluster and eval coverage; samples are compared only with first samples of clusters (see GetGBufferSample kernel)
   //
-  float minDiff   = 100000000.0f; 
-  int   minDiffId = 0;
+  int clusterFirst[GBUFFER_CLUSTERS];
+  int clusterSize [GBUFFER_CLUSTERS];
+  int clustersNum = 0;
 
   for (int i = 0; i < GBUFFER_SAMPLES; i++)
   {
-    float diff     = 0.0f;
-    float coverage = 0.0f;
-    for (int j = 0; j < GBUFFER_SAMPLES; j++)
+    int found = -1;
+    for (int c = 0; c < clustersNum; c++)
     {
-      const float thisDiff = gbuffDiff(samples[i], samples[j], fov, float(m_width), float(m_height));
-      diff += thisDiff;
-      if (thisDiff < 1.0f)
-        coverage += 1.0f;
+      if (gbuffDiff(samples[clusterFirst[c]], samples[i], fov, float(m_width), float(m_height)) < 1.0f)
+      {
+        found = c;
+        break;
+      }
     }
 
-    coverage *= (1.0f / (float)GBUFFER_SAMPLES);
-    samples[i].data1.coverage = coverage;
-
-    if (diff < minDiff)
+    if (found >= 0)
+      clusterSize[found]++;
+    else if (clustersNum < GBUFFER_CLUSTERS)
     {
-      minDiff   = diff;
-      minDiffId = i;
+      clusterFirst[clustersNum] = i;
+      clusterSize [clustersNum] = 1;
+      clustersNum++;
     }
   }
 
+  const int biggest = int(std::max_element(clusterSize, clusterSize + clustersNum) - clusterSize);
+  const int resId   = clusterFirst[biggest];
+  samples[resId].data1.coverage = float(clusterSize[biggest]) / float(GBUFFER_SAMPLES);
+
   // (4) average depth, norm and e.t.c for all samples with the same cluster
   //
 
-  return samples[minDiffId];
+  return samples[resId];
 }
 
 
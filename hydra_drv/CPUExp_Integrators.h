@@ -22,6 +22,7 @@
 #include <omp.h>
 
 #include "IBVHBuilderAPI.h"
+#include "RenderCheckpoint.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// old
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// old
@@ -123,6 +124,10 @@ public:
 
   virtual void TracePrimary(std::vector<uint>& a_imageLDR) = 0;
   virtual void TraceForTest(std::vector<uint>& a_imageLDR) { }
+  virtual void DebugSaveTraversalHeatmaps(const wchar_t* a_path) { }
+
+  virtual bool SaveCheckpoint(RenderCheckpoint* a_pData) const { return false; }
+  virtual bool LoadCheckpoint(const RenderCheckpoint& a_data)  { return false; }
 
   virtual void GetImageHDR(float4* data, int width, int height) const = 0;
   virtual void GetImageToLDR(std::vector<uint>& a_imageLDR)     const = 0;
@@ -177,6 +182,10 @@ public:
 
   void TracePrimary(std::vector<uint>& a_imageLDR);
   void TraceForTest(std::vector<uint>& a_imageLDR);
+  void DebugSaveTraversalHeatmaps(const wchar_t* a_path) override;
+
+  bool SaveCheckpoint(RenderCheckpoint* a_pData) const override;
+  bool LoadCheckpoint(const RenderCheckpoint& a_data) override;
 
 
   // expose them for hybrid engine usage
@@ -258,7 +267,7 @@ protected:
 
   RandomGen& randomGen();
 
-  constexpr static int INTEGRATOR_MAX_THREADS_NUM = 32;
+  constexpr static int INTEGRATOR_MAX_THREADS_NUM = 128;
 
 
   struct PerThreadData
@@ -694,8 +703,6 @@ public:
 
 protected:
 
-  virtual void DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImage);
-
   PathVertex LightPath(PerThreadData* a_perThread, int a_lightTraceDepth);
 
   PathVertex CameraPath(float3 ray_pos, float3 ray_dir, MisData a_misPrev, int a_currDepth, uint flags,
@@ -734,6 +741,45 @@ protected:
   void MutateLightPart(PSSampleV& a_vec, int s, RandomGen* pGen);
   void MutateCameraPart(PSSampleV& a_vec, int s, RandomGen* pGen);
 
+  constexpr static int MMLT_CHAINS_PER_THREAD    = 16;     ///< chains of thread are mutated in turn, so neighbour samples of the thread are not correlated
+  constexpr static int MMLT_MUTATIONS_PER_PIXEL  = 8;      ///< mutations of all chains per pass
+  constexpr static int MMLT_SPLAT_CHUNK          = 16384;  ///< mutations per thread between merges of splats to image
+  constexpr static int MMLT_SEED_CANDIDATES      = 16;     ///< large step samples to select initial state of chain from
+
+  struct SplatRecord
+  {
+    float4 color;  ///< xyz is contribution, w is acceptance weight
+    int    offset; ///< pixel offset in image
+  };
+
+  /**
+  \brief Markov chains of a single thread in SoA layout. Chains live between passes, so only the first pass pays for their start.
+  */
+  struct ChainsSoA
+  {
+    std::vector<float>      samples;  ///< primary space sample of each chain, ChainSampleSize() floats per chain
+    std::vector<float3>     color;    ///< F of current sample
+    std::vector<int>        depth;    ///< path depth of each chain; it is fixed, depths are distributed proportional to their brightness
+    std::vector<int>        screen;   ///< pixel offset of current sample
+    std::vector<PathVertex> lightV;   ///< sub paths of current sample; they are reused if mutation does not change them, see F
+    std::vector<PathVertex> cameraV;
+    
+    std::vector< std::vector<SplatRecord> > bins; ///< splats for each band of image rows; each band is merged to image by single thread
+    int accepted;
+  };
+
+  std::vector<ChainsSoA> m_chains;     ///< one per thread
+  std::vector<float>     m_chainScale; ///< per depth splat scale to compensate chains number of depth
+
+  int  MMLTThreadsNum() const;
+  void InitChains(int a_threadsNum);
+  void MutateChain(ChainsSoA& a_chains, int a_chainId, PSSampleV& a_temp, int a_bandsNum);
+  void SplatToBin(ChainsSoA& a_chains, int a_offset, float4 a_color, int a_bandsNum);
+
+  virtual int  ChainSampleSize() const;
+  virtual void StoreChainSample(const PSSampleV& a_vec, float* a_data);
+  virtual void LoadChainSample(const float* a_data, int d, PSSampleV& a_vec);
+
   HDRImage4f   m_direct;
   const float* m_mask;
 
@@ -775,8 +821,9 @@ protected:
   PSSampleVC Compress(const PSSampleV& a_vec);
   PSSampleV  Decompress(const PSSampleVC& a_vec);
   
-  PSSampleVC InitialSamplePS2(const int d, const int a_burnIters = 0); 
-  void DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImage) override;
+  int  ChainSampleSize() const override;
+  void StoreChainSample(const PSSampleV& a_vec, float* a_data) override;
+  void LoadChainSample(const float* a_data, int d, PSSampleV& a_vec) override;
 };
 
 
@@ -2,6 +2,7 @@
 
 #include "CPUExp_Integrators.h"
 #include "ctrace.h"
+#include "CPUImageOutput.h"
 
 #include <cmath>
 #include <algorithm>
@@ -65,6 +66,7 @@ void IntegratorCommon::RandomizeAllGenerators()
 }
 
 extern "C" void initQuasirandomGenerator(unsigned int table[QRNG_DIMENSIONS][QRNG_RESOLUTION]);
+extern "C" const float* getBlueNoiseMask();
 
 IntegratorCommon::IntegratorCommon(int w, int h, EngineGlobals* a_pGlobals, int a_createFlags) : m_initDoneOnce(false), m_matStorage(nullptr)
 {
@@ -283,11 +285,13 @@ void IntegratorCommon::DoPass(std::vector<uint>& a_imageLDR)
   // Update HDR image
   //
   const float alpha = 1.0f / float(m_spp + 1);
+  const int4  crop  = cropWindowPixels(m_pGlobals->varsF[HRT_CROP_MIN_X], m_pGlobals->varsF[HRT_CROP_MIN_Y], 
+                                       m_pGlobals->varsF[HRT_CROP_MAX_X], m_pGlobals->varsF[HRT_CROP_MAX_Y], m_width, m_height);
 
   #pragma omp parallel for
-  for (int y = 0; y < m_height; y++)
+  for (int y = crop.y; y < crop.w; y++)
   {
-    for (int x = 0; x < m_width; x++)
+    for (int x = crop.x; x < crop.z; x++)
     {
       float3 ray_pos, ray_dir;
       std::tie(ray_pos, ray_dir) = makeEyeRay(x, y);
@@ -316,20 +320,8 @@ void IntegratorCommon::DoPass(std::vector<uint>& a_imageLDR)
 
 void IntegratorCommon::GetImageToLDR(std::vector<uint>& a_imageLDR) const
 {
-  // get HDR to LDR
-  //
-  float gammaPow = 1.0f / m_pGlobals->varsF[HRT_IMAGE_GAMMA];  // gamma correction
-
-  for (size_t i = 0; i < a_imageLDR.size(); i++)
-  {
-    float4 color = ToneMapping4(m_summColors[i]);
-
-    color.x = powf(color.x, gammaPow);
-    color.y = powf(color.y, gammaPow);
-    color.z = powf(color.z, gammaPow);
-
-    a_imageLDR[i] = RealColorToUint32(color);
-  }
+  const float gammaPow = 1.0f / m_pGlobals->varsF[HRT_IMAGE_GAMMA];  // gamma correction
+  HDRImageToLDR(m_summColors.data(), 1.0f, nullptr, 0.0f, int(a_imageLDR.size()), gammaPow, a_imageLDR.data());
 }
 
 void IntegratorCommon::GetImageHDR(float4* a_imageHDR, int w, int h) const
@@ -349,7 +341,11 @@ std::tuple<float3,float3> IntegratorCommon::makeEyeRay(int x, int y)
   EngineGlobals* a_globals = m_pGlobals;
 
   RandomGen& gen = randomGen();
-  float4 offsets = rndUniform(&gen, -1.0f, 1.0f);
+  float4 offsets;
+  if (m_pGlobals->g_flags & HRT_ENABLE_BLUE_NOISE)
+    offsets = make_float4(-1.0f, -1.0f, -1.0f, -1.0f) + 2.0f*rndBlueNoiseLens(x, y, (unsigned int)m_spp, getBlueNoiseMask()); // mask is generated on first use
+  else
+    offsets = rndUniform(&gen, -1.0f, 1.0f);
 
   float3 ray_pos, ray_dir;
   MakeRandEyeRay(x, y, m_width, m_height, offsets, m_pGlobals, 
@@ -496,6 +492,132 @@ void IntegratorCommon::TraceForTest(std::vector<uint>& a_imageLDR)
 }
 
 
+bool HR_SaveLDRImageToFile(const wchar_t* a_fileName, int w, int h, int32_t* data);
+
+static inline float3 HeatmapColor(const float a_val) // 0 -> blue, 0.5 -> green, 1 -> red
+{
+  const float t = clamp(a_val, 0.0f, 1.0f);
+  if (t < 0.5f)
+    return make_float3(0.0f, 2.0f*t, 1.0f - 2.0f*t);
+  else
+    return make_float3(2.0f*t - 1.0f, 2.0f - 2.0f*t, 0.0f);
+}
+
+static void SaveHeatmap(const std::wstring& a_path, int a_width, int a_height, const std::vector<int2>& a_counters, bool a_tris)
+{
+  int    maxVal = 1;
+  double avgVal = 0.0;
+  for (const auto& c : a_counters)
+  {
+    const int val = a_tris ? c.y : c.x;
+    maxVal  = std::max(maxVal, val);
+    avgVal += double(val);
+  }
+  avgVal /= double(a_counters.size());
+
+  std::vector<int32_t> image(a_counters.size());
+  for (size_t i = 0; i < a_counters.size(); i++)
+  {
+    const float val = float(a_tris ? a_counters[i].y : a_counters[i].x) / float(maxVal);
+    image[i]        = int32_t(RealColorToUint32(to_float4(HeatmapColor(val), 1.0f)));
+  }
+
+  HR_SaveLDRImageToFile(a_path.c_str(), a_width, a_height, &image[0]);
+  std::cout << "[heatmap]: " << (a_tris ? "tri tests  " : "node visits") << " avg = " << avgVal << ", max = " << maxVal << std::endl;
+}
+
+void IntegratorCommon::DebugSaveTraversalHeatmaps(const wchar_t* a_path)
+{
+  if (m_geom.pExternalImpl != nullptr || m_geom.bvhTreesNumber == 0 || m_geom.nodesPtr[0] == nullptr)
+  {
+    std::cout << "[DebugSaveTraversalHeatmaps]: converted BVH layout is needed" << std::endl;
+    return;
+  }
+
+  std::vector<int2> counters(m_width*m_height);
+
+  // alpha test is ignored here, so alpha tested trees are counted as opaque
+  //
+  #pragma omp parallel for
+  for (int y = 0; y < m_height; y++)
+  {
+    for (int x = 0; x < m_width; x++)
+    {
+      float3 ray_pos, ray_dir;
+      std::tie(ray_pos, ray_dir) = makeEyeRay2(float(x) + 0.5f, float(y) + 0.5f);
+
+      int2     stat    = int2(0, 0);
+      Lite_Hit liteHit = Make_Lite_Hit(MAXFLOAT, -1);
+
+      for (int i = 0; i < m_geom.bvhTreesNumber; i++)
+      {
+        const float4* bvhdata = (const float4*)m_geom.nodesPtr[i];
+        const float4* tridata = (const float4*)m_geom.primsPtr[i];
+
+        if (m_geom.haveInst[i])
+          liteHit = BVH4InstTraverse(ray_pos, ray_dir, 0.0f, liteHit, bvhdata, tridata, &stat);
+        else
+          liteHit = BVH4Traverse(ray_pos, ray_dir, 0.0f, liteHit, bvhdata, tridata, &stat);
+      }
+
+      counters[y*m_width + x] = stat;
+    }
+  }
+
+  SaveHeatmap(std::wstring(a_path) + L"_nodes.png", m_width, m_height, counters, false);
+  SaveHeatmap(std::wstring(a_path) + L"_tris.png",  m_width, m_height, counters, true);
+}
+
+struct IntegratorThreadState ///< per thread part of checkpoint
+{
+  uint2 gen;
+  uint2 gen2;
+  int   qmcPos;
+};
+
+bool IntegratorCommon::SaveCheckpoint(RenderCheckpoint* a_pData) const
+{
+  a_pData->width  = m_width;
+  a_pData->height = m_height;
+  a_pData->spp    = float(m_spp);
+  a_pData->color.resize(m_summColors.size()*4);
+  memcpy(a_pData->color.data(), m_summColors.data(), m_summColors.size()*sizeof(float4));
+
+  a_pData->randState.resize(m_perThread.size()*sizeof(IntegratorThreadState));
+  IntegratorThreadState* pStates = (IntegratorThreadState*)a_pData->randState.data();
+  for (size_t i = 0; i < m_perThread.size(); i++)
+  {
+    pStates[i].gen    = m_perThread[i].gen.state;
+    pStates[i].gen2   = m_perThread[i].gen2.state;
+    pStates[i].qmcPos = m_perThread[i].qmcPos;
+  }
+
+  return true;
+}
+
+bool IntegratorCommon::LoadCheckpoint(const RenderCheckpoint& a_data)
+{
+  if (a_data.width != m_width || a_data.height != m_height || a_data.color.size() != m_summColors.size()*4 ||
+      a_data.randState.size() != m_perThread.size()*sizeof(IntegratorThreadState))
+  {
+    std::cerr << "IntegratorCommon::LoadCheckpoint: checkpoint does not match current resolution or threads number" << std::endl;
+    return false;
+  }
+
+  memcpy(m_summColors.data(), a_data.color.data(), m_summColors.size()*sizeof(float4));
+  m_spp = int(a_data.spp);
+
+  const IntegratorThreadState* pStates = (const IntegratorThreadState*)a_data.randState.data();
+  for (size_t i = 0; i < m_perThread.size(); i++)
+  {
+    m_perThread[i].gen.state  = pStates[i].gen;
+    m_perThread[i].gen2.state = pStates[i].gen2;
+    m_perThread[i].qmcPos     = pStates[i].qmcPos;
+  }
+
+  return true;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////
 
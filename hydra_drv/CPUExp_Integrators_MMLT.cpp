@@ -3,6 +3,8 @@
 #include "time.h"
 
 #include <algorithm> 
+#include <cstdint>
+#include <cstring>
 
 bool HR_SaveHDRImageToFileLDR(const wchar_t* a_fileName, int w, int h, const float* a_data, const float a_scaleInv, const float a_gamma = 2.2f);
 bool HR_SaveHDRImageToFileHDR(const wchar_t* a_fileName, int w, int h, const float* a_data, const float a_scale = 1.0f);
@@ -314,19 +316,6 @@ float3 IntegratorMMLT::F(const PSSampleV& a_xVec, const int d, int m_type,
   return sampleColor;
 }
 
-static std::vector<float> PrefixSumm(const std::vector<float>& a_vec)
-{
-  float accum = 0.0f;
-  std::vector<float> avgBAccum(a_vec.size() + 1);
-  for (size_t i = 0; i < a_vec.size(); i++)
-  {
-    avgBAccum[i] = accum;
-    accum += a_vec[i];
-  }
-  avgBAccum[avgBAccum.size() - 1] = accum;
-  return avgBAccum;
-}
-
 //int SelectIndexPropTo(const float a_r, const std::vector<float>& a_vec, float* pPDF)
 //{
 //  int  d = 0;
@@ -345,118 +334,266 @@ static std::vector<float> PrefixSumm(const std::vector<float>& a_vec)
 //  return d;
 //}
 
-void IntegratorMMLT::DoPassIndirectMLT(float4* a_outImage)
+int IntegratorMMLT::MMLTThreadsNum() const
 {
-  float pdfSelector = 1.0f;
-  auto avgBAccum  = PrefixSumm(m_avgBPerBounce);
-  const float r   = rndFloat1_Pseudo(&PerThread().gen);
-  const int   d   = SelectIndexPropToOpt(r, &avgBAccum[0], int(avgBAccum.size()), &pdfSelector);  
-  const float wk  = 1.0f; // (m_avgBPerBounce[d] / m_avgBrightness) / pdfSelector; // because it will be wk / wk ...
-  DoPassIndirectMLT(d, wk, a_outImage);
+  return std::min(omp_get_max_threads(), int(INTEGRATOR_MAX_THREADS_NUM));
 }
 
-void IntegratorMMLT::DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImage)
+int IntegratorMMLT::ChainSampleSize() const
 {
-  auto& gen2 = m_perThread[ThreadId()].gen2;
+  return randArraySizeOfDepthMMLT(m_maxDepth);
+}
 
-  //////////////////////////////////////////////////////////////////////////////////// randomize generator
-  if (clock() % 3 == 0)
+void IntegratorMMLT::StoreChainSample(const PSSampleV& a_vec, float* a_data)
+{
+  memcpy(a_data, a_vec.data(), a_vec.size()*sizeof(float));
+}
+
+void IntegratorMMLT::LoadChainSample(const float* a_data, int d, PSSampleV& a_vec)
+{
+  a_vec.resize(randArraySizeOfDepthMMLT(d));
+  memcpy(a_vec.data(), a_data, a_vec.size()*sizeof(float));
+}
+
+void IntegratorMMLT::InitChains(int a_threadsNum)
+{
+  // (1) distribute depths between chains proportional to their brightness; each bright enough depth gets at least one chain
+  //
+  const int chainsNum = a_threadsNum*MMLT_CHAINS_PER_THREAD;
+  const int depthNum  = int(m_avgBPerBounce.size());
+
+  std::vector<int> chainsPerDepth(depthNum, 0);
+  int summ = 0, largest = -1;
+  for (int d = 0; d < depthNum; d++)
   {
-    const int NRandomisation = (clock() % 9) + (clock() % 4);
-    for (int i = 0; i < NRandomisation; i++)
-      NextState(&gen2);
+    if (m_avgBPerBounce[d] <= 0.0f)
+      continue;
+    chainsPerDepth[d] = std::max(int(float(chainsNum)*m_avgBPerBounce[d]/fmax(m_avgBrightness, 1e-20f) + 0.5f), 1);
+    summ += chainsPerDepth[d];
+    if (largest < 0 || chainsPerDepth[d] > chainsPerDepth[largest])
+      largest = d;
   }
-  //////////////////////////////////////////////////////////////////////////////////// 
 
-  const int samplesPerPass = m_width*m_height;
-  mLightSubPathCount = float(samplesPerPass);
+  if (largest < 0) // black image; let chains run at max depth, they will not splat anything
+  {
+    largest = depthNum - 1;
+    summ    = 0;
+  }
+  chainsPerDepth[largest] += (chainsNum - summ);
+
+  // splats of depth 'd' have total weight chainsPerDepth[d]; they should have m_avgBPerBounce[d]
+  //
+  m_chainScale.resize(depthNum);
+  for (int d = 0; d < depthNum; d++)
+  {
+    const float fractionN = float(chainsPerDepth[d]) / float(chainsNum);
+    m_chainScale[d] = (chainsPerDepth[d] == 0) ? 0.0f : (m_avgBPerBounce[d]/fmax(m_avgBrightness, 1e-20f))/fractionN;
+  }
 
-  // select seed
+  // chain 'i' goes to thread i%threadsNum, so each thread gets mix of cheap and expensive depths
   //
-  int xScr = 0, yScr = 0;
-  auto   xVec   = InitialSamplePS(d);
-  float3 yColor = F(xVec, d, (MUTATE_CAMERA | MUTATE_LIGHT), &xScr, &yScr);
-  float  y      = contribFunc(yColor);
+  std::vector<int> depthOfChain;
+  depthOfChain.reserve(chainsNum);
+  for (int d = 0; d < depthNum; d++)
+    for (int i = 0; i < chainsPerDepth[d]; i++)
+      depthOfChain.push_back(d);
+
+  const int sampleSize = ChainSampleSize();
+  const int bandsNum   = std::min(m_height, 4*a_threadsNum);
+
+  m_chains.resize(a_threadsNum);
+  for (int t = 0; t < a_threadsNum; t++)
+  {
+    ChainsSoA& chains = m_chains[t];
+    chains.samples.resize(MMLT_CHAINS_PER_THREAD*sampleSize);
+    chains.color.resize  (MMLT_CHAINS_PER_THREAD);
+    chains.depth.resize  (MMLT_CHAINS_PER_THREAD);
+    chains.screen.resize (MMLT_CHAINS_PER_THREAD);
+    chains.lightV.resize (MMLT_CHAINS_PER_THREAD);
+    chains.cameraV.resize(MMLT_CHAINS_PER_THREAD);
+    chains.bins.resize(bandsNum);
+    for (auto& bin : chains.bins)
+      bin.clear();
+    chains.accepted = 0;
+
+    for (int i = 0; i < MMLT_CHAINS_PER_THREAD; i++)
+      chains.depth[i] = depthOfChain[i*a_threadsNum + t];
+  }
 
-  // run MCMC
+  // (2) select initial state of each chain from several large step samples proportional to contribution, so chains don't start from black paths
   //
-  int accept = 0;
-  
-  for (int sampleId = 0; sampleId < samplesPerPass; sampleId++)
+  #pragma omp parallel num_threads(a_threadsNum)
+  {
+    ChainsSoA& chains = m_chains[ThreadId()];
+    auto& gen         = PerThread().gen2;
+
+    for (int i = 0; i < MMLT_CHAINS_PER_THREAD; i++)
+    {
+      const int d = chains.depth[i];
+      float summW = 0.0f;
+      chains.color[i]  = float3(0, 0, 0);
+      chains.screen[i] = 0;
+
+      for (int c = 0; c < MMLT_SEED_CANDIDATES; c++)
+      {
+        int xScr = 0, yScr = 0;
+        auto   xVec  = InitialSamplePS(d);
+        float3 color = F(xVec, d, (MUTATE_CAMERA | MUTATE_LIGHT), &xScr, &yScr);
+        const float w = contribFunc(color);
+
+        summW += w;
+        if (c == 0 || (w > 0.0f && rndFloat1_Pseudo(&gen)*summW <= w)) // reservoir sampling
+        {
+          StoreChainSample(xVec, &chains.samples[i*sampleSize]);
+          chains.color[i]   = color;
+          chains.screen[i]  = yScr*m_width + xScr;
+          chains.lightV[i]  = m_oldLightV [ThreadId()];
+          chains.cameraV[i] = m_oldCameraV[ThreadId()];
+        }
+      }
+    }
+  }
+
+  std::cout << "[MMLT]: threads = " << a_threadsNum << ", chains = " << chainsNum << std::endl;
+  for (int d = 0; d < depthNum; d++)
+  {
+    if(chainsPerDepth[d] != 0)
+      std::cout << "[d = " << d << ", N = " << chainsPerDepth[d] << ", coeff = " << m_chainScale[d] << "]" << std::endl;
+  }
+}
+
+void IntegratorMMLT::SplatToBin(ChainsSoA& a_chains, int a_offset, float4 a_color, int a_bandsNum)
+{
+  const int band = ((a_offset / m_width)*a_bandsNum) / m_height;
+  SplatRecord rec;
+  rec.color  = a_color;
+  rec.offset = a_offset;
+  a_chains.bins[band].push_back(rec);
+}
+
+void IntegratorMMLT::MutateChain(ChainsSoA& a_chains, int a_chainId, PSSampleV& a_temp, int a_bandsNum)
+{
+  auto& gen2 = PerThread().gen2;
+
+  const int sampleSize = ChainSampleSize();
+  const int d          = a_chains.depth[a_chainId];
+  float* pSample       = &a_chains.samples[a_chainId*sampleSize];
+
+  LoadChainSample(pSample, d, a_temp);
+
+  // F reuses sub path of previous sample of thread if it was not mutated; previous sample of thread belongs to other chain
+  //
+  m_oldLightV [ThreadId()] = a_chains.lightV [a_chainId];
+  m_oldCameraV[ThreadId()] = a_chains.cameraV[a_chainId];
+
+  int mtype = 0;
+  auto xNew = MutatePrimarySpace(a_temp, d, &mtype);
+
+  const float3 yOldColor = a_chains.color[a_chainId];
+  const float  yOld      = contribFunc(yOldColor);
+
+  int xScrNew = 0, yScrNew = 0;
+  const float3 yNewColor = F(xNew, d, mtype, &xScrNew, &yScrNew);
+  const float  yNew      = contribFunc(yNewColor);
+
+  const float a = (yOld == 0.0f) ? 1.0f : fminf(1.0f, yNew / yOld);
+
+  const int offsetOld = a_chains.screen[a_chainId];
+  const int offsetNew = yScrNew*m_width + xScrNew;
+
+  // (5) contrib to image
+  //
+  const float  bkScale    = m_chainScale[d];
+  const float3 contribAtX = bkScale*yOldColor*(1.0f / fmaxf(yOld, 1e-6f))*(1.0f - a);
+  const float3 contribAtY = bkScale*yNewColor*(1.0f / fmaxf(yNew, 1e-6f))*a;
+
+  if (dot(contribAtX, contribAtX) > 1e-12f)
+    SplatToBin(a_chains, offsetOld, to_float4(contribAtX, 1.0f - a), a_bandsNum);
+
+  if (dot(contribAtY, contribAtY) > 1e-12f)
+    SplatToBin(a_chains, offsetNew, to_float4(contribAtY, a), a_bandsNum);
+
+  if (rndFloat1_Pseudo(&gen2) <= a) // accept //
   {
-    int mtype = 0;
-    auto xOld  = xVec;
-    auto xNew  = MutatePrimarySpace(xOld, d, &mtype);
+    StoreChainSample(xNew, pSample);
+    a_chains.color  [a_chainId] = yNewColor;
+    a_chains.screen [a_chainId] = offsetNew;
+    a_chains.lightV [a_chainId] = m_oldLightV [ThreadId()];
+    a_chains.cameraV[a_chainId] = m_oldCameraV[ThreadId()];
+    a_chains.accepted++;
+  }
+}
 
-    float  yOld      = y;
-    float3 yOldColor = yColor;
+void IntegratorMMLT::DoPassIndirectMLT(float4* a_outImage)
+{
+  const int threadsNum = MMLTThreadsNum();
 
-    int xScrOld = xScr, yScrOld = yScr;
-    int xScrNew = 0,    yScrNew = 0;
+  if (int(m_chains.size()) != threadsNum)
+    InitChains(threadsNum);
 
-    float3 yNewColor = F(xNew, d, mtype, &xScrNew, &yScrNew);
-    float  yNew      = contribFunc(yNewColor);
+  const int samplesPerPass = m_width*m_height;
+  mLightSubPathCount = float(samplesPerPass);
 
-    float a = (yOld == 0.0f) ? 1.0f : fminf(1.0f, yNew / yOld);
+  // each thread mutates its own chains and puts splats to its own bins; after each chunk bins are merged to image band by band, 
+  // so each pixel is written by single thread and no atomics are needed
+  //
+  const int mutationsPerThread = int((int64_t(samplesPerPass)*int64_t(MMLT_MUTATIONS_PER_PIXEL)) / int64_t(threadsNum));
+  const int chunksNum          = (mutationsPerThread + MMLT_SPLAT_CHUNK - 1) / MMLT_SPLAT_CHUNK;
+  const int bandsNum           = int(m_chains[0].bins.size());
 
-    float p = rndFloat1_Pseudo(&gen2);
+  #pragma omp parallel num_threads(threadsNum)
+  {
+    ChainsSoA& chains = m_chains[ThreadId()];
+    PSSampleV  temp;
 
-    if (p <= a) // accept //
+    //////////////////////////////////////////////////////////////////////////////////// randomize generator
+    auto& gen2 = PerThread().gen2;
+    if (clock() % 3 == 0)
     {
-      xVec   = xNew;
-      y      = yNew;
-      yColor = yNewColor;
-      xScr   = xScrNew;
-      yScr   = yScrNew;
-      accept++;
+      const int NRandomisation = (clock() % 9) + (clock() % 4);
+      for (int i = 0; i < NRandomisation; i++)
+        NextState(&gen2);
     }
-    else        // reject
+    //////////////////////////////////////////////////////////////////////////////////// 
+
+    chains.accepted = 0;
+    int chainId     = 0;
+
+    for (int chunk = 0; chunk < chunksNum; chunk++)
     {
-      //x      = x;
-      //y      = y;
-      //yColor = yColor;
-    }
+      const int mutationsNum = std::min(int(MMLT_SPLAT_CHUNK), mutationsPerThread - chunk*MMLT_SPLAT_CHUNK);
+      
+      for (int i = 0; i < mutationsNum; i++)
+      {
+        MutateChain(chains, chainId, temp, bandsNum);
+        chainId = (chainId + 1) % MMLT_CHAINS_PER_THREAD;
+      }
 
-    // (5) contrib to image
-    //
-    float3 contribAtX = a_bkScale*yOldColor*(1.0f / fmaxf(yOld, 1e-6f))*(1.0f - a);
-    float3 contribAtY = a_bkScale*yNewColor*(1.0f / fmaxf(yNew, 1e-6f))*a;
-
-    if (dot(contribAtX, contribAtX) > 1e-12f)
-    { 
-      const int offset = yScrOld*m_width + xScrOld;
-      #pragma omp atomic
-      a_outImage[offset].x += contribAtX.x;
-      #pragma omp atomic
-      a_outImage[offset].y += contribAtX.y;
-      #pragma omp atomic
-      a_outImage[offset].z += contribAtX.z;
-      #pragma omp atomic
-      a_outImage[offset].w += (1.0f-a);
-    }
+      #pragma omp barrier
 
-    if (dot(contribAtY, contribAtY) > 1e-12f)
-    { 
-      const int offset = yScrNew*m_width + xScrNew;
-      #pragma omp atomic
-      a_outImage[offset].x += contribAtY.x;
-      #pragma omp atomic
-      a_outImage[offset].y += contribAtY.y;
-      #pragma omp atomic
-      a_outImage[offset].z += contribAtY.z;
-      #pragma omp atomic
-      a_outImage[offset].w += a;
+      #pragma omp for schedule(dynamic)
+      for (int band = 0; band < bandsNum; band++)
+      {
+        for (int t = 0; t < threadsNum; t++)
+        {
+          for (const auto& rec : m_chains[t].bins[band])
+            a_outImage[rec.offset] += rec.color;
+        }
+      }
+
+      for (auto& bin : chains.bins)
+        bin.clear();
     }
-    
   }
 
-  if (omp_get_thread_num() == 0)
-  {
-    float acceptanceRate = float(accept) / float(samplesPerPass);
-    auto oldPrecition = std::cout.precision(3);
-    std::cout << "[MMLT]: acceptanceRate = " << 100.0f*acceptanceRate << "%" << std::endl;
-    std::cout.precision(oldPrecition);
-  }
+  int accepted = 0;
+  for (const auto& chains : m_chains)
+    accepted += chains.accepted;
+
+  const float acceptanceRate = float(accepted) / float(std::max(mutationsPerThread*threadsNum, 1));
+  auto oldPrecition = std::cout.precision(3);
+  std::cout << "[MMLT]: acceptanceRate = " << 100.0f*acceptanceRate << "%" << std::endl;
+  std::cout.precision(oldPrecition);
 }
 
 
@@ -473,43 +610,43 @@ float IntegratorMMLT::DoPassEstimateAvgBrightness()
 
   const int numPass = (m_mask == nullptr) ? 4 : 8;
 
-  for (int pass = 0; pass < numPass; pass++)
-  {
-    std::cout << "pass " << pass << " begin" << std::endl;
-
-    int mmltFirstBounce = m_pGlobals->varsI[HRT_MMLT_FIRST_BOUNCE];
-    if (mmltFirstBounce > 3) mmltFirstBounce = 3;
-    if (mmltFirstBounce < 2) mmltFirstBounce = 2;
+  int mmltFirstBounce = m_pGlobals->varsI[HRT_MMLT_FIRST_BOUNCE];
+  if (mmltFirstBounce > 3) mmltFirstBounce = 3;
+  if (mmltFirstBounce < 2) mmltFirstBounce = 2;
 
-    for (int d = mmltFirstBounce; d <= m_maxDepth; d++)
-    {
-      const float selectorInvPdf = float(d + 1);
-      double brightness = 0.0f;
+  // each thread accumulates all depths to its own row; rows are padded to separate cache lines
+  //
+  const int threadsNum = MMLTThreadsNum();
+  const int rowSize    = ((m_maxDepth + 1 + 7) / 8) * 8;
+  std::vector<double> brightness(threadsNum*rowSize, 0.0);
 
-      std::cout << "pass " << pass << ", d = " << d << std::endl;
+  #pragma omp parallel num_threads(threadsNum)
+  {
+    double* myBrightness = brightness.data() + ThreadId()*rowSize;
 
-      #pragma omp parallel for reduction(+:brightness)
-      for (int sampleId = 0; sampleId < samplesPerPass; sampleId++)
+    #pragma omp for schedule(dynamic, 256)
+    for (int sampleId = 0; sampleId < numPass*samplesPerPass; sampleId++)
+    {
+      for (int d = mmltFirstBounce; d <= m_maxDepth; d++)
       {
+        const float selectorInvPdf = float(d + 1);
         int xScrNew = 0, yScrNew = 0;
 
         auto xNew        = InitialSamplePS(d);
         float3 yNewColor = F(xNew, d, (MUTATE_CAMERA | MUTATE_LIGHT), &xScrNew, &yScrNew)*selectorInvPdf;
-        const float c    = contribFunc(yNewColor);
-
-        brightness += double(c);
+        myBrightness[d] += double(contribFunc(yNewColor));
       }
-
-      m_avgBPerBounce[d] += float(brightness);
     }
-
-    std::cout << "pass " << pass << " end" << std::endl;
   }
 
   m_avgBrightness = 0.0f;
   for (size_t i = 0; i < m_avgBPerBounce.size(); i++)
   {
-    m_avgBPerBounce[i] *= (1.0f / float(numPass*samplesPerPass));
+    double summ = 0.0;
+    for (int t = 0; t < threadsNum; t++)
+      summ += brightness[t*rowSize + i];
+
+    m_avgBPerBounce[i] = float(summ / double(numPass*samplesPerPass));
     m_avgBrightness += m_avgBPerBounce[i];
     std::cout << "[d = " << i << ", avgB = " << m_avgBPerBounce[i] << ", coeff = " << float(i + 1) << "]" << std::endl;
   }
@@ -553,6 +690,8 @@ float IntegratorMMLT::EstimateScaleCoeff() const
 
 void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
 {
+  m_pGlobals->g_flags |= HRT_MESH_LIGHT_AREA_SAMPLING; // light sampling must match lightPdfFwd, see meshLightUseEmissionTable
+
   //DebugLoadPaths();
 
   // (0) estimate average brightness
@@ -560,6 +699,7 @@ void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
   if (m_firstPass)
   {
     DoPassEstimateAvgBrightness();
+    InitChains(MMLTThreadsNum());
     m_firstPass    = false;
   }
 
@@ -576,8 +716,6 @@ void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
 
   // (2) Run MMLT. 
   //
-  constexpr int samplesPerPass = 8;
-  #pragma omp parallel num_threads(samplesPerPass)
   DoPassIndirectMLT(indirect);
 
   // (3) estimate scale coeff
@@ -608,7 +746,7 @@ void IntegratorMMLT::DoPass(std::vector<uint>& a_imageLDR)
 
   RandomizeAllGenerators();
 
-  std::cout << "IntegratorMMLT: mpp  = " << m_spp*samplesPerPass << std::endl;
+  std::cout << "IntegratorMMLT: mpp  = " << m_spp*MMLT_MUTATIONS_PER_PIXEL << std::endl;
   m_spp++;
 
   //float averageBrightness = (kScaleIndirect / m_spp)*EstimateAverageBrightness(m_summColors);
@@ -1072,7 +1210,7 @@ float3 IntegratorMMLT::PathTraceDirectLight(float3 ray_pos, float3 ray_dir, MisD
 
     if (pLight != nullptr)
     {
-      float lgtPdf    = lightPdfSelectRev(pLight)*lightEvalPDF(pLight, ray_pos, ray_dir, surfElem.pos, surfElem.normal, surfElem.texCoord, m_pdfStorage, m_pGlobals);
+      float lgtPdf    = lightPdfSelectRev(pLight)*lightEvalPDF(pLight, ray_pos, ray_dir, surfElem.pos, surfElem.normal, surfElem.texCoord, hit.primId, m_pdfStorage, m_pGlobals);
       float bsdfPdf   = misPrev.matSamplePdf;
       float misWeight = misWeightHeuristic(bsdfPdf, lgtPdf);  // (bsdfPdf*bsdfPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
 
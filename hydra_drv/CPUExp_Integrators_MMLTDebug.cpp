@@ -191,112 +191,38 @@ IntegratorMMLT_CompressedRand::PSSampleV  IntegratorMMLT_CompressedRand::Decompr
   return res;
 }
 
-IntegratorMMLT_CompressedRand::PSSampleVC IntegratorMMLT_CompressedRand::InitialSamplePS2(const int d, const int a_burnIters)
+int IntegratorMMLT_CompressedRand::ChainSampleSize() const
 {
-  return Compress(IntegratorMMLT::InitialSamplePS(d));
+  return MMLT_HEAD_TOTAL_SIZE + m_maxDepth*6; // uint4 + uint2 per bounce instead of MMLT_FLOATS_PER_BOUNCE floats
 }
 
-
-void IntegratorMMLT_CompressedRand::DoPassIndirectMLT(int d, float a_bkScale, float4* a_outImage)
+void IntegratorMMLT_CompressedRand::StoreChainSample(const PSSampleV& a_vec, float* a_data)
 {
-  auto& gen2 = m_perThread[ThreadId()].gen2;
+  const PSSampleVC packed = Compress(a_vec);
+  
+  memcpy(a_data, packed.head, MMLT_HEAD_TOTAL_SIZE*sizeof(float));
+  float* words = a_data + MMLT_HEAD_TOTAL_SIZE;
 
-  //////////////////////////////////////////////////////////////////////////////////// randomize generator
-  if (clock() % 3 == 0)
+  for (int b = 0; b < packed.bounceNum; b++)
   {
-    const int NRandomisation = (clock() % 9) + (clock() % 4);
-    for (int i = 0; i < NRandomisation; i++)
-      NextState(&gen2);
+    memcpy(words + b*6 + 0, &packed.group1[b], sizeof(uint4));
+    memcpy(words + b*6 + 4, &packed.group2[b], sizeof(uint2));
   }
-  //////////////////////////////////////////////////////////////////////////////////// 
+}
 
-  const int samplesPerPass = m_width*m_height;
-  mLightSubPathCount = float(samplesPerPass);
+void IntegratorMMLT_CompressedRand::LoadChainSample(const float* a_data, int d, PSSampleV& a_vec)
+{
+  PSSampleVC packed;
+  packed.bounceNum = d;
 
-  // select seed
-  //
-  int xScr = 0, yScr = 0;
-  auto   xVec   = InitialSamplePS2(d);
-  float3 yColor = F(Decompress(xVec), d, (MUTATE_CAMERA | MUTATE_LIGHT), &xScr, &yScr);
-  float  y      = contribFunc(yColor);
+  memcpy(packed.head, a_data, MMLT_HEAD_TOTAL_SIZE*sizeof(float));
+  const float* words = a_data + MMLT_HEAD_TOTAL_SIZE;
 
-  // run MCMC
-  //
-  int accept = 0;
-  
-  for (int sampleId = 0; sampleId < samplesPerPass; sampleId++)
+  for (int b = 0; b < packed.bounceNum; b++)
   {
-    int mtype = 0;
-    auto xOld  = xVec;
-    auto xNew  = Compress( MutatePrimarySpace(Decompress(xOld), d, &mtype) );
-
-    float  yOld      = y;
-    float3 yOldColor = yColor;
-
-    int xScrOld = xScr, yScrOld = yScr;
-    int xScrNew = 0,    yScrNew = 0;
-
-    float3 yNewColor = F(Decompress(xNew), d, mtype, &xScrNew, &yScrNew);
-    float  yNew      = contribFunc(yNewColor);
-
-    float a = (yOld == 0.0f) ? 1.0f : fminf(1.0f, yNew / yOld);
-
-    float p = rndFloat1_Pseudo(&gen2);
-
-    if (p <= a) // accept //
-    {
-      xVec   = xNew;
-      y      = yNew;
-      yColor = yNewColor;
-      xScr   = xScrNew;
-      yScr   = yScrNew;
-      accept++;
-    }
-    else        // reject
-    {
-      //x      = x;
-      //y      = y;
-      //yColor = yColor;
-    }
-
-    // (5) contrib to image
-    //
-    float3 contribAtX = a_bkScale*yOldColor*(1.0f / fmaxf(yOld, 1e-6f))*(1.0f - a);
-    float3 contribAtY = a_bkScale*yNewColor*(1.0f / fmaxf(yNew, 1e-6f))*a;
-
-    if (dot(contribAtX, contribAtX) > 1e-12f)
-    { 
-      const int offset = yScrOld*m_width + xScrOld;
-      #pragma omp atomic
-      a_outImage[offset].x += contribAtX.x;
-      #pragma omp atomic
-      a_outImage[offset].y += contribAtX.y;
-      #pragma omp atomic
-      a_outImage[offset].z += contribAtX.z;
-      #pragma omp atomic
-      a_outImage[offset].w += (1.0f-a);
-    }
-
-    if (dot(contribAtY, contribAtY) > 1e-12f)
-    { 
-      const int offset = yScrNew*m_width + xScrNew;
-      #pragma omp atomic
-      a_outImage[offset].x += contribAtY.x;
-      #pragma omp atomic
-      a_outImage[offset].y += contribAtY.y;
-      #pragma omp atomic
-      a_outImage[offset].z += contribAtY.z;
-      #pragma omp atomic
-      a_outImage[offset].w += a;
-    }
-    
+    memcpy(&packed.group1[b], words + b*6 + 0, sizeof(uint4));
+    memcpy(&packed.group2[b], words + b*6 + 4, sizeof(uint2));
   }
 
-  if (omp_get_thread_num() == 0)
-  {
-    float acceptanceRate = float(accept) / float(samplesPerPass);
-    auto oldPrecition = std::cout.precision(3);
-    std::cout << "[MMLTC]: acceptanceRate = " << 100.0f*acceptanceRate << "%" << std::endl;
-    std::cout.precision(oldPrecition);
-  }
+  a_vec = Decompress(packed);
 }
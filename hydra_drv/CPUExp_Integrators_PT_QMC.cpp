@@ -7,8 +7,11 @@ void IntegratorMISPT_QMC::DoPass(std::vector<uint>& a_imageLDR)
   if (m_width*m_height != a_imageLDR.size())
     RUN_TIME_ERROR("DoPass: bad output bufffer size");
   
+  const int4 crop     = cropWindowPixels(m_pGlobals->varsF[HRT_CROP_MIN_X], m_pGlobals->varsF[HRT_CROP_MIN_Y], 
+                                         m_pGlobals->varsF[HRT_CROP_MAX_X], m_pGlobals->varsF[HRT_CROP_MAX_Y], m_width, m_height);
+
   const float alpha   = 1.0f / float(m_spp + 1);  // Update HDR image coeff
-  const auto loopSize = m_summColors.size();
+  const int loopSize  = (crop.z - crop.x)*(crop.w - crop.y); // one sample per pixel of crop window
   const int qmcOffset = int(loopSize)*m_spp;
   
   #pragma omp parallel for
@@ -17,8 +20,8 @@ void IntegratorMISPT_QMC::DoPass(std::vector<uint>& a_imageLDR)
     PerThread().qmcPos = qmcOffset + i;
     
     RandomGen& gen  = randomGen();
-    float4 lensOffs = rndLens(&gen, nullptr, float2(1,1), 
-                              m_pGlobals->rmQMC, PerThread().qmcPos, (const unsigned int*)m_tableQMC);
+    float4 lensOffs = cropLensSample(rndLens(&gen, nullptr, float2(1,1), 
+                                             m_pGlobals->rmQMC, PerThread().qmcPos, (const unsigned int*)m_tableQMC), m_pGlobals);
                               
     float  fx, fy;
     float3 ray_pos, ray_dir;
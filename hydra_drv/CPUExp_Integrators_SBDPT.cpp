@@ -10,6 +10,8 @@ void IntegratorSBDPT::SetMaxDepth(int a_depth)
 
 void IntegratorSBDPT::DoPass(std::vector<uint>& a_imageLDR)
 {
+  m_pGlobals->g_flags |= HRT_MESH_LIGHT_AREA_SAMPLING; // light sampling must match lightPdfFwd, see meshLightUseEmissionTable
+
   const int samplesPerPass = m_width*m_height;
   mLightSubPathCount = float(samplesPerPass);
 
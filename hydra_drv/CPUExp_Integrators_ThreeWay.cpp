@@ -26,6 +26,8 @@ void IntegratorThreeWay::GetImageHDR(float4* a_imageHDR, int w, int h) const
 
 void IntegratorThreeWay::DoPass(std::vector<uint>& a_imageLDR)
 {
+  m_pGlobals->g_flags |= HRT_MESH_LIGHT_AREA_SAMPLING; // light sampling must match lightPdfFwd, see meshLightUseEmissionTable
+
   // if (m_spp == 0)
   //   DebugSaveGbufferImage(L"gbufferout");
 
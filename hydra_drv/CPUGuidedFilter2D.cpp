@@ -0,0 +1,171 @@
+#include "IHWLayer.h"
+#include "CPUGuidedFilter2D.h"
+
+#include <algorithm>
+#undef min
+#undef max
+
+#include "../../HydraAPI/hydra_api/ssemath.h"
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+constexpr static int   GUIDED_FILTER_TILE  = 32;     ///< tile is processed by single thread; other constants are in cdenoise.h
+
+void GuidedFilterMakeGuides(const float4* a_gbuffer1, int a_size, float4* a_normDepth, float4* a_albedo)
+{
+  #pragma omp parallel for
+  for (int i = 0; i < a_size; i++)
+  {
+    const GBuffer1 gbuff = unpackGBuffer1(a_gbuffer1[i]);
+    a_normDepth[i] = to_float4(gbuff.norm, gbuff.depth);
+
+    if (gbuff.depth >= GUIDED_BACK_DEPTH) // background, don't demodulate
+      a_albedo[i] = make_float4(1.0f, 1.0f, 1.0f, gbuff.coverage);
+    else
+      a_albedo[i] = make_float4(fmax(gbuff.rgba.x, GUIDED_MIN_ALBEDO), fmax(gbuff.rgba.y, GUIDED_MIN_ALBEDO), fmax(gbuff.rgba.z, GUIDED_MIN_ALBEDO), gbuff.coverage);
+  }
+}
+
+static inline float hsum3(const __m128 v)
+{
+  const __m128 vxyz = _mm_and_ps(v, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+  const __m128 t1   = _mm_add_ps(vxyz, _mm_movehl_ps(vxyz, vxyz));
+  const __m128 t2   = _mm_add_ss(t1, _mm_shuffle_ps(t1, t1, 1));
+  return _mm_cvtss_f32(t2);
+}
+
+void GuidedFilterNLM(const float4* a_color, const float4* a_normDepth, const float4* a_albedo, int w, int h,
+                     int a_windowRadius, float a_strength, float4* a_out)
+{
+  const int r   = std::max(a_windowRadius, 1);
+  const int pad = r + 1;       // search window + 3x3 patch
+  const int pw  = w + 2*pad;
+  const int ph  = h + 2*pad;
+
+  // demodulated lighting with clamped border, so inner loops don't need any bounds checks
+  //
+  std::vector<float4> irradiance(size_t(pw)*size_t(ph));
+
+  #pragma omp parallel for
+  for (int y = 0; y < ph; y++)
+  {
+    const int y0 = std::min(std::max(y - pad, 0), h - 1);
+    for (int x = 0; x < pw; x++)
+    {
+      const int x0 = std::min(std::max(x - pad, 0), w - 1);
+      const float4 color  = a_color[y0*w + x0];
+      const float4 albedo = a_albedo[y0*w + x0];
+      irradiance[y*pw + x] = make_float4(color.x/albedo.x, color.y/albedo.y, color.z/albedo.z, 0.0f);
+    }
+  }
+
+  const float invH2      = 1.0f/fmax(a_strength*a_strength, 1e-6f);
+  const float invSpatial = 1.0f/float(2*r*r);
+  const float invPatch   = 1.0f/9.0f;
+
+  const int tilesX = (w + GUIDED_FILTER_TILE - 1) / GUIDED_FILTER_TILE;
+  const int tilesY = (h + GUIDED_FILTER_TILE - 1) / GUIDED_FILTER_TILE;
+
+  const float4* irr = irradiance.data();
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int tile = 0; tile < tilesX*tilesY; tile++)
+  {
+    const int tileX = (tile % tilesX)*GUIDED_FILTER_TILE;
+    const int tileY = (tile / tilesX)*GUIDED_FILTER_TILE;
+    const int endX  = std::min(tileX + GUIDED_FILTER_TILE, w);
+    const int endY  = std::min(tileY + GUIDED_FILTER_TILE, h);
+
+    for (int y = tileY; y < endY; y++)
+    {
+      for (int x = tileX; x < endX; x++)
+      {
+        const int    pixelId   = y*w + x;
+        const float4 normDepth = a_normDepth[pixelId];
+        const float4 albedo    = a_albedo[pixelId];
+        const bool   isBack    = (normDepth.w >= GUIDED_BACK_DEPTH);
+        const float  invDepth  = 1.0f/fmax(normDepth.w, 1e-4f);
+
+        const float4* centre  = irr + (y + pad)*pw + (x + pad);
+        const __m128  c0      = _mm_loadu_ps((const float*)centre);
+        const float   c0Norm  = hsum3(_mm_mul_ps(c0, c0));
+
+        __m128 summ = _mm_setzero_ps();
+        float  wSum = 0.0f;
+
+        for (int y1 = std::max(y - r, 0); y1 <= std::min(y + r, h - 1); y1++)
+        {
+          for (int x1 = std::max(x - r, 0); x1 <= std::min(x + r, w - 1); x1++)
+          {
+            const int   otherId = y1*w + x1;
+            const float4 nd1    = a_normDepth[otherId];
+            const bool isBack1  = (nd1.w >= GUIDED_BACK_DEPTH);
+
+            if (isBack != isBack1)
+              continue;
+
+            // (1) geometry and texture guides are cheap, evaluate them first
+            //
+            float exponent = float((x1 - x)*(x1 - x) + (y1 - y)*(y1 - y))*invSpatial;
+            if (!isBack)
+            {
+              const float4 a1   = a_albedo[otherId];
+              const float3 aDif = make_float3(a1.x - albedo.x, a1.y - albedo.y, a1.z - albedo.z);
+              const float  nDot = normDepth.x*nd1.x + normDepth.y*nd1.y + normDepth.z*nd1.z;
+              exponent += GUIDED_NORMAL_K*fmax(1.0f - nDot, 0.0f);
+              exponent += GUIDED_DEPTH_K*fabs(nd1.w - normDepth.w)*invDepth;
+              exponent += GUIDED_ALBEDO_K*dot(aDif, aDif);
+            }
+
+            if (exponent > GUIDED_MAX_EXPONENT)
+              continue;
+
+            // (2) 3x3 patch distance, relative to pixel intensity
+            //
+            const float4* other = irr + (y1 + pad)*pw + (x1 + pad);
+            const __m128  c1    = _mm_loadu_ps((const float*)other);
+            __m128 patchDist    = _mm_setzero_ps();
+
+            for (int py = -1; py <= 1; py++)
+            {
+              for (int px = -1; px <= 1; px++)
+              {
+                const __m128 p0   = _mm_loadu_ps((const float*)(centre + py*pw + px));
+                const __m128 p1   = _mm_loadu_ps((const float*)(other  + py*pw + px));
+                const __m128 diff = _mm_sub_ps(p0, p1);
+                patchDist = _mm_add_ps(patchDist, _mm_mul_ps(diff, diff));
+              }
+            }
+
+            const float c1Norm = hsum3(_mm_mul_ps(c1, c1));
+            exponent += invH2*invPatch*hsum3(patchDist)/(GUIDED_PATCH_EPS + c0Norm + c1Norm);
+
+            if (exponent > GUIDED_MAX_EXPONENT)
+              continue;
+
+            const float weight = expf(-exponent);
+            summ  = _mm_add_ps(summ, _mm_mul_ps(c1, _mm_set1_ps(weight)));
+            wSum += weight;
+          }
+        }
+
+        float4 result;
+        _mm_storeu_ps((float*)&result, summ);
+
+        const float norm = 1.0f/fmax(wSum, 1e-6f); // centre pixel always has weight 1
+        a_out[pixelId] = make_float4(result.x*norm*albedo.x, result.y*norm*albedo.y, result.z*norm*albedo.z, a_color[pixelId].w);
+      }
+    }
+  }
+
+}
+
+void IHWLayer::DenoiseHDR(float4* a_color, const float4* a_gbuffer1, int w, int h, int a_windowRadius, float a_strength)
+{
+  std::vector<float4> normDepth(w*h), albedo(w*h), filtered(w*h);
+  GuidedFilterMakeGuides(a_gbuffer1, w*h, normDepth.data(), albedo.data());
+  GuidedFilterNLM(a_color, normDepth.data(), albedo.data(), w, h, a_windowRadius, a_strength, filtered.data());
+  memcpy(a_color, filtered.data(), filtered.size()*sizeof(float4));
+}
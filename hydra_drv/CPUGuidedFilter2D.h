@@ -0,0 +1,32 @@
+#pragma once
+
+#include "cglobals.h"
+#include "cdenoise.h"
+
+/**
+\brief Unpack G-buffer (first layer, see packGBuffer1) to guide images used by the denoiser.
+\param a_gbuffer1   - packed G-buffer layer 1
+\param a_size       - pixels number
+\param a_normDepth  - out normal (xyz) and depth (w)
+\param a_albedo     - out texture color to demodulate lighting with (xyz) and coverage (w); background pixels get albedo 1
+
+*/
+void GuidedFilterMakeGuides(const float4* a_gbuffer1, int a_size, float4* a_normDepth, float4* a_albedo);
+
+/**
+\brief Feature guided non local means filter for noisy HDR frames. Lighting is demodulated by albedo and filtered with
+       3x3 patch distance while normals, depth and albedo guides prevent blurring across geometry and texture edges.
+       Image is processed in tiles to keep the search window in cache; alpha (shadow) channel is preserved.
+\param a_color        - input HDR image
+\param a_normDepth    - guide from GuidedFilterMakeGuides
+\param a_albedo       - guide from GuidedFilterMakeGuides
+\param w              - image width
+\param h              - image height
+\param a_windowRadius - search window radius; 5 (11x11 window) is usually enough for 16-64 spp
+\param a_strength     - expected relative noise level; greater values smooth more
+\param a_out          - output image, must not overlap a_color
+
+*/
+void GuidedFilterNLM(const float4* a_color, const float4* a_normDepth, const float4* a_albedo, int w, int h,
+                     int a_windowRadius, float a_strength, float4* a_out);
+
@@ -0,0 +1,82 @@
+#include "CPUImageOutput.h"
+
+#include <algorithm>
+#undef min
+#undef max
+
+#include "../../HydraAPI/hydra_api/ssemath.h"
+
+constexpr static int LDR_OUTPUT_CHUNK = 4096; ///< pixels per thread task; big enough to amortize scheduling, small enough to balance 4K frames
+
+static inline uint PackLDR(const __m128 a_color)
+{
+  const __m128  const_255 = _mm_set_ps1(255.0f);
+  const __m128i rgba      = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(a_color, const_255), const_255));
+  const __m128i out       = _mm_packus_epi32(rgba, _mm_setzero_si128());
+  const __m128i out2      = _mm_packus_epi16(out, _mm_setzero_si128());
+  return uint(_mm_cvtsi128_si32(out2));
+}
+
+static inline __m128 GammaRGB(const __m128 a_color, const __m128 a_power) ///< alpha stays linear
+{
+  return _mm_blend_ps(HydraSSE::powf4(a_color, a_power), a_color, 0x8);
+}
+
+void HDRImageToLDR(const float4* a_color, float a_scale, const float4* a_color2, float a_scale2, int a_size, float a_gammaInv, uint* a_out)
+{
+  const int chunks = (a_size + LDR_OUTPUT_CHUNK - 1) / LDR_OUTPUT_CHUNK;
+
+  if (!HydraSSE::g_useSSE)
+  {
+    #pragma omp parallel for
+    for (int chunk = 0; chunk < chunks; chunk++)
+    {
+      const int end = std::min(a_size, (chunk + 1)*LDR_OUTPUT_CHUNK);
+      for (int i = chunk*LDR_OUTPUT_CHUNK; i < end; i++)
+      {
+        float4 color = a_color[i]*a_scale;
+        if (a_color2 != nullptr)
+          color += a_color2[i]*a_scale2;
+
+        color.x = powf(color.x, a_gammaInv);
+        color.y = powf(color.y, a_gammaInv);
+        color.z = powf(color.z, a_gammaInv);
+        a_out[i] = RealColorToUint32(ToneMapping4(color));
+      }
+    }
+    return;
+  }
+
+  const __m128 powerf4 = _mm_set_ps1(a_gammaInv);
+  const __m128 scale1  = _mm_set_ps1(a_scale);
+  const __m128 scale2  = _mm_set_ps1(a_scale2);
+  const __m128 zero    = _mm_setzero_ps();
+
+  const float* data1 = (const float*)a_color;
+  const float* data2 = (const float*)a_color2;
+
+  #pragma omp parallel for
+  for (int chunk = 0; chunk < chunks; chunk++)
+  {
+    const int end = std::min(a_size, (chunk + 1)*LDR_OUTPUT_CHUNK);
+
+    if (data2 == nullptr)
+    {
+      for (int i = chunk*LDR_OUTPUT_CHUNK; i < end; i++)
+      {
+        const __m128 color = _mm_max_ps(_mm_mul_ps(scale1, _mm_loadu_ps(data1 + i*4)), zero);
+        a_out[i] = PackLDR(GammaRGB(color, powerf4));
+      }
+    }
+    else
+    {
+      for (int i = chunk*LDR_OUTPUT_CHUNK; i < end; i++)
+      {
+        const __m128 color1 = _mm_mul_ps(scale1, _mm_loadu_ps(data1 + i*4));
+        const __m128 color2 = _mm_mul_ps(scale2, _mm_loadu_ps(data2 + i*4));
+        a_out[i] = PackLDR(GammaRGB(_mm_max_ps(_mm_add_ps(color1, color2), zero), powerf4));
+      }
+    }
+  }
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "cglobals.h"
+
+/**
+\brief Single output stage for all CPU side HDR to LDR conversions. Scale (normalization and exposure), optional second layer,
+       gamma (RGB only, alpha stays linear) and packing are fused, so each HDR buffer is read only once per display update. Uses SSE gamma when HydraSSE::g_useSSE
+       is set and splits image between threads.
+\param a_color   - first HDR layer (accumulated color)
+\param a_scale   - multiplier for the first layer
+\param a_color2  - optional second HDR layer added to the first one (direct light layer in MMLT); may be nullptr
+\param a_scale2  - multiplier for the second layer
+\param a_size    - pixels number
+\param a_gammaInv - 1.0f/gamma
+\param a_out     - output LDR image, RGBA8
+
+*/
+void HDRImageToLDR(const float4* a_color, float a_scale, const float4* a_color2, float a_scale2, int a_size, float a_gammaInv, uint* a_out);
+
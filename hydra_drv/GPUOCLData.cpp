@@ -3,6 +3,7 @@
 
 #include "MemoryStorageCPU.h"
 #include "MemoryStorageOCL.h"
+#include "CPUGuidedFilter2D.h"
 
 void GPUOCLLayer::CreateBuffersGeom(InputGeom a_input, cl_mem_flags a_flags) { }
 void GPUOCLLayer::CreateBuffersBVH(InputGeomBVH a_input, cl_mem_flags a_flags) { }
@@ -98,8 +99,15 @@ void GPUOCLLayer::SetAllBVH4(const ConvertionResult& a_convertedBVH, IBVHBuilder
 
   m_memoryTaken[MEM_TAKEN_BVH] = 0;
 
+  m_scene.bvhBoxMin = float3(+INFINITY, +INFINITY, +INFINITY);
+  m_scene.bvhBoxMax = float3(-INFINITY, -INFINITY, -INFINITY);
+
   for (int i = 0; i < a_convertedBVH.treesNum; i++)
   {
+    const BVHNode root = a_convertedBVH.pBVH[i][0];                          // the quantized layout header keeps root box in the same place
+    m_scene.bvhBoxMin  = float3(fminf(m_scene.bvhBoxMin.x, root.m_boxMin.x), fminf(m_scene.bvhBoxMin.y, root.m_boxMin.y), fminf(m_scene.bvhBoxMin.z, root.m_boxMin.z));
+    m_scene.bvhBoxMax  = float3(fmaxf(m_scene.bvhBoxMax.x, root.m_boxMax.x), fmaxf(m_scene.bvhBoxMax.y, root.m_boxMax.y), fmaxf(m_scene.bvhBoxMax.z, root.m_boxMax.z));
+
     const size_t nodesSize = a_convertedBVH.nodesNum[i]*sizeof(BVHNode);
     const size_t primsSize = a_convertedBVH.trif4Num[i]*sizeof(float4);
     const size_t alphaSize = a_convertedBVH.triAfNum[i]*sizeof(uint2);
@@ -114,7 +122,7 @@ void GPUOCLLayer::SetAllBVH4(const ConvertionResult& a_convertedBVH, IBVHBuilder
     if(a_convertedBVH.pTriangleAlpha[i] != nullptr)
       m_scene.alphTstBuff[i] = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, alphaSize, (void*)a_convertedBVH.pTriangleAlpha[i], &ciErr1);
 
-    m_scene.bvhHaveInst[i]      = (std::string(a_convertedBVH.bvhType[i]) != "triangle4v"); // or (bvhType == "object")
+    m_scene.bvhHaveInst[i]      = BVHTypeHaveInst(a_convertedBVH.bvhType[i]);
     m_bvhTrees[i].smoothOpacity = (a_flags & BVH_ENABLE_SMOOTH_OPACITY) != 0;
   }
 
@@ -347,7 +355,7 @@ void GPUOCLLayer::SetAllFlagsAndVars(const AllRenderVarialbes& a_vars)
 
 void GPUOCLLayer::CallNamedFunc(const char* a_name, const char* a_args)
 {
-  
+  Base::CallNamedFunc(a_name, a_args); // CPU integrator exists only if we store CPU data
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -614,3 +622,54 @@ std::vector<uchar4> GPUOCLLayer::NormalMapFromDisplacement(int w, int h, const u
   return resData;
 }
 
+void GPUOCLLayer::DenoiseHDR(float4* a_color, const float4* a_gbuffer1, int w, int h, int a_windowRadius, float a_strength)
+{
+  std::vector<float4> normDepth(w*h), albedo(w*h);
+  GuidedFilterMakeGuides(a_gbuffer1, w*h, normDepth.data(), albedo.data());
+
+  cl_int ciErr1 = CL_SUCCESS, ciErr2 = CL_SUCCESS, ciErr3 = CL_SUCCESS, ciErr4 = CL_SUCCESS;
+  const size_t bufferSize = size_t(w)*size_t(h)*sizeof(float4);
+
+  cl_mem colorIn   = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bufferSize, (void*)a_color,          &ciErr1);
+  cl_mem guideND   = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bufferSize, (void*)normDepth.data(), &ciErr2);
+  cl_mem guideAlb  = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bufferSize, (void*)albedo.data(),    &ciErr3);
+  cl_mem colorOut  = clCreateBuffer(m_globals.ctx, CL_MEM_WRITE_ONLY, bufferSize, NULL, &ciErr4);
+
+  if (ciErr1 != CL_SUCCESS || ciErr2 != CL_SUCCESS || ciErr3 != CL_SUCCESS || ciErr4 != CL_SUCCESS) // not enough device memory, CPU fallback
+  {
+    std::cerr << "[cl_core]: DenoiseHDR(); can't alloc buffers; CPU fallback" << std::endl;
+    if (colorIn  != 0) clReleaseMemObject(colorIn);
+    if (guideND  != 0) clReleaseMemObject(guideND);
+    if (guideAlb != 0) clReleaseMemObject(guideAlb);
+    if (colorOut != 0) clReleaseMemObject(colorOut);
+    Base::DenoiseHDR(a_color, a_gbuffer1, w, h, a_windowRadius, a_strength);
+    return;
+  }
+
+  const int w2 = blocks(w, 16) * 16;
+  const int h2 = blocks(h, 16) * 16;
+
+  size_t global_item_size[2] = { size_t(w2), size_t(h2) };
+  size_t local_item_size[2]  = { 16, 16 };
+
+  cl_kernel myKernel = m_progs.imagep.kernel("GuidedNLMFilter");
+
+  CHECK_CL(clSetKernelArg(myKernel, 0, sizeof(cl_mem),   (void*)&colorOut));
+  CHECK_CL(clSetKernelArg(myKernel, 1, sizeof(cl_mem),   (void*)&colorIn));
+  CHECK_CL(clSetKernelArg(myKernel, 2, sizeof(cl_mem),   (void*)&guideND));
+  CHECK_CL(clSetKernelArg(myKernel, 3, sizeof(cl_mem),   (void*)&guideAlb));
+  CHECK_CL(clSetKernelArg(myKernel, 4, sizeof(cl_int),   (void*)&w));
+  CHECK_CL(clSetKernelArg(myKernel, 5, sizeof(cl_int),   (void*)&h));
+  CHECK_CL(clSetKernelArg(myKernel, 6, sizeof(cl_int),   (void*)&a_windowRadius));
+  CHECK_CL(clSetKernelArg(myKernel, 7, sizeof(cl_float), (void*)&a_strength));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, myKernel, 2, NULL, global_item_size, local_item_size, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, colorOut, CL_TRUE, 0, bufferSize, a_color, 0, NULL, NULL));
+
+  clReleaseMemObject(colorIn);  colorIn  = 0;
+  clReleaseMemObject(guideND);  guideND  = 0;
+  clReleaseMemObject(guideAlb); guideAlb = 0;
+  clReleaseMemObject(colorOut); colorOut = 0;
+}
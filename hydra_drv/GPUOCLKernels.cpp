@@ -1,6 +1,9 @@
 #include "GPUOCLLayer.h"
+#include "crandom.h"
 #include "cl_scan_gpu.h"
 
+extern "C" const float* getBlueNoiseMask();
+
 void GPUOCLLayer::waitIfDebug(const char* file, int line) const
 {
 #ifdef _DEBUG
@@ -42,6 +45,39 @@ void GPUOCLLayer::runKernel_MakeEyeSamplesOnly(size_t a_size, int a_passNumber,
 }
 
 
+void GPUOCLLayer::runKernel_MakeEyeSamplesBlueNoise(size_t a_size, int a_passNumber,
+                                                    cl_mem a_zindex, cl_mem a_samples)
+{
+  size_t localWorkSize   = CMP_RESULTS_BLOCK_SIZE;
+  int iSize              = int(a_size);
+  a_size                 = roundBlocks(a_size, int(localWorkSize));
+
+  if (m_globals.blueNoiseMask == nullptr) // mask is rather expensive to generate, so do it only when it is actually used
+  {
+    cl_int ciErr1 = CL_SUCCESS;
+    m_globals.blueNoiseMask = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, BLUE_NOISE_SIZE*BLUE_NOISE_SIZE*sizeof(float), (void*)getBlueNoiseMask(), &ciErr1);
+    if (ciErr1 != CL_SUCCESS)
+      RUN_TIME_ERROR("Error when create blueNoiseMask");
+  }
+
+  cl_kernel makeSamples  = m_progs.screen.kernel("MakeEyeRaysSamplesBlueNoise");
+
+  CHECK_CL(clSetKernelArg(makeSamples, 0, sizeof(cl_mem), (void*)&a_samples));
+  CHECK_CL(clSetKernelArg(makeSamples, 1, sizeof(cl_mem), (void*)&a_zindex));
+  CHECK_CL(clSetKernelArg(makeSamples, 2, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+  CHECK_CL(clSetKernelArg(makeSamples, 3, sizeof(cl_mem), (void*)&m_globals.cMortonTable));
+  CHECK_CL(clSetKernelArg(makeSamples, 4, sizeof(cl_mem), (void*)&m_globals.blueNoiseMask));
+  CHECK_CL(clSetKernelArg(makeSamples, 5, sizeof(cl_int), (void*)&a_passNumber));
+  CHECK_CL(clSetKernelArg(makeSamples, 6, sizeof(cl_int), (void*)&m_width));
+  CHECK_CL(clSetKernelArg(makeSamples, 7, sizeof(cl_int), (void*)&m_height));
+  CHECK_CL(clSetKernelArg(makeSamples, 8, sizeof(cl_int), (void*)&iSize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, makeSamples, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  m_globals.m_passNumberQMC = a_passNumber; 
+}
+
 void GPUOCLLayer::runKernel_MakeEyeRaysQMC(size_t a_size, int a_passNumber,
                                            cl_mem a_zindex, cl_mem a_samples)
 {
@@ -376,93 +412,284 @@ void GPUOCLLayer::runKernel_HDRToLDRWithScale(cl_mem in_colorHDR, float a_kScale
 
 
 void GPUOCLLayer::runKernel_Trace(cl_mem a_rpos, cl_mem a_rdir, size_t a_size,
-                                  cl_mem a_hits)
+                                  cl_mem a_hits, int a_bounce)
 {
+  const bool measure = m_vars.m_varsI[HRT_ENABLE_MRAYS_COUNTERS] && (a_bounce == m_vars.m_varsI[HRT_MEASURE_RAYS_TYPE]);
+  if (measure)
+    m_stat.reorderTimeMs = 0.0f;
+
   if (m_globals.cpuTrace)
-  {
     runTraceCPU(a_rpos, a_rdir, m_rays.hits, a_size);
-  }
+  else if (a_bounce >= 1 && RayReorderEnabled(a_size)) // primary rays are already coherent
+    runKernel_TraceReordered(a_rpos, a_rdir, a_size, a_hits, measure);
   else
+    runKernel_TraceBVH(a_rpos, a_rdir, m_rays.rayFlags, m_rays.randGenState, a_size, a_hits);
+}
+
+void GPUOCLLayer::runKernel_TraceBVH(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_flags, cl_mem a_gens, size_t a_size,
+                                     cl_mem a_hits)
+{
+  cl_kernel kernTrace1 = m_progs.trace.kernel("BVH4TraversalKernel");
+  cl_kernel kernTrace2 = m_progs.trace.kernel("BVH4TraversalInstKernel");
+  cl_kernel kernTrace3 = m_progs.trace.kernel("BVH4TraversalInstKernelA");
+  cl_kernel kernTrace4 = m_progs.trace.kernel("BVH4TraversalInstKernelAS");
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  for(int runId = 0; runId < m_scene.bvhNumber; runId++)
   {
-    cl_kernel kernTrace1 = m_progs.trace.kernel("BVH4TraversalKernel");
-    cl_kernel kernTrace2 = m_progs.trace.kernel("BVH4TraversalInstKernel");
-    cl_kernel kernTrace3 = m_progs.trace.kernel("BVH4TraversalInstKernelA");
-    cl_kernel kernTrace4 = m_progs.trace.kernel("BVH4TraversalInstKernelAS");
+    bool smoothOpacity  = m_bvhTrees[runId].smoothOpacity && ((m_vars.m_flags & HRT_ENABLE_MMLT) == 0);
 
-    size_t localWorkSize = 256;
-    int    isize         = int(a_size);
-    a_size               = roundBlocks(a_size, int(localWorkSize));
+    cl_mem    bvhBuff   = m_scene.bvhBuff    [runId];
+    cl_mem    triBuff   = m_scene.objListBuff[runId];
+    cl_mem    triAlpha  = m_scene.alphTstBuff[runId];
+    cl_kernel kernTrace = m_scene.bvhHaveInst[runId] ? kernTrace2 : kernTrace1;
 
-    for(int runId = 0; runId < m_scene.bvhNumber; runId++)
+    if (triAlpha != nullptr)
     {
-      bool smoothOpacity  = m_bvhTrees[runId].smoothOpacity && ((m_vars.m_flags & HRT_ENABLE_MMLT) == 0);
+      if (smoothOpacity)
+      {
+        kernTrace = kernTrace4;
+
+        CHECK_CL(clSetKernelArg(kernTrace, 0, sizeof(cl_mem), (void*)&a_rpos));
+        CHECK_CL(clSetKernelArg(kernTrace, 1, sizeof(cl_mem), (void*)&a_rdir));
+        CHECK_CL(clSetKernelArg(kernTrace, 2, sizeof(cl_mem), (void*)&bvhBuff));
+        CHECK_CL(clSetKernelArg(kernTrace, 3, sizeof(cl_mem), (void*)&triBuff));
 
-      cl_mem    bvhBuff   = m_scene.bvhBuff    [runId];
-      cl_mem    triBuff   = m_scene.objListBuff[runId];
-      cl_mem    triAlpha  = m_scene.alphTstBuff[runId];
-      cl_kernel kernTrace = m_scene.bvhHaveInst[runId] ? kernTrace2 : kernTrace1;
+        CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&triAlpha));
+        CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&m_scene.storageTex));
+        CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
 
-      if (triAlpha != nullptr)
-      {
-        if (smoothOpacity)
-        {
-          kernTrace = kernTrace4;
-
-          CHECK_CL(clSetKernelArg(kernTrace, 0, sizeof(cl_mem), (void*)&a_rpos));
-          CHECK_CL(clSetKernelArg(kernTrace, 1, sizeof(cl_mem), (void*)&a_rdir));
-          CHECK_CL(clSetKernelArg(kernTrace, 2, sizeof(cl_mem), (void*)&bvhBuff));
-          CHECK_CL(clSetKernelArg(kernTrace, 3, sizeof(cl_mem), (void*)&triBuff));
-
-          CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&triAlpha));
-          CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&m_scene.storageTex));
-          CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
-
-          CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_mem), (void*)&m_rays.rayFlags));
-          CHECK_CL(clSetKernelArg(kernTrace, 8, sizeof(cl_mem), (void*)&a_hits));
-          CHECK_CL(clSetKernelArg(kernTrace, 9, sizeof(cl_mem), (void*)&m_rays.randGenState));
-
-          CHECK_CL(clSetKernelArg(kernTrace, 10, sizeof(cl_int), (void*)&runId));
-          CHECK_CL(clSetKernelArg(kernTrace, 11, sizeof(cl_int), (void*)&isize));
-        }
-        else
-        {
-          kernTrace = kernTrace3;
-
-          CHECK_CL(clSetKernelArg(kernTrace, 0, sizeof(cl_mem), (void*)&a_rpos));
-          CHECK_CL(clSetKernelArg(kernTrace, 1, sizeof(cl_mem), (void*)&a_rdir));
-          
-          CHECK_CL(clSetKernelArg(kernTrace, 2, sizeof(cl_mem), (void*)&bvhBuff));
-          CHECK_CL(clSetKernelArg(kernTrace, 3, sizeof(cl_mem), (void*)&triBuff));
-          CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&triAlpha));
-
-          CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&m_scene.storageTex));
-          CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
-
-          CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_mem), (void*)&m_rays.rayFlags));
-          CHECK_CL(clSetKernelArg(kernTrace, 8, sizeof(cl_mem), (void*)&a_hits));
-          CHECK_CL(clSetKernelArg(kernTrace, 9, sizeof(cl_int), (void*)&runId));
-          CHECK_CL(clSetKernelArg(kernTrace, 10, sizeof(cl_int), (void*)&isize));
-        }
+        CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_mem), (void*)&a_flags));
+        CHECK_CL(clSetKernelArg(kernTrace, 8, sizeof(cl_mem), (void*)&a_hits));
+        CHECK_CL(clSetKernelArg(kernTrace, 9, sizeof(cl_mem), (void*)&a_gens));
+
+        CHECK_CL(clSetKernelArg(kernTrace, 10, sizeof(cl_int), (void*)&runId));
+        CHECK_CL(clSetKernelArg(kernTrace, 11, sizeof(cl_int), (void*)&isize));
       }
       else
       {
+        kernTrace = kernTrace3;
+
         CHECK_CL(clSetKernelArg(kernTrace, 0, sizeof(cl_mem), (void*)&a_rpos));
         CHECK_CL(clSetKernelArg(kernTrace, 1, sizeof(cl_mem), (void*)&a_rdir));
+        
         CHECK_CL(clSetKernelArg(kernTrace, 2, sizeof(cl_mem), (void*)&bvhBuff));
         CHECK_CL(clSetKernelArg(kernTrace, 3, sizeof(cl_mem), (void*)&triBuff));
-        CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&m_rays.rayFlags));
-        CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&a_hits));
+        CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&triAlpha));
+
+        CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&m_scene.storageTex));
+        CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+
+        CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_mem), (void*)&a_flags));
+        CHECK_CL(clSetKernelArg(kernTrace, 8, sizeof(cl_mem), (void*)&a_hits));
+        CHECK_CL(clSetKernelArg(kernTrace, 9, sizeof(cl_int), (void*)&runId));
+        CHECK_CL(clSetKernelArg(kernTrace, 10, sizeof(cl_int), (void*)&isize));
+      }
+    }
+    else
+    {
+      CHECK_CL(clSetKernelArg(kernTrace, 0, sizeof(cl_mem), (void*)&a_rpos));
+      CHECK_CL(clSetKernelArg(kernTrace, 1, sizeof(cl_mem), (void*)&a_rdir));
+      CHECK_CL(clSetKernelArg(kernTrace, 2, sizeof(cl_mem), (void*)&bvhBuff));
+      CHECK_CL(clSetKernelArg(kernTrace, 3, sizeof(cl_mem), (void*)&triBuff));
+      CHECK_CL(clSetKernelArg(kernTrace, 4, sizeof(cl_mem), (void*)&a_flags));
+      CHECK_CL(clSetKernelArg(kernTrace, 5, sizeof(cl_mem), (void*)&a_hits));
+
+      if (kernTrace == kernTrace2)
+      {
+        memsetu32(m_rays.traceOverflow, 0, 1);
+        CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_mem), (void*)&m_rays.traceOverflow));
+        CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_int), (void*)&runId));
+        CHECK_CL(clSetKernelArg(kernTrace, 8, sizeof(cl_int), (void*)&isize));
+      }
+      else
+      {
         CHECK_CL(clSetKernelArg(kernTrace, 6, sizeof(cl_int), (void*)&runId));
         CHECK_CL(clSetKernelArg(kernTrace, 7, sizeof(cl_int), (void*)&isize));
       }
+    }
+
+    CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernTrace, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+    waitIfDebug(__FILE__, __LINE__);
+
+    // rays that are too deep for restart trail are finished with full stack; count is read on device, so there is no host sync here
+    //
+    if (kernTrace == kernTrace2 && (m_initFlags & GPU_RT_SHORT_STACK_TRAVERSAL))
+    {
+      cl_kernel kernOverflow = m_progs.trace.kernel("BVH4TraversalInstOverflowKernel");
+
+      CHECK_CL(clSetKernelArg(kernOverflow, 0, sizeof(cl_mem), (void*)&a_rpos));
+      CHECK_CL(clSetKernelArg(kernOverflow, 1, sizeof(cl_mem), (void*)&a_rdir));
+      CHECK_CL(clSetKernelArg(kernOverflow, 2, sizeof(cl_mem), (void*)&bvhBuff));
+      CHECK_CL(clSetKernelArg(kernOverflow, 3, sizeof(cl_mem), (void*)&triBuff));
+      CHECK_CL(clSetKernelArg(kernOverflow, 4, sizeof(cl_mem), (void*)&m_rays.traceOverflow));
+      CHECK_CL(clSetKernelArg(kernOverflow, 5, sizeof(cl_mem), (void*)&a_hits));
+      CHECK_CL(clSetKernelArg(kernOverflow, 6, sizeof(cl_int), (void*)&isize));
 
-      CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernTrace, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+      CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernOverflow, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
       waitIfDebug(__FILE__, __LINE__);
-      
     }
+  }
+}
+
+bool GPUOCLLayer::RayReorderEnabled(size_t a_size) const
+{
+  const bool powerOfTwo = (a_size != 0) && ((a_size & (a_size - 1)) == 0); // bitonic sort limitation
+  return (m_initFlags & GPU_RT_RAY_REORDER) && (a_size == m_rays.MEGABLOCKSIZE) && powerOfTwo && (m_scene.bvhNumber > 0);
+}
+
+void GPUOCLLayer::CL_RAY_REORDER::free()
+{
+  if (index)    { clReleaseMemObject(index);    index    = nullptr; }
+  if (rayPos)   { clReleaseMemObject(rayPos);   rayPos   = nullptr; }
+  if (rayDir)   { clReleaseMemObject(rayDir);   rayDir   = nullptr; }
+  if (rayFlags) { clReleaseMemObject(rayFlags); rayFlags = nullptr; }
+  if (hits)     { clReleaseMemObject(hits);     hits     = nullptr; }
+  if (gens)     { clReleaseMemObject(gens);     gens     = nullptr; }
+  size = 0;
+}
+
+void GPUOCLLayer::RayReorder_Alloc()
+{
+  const size_t size = m_rays.MEGABLOCKSIZE;
+  if (m_reorder.size == size && m_reorder.index != nullptr)
+    return;
 
+  m_reorder.free();
+
+  cl_int ciErr1 = CL_SUCCESS, ciErr2 = CL_SUCCESS, ciErr3 = CL_SUCCESS, ciErr4 = CL_SUCCESS, ciErr5 = CL_SUCCESS, ciErr6 = CL_SUCCESS;
+
+  m_reorder.index    = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 2*sizeof(int)*size,     NULL, &ciErr1);
+  m_reorder.rayPos   = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(float4)*size,    NULL, &ciErr2);
+  m_reorder.rayDir   = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(float4)*size,    NULL, &ciErr3);
+  m_reorder.rayFlags = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(uint)*size,      NULL, &ciErr4);
+  m_reorder.hits     = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(Lite_Hit)*size,  NULL, &ciErr5);
+  m_reorder.gens     = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(RandomGen)*size, NULL, &ciErr6);
+
+  if (ciErr1 != CL_SUCCESS || ciErr2 != CL_SUCCESS || ciErr3 != CL_SUCCESS || ciErr4 != CL_SUCCESS || ciErr5 != CL_SUCCESS || ciErr6 != CL_SUCCESS)
+    RUN_TIME_ERROR("[cl_core]: Failed to create ray reorder buffers ");
+
+  m_reorder.size = size;
+}
+
+/**
+\brief Trace incoherent rays in sorted order: (1) make (key, rayId) pairs from direction octant and origin Morton code;
+       (2) sort them; (3) gather rays; (4) trace all trees; (5) scatter hits back to the original ray order. 
+       Inactive rays go to the end of sorted array, so dead threads are packed together too.
+       If a_measure is set, time of all steps except (4) is stored in m_stat.reorderTimeMs; traversalTimeMs still includes it.
+*/
+void GPUOCLLayer::runKernel_TraceReordered(cl_mem a_rpos, cl_mem a_rdir, size_t a_size,
+                                           cl_mem a_hits, bool a_measure)
+{
+  RayReorder_Alloc();
+
+  Timer reorderTimer(false);
+  if (a_measure)
+  {
+    clFinish(m_globals.cmdQueue);
+    reorderTimer.start();
   }
 
+  bool needGens = false;                                                        // only stochastic opacity kernel changes random generator state
+  for (int runId = 0; runId < m_scene.bvhNumber; runId++)
+    needGens = needGens || (m_scene.alphTstBuff[runId] != nullptr && m_bvhTrees[runId].smoothOpacity && ((m_vars.m_flags & HRT_ENABLE_MMLT) == 0));
+
+  cl_mem gensIn  = needGens ? m_rays.randGenState : nullptr;
+  cl_mem gensOut = needGens ? m_reorder.gens      : nullptr;
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  size_t globalSize    = roundBlocks(a_size, int(localWorkSize));
+
+  const float3 boxSize    = m_scene.bvhBoxMax - m_scene.bvhBoxMin;
+  const float4 boxMin     = to_float4(m_scene.bvhBoxMin, 0.0f);
+  const float4 boxInvSize = float4(1.0f/fmaxf(boxSize.x, 1e-6f), 1.0f/fmaxf(boxSize.y, 1e-6f), 1.0f/fmaxf(boxSize.z, 1e-6f), 0.0f);
+
+  // (1) make keys
+  //
+  cl_kernel kernKeys = m_progs.trace.kernel("MakeRayReorderKeys");
+
+  CHECK_CL(clSetKernelArg(kernKeys, 0, sizeof(cl_mem),    (void*)&a_rpos));
+  CHECK_CL(clSetKernelArg(kernKeys, 1, sizeof(cl_mem),    (void*)&a_rdir));
+  CHECK_CL(clSetKernelArg(kernKeys, 2, sizeof(cl_mem),    (void*)&m_rays.rayFlags));
+  CHECK_CL(clSetKernelArg(kernKeys, 3, sizeof(cl_mem),    (void*)&m_reorder.index));
+  CHECK_CL(clSetKernelArg(kernKeys, 4, sizeof(cl_float4), (void*)&boxMin));
+  CHECK_CL(clSetKernelArg(kernKeys, 5, sizeof(cl_float4), (void*)&boxInvSize));
+  CHECK_CL(clSetKernelArg(kernKeys, 6, sizeof(cl_int),    (void*)&isize));
+  CHECK_CL(clSetKernelArg(kernKeys, 7, sizeof(cl_int),    (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernKeys, 1, NULL, &globalSize, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  // (2) sort them
+  //
+  BitonicCLArgs sortArgs;
+  sortArgs.bitonicPassK = m_progs.sort.kernel("bitonic_pass_kernel");
+  sortArgs.bitonic512   = m_progs.sort.kernel("bitonic_512");
+  sortArgs.bitonic1024  = m_progs.sort.kernel("bitonic_1024");
+  sortArgs.bitonic2048  = m_progs.sort.kernel("bitonic_2048");
+  sortArgs.cmdQueue     = m_globals.cmdQueue;
+  sortArgs.dev          = m_globals.device;
+
+  bitonic_sort_gpu(m_reorder.index, isize, sortArgs);
+
+  // (3) gather rays
+  //
+  cl_kernel kernGather = m_progs.trace.kernel("ReorderRaysByIndex");
+
+  CHECK_CL(clSetKernelArg(kernGather, 0, sizeof(cl_mem), (void*)&m_reorder.index));
+  CHECK_CL(clSetKernelArg(kernGather, 1, sizeof(cl_mem), (void*)&a_rpos));
+  CHECK_CL(clSetKernelArg(kernGather, 2, sizeof(cl_mem), (void*)&a_rdir));
+  CHECK_CL(clSetKernelArg(kernGather, 3, sizeof(cl_mem), (void*)&m_rays.rayFlags));
+  CHECK_CL(clSetKernelArg(kernGather, 4, sizeof(cl_mem), (void*)&gensIn));
+  CHECK_CL(clSetKernelArg(kernGather, 5, sizeof(cl_mem), (void*)&m_reorder.rayPos));
+  CHECK_CL(clSetKernelArg(kernGather, 6, sizeof(cl_mem), (void*)&m_reorder.rayDir));
+  CHECK_CL(clSetKernelArg(kernGather, 7, sizeof(cl_mem), (void*)&m_reorder.rayFlags));
+  CHECK_CL(clSetKernelArg(kernGather, 8, sizeof(cl_mem), (void*)&gensOut));
+  CHECK_CL(clSetKernelArg(kernGather, 9, sizeof(cl_int), (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernGather, 1, NULL, &globalSize, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  if (a_measure)
+  {
+    clFinish(m_globals.cmdQueue);
+    m_stat.reorderTimeMs = reorderTimer.getElapsed()*1000.0f;
+  }
+
+  // (4) trace
+  //
+  runKernel_TraceBVH(m_reorder.rayPos, m_reorder.rayDir, m_reorder.rayFlags, m_reorder.gens, a_size,
+                     m_reorder.hits);
+
+  if (a_measure)
+  {
+    clFinish(m_globals.cmdQueue);
+    reorderTimer.start();
+  }
+
+  // (5) scatter hits
+  //
+  cl_kernel kernScatter = m_progs.trace.kernel("UnorderHitsByIndex");
+
+  CHECK_CL(clSetKernelArg(kernScatter, 0, sizeof(cl_mem), (void*)&m_reorder.index));
+  CHECK_CL(clSetKernelArg(kernScatter, 1, sizeof(cl_mem), (void*)&m_reorder.hits));
+  CHECK_CL(clSetKernelArg(kernScatter, 2, sizeof(cl_mem), (void*)&gensOut));
+  CHECK_CL(clSetKernelArg(kernScatter, 3, sizeof(cl_mem), (void*)&a_hits));
+  CHECK_CL(clSetKernelArg(kernScatter, 4, sizeof(cl_mem), (void*)&gensIn));
+  CHECK_CL(clSetKernelArg(kernScatter, 5, sizeof(cl_int), (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernScatter, 1, NULL, &globalSize, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  if (a_measure)
+  {
+    clFinish(m_globals.cmdQueue);
+    m_stat.reorderTimeMs += reorderTimer.getElapsed()*1000.0f;
+  }
 }
 
 void GPUOCLLayer::runKernel_ComputeAO(cl_mem outCompressedAO, size_t a_size)
@@ -1072,6 +1299,133 @@ void GPUOCLLayer::ShadePass(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_outColor, siz
 
 }
 
+void GPUOCLLayer::runKernel_MakeEyeRaysPerPixel(int a_width, int a_height,
+                                                cl_mem out_rpos, cl_mem out_rdir, cl_mem out_packXY)
+{
+  cl_kernel kernX = m_progs.screen.kernel("MakeEyeRaysPerPixel");
+
+  size_t localWorkSize = 256;
+  size_t a_size        = roundBlocks(size_t(a_width*a_height), int(localWorkSize));
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&out_rpos));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_mem), (void*)&out_rdir));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_mem), (void*)&out_packXY));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_mem), (void*)&m_rays.randGenState));
+  CHECK_CL(clSetKernelArg(kernX, 4, sizeof(cl_int), (void*)&a_width));
+  CHECK_CL(clSetKernelArg(kernX, 5, sizeof(cl_int), (void*)&a_height));
+  CHECK_CL(clSetKernelArg(kernX, 6, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
+void GPUOCLLayer::runKernel_DLReservoirsInitial(cl_mem a_rpos, cl_mem a_rdir, cl_mem in_resPrev, size_t a_size,
+                                                cl_mem a_gbuffer, cl_mem out_res)
+{
+  cl_kernel kernX = m_progs.material.kernel("DLReservoirsInitial");
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  cl_int candidates = cl_int(m_vars.m_varsI[HRT_DLRES_CANDIDATES]);
+  cl_int maxHistory = cl_int(m_vars.m_varsI[HRT_DLRES_TEMPORAL_MAX]);
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&a_rpos));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_mem), (void*)&a_rdir));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_mem), (void*)&m_rays.rayFlags));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_mem), (void*)&m_rays.hitSurfaceAll));
+  CHECK_CL(clSetKernelArg(kernX, 4, sizeof(cl_mem), (void*)&m_rays.hitProcTexData));
+  CHECK_CL(clSetKernelArg(kernX, 5, sizeof(cl_mem), (void*)&m_rays.randGenState));
+
+  CHECK_CL(clSetKernelArg(kernX, 6, sizeof(cl_mem), (void*)&in_resPrev));
+  CHECK_CL(clSetKernelArg(kernX, 7, sizeof(cl_mem), (void*)&a_gbuffer));
+  CHECK_CL(clSetKernelArg(kernX, 8, sizeof(cl_mem), (void*)&out_res));
+
+  CHECK_CL(clSetKernelArg(kernX, 9,  sizeof(cl_mem), (void*)&m_scene.storageTex));
+  CHECK_CL(clSetKernelArg(kernX, 10, sizeof(cl_mem), (void*)&m_scene.storageTexAux));
+  CHECK_CL(clSetKernelArg(kernX, 11, sizeof(cl_mem), (void*)&m_scene.storageMat));
+  CHECK_CL(clSetKernelArg(kernX, 12, sizeof(cl_mem), (void*)&m_scene.storagePdfs));
+  CHECK_CL(clSetKernelArg(kernX, 13, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+
+  CHECK_CL(clSetKernelArg(kernX, 14, sizeof(cl_int), (void*)&candidates));
+  CHECK_CL(clSetKernelArg(kernX, 15, sizeof(cl_int), (void*)&maxHistory));
+  CHECK_CL(clSetKernelArg(kernX, 16, sizeof(cl_int), (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
+void GPUOCLLayer::runKernel_DLReservoirsSpatial(cl_mem a_rpos, cl_mem a_rdir, cl_mem in_res, int a_width, int a_height, size_t a_size,
+                                                cl_mem out_res, cl_mem out_srpos, cl_mem out_srdir)
+{
+  cl_kernel kernX = m_progs.material.kernel("DLReservoirsSpatial");
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  cl_int   taps   = cl_int(m_vars.m_varsI[HRT_DLRES_SPATIAL_TAPS]);
+  cl_float radius = cl_float(m_vars.m_varsF[HRT_DLRES_SPATIAL_RADIUS]);
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&a_rpos));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_mem), (void*)&a_rdir));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_mem), (void*)&m_rays.rayFlags));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_mem), (void*)&m_rays.hitSurfaceAll));
+  CHECK_CL(clSetKernelArg(kernX, 4, sizeof(cl_mem), (void*)&m_rays.hitProcTexData));
+  CHECK_CL(clSetKernelArg(kernX, 5, sizeof(cl_mem), (void*)&m_rays.randGenState));
+
+  CHECK_CL(clSetKernelArg(kernX, 6, sizeof(cl_mem), (void*)&m_dlres.gbuffer));
+  CHECK_CL(clSetKernelArg(kernX, 7, sizeof(cl_mem), (void*)&in_res));
+  CHECK_CL(clSetKernelArg(kernX, 8, sizeof(cl_mem), (void*)&out_res));
+
+  CHECK_CL(clSetKernelArg(kernX, 9,  sizeof(cl_mem), (void*)&out_srpos));
+  CHECK_CL(clSetKernelArg(kernX, 10, sizeof(cl_mem), (void*)&out_srdir));
+
+  CHECK_CL(clSetKernelArg(kernX, 11, sizeof(cl_mem), (void*)&m_scene.storageTex));
+  CHECK_CL(clSetKernelArg(kernX, 12, sizeof(cl_mem), (void*)&m_scene.storageTexAux));
+  CHECK_CL(clSetKernelArg(kernX, 13, sizeof(cl_mem), (void*)&m_scene.storageMat));
+  CHECK_CL(clSetKernelArg(kernX, 14, sizeof(cl_mem), (void*)&m_scene.storagePdfs));
+  CHECK_CL(clSetKernelArg(kernX, 15, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+
+  CHECK_CL(clSetKernelArg(kernX, 16, sizeof(cl_int),   (void*)&taps));
+  CHECK_CL(clSetKernelArg(kernX, 17, sizeof(cl_float), (void*)&radius));
+  CHECK_CL(clSetKernelArg(kernX, 18, sizeof(cl_int),   (void*)&a_width));
+  CHECK_CL(clSetKernelArg(kernX, 19, sizeof(cl_int),   (void*)&a_height));
+  CHECK_CL(clSetKernelArg(kernX, 20, sizeof(cl_int),   (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
+void GPUOCLLayer::runKernel_DLReservoirsShade(cl_mem a_rdir, cl_mem in_res, cl_mem in_shadow, size_t a_size,
+                                              cl_mem a_outColor)
+{
+  cl_kernel kernX = m_progs.material.kernel("DLReservoirsShade");
+
+  size_t localWorkSize = 256;
+  int    isize         = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&a_rdir));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_mem), (void*)&m_rays.rayFlags));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_mem), (void*)&m_rays.hitSurfaceAll));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_mem), (void*)&m_rays.hitProcTexData));
+  CHECK_CL(clSetKernelArg(kernX, 4, sizeof(cl_mem), (void*)&in_res));
+  CHECK_CL(clSetKernelArg(kernX, 5, sizeof(cl_mem), (void*)&in_shadow));
+  CHECK_CL(clSetKernelArg(kernX, 6, sizeof(cl_mem), (void*)&a_outColor));
+
+  CHECK_CL(clSetKernelArg(kernX, 7,  sizeof(cl_mem), (void*)&m_scene.storageTex));
+  CHECK_CL(clSetKernelArg(kernX, 8,  sizeof(cl_mem), (void*)&m_scene.storageTexAux));
+  CHECK_CL(clSetKernelArg(kernX, 9,  sizeof(cl_mem), (void*)&m_scene.storageMat));
+  CHECK_CL(clSetKernelArg(kernX, 10, sizeof(cl_mem), (void*)&m_scene.storagePdfs));
+  CHECK_CL(clSetKernelArg(kernX, 11, sizeof(cl_mem), (void*)&m_scene.allGlobsData));
+  CHECK_CL(clSetKernelArg(kernX, 12, sizeof(cl_int), (void*)&isize));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
 void GPUOCLLayer::runKernel_EyeShadowRays(cl_mem a_rayFlags, cl_mem a_rdir2,
                                           cl_mem a_rpos,     cl_mem a_rdir, size_t a_size)
 {
@@ -5,6 +5,7 @@
 #include "../../HydraAPI/hydra_api/ssemath.h"
 
 #include "cl_scan_gpu.h"
+#include "CPUImageOutput.h"
 
 extern "C" void initQuasirandomGenerator(unsigned int table[QRNG_DIMENSIONS][QRNG_RESOLUTION]);
 
@@ -73,6 +74,7 @@ void GPUOCLLayer::CL_BUFFERS_RAYS::free()
   if (debugf4)         { clReleaseMemObject(debugf4);    debugf4    = nullptr; }
 
   if(atomicCounterMem) { clReleaseMemObject(atomicCounterMem); atomicCounterMem = nullptr;}
+  if(traceOverflow)    { clReleaseMemObject(traceOverflow);    traceOverflow    = nullptr;}
 }
 
 size_t GPUOCLLayer::CL_BUFFERS_RAYS::resize(cl_context ctx, cl_command_queue cmdQueue, size_t a_size, bool a_cpuShare, bool a_cpuFB)
@@ -163,6 +165,7 @@ size_t GPUOCLLayer::CL_BUFFERS_RAYS::resize(cl_context ctx, cl_command_queue cmd
   samZindex       = clCreateBuffer(ctx, CL_MEM_READ_WRITE, 2*sizeof(int)*MEGABLOCKSIZE, NULL, &ciErr1); currSize += buff1Size * 2;
   packedXY        = clCreateBuffer(ctx, CL_MEM_READ_WRITE, 1*sizeof(int)*MEGABLOCKSIZE, NULL, &ciErr1); currSize += buff1Size * 1;
   lightOffsetBuff = clCreateBuffer(ctx, CL_MEM_READ_WRITE, 1*sizeof(int)*MEGABLOCKSIZE, NULL, &ciErr1); currSize += buff1Size * 1;
+  traceOverflow   = clCreateBuffer(ctx, CL_MEM_READ_WRITE, 1*sizeof(int)*(MEGABLOCKSIZE+1), NULL, &ciErr1); currSize += buff1Size * 1;
 
   if (ciErr1 != CL_SUCCESS)
     RUN_TIME_ERROR("Error in resize rays buffers");
@@ -617,7 +620,7 @@ GPUOCLLayer::GPUOCLLayer(int w, int h, int a_flags, int a_deviceId) : Base(w, h,
     devHash += "0";
 
   std::string sshaderpathBin  = installPath2 + "shadercache/" + "screen_" + devHash + ".bin";
-  std::string tshaderpathBin  = installPath2 + "shadercache/" + "tracex_" + devHash + ".bin";
+  std::string tshaderpathBin  = installPath2 + "shadercache/" + ((a_flags & GPU_RT_SHORT_STACK_TRAVERSAL) ? "traces_" : "tracex_") + devHash + ".bin";
   std::string soshaderpathBin = installPath2 + "shadercache/" + "sortxx_" + devHash + ".bin";
   std::string ioshaderpathBin = installPath2 + "shadercache/" + "imagex_" + devHash + ".bin";
   std::string moshaderpathBin = installPath2 + "shadercache/" + "mltxxx_" + devHash + ".bin";
@@ -667,6 +670,17 @@ GPUOCLLayer::GPUOCLLayer(int w, int h, int a_flags, int a_deviceId) : Base(w, h,
 
   std::cout << "[cl_core]: build cl programs complete" << std::endl << std::endl;
 
+  // private memory of closest hit traversal limits occupancy; compare with and without GPU_RT_SHORT_STACK_TRAVERSAL together with '[stat]: MRays/sec'
+  //
+  {
+    cl_kernel traceKern = m_progs.trace.kernel("BVH4TraversalInstKernel");
+    cl_ulong  privMem   = 0;
+    size_t    wgSize    = 0;
+    clGetKernelWorkGroupInfo(traceKern, m_globals.device, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(privMem), &privMem, NULL);
+    clGetKernelWorkGroupInfo(traceKern, m_globals.device, CL_KERNEL_WORK_GROUP_SIZE,  sizeof(wgSize),  &wgSize,  NULL);
+    std::cout << "[cl_core]: trace kernel (" << ((m_initFlags & GPU_RT_SHORT_STACK_TRAVERSAL) ? "short stack" : "full stack") << "): private mem = " << privMem << " bytes, max work group = " << wgSize << std::endl << std::endl;
+  }
+
   if (!inDevelopment)
   {
     if (!isFileExists(ioshaderpathBin))
@@ -720,6 +734,8 @@ GPUOCLLayer::GPUOCLLayer(int w, int h, int a_flags, int a_deviceId) : Base(w, h,
   m_sppDone       = 0.0f;
   m_sppContrib    = 0.0f;
   m_avgBrightness = 1.0f;
+  m_sharedSppPending[0] = 0.0f;
+  m_sharedSppPending[1] = 0.0f;
 }
 
 void GPUOCLLayer::RecompileProcTexShaders(const std::string& a_shaderPath)
@@ -755,10 +771,13 @@ void GPUOCLLayer::FinishAll()
 
 GPUOCLLayer::~GPUOCLLayer()
 {
+  m_checkpointWriter.Wait(); // may wait for reads from device buffers that are released below
   FinishAll();
   
   MLT_Free();
   kmlt.free();
+  m_dlres.free();
+  m_reorder.free();
   m_rays.free();
   m_screen.free();
   m_scene.free();
@@ -767,6 +786,7 @@ GPUOCLLayer::~GPUOCLLayer()
   if (m_globals.qmcTable)         { clReleaseMemObject(m_globals.qmcTable);          m_globals.qmcTable          = nullptr; }
   if (m_globals.hammersley2DGBuff){ clReleaseMemObject(m_globals.hammersley2DGBuff); m_globals.hammersley2DGBuff = nullptr; }
   if (m_globals.hammersley2D256)  { clReleaseMemObject(m_globals.hammersley2D256);   m_globals.hammersley2D256   = nullptr; }
+  if (m_globals.blueNoiseMask)    { clReleaseMemObject(m_globals.blueNoiseMask);     m_globals.blueNoiseMask     = nullptr; }
 
   if(m_globals.cmdQueue)          { clReleaseCommandQueue(m_globals.cmdQueue);          m_globals.cmdQueue          = nullptr; }
   if(m_globals.cmdQueueDevToHost) { clReleaseCommandQueue(m_globals.cmdQueueDevToHost); m_globals.cmdQueueDevToHost = nullptr; }
@@ -793,7 +813,10 @@ size_t GPUOCLLayer::CalcMegaBlockSize(int a_flags)
 
   if (a_flags & GPU_MLT_ENABLED_AT_START)
   {
-    MEGABLOCK_SIZE = 524288;
+    // with packed vector head a chain takes ~1460 bytes of device memory for depth 8 (ray buffers and MLT_Alloc), 
+    // so 1M chains (~1.5 GB) are used on devices with 8 GB or more. Chains number must stay power of 2 for bitonic sort. 
+    //
+    MEGABLOCK_SIZE = (memAmount >= size_t(8*1024)*MB) ? 1024*1024 : 524288;
     if (a_flags & GPU_MMLT_THREADS_262K)
       MEGABLOCK_SIZE = 262144;
     else if (a_flags & GPU_MMLT_THREADS_131K)
@@ -822,6 +845,9 @@ std::string GPUOCLLayer::GetOCLShaderCompilerOptions()
   if (!m_globals.devIsCPU && !m_globals.liteCore)
     specDefines += " -D RAYTR_THREAD_COMPACTION ";
 
+  if (m_initFlags & GPU_RT_SHORT_STACK_TRAVERSAL)
+    specDefines += " -D BVH_SHORT_STACK ";
+
   std::string optionsGeneral = "-cl-mad-enable -cl-no-signed-zeros -cl-single-precision-constant -cl-denorms-are-zero "; // -cl-uniform-work-group-size 
   std::string optionsInclude = "-I ../hydra_drv -I " + HydraInstallPath() + "/shaders -D OCL_COMPILER ";             // put function that will find shader include folder
 
@@ -840,6 +866,8 @@ void GPUOCLLayer::ResizeScreen(int width, int height, int a_flags)
   Base::ResizeScreen(width, height, a_flags);
 
   m_screen.free();
+  m_dlres.free();
+  m_reorder.free();
 
   //
   //
@@ -983,7 +1011,8 @@ void GPUOCLLayer::GetLDRImage(uint* data, int width, int height) const
       return;
 
     int width2, height2;
-    const float4* color0 = GetCPUScreenBuffer(0, width2, height2);
+    std::vector<float4> indirect;
+    const float4* color0 = (m_vars.m_flags & HRT_ENABLE_MMLT) ? MMLT_IndirectImage(indirect) : GetCPUScreenBuffer(0, width2, height2);
     const float4* color1 = GetCPUScreenBuffer(1, width2, height2);
 
     float normConst   = 1.0f / m_spp; // 1.0f / float(m_passNumber - 1); // remember about pipelined copy!!
@@ -992,75 +1021,14 @@ void GPUOCLLayer::GetLDRImage(uint* data, int width, int height) const
     if (m_vars.m_flags & HRT_ENABLE_MMLT && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0)  
       normConst = EstimateMLTNormConst(color0, width, height);
 
-    if (!HydraSSE::g_useSSE)
-    {
-      #pragma omp parallel for
-      for (int i = 0; i < size; i++)  // #TODO: use sse and fast pow
-      {
-        float4 color = color0[i];
-        color.x = powf(color.x*normConst, gammaInv);
-        color.y = powf(color.y*normConst, gammaInv);
-        color.z = powf(color.z*normConst, gammaInv);
-        color.w = powf(color.w*normConst, gammaInv);
-        data[i] = RealColorToUint32(ToneMapping4(color));
-      }
-    }
+    const bool addDirectLayer = (m_vars.m_flags & HRT_ENABLE_MMLT) && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0 && color1 != nullptr;
+
+    if (color0 != nullptr)
+      HDRImageToLDR(color0, normConst, addDirectLayer ? color1 : nullptr, normConstDL, size, gammaInv, data);
     else
     {
-      const __m128 powerf4   = _mm_set_ps(gammaInv, gammaInv, gammaInv, gammaInv);
-      const __m128 normc     = _mm_set_ps(normConst, normConst, normConst, normConst);
-      const __m128 normc2    = _mm_set_ps(normConstDL, normConstDL, normConstDL, normConstDL);
-      const __m128 const_255 = _mm_set_ps1(255.0f);
-
-      const float* dataHDR  = (const float*)color0;
-      const float* dataHDR1 = (const float*)color1;
-
-      if (m_vars.m_flags & HRT_ENABLE_MMLT && (m_vars.m_flags & HRT_ENABLE_SBPT) == 0)
-      {
-        if (color1 != nullptr && color0 != nullptr)
-        {
-
-          #pragma omp parallel for
-          for (int i = 0; i < size; i++)
-          {
-            const __m128 colorDL = _mm_mul_ps(normc2, _mm_load_ps(dataHDR1 + i * 4));
-            const __m128 colorIL = _mm_mul_ps(normc, _mm_load_ps(dataHDR + i * 4));
-            const __m128 color2  = HydraSSE::powf4(_mm_add_ps(colorDL, colorIL), powerf4);
-            const __m128i rgba   = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(color2, const_255), const_255));
-            const __m128i out    = _mm_packus_epi32(rgba, _mm_setzero_si128());
-            const __m128i out2   = _mm_packus_epi16(out, _mm_setzero_si128());
-            data[i] = _mm_cvtsi128_si32(out2);
-          }
-
-        }
-        else if (color0 != nullptr)
-        {
-          #pragma omp parallel for
-          for (int i = 0; i < size; i++)
-          {
-            data[i] = HydraSSE::gammaCorr(dataHDR + i * 4, normc, powerf4);
-          }
-        }
-        else
-        {
-          std::cerr << "GPUOCLLayer::GetLDRImage(HRT_ENABLE_MMLT): both internal CPU images == nullptr!!!" << std::endl;
-          std::cerr.flush();
-        }
-
-        //#pragma omp parallel for
-        //for (int i = 0; i < size; i++)
-        //{
-        //  data[i] = HydraSSE::gammaCorr(dataHDR1 + i*4, normc2, powerf4);
-        //}
-      }
-      else
-      {
-        #pragma omp parallel for
-        for (int i = 0; i < size; i++)
-        {
-          data[i] = HydraSSE::gammaCorr(dataHDR + i * 4, normc, powerf4);
-        }
-      }
+      std::cerr << "GPUOCLLayer::GetLDRImage: internal CPU image == nullptr!!!" << std::endl;
+      std::cerr.flush();
     }
   }
   else
@@ -1069,19 +1037,8 @@ void GPUOCLLayer::GetLDRImage(uint* data, int width, int height) const
     {
       std::cerr << "[cl_core]: null m_screen.pbo, alloc temp buffer in host memory " << std::endl;
       std::vector<float4> hdrData(width*height);
-      GetHDRImage(&hdrData[0], width, height);
-
-      #pragma omp parallel for
-      for (int i = 0; i < size; i++)  // #TODO: use sse and fast pow
-      {
-        float4 color = hdrData[i];
-        color.x = powf(color.x, gammaInv);
-        color.y = powf(color.y, gammaInv);
-        color.z = powf(color.z, gammaInv);
-        color.w = powf(color.w, gammaInv);
-        data[i] = RealColorToUint32(ToneMapping4(color));
-      }
-      
+      CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_screen.color0, CL_TRUE, 0, size * sizeof(cl_float4), hdrData.data(), 0, NULL, NULL));
+      HDRImageToLDR(hdrData.data(), 1.0f/fmax(m_spp, 1e-5f), nullptr, 0.0f, size, gammaInv, data);
     }
     else
     {
@@ -1112,17 +1069,30 @@ void GPUOCLLayer::GetHDRImage(float4* data, int width, int height) const
 
   if (m_screen.m_cpuFrameBuffer)
   {
+    std::vector<float4> indirect;
+    const float4* color0 = (m_vars.m_flags & HRT_ENABLE_MMLT) ? MMLT_IndirectImage(indirect) : m_screen.color0CPU.data();
+
     if (m_vars.m_flags & HRT_ENABLE_MMLT)  
-      normConst = EstimateMLTNormConst(m_screen.color0CPU.data(), width, height);
+      normConst = EstimateMLTNormConst(color0, width, height);
 
-    for (size_t i = 0; i < (width*height); i++)
-      data[i] = m_screen.color0CPU[i] * normConst;
+    #pragma omp parallel for
+    for (int i = 0; i < (width*height); i++)
+      data[i] = color0[i] * normConst;
   }
   else if(m_screen.color0 != nullptr)
   {
-    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_screen.color0, CL_TRUE, 0, m_width*m_height * sizeof(cl_float4), data, 0, NULL, NULL));
-    for (size_t i = 0; i < (width*height); i++)
-      data[i] = data[i] * normConst;
+    const int4   crop   = m_vars.CropWindow(m_width, m_height); // rows outside crop window are never rendered, don't copy them
+    const size_t offset = size_t(crop.y)*size_t(m_width);
+    const int    size   = (crop.w - crop.y)*m_width;
+
+    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_screen.color0, CL_TRUE, offset * sizeof(cl_float4), size * sizeof(cl_float4), data + offset, 0, NULL, NULL));
+    
+    std::fill(data, data + offset, float4(0,0,0,0));                                 // but caller expects the whole frame, as with device color0 which is zero there
+    std::fill(data + offset + size, data + size_t(width)*size_t(height), float4(0,0,0,0));
+
+    #pragma omp parallel for
+    for (int i = 0; i < size; i++)
+      data[offset + i] = data[offset + i] * normConst;
   }
 }
 
@@ -1136,6 +1106,8 @@ void GPUOCLLayer::InitPathTracing(int seed)
   m_spp        = 0.0f;
   m_sppDone    = 0.0f;
   m_sppContrib = 0.0f;
+  m_sharedSppPending[0] = 0.0f;
+  m_sharedSppPending[1] = 0.0f;
   m_passNumberForQMC = 0;
 
   ClearAccumulatedColor();
@@ -1148,8 +1120,13 @@ void GPUOCLLayer::ClearAccumulatedColor()
   else if(m_screen.color0 != nullptr)
     memsetf4(m_screen.color0, make_float4(0, 0, 0, 0.0f), m_width*m_height); // #TODO: change this for 2D memset to support large resolutions!!!!
 
-  m_mlt.mppDone = 0.0;
-  m_spp         = 0.0f;
+  if (m_mlt.colorDevice != nullptr)
+    memsetf4(m_mlt.colorDevice, make_float4(0, 0, 0, 0.0f), m_width*m_height);
+  m_mlt.passesNotFlushed = 0;
+
+  m_mlt.mppDone       = 0.0;
+  m_spp               = 0.0f;
+  m_dlres.haveHistory = false;
 }
 
 MRaysStat GPUOCLLayer::GetRaysStat()
@@ -1203,6 +1180,12 @@ void GPUOCLLayer::BeginTracingPass()
   //m_vars.m_flags |= HRT_ENABLE_PT_CAUSTICS;
   //UpdateVarsOnGPU(m_vars);
 
+  if ((m_vars.m_flags & HRT_ENABLE_DL_RESERVOIRS) && size_t(m_width*m_height) > m_rays.MEGABLOCKSIZE)
+  {
+    std::cerr << "[cl_core]: dl_reservoirs need one thread per pixel, screen is larger than MEGABLOCKSIZE; fall back to PT" << std::endl;
+    m_vars.m_flags &= (~HRT_ENABLE_DL_RESERVOIRS);
+  }
+
   if((m_vars.m_flags & HRT_ENABLE_SBPT) != 0)
   {
     #ifdef SBDPT_INDIRECT_ONLY
@@ -1245,6 +1228,10 @@ void GPUOCLLayer::BeginTracingPass()
     //{ 
     //  KMLT_Pass(NUM_MMLT_PASS, minBounce, maxBounce, 128); // BURN_ITERS
     //}
+    else if (DLReservoirsEnabled())                     // direct light preview with reservoir resampling
+    {
+      DLReservoirs_Pass();
+    }
     else                                                // PT 
     { 
       //m_vars.m_flags |= HRT_INDIRECT_LIGHT_MODE; // for test
@@ -1259,6 +1246,11 @@ void GPUOCLLayer::BeginTracingPass()
         runKernel_MakeEyeRaysQMC(m_rays.MEGABLOCKSIZE, m_passNumberForQMC,
                                  m_rays.samZindex, kmlt.xVectorQMC);
       }
+      else if(m_vars.m_flags & HRT_ENABLE_BLUE_NOISE)
+      {
+        runKernel_MakeEyeSamplesBlueNoise(m_rays.MEGABLOCKSIZE, m_passNumberForQMC,
+                                          m_rays.samZindex, kmlt.xVectorQMC);
+      }
       else
       {
         runKernel_MakeEyeSamplesOnly(m_rays.MEGABLOCKSIZE, m_passNumberForQMC,
@@ -1290,7 +1282,13 @@ void GPUOCLLayer::EndTracingPass()
   if (m_vars.m_flags & HRT_UNIFIED_IMAGE_SAMPLING)
   {
     const float passScale = (m_vars.m_flags & HRT_ENABLE_MMLT) ? float(NUM_MMLT_PASS) : 1.0f;
-    m_spp += passScale*float(double(m_rays.MEGABLOCKSIZE) / double(m_width*m_height));
+    if (DLReservoirsEnabled())
+      m_spp += 1.0f;
+    else
+    {
+      const int4 crop = m_vars.CropWindow(m_width, m_height); // all samples of the pass are inside crop window
+      m_spp += passScale*float(double(m_rays.MEGABLOCKSIZE) / double((crop.z - crop.x)*(crop.w - crop.y)));
+    }
 
     const float time = m_timer.getElapsed();
     if (m_passNumberForQMC % 4 == 0 && m_passNumberForQMC > 0)
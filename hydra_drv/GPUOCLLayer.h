@@ -79,6 +79,9 @@ public:
   void ResizeScreen(int w, int h, int a_flags);
 
   void ContribToExternalImageAccumulator(IHRSharedAccumImage* a_pImage);
+  bool    ContribToSharedImage(IHRSharedAccumImage* a_pImage, int a_layerId, float4* a_color, float a_spp, int a_lockTime); ///< add to shared image layer under lock; a_color is cleared on success
+  float4* SharedImageStaging(int a_layerId);
+  void    FlushSharedImageStaging(int a_layerId, float a_spp, int a_lockTime);
 
   size_t GetAvaliableMemoryAmount(bool allMem);
   size_t GetMaxBufferSizeInBytes();
@@ -99,6 +102,9 @@ public:
   void SetNamedBuffer(const char* a_name, void* a_data, size_t a_size);
   void CallNamedFunc(const char* a_name, const char* a_args);
 
+  bool SaveCheckpoint(const char* a_fileName, uint64_t a_sceneHash) override;
+  bool LoadCheckpoint(const char* a_fileName, uint64_t a_sceneHash) override;
+
   bool StoreCPUData() const { return m_globals.cpuTrace; }
 
   bool   MLT_IsAllocated() const;               ///< return true if internal MLT data is allocated
@@ -141,8 +147,7 @@ protected:
   void AddContributionToScreenGPU(cl_mem in_color, cl_mem in_indices, int a_size, int a_width, int a_height, int a_spp, bool a_copyToLDRNow,
                                   cl_mem out_colorHDR, cl_mem out_colorLDR);
 
-  void AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a_width, int a_height, float4* out_color, bool repackIndex = true);
-  void AddContributionToScreenCPU2(cl_mem& in_color, cl_mem& in_color2, int a_size, int a_width, int a_height, float4* out_color);
+  void AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a_width, int a_height, float4* out_color, int a_layerId = 0, bool repackIndex = true);
 
   float EstimateMLTNormConst(const float4* data, int width, int height) const;
  
@@ -155,8 +160,13 @@ protected:
   */
   void AddContributionToScreen (cl_mem& in_color, cl_mem in_indices, bool a_copyToLDRNow = true, int a_layerId = 0, bool a_repackIndex = true);
 
+  /** \brief add one sample per pixel from in_color (in_color[y*w+x]) to screen buffer
+  */
+  void AddPerPixelContributionToScreen(cl_mem in_color);
+
   std::vector<uchar4> NormalMapFromDisplacement(int w, int h, const uchar4* a_data, float bumpAmt, bool invHeight, float smoothLvl);
   void Denoise(cl_mem textureIn, cl_mem textureOut, int w, int h, float smoothLvl);
+  void DenoiseHDR(float4* a_color, const float4* a_gbuffer1, int w, int h, int a_windowRadius, float a_strength) override;
 
   size_t CalcMegaBlockSize(int a_flags);
   std::string GetOCLShaderCompilerOptions();
@@ -180,6 +190,7 @@ protected:
   float m_sppDL;
   float m_sppDone;
   float m_sppContrib;
+  float m_sharedSppPending[2]; ///< spp of samples that are gathered in SharedImageStaging but not moved to shared image yet because it was locked
   float m_avgBrightness;
 
   struct CL_SCREEN_BUFFERS
@@ -210,8 +221,8 @@ protected:
   {
     CL_MLT_DATA() : rstateForAcceptReject(0), rstateCurr(0), rstateOld(0), rstateNew(0), dNew(0), dOld(0),
                     xVector(0), yVector(0), currVec(0), xColor(0), yColor(0), lightVertexSup(0), cameraVertexSup(0), cameraVertexHit(0), 
-                    pdfArray(0), pathAuxColor(0), pathAuxColorCPU(0), pathAuxColor2(0), pathAuxColorCPU2(0), yMultAlpha(0), xMultOneMinusAlpha(0), 
-                    splitData(0), scaleTable(0), scaleTable2(0), memTaken(0), mppDone(0.0), currBounceThreadsNum(0), lastBurnIters(0) {}
+                    pdfArray(0), yMultAlpha(0), xMultOneMinusAlpha(0), 
+                    splitData(0), scaleTable(0), scaleTable2(0), depthRanges(0), depthStat(0), colorDevice(0), passesNotFlushed(0), memTaken(0), mppDone(0.0), avgBrightnessSamples(0), currBounceThreadsNum(0), lastBurnIters(0), burnItersDone(0), burnBrightness(0.0) { depthStatEvents[0] = 0; depthStatEvents[1] = 0; }
 
     cl_mem rstateForAcceptReject; // sizeof(RandGen), MEGABLOCKSIZE size
     cl_mem rstateCurr;            // sizeof(RandGen), MEGABLOCKSIZE size; not allocated, assign m_rays.randGenState
@@ -234,17 +245,17 @@ protected:
     cl_mem cameraVertexHit;
     cl_mem pdfArray;
     
-    cl_mem pathAuxColor;
-    cl_mem pathAuxColorCPU;
-    cl_mem pathAuxColor2;
-    cl_mem pathAuxColorCPU2;
-
     cl_mem yMultAlpha;
     cl_mem xMultOneMinusAlpha;
 
     cl_mem splitData;
     cl_mem scaleTable;
     cl_mem scaleTable2;
+    cl_mem depthRanges;           ///< (offset, size) of chains of each depth, 256 int2
+    cl_mem depthStat;             ///< summ of brightness (first 256) and acceptance (last 256) over chains of each depth
+
+    cl_mem colorDevice;           ///< indirect light accumulated on device with atomic splatting, w*h float4; is copied to host only when image is requested
+    int    passesNotFlushed;      ///< passes splatted to colorDevice since last flush to shared image
 
     size_t memTaken;
 
@@ -254,14 +265,24 @@ protected:
     void free();
 
     std::vector<int>    perBounceActiveThreads;
-    std::vector<int>    perBounceThreads;
-    std::vector<double> avgBrightnessCPU;
+    std::vector<int>    perBounceThreads;       ///< chains per depth; chains are sorted by depth in descending order
+    std::vector<double> avgBrightnessCPU;       ///< measured average brightness of each depth 
+    std::vector<double> avgAcceptanceCPU;       ///< measured average acceptance probability of small steps for each depth 
+    std::vector<float>  scaleTableCPU;          ///< copy of scaleTable
+    std::vector<float>  scaleTable2CPU;         ///< copy of scaleTable2
     int                 avgBrightnessSamples;
     size_t currBounceThreadsNum;
 
     std::vector<float4, aligned16<float4> > colorDLCPU;
+    std::vector<int2>                       depthRangesCPU; ///< copy of depthRanges; must not change until MMLTUpdateDepthStat
+    std::vector<float>                      depthStatCPU;   ///< per depth summs of large step brightness and accepted small step contribution read back from depthStat
+    cl_event                                depthStatEvents[2]; ///< non blocking reads of depthStat; MMLTUpdateDepthStat waits for them
+
+    int    lastBurnIters;
+    int    burnItersDone;                       ///< burn-in is overlapped with rendering; it is in progress while burnItersDone < lastBurnIters
+    double burnBrightness;                      ///< summ of average brightness over done burn-in iterations
 
-    int lastBurnIters;
+    bool BurningIn() const { return burnItersDone < lastBurnIters; }
     
   } m_mlt;
 
@@ -301,13 +322,47 @@ protected:
 
   } kmlt;
 
+  struct CL_DL_RESERVOIRS
+  {
+    CL_DL_RESERVOIRS() : resTemporal(nullptr), resFinal(nullptr), gbuffer(nullptr), pixelsNum(0), haveHistory(false) { }
+
+    cl_mem resTemporal; ///< DLReservoir, 2*float4 per pixel; temporal pass output
+    cl_mem resFinal;    ///< DLReservoir, 2*float4 per pixel; spatial pass output and temporal pass history input
+    cl_mem gbuffer;     ///< packed GBuffer1 of previous frame, float4 per pixel
+
+    size_t pixelsNum;
+    bool   haveHistory;
+
+    std::vector<float4, aligned16<float4> > colorCPU;
+
+    void free();
+
+  } m_dlres;
+
+  struct CL_RAY_REORDER
+  {
+    CL_RAY_REORDER() : index(nullptr), rayPos(nullptr), rayDir(nullptr), rayFlags(nullptr), hits(nullptr), gens(nullptr), size(0) { }
+
+    cl_mem index;    ///< int2 (key, rayId), sorted by key
+    cl_mem rayPos;   ///< rays in sorted order
+    cl_mem rayDir;   ///< rays in sorted order
+    cl_mem rayFlags; ///< flags in sorted order
+    cl_mem hits;     ///< Lite_Hit in sorted order
+    cl_mem gens;     ///< RandomGen in sorted order; for stochastic opacity only
+
+    size_t size;
+
+    void free();
+
+  } m_reorder;
+
 
   struct CL_BUFFERS_RAYS
   {
     CL_BUFFERS_RAYS() : rayPos(0), rayDir(0), hits(0), rayFlags(0), hitSurfaceAll(0), hitProcTexData(0),
                         pathThoroughput(0), pathMisDataPrev(0), pathShadeColor(0), pathAccColor(0), pathAuxColor(0), pathAuxColorCPU(0), pathShadow8B(0), pathShadow8BAux(0), pathShadow8BAuxCPU(0), 
                         randGenState(0), lsamRev(0), shadowRayPos(0), shadowRayDir(0), accPdf(0), oldFlags(0), oldRayDir(0), oldColor(0),
-                        lshadow(0), shadowTemp1i(0), fogAtten(0), samZindex(0), aoCompressed(0), aoCompressed2(0), lightOffsetBuff(0), packedXY(0), debugf4(0), atomicCounterMem(0), MEGABLOCKSIZE(0) {}
+                        lshadow(0), shadowTemp1i(0), fogAtten(0), samZindex(0), aoCompressed(0), aoCompressed2(0), lightOffsetBuff(0), packedXY(0), debugf4(0), atomicCounterMem(0), traceOverflow(0), MEGABLOCKSIZE(0) {}
 
     void free();
     size_t resize(cl_context ctx, cl_command_queue cmdQueue, size_t a_size, bool a_cpuShare, bool a_cpuFB);
@@ -352,6 +407,7 @@ protected:
 
     cl_mem packedXY;
     cl_mem debugf4;
+    cl_mem traceOverflow; ///< (count, ray ids) of rays that are too deep for short stack traversal; 1 + MEGABLOCKSIZE ints
 
     cl_mem atomicCounterMem;
 
@@ -362,7 +418,7 @@ protected:
   struct CL_GLOBALS
   {
     CL_GLOBALS() : ctx(0), cmdQueue(0), cmdQueueDevToHost(0), platform(0), device(0), m_maxWorkGroupSize(0), oclVer(100), use1DTex(false), liteCore(false),
-                   cMortonTable(0), qmcTable(0), hammersley2DGBuff(0), hammersley2D256(0), devIsCPU(false), cpuTrace(false), m_passNumberQMC(0) {}
+                   cMortonTable(0), qmcTable(0), hammersley2DGBuff(0), hammersley2D256(0), blueNoiseMask(0), devIsCPU(false), cpuTrace(false), m_passNumberQMC(0) {}
 
     cl_context       ctx;               // OpenCL context
     cl_command_queue cmdQueue;          // OpenCL command que
@@ -374,6 +430,7 @@ protected:
     cl_mem qmcTable;                    // this is unrelated to previous. Table for Sobol/Niederreiter quasi random sequence.
     cl_mem hammersley2DGBuff;
     cl_mem hammersley2D256;
+    cl_mem blueNoiseMask;               // BLUE_NOISE_SIZE*BLUE_NOISE_SIZE floats, see initBlueNoiseMask
 
     size_t m_maxWorkGroupSize;
 
@@ -402,6 +459,8 @@ protected:
         bvhHaveInst[i] = false;
       }
       bvhNumber        = 0;
+      bvhBoxMin        = float3(0, 0, 0);
+      bvhBoxMax        = float3(0, 0, 0);
       remapListsSize   = 0;
       remapTableSize   = 0;
       remapInstSize    = 0;
@@ -421,6 +480,8 @@ protected:
     cl_mem alphTstBuff[MAXBVHTREES];
     bool   bvhHaveInst[MAXBVHTREES];
     int    bvhNumber;
+    float3 bvhBoxMin;   ///< scene bounds from root nodes of all trees; used for ray reordering keys
+    float3 bvhBoxMax;
 
     cl_mem matrices;
     cl_mem instLightInst;
@@ -478,6 +539,9 @@ protected:
 
   void runKernel_MakeEyeRaysQMC(size_t a_size, int a_passNumber,
                                 cl_mem a_zindex, cl_mem a_samples);
+
+  void runKernel_MakeEyeSamplesBlueNoise(size_t a_size, int a_passNumber,
+                                         cl_mem a_zindex, cl_mem a_samples);
                                     
   void runKernel_MakeRaysFromEyeSam(cl_mem a_zindex, cl_mem a_samples, size_t a_size, int a_passNumber,
                                     cl_mem a_rpos, cl_mem a_rdir);
@@ -494,7 +558,13 @@ protected:
   void runKernel_ClearAllInternalTempBuffers(size_t a_size);
  
   void runKernel_Trace(cl_mem a_rpos, cl_mem a_rdir, size_t a_size,
-                       cl_mem a_hits);
+                       cl_mem a_hits, int a_bounce = 0);
+
+  void runKernel_TraceBVH(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_flags, cl_mem a_gens, size_t a_size,
+                          cl_mem a_hits);
+
+  void runKernel_TraceReordered(cl_mem a_rpos, cl_mem a_rdir, size_t a_size,
+                                cl_mem a_hits, bool a_measure);
 
   void runKernel_ComputeHit(cl_mem a_rpos, cl_mem a_rdir, cl_mem a_hits, size_t a_size, size_t a_sizeRun,
                             cl_mem a_outSurfaceHit, cl_mem a_outProcTexData);
@@ -515,6 +585,16 @@ protected:
   void runKernel_ShadowTrace(cl_mem a_rayFlags, cl_mem a_rpos, cl_mem a_rdir, size_t a_size,
                              cl_mem a_outShadow);
 
+  void runKernel_MakeEyeRaysPerPixel(int a_width, int a_height,
+                                     cl_mem out_rpos, cl_mem out_rdir, cl_mem out_packXY);
+
+  void runKernel_DLReservoirsInitial(cl_mem a_rpos, cl_mem a_rdir, cl_mem in_resPrev, size_t a_size,
+                                     cl_mem a_gbuffer, cl_mem out_res);
+  void runKernel_DLReservoirsSpatial(cl_mem a_rpos, cl_mem a_rdir, cl_mem in_res, int a_width, int a_height, size_t a_size,
+                                     cl_mem out_res, cl_mem out_srpos, cl_mem out_srdir);
+  void runKernel_DLReservoirsShade(cl_mem a_rdir, cl_mem in_res, cl_mem in_shadow, size_t a_size,
+                                   cl_mem a_outColor);
+
   void runKernel_ShadowTraceAO(cl_mem a_rayFlags, cl_mem a_rpos, cl_mem a_rdir, cl_mem a_instId,
                                cl_mem a_outShadow, size_t a_size);
 
@@ -542,6 +622,12 @@ protected:
                                            cl_mem out_buff);
 
   void  DL_Pass(int a_maxBounce, int a_itersNum);
+  void  DLReservoirs_Pass();
+  void  DLReservoirs_Alloc();
+  bool  DLReservoirsEnabled() const;
+
+  bool  RayReorderEnabled(size_t a_size) const;
+  void  RayReorder_Alloc();
   void  MMLT_Pass(int a_passNumber, int minBounce, int maxBounce, int BURN_ITERS);
   void  KMLT_Pass(int a_passNumber, int minBounce, int maxBounce, int BURN_ITERS);
 
@@ -550,12 +636,21 @@ protected:
   float KMLT_BurningIn(int minBounce, int maxBounce, int BURN_ITERS,
                        cl_mem out_rstate);
 
-  float MMLT_BurningIn(int minBounce, int maxBounce, int BURN_ITERS,
-                       cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads);
+  void  MMLT_BurningInBegin(int minBounce, int maxBounce, int BURN_ITERS,
+                            cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads);
+  void  MMLT_BurningInStep(int minBounce, int maxBounce);
+  float MMLT_BurningInEnd(int minBounce, int maxBounce,
+                          cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads);
 
   void runKernel_AcceptReject(cl_mem a_xVector, cl_mem a_yVector, cl_mem a_xColor, cl_mem a_yColor, cl_mem a_scaleTable, cl_mem a_split,
                               cl_mem a_rstateForAcceptReject, int a_maxBounce, size_t a_size,
                               cl_mem xMultOneMinusAlpha, cl_mem yMultAlpha);
+
+  void runKernel_SplatSamplesAtomic(cl_mem in_color, size_t a_size, int a_width, int a_height,
+                                    cl_mem out_color, float a_mult = 1.0f);
+
+  void          MMLT_FlushSplats();
+  const float4* MMLT_IndirectImage(std::vector<float4>& a_temp) const;
   
   void runKernel_MMLTMakeStatesIndexToSort(cl_mem in_gens, cl_mem in_depth, size_t a_size,
                                           cl_mem out_index);
@@ -601,7 +696,10 @@ protected:
 
   void runKernel_DebugClearInt2WithTID(cl_mem index, size_t a_size);
 
-  void MMLTUpdateAverageBrightnessConstants(int minBounce, cl_mem in_color, size_t a_size);
+  void MMLTReadDepthStat(cl_mem in_color, int a_statId);
+  void MMLTUpdateDepthStat(int minBounce);
+  void MMLTRebalanceChains(int minBounce);
+  void MMLTWriteChainsLayout(int minBounce, const std::vector<int>& a_chainsPerDepth, std::vector<int>& out_activeThreads);
 
   void MMLTCheatThirdBounceContrib(cl_mem in_split, float a_multValue, size_t a_size,
                                    cl_mem a_contrib1f);
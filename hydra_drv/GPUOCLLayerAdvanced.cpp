@@ -105,6 +105,108 @@ void GPUOCLLayer::DL_Pass(int a_maxBounce, int a_itersNum)
   m_sppDL += float(a_itersNum*m_rays.MEGABLOCKSIZE)/float(m_width*m_height);
 }
 
+void GPUOCLLayer::CL_DL_RESERVOIRS::free()
+{
+  if (resTemporal) { clReleaseMemObject(resTemporal); resTemporal = nullptr; }
+  if (resFinal)    { clReleaseMemObject(resFinal);    resFinal    = nullptr; }
+  if (gbuffer)     { clReleaseMemObject(gbuffer);     gbuffer     = nullptr; }
+
+  colorCPU    = std::vector<float4, aligned16<float4> >();
+  pixelsNum   = 0;
+  haveHistory = false;
+}
+
+bool GPUOCLLayer::DLReservoirsEnabled() const
+{
+  return (m_vars.m_flags & HRT_ENABLE_DL_RESERVOIRS) && !(m_vars.m_flags & (HRT_ENABLE_MMLT | HRT_ENABLE_SBPT | HRT_PRODUCTION_IMAGE_SAMPLING)) && 
+         (size_t(m_width*m_height) <= m_rays.MEGABLOCKSIZE);
+}
+
+void GPUOCLLayer::DLReservoirs_Alloc()
+{
+  const size_t pixelsNum = size_t(m_width*m_height);
+  if (m_dlres.pixelsNum == pixelsNum && m_dlres.resFinal != nullptr)
+    return;
+
+  m_dlres.free();
+
+  cl_int ciErr1 = CL_SUCCESS, ciErr2 = CL_SUCCESS, ciErr3 = CL_SUCCESS;
+
+  m_dlres.resTemporal = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 2*sizeof(float4)*pixelsNum, NULL, &ciErr1);
+  m_dlres.resFinal    = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 2*sizeof(float4)*pixelsNum, NULL, &ciErr2);
+  m_dlres.gbuffer     = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 1*sizeof(float4)*pixelsNum, NULL, &ciErr3);
+
+  if (ciErr1 != CL_SUCCESS || ciErr2 != CL_SUCCESS || ciErr3 != CL_SUCCESS)
+    RUN_TIME_ERROR("[cl_core]: Failed to create m_dlres.resTemporal/m_dlres.resFinal/m_dlres.gbuffer ");
+
+  if (m_screen.m_cpuFrameBuffer)
+    m_dlres.colorCPU.resize(pixelsNum);
+
+  m_dlres.pixelsNum   = pixelsNum;
+  m_dlres.haveHistory = false;
+}
+
+/**
+\brief Direct light preview; one primary ray per pixel, light sample is selected with resampled importance sampling 
+       from per pixel reservoirs that are reused in time (previous frame, same pixel) and in space (neighbour pixels).  
+
+       Only one shadow ray per pixel is traced. Reuse is biased (no visibility in target function, no MIS between domains),
+       so this mode is intended for interactive preview only.
+
+*/
+void GPUOCLLayer::DLReservoirs_Pass()
+{
+  DLReservoirs_Alloc();
+
+  const size_t pixelsNum = m_dlres.pixelsNum;
+
+  runKernel_MakeEyeRaysPerPixel(m_width, m_height, 
+                                m_rays.rayPos, m_rays.rayDir, m_rays.packedXY);
+
+  runKernel_ClearAllInternalTempBuffers(pixelsNum);
+
+  runKernel_Trace(m_rays.rayPos, m_rays.rayDir, pixelsNum,
+                  m_rays.hits);
+
+  runKernel_ComputeHit(m_rays.rayPos, m_rays.rayDir, m_rays.hits, pixelsNum, pixelsNum,
+                       m_rays.hitSurfaceAll, m_rays.hitProcTexData);
+
+  runKernel_HitEnvOrLight(m_rays.rayFlags, m_rays.rayPos, m_rays.rayDir, m_rays.pathAccColor, 0, 0, pixelsNum);
+
+  runKernel_DLReservoirsInitial(m_rays.rayPos, m_rays.rayDir, (m_dlres.haveHistory ? m_dlres.resFinal : nullptr), pixelsNum,
+                                m_dlres.gbuffer, m_dlres.resTemporal);
+
+  runKernel_DLReservoirsSpatial(m_rays.rayPos, m_rays.rayDir, m_dlres.resTemporal, m_width, m_height, pixelsNum,
+                                m_dlres.resFinal, m_rays.shadowRayPos, m_rays.shadowRayDir);
+
+  if (m_vars.m_flags & HRT_COMPUTE_SHADOWS)
+  {
+    runKernel_ShadowTrace(m_rays.rayFlags, m_rays.shadowRayPos, m_rays.shadowRayDir, pixelsNum,
+                          m_rays.lshadow);
+  }
+  else
+  {
+    cl_kernel kernN = m_progs.trace.kernel("NoShadow");
+
+    size_t localWorkSize = 256;
+    int    isize         = int(pixelsNum);
+    size_t a_size        = roundBlocks(pixelsNum, int(localWorkSize));
+
+    CHECK_CL(clSetKernelArg(kernN, 0, sizeof(cl_mem), (void*)&m_rays.lshadow));
+    CHECK_CL(clSetKernelArg(kernN, 1, sizeof(cl_int), (void*)&isize));
+    CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernN, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+    waitIfDebug(__FILE__, __LINE__);
+  }
+
+  runKernel_DLReservoirsShade(m_rays.rayDir, m_dlres.resFinal, m_rays.lshadow, pixelsNum,
+                              m_rays.pathAccColor);
+
+  m_dlres.haveHistory = true;
+
+  AddPerPixelContributionToScreen(m_rays.pathAccColor);
+}
+
+
 
 void _DebugPrintContribAndIndices(cl_command_queue cmdQueue, const std::string& a_fileName, cl_mem in_contrib1f, size_t a_size1, cl_mem in_indices, size_t a_size2)
 {
@@ -408,37 +510,61 @@ void GPUOCLLayer::MMLT_Pass(int a_passNumber, int minBounce, int maxBounce, int
     runKernel_ClearAllInternalTempBuffers(m_rays.MEGABLOCKSIZE);                  waitIfDebug(__FILE__, __LINE__);
 
     memsetf4(m_rays.pathAuxColor,      float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0); waitIfDebug(__FILE__, __LINE__);
-    memsetf4(m_mlt.pathAuxColor,       float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0); waitIfDebug(__FILE__, __LINE__);
-    memsetf4(m_mlt.pathAuxColor2,      float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0); waitIfDebug(__FILE__, __LINE__);
     memsetf4(m_mlt.yMultAlpha,         float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0); waitIfDebug(__FILE__, __LINE__);
     memsetf4(m_mlt.xMultOneMinusAlpha, float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0); waitIfDebug(__FILE__, __LINE__);
   } 
   
-  if(m_spp < 1e-5f) // run init stage and burning in
+  if(m_spp < 1e-5f) // start burning in; it is overlapped with first passes, so image appears before it has finished
   {
-    m_avgBrightness = MMLT_BurningIn(minBounce, maxBounce, BURN_ITERS,
-                                     m_mlt.rstateNew, m_mlt.dNew, m_mlt.splitData, m_mlt.scaleTable, m_mlt.perBounceActiveThreads);
+    MMLT_BurningInBegin(minBounce, maxBounce, BURN_ITERS,
+                        m_mlt.rstateNew, m_mlt.dNew, m_mlt.splitData, m_mlt.scaleTable, m_mlt.perBounceActiveThreads);
+  }
 
-    if(m_pExternalImage != nullptr)
-      m_pExternalImage->Header()->avgImageB = m_avgBrightness;
+  if(m_mlt.BurningIn())
+  {
+    for(int pass = 0; pass < a_passNumber && m_mlt.BurningIn(); pass++)
+    {
+      MMLT_BurningInStep(minBounce, maxBounce);
+      m_sppDone += float(double(m_rays.MEGABLOCKSIZE) / double(m_width*m_height));
+      m_passNumber++;
+      m_mlt.passesNotFlushed++;
+    }
 
-    //#NOTE: force large step = 1 to generate numbers from current state
-    runKernel_MMLTMakeProposal(m_mlt.rstateNew, nullptr, MUTATE_LARGE, maxBounce, m_rays.MEGABLOCKSIZE, 
-                               m_mlt.rstateNew, m_mlt.xVector);
+    m_avgBrightness = float(m_mlt.burnBrightness/double(m_mlt.burnItersDone));
 
-    // swap (m_mlt.rstateNew, m_mlt.dNew) and (m_mlt.rstateOld, m_mlt.dOld)
+    if(!m_mlt.BurningIn())
     {
-      cl_mem sTmp     = m_mlt.rstateNew; cl_mem dTmp = m_mlt.dNew;
-      m_mlt.rstateNew = m_mlt.rstateOld;  m_mlt.dNew = m_mlt.dOld;
-      m_mlt.rstateOld = sTmp;             m_mlt.dOld = dTmp;
+      m_avgBrightness = MMLT_BurningInEnd(minBounce, maxBounce,
+                                          m_mlt.rstateNew, m_mlt.dNew, m_mlt.splitData, m_mlt.scaleTable, m_mlt.perBounceActiveThreads);
+
+      //#NOTE: force large step = 1 to generate numbers from current state
+      runKernel_MMLTMakeProposal(m_mlt.rstateNew, nullptr, MUTATE_LARGE, maxBounce, m_rays.MEGABLOCKSIZE, 
+                                 m_mlt.rstateNew, m_mlt.xVector);
+
+      // swap (m_mlt.rstateNew, m_mlt.dNew) and (m_mlt.rstateOld, m_mlt.dOld)
+      {
+        cl_mem sTmp     = m_mlt.rstateNew; cl_mem dTmp = m_mlt.dNew;
+        m_mlt.rstateNew = m_mlt.rstateOld;  m_mlt.dNew = m_mlt.dOld;
+        m_mlt.rstateOld = sTmp;             m_mlt.dOld = dTmp;
+      }
+
+      EvalSBDPT(m_mlt.xVector, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
+                m_mlt.xColor);
     }
 
-    EvalSBDPT(m_mlt.xVector, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
-              m_mlt.xColor);
+    if(m_pExternalImage != nullptr)
+      m_pExternalImage->Header()->avgImageB = m_avgBrightness;
 
-    m_mlt.lastBurnIters = BURN_ITERS;
+    clFlush(m_globals.cmdQueue);
+    MMLT_FlushSplats();
+    return;
   }
 
+  // per depth statistics is read from the last large step and the last small step of this call
+  //
+  const int lastLargePass = (a_passNumber/3)*3 - 1;
+  const int lastSmallPass = (a_passNumber%3 == 0) ? a_passNumber - 2 : a_passNumber - 1;
+
   for(int pass = 0; pass < a_passNumber; pass++)
   {
     // (1) make poposal / gen rands
@@ -468,8 +594,8 @@ void GPUOCLLayer::MMLT_Pass(int a_passNumber, int minBounce, int maxBounce, int
     EvalSBDPT(m_mlt.yVector, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
               m_mlt.yColor, proposalTypeRecompute);
     
-    // if(largeStep)
-    //   MMLTUpdateAverageBrightnessConstants(minBounce, m_mlt.yColor, m_rays.MEGABLOCKSIZE);
+    if(largeStep && pass == lastLargePass)
+      MMLTReadDepthStat(m_mlt.yColor, 0);
 
     // (3) Accept/Reject => (xColor, yColor)
     //
@@ -477,24 +603,32 @@ void GPUOCLLayer::MMLT_Pass(int a_passNumber, int minBounce, int maxBounce, int
                            m_mlt.rstateForAcceptReject, maxBounce, m_rays.MEGABLOCKSIZE,
                            m_mlt.xMultOneMinusAlpha, m_mlt.yMultAlpha);
     
-    // (4) (xColor, yColor) => ContribToScreen
+    if(pass == lastSmallPass && lastLargePass >= 0)
+      MMLTReadDepthStat(m_mlt.yMultAlpha, 1);
+
+    // (4) (xColor, yColor) => ContribToScreen; splat on device, host reads image only when it is requested
     //
-    if(m_screen.m_cpuFrameBuffer)
-    {
-      int width, height;
-      float4* resultPtr = const_cast<float4*>(GetCPUScreenBuffer(0, width, height));
-     
-      AddContributionToScreenCPU2(m_mlt.yMultAlpha, m_mlt.xMultOneMinusAlpha, int(m_rays.MEGABLOCKSIZE), width, height,
-                                  resultPtr);
-    }
-    else
-    {
-      AddContributionToScreen(m_mlt.xMultOneMinusAlpha, nullptr, false);                         
-      AddContributionToScreen(m_mlt.yMultAlpha        , nullptr, (pass == a_passNumber-1));
-    } 
-    
+    runKernel_SplatSamplesAtomic(m_mlt.xMultOneMinusAlpha, m_rays.MEGABLOCKSIZE, m_width, m_height,
+                                 m_mlt.colorDevice);
+    runKernel_SplatSamplesAtomic(m_mlt.yMultAlpha,         m_rays.MEGABLOCKSIZE, m_width, m_height,
+                                 m_mlt.colorDevice);
+
+    m_sppDone += float(double(m_rays.MEGABLOCKSIZE) / double(m_width*m_height));
+    m_passNumber++;
+    m_mlt.passesNotFlushed++;
   }
 
+  clFlush(m_globals.cmdQueue);
+
+  MMLT_FlushSplats(); // shared image is read by other process, so it has to get data once per a_passNumber passes
+
+  // (5) move chains to depths where they are needed more and update per depth normalisation constants
+  //
+  if(lastLargePass >= 0)
+  {
+    MMLTUpdateDepthStat(minBounce);
+    MMLTRebalanceChains(minBounce);
+  }
 }
 
 std::vector<float> CalcSBPTScaleTable(int bounceBeg, int bounceEnd)
@@ -604,8 +738,6 @@ void GPUOCLLayer::SBDPT_Pass(int minBounce, int maxBounce, int ITERS)
     std::cout << "[AllocAll]: MEM(MLT)    = " << mltMem / size_t(1024*1024) << "\tMB" << std::endl;  
     runKernel_ClearAllInternalTempBuffers(m_rays.MEGABLOCKSIZE);
     memsetf4(m_rays.pathAuxColor,      float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
-    memsetf4(m_mlt.pathAuxColor,       float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
-    memsetf4(m_mlt.pathAuxColor2,      float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
     memsetf4(m_mlt.yMultAlpha,         float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
     memsetf4(m_mlt.xMultOneMinusAlpha, float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
   
@@ -637,128 +769,102 @@ double GPUOCLLayer::reduce_avg1f(cl_mem a_buff, size_t a_size)
 }
 
 
-float GPUOCLLayer::MMLT_BurningIn(int minBounce, int maxBounce, int BURN_ITERS,
-                                  cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads)
+void GPUOCLLayer::MMLT_BurningInBegin(int minBounce, int maxBounce, int BURN_ITERS,
+                                      cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads)
 {
 
-  if(m_mlt.rstateOld == out_rstate || out_dsplit == m_mlt.dOld)
+  if(m_mlt.rstateOld == out_rstate || out_dsplit == m_mlt.dOld || out_dsplit != m_mlt.dNew)
   {
-    std::cerr << "MMLT_BurningIn, wrong input buffers! Select (m_mlt.rstateNew, dNew) instead!" << std::endl;
-    std::cout << "MMLT_BurningIn, wrong input buffers! Select (m_mlt.rstateNew, dNew) instead!" << std::endl;
-    return 1.0f;
+    std::cerr << "MMLT_BurningInBegin, wrong input buffers! Select (m_mlt.rstateNew, dNew) instead!" << std::endl;
+    std::cout << "MMLT_BurningInBegin, wrong input buffers! Select (m_mlt.rstateNew, dNew) instead!" << std::endl;
+    return;
   }
 
-  // zero out_normC table because we are going to increment it via simulated floating points atomics ... 
-  cl_int ciErr1 = CL_SUCCESS;
-
-  //std::vector<float> scale(maxBounce+1);
-  //for(auto& coeff : scale)
-  //  coeff = 0.0f;
-  //cl_mem avgBTableGPU = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, 256*sizeof(float), (void*)scale.data(), &ciErr1);
-  //
-  
   MMLTInitSplitDataUniform(minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
                            out_split2, out_normC, out_activeThreads);
 
-  const int BURN_PORTION = m_rays.MEGABLOCKSIZE/BURN_ITERS;
+  m_mlt.lastBurnIters  = BURN_ITERS;
+  m_mlt.burnItersDone  = 0;
+  m_mlt.burnBrightness = 0.0;
+
+  std::cout << std::endl;
+}
+
+void GPUOCLLayer::MMLT_BurningInStep(int minBounce, int maxBounce)
+{
+  const int iter         = m_mlt.burnItersDone;
+  const int BURN_PORTION = int(m_rays.MEGABLOCKSIZE)/m_mlt.lastBurnIters;
 
-  cl_mem temp_f1 = out_dsplit; // #NOTE: well, that's not ok in general, but due to sizeof(int) == sizeof(float) we can use this buffer temporary
+  cl_mem temp_f1 = m_mlt.dNew; // #NOTE: this is out_dsplit of MMLT_BurningInBegin; it is overwritten only in MMLT_BurningInEnd
+                               // #NOTE: well, that's not ok in general, but due to sizeof(int) == sizeof(float) we can use this buffer temporary
                                // #NOTE: do you allocate enough memory for this buffer? --> seems yes (see inPlaceScanAnySize1f impl).
                                // #NOTE: current search will not work !!! It need size+1 array !!!  
                                // #NOTE: you can just set last element to size-2, not size-1. So it will work in this way.
-  double avgBrightness = 0.0;
-
-  double avgTimeMk     = 0.0;
-  double avgTimeEv     = 0.0;
-  double avgTimeCt     = 0.0;
-  double avgTimeSel    = 0.0;
-  Timer timer(false);
-
-  const bool measureTime = false;
-
-  std::cout << std::endl;
-  for(int iter=0; iter<BURN_ITERS;iter++)
-  {
-    if(measureTime)
-    {
-      clFinish(m_globals.cmdQueue);
-      timer.start();
-    }
 
-    runKernel_MMLTMakeProposal(m_mlt.rstateCurr, nullptr, MUTATE_LARGE, maxBounce, m_rays.MEGABLOCKSIZE,
-                               m_mlt.rstateNew,  m_mlt.xVector);
+  runKernel_MMLTMakeProposal(m_mlt.rstateCurr, nullptr, MUTATE_LARGE, maxBounce, m_rays.MEGABLOCKSIZE,
+                             m_mlt.rstateNew,  m_mlt.xVector);
 
-    if(measureTime)
-    {
-      clFinish(m_globals.cmdQueue);
-      avgTimeMk += timer.getElapsed();
-      timer.start();
-    }
+  EvalSBDPT(m_mlt.xVector, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
+            m_rays.pathAccColor);
 
-    EvalSBDPT(m_mlt.xVector, minBounce, maxBounce, m_rays.MEGABLOCKSIZE,
-              m_rays.pathAccColor);
+  runKernel_MLTEvalContribFunc(m_rays.pathAccColor, 0, m_rays.MEGABLOCKSIZE,
+                               temp_f1);
 
-    if(measureTime)
-    {
-      clFinish(m_globals.cmdQueue);
-      avgTimeEv += timer.getElapsed();
-      timer.start();
-    }
+  m_mlt.burnBrightness += reduce_avg1f(temp_f1, m_rays.MEGABLOCKSIZE);
+  m_mlt.burnItersDone++;
 
-    runKernel_MLTEvalContribFunc(m_rays.pathAccColor, 0, m_rays.MEGABLOCKSIZE,
-                                 temp_f1);
+  // burn-in samples are ordinary SBDPT samples, so they are shown while chains are not ready; 
+  // they are scaled to unit average brightness to have the same weight as MLT splats which follow them
+  //
+  const double avgBrightness = m_mlt.burnBrightness/double(m_mlt.burnItersDone);
+  runKernel_SplatSamplesAtomic(m_rays.pathAccColor, m_rays.MEGABLOCKSIZE, m_width, m_height,
+                               m_mlt.colorDevice, float(1.0/fmax(avgBrightness, 1e-10)));
 
-    if(measureTime)
-    {
-      clFinish(m_globals.cmdQueue);
-      avgTimeCt += timer.getElapsed();
-      timer.start();
-    }                                 
-    
-    avgBrightness += reduce_avg1f(temp_f1, m_rays.MEGABLOCKSIZE)*(1.0/double(BURN_ITERS));
+  MMLTCheatThirdBounceContrib(m_mlt.splitData, 0.5f, m_rays.MEGABLOCKSIZE, temp_f1); // THIS IS IN UNKNOWN (bounce==3) ISSUE/BUG !!!!
 
-    MMLTCheatThirdBounceContrib(m_mlt.splitData, 0.5f, m_rays.MEGABLOCKSIZE, temp_f1); // THIS IS IN UNKNOWN (bounce==3) ISSUE/BUG !!!!
+  inPlaceScanAnySize1f(temp_f1, m_rays.MEGABLOCKSIZE);
 
-    inPlaceScanAnySize1f(temp_f1, m_rays.MEGABLOCKSIZE);
+  // select BURN_PORTION (state,d) from (m_mlt.rstateCurr, m_mlt.splitData) => (m_mlt.rstateOld, dOld)
+  // 
+  runKernel_MLTSelectSampleProportionalToContrib(m_mlt.rstateCurr, m_mlt.splitData, temp_f1, m_rays.MEGABLOCKSIZE, m_mlt.rstateForAcceptReject, BURN_PORTION,
+                                                 BURN_PORTION*iter, m_mlt.rstateOld, m_mlt.dOld);
 
-    // select BURN_PORTION (state,d) from (m_mlt.rstateCurr, m_mlt.splitData) => (m_mlt.rstateOld, dOld)
-    // 
-    runKernel_MLTSelectSampleProportionalToContrib(m_mlt.rstateCurr, m_mlt.splitData, temp_f1, m_rays.MEGABLOCKSIZE, m_mlt.rstateForAcceptReject, BURN_PORTION,
-                                                   BURN_PORTION*iter, m_mlt.rstateOld, m_mlt.dOld);
- 
-    {
-      cl_mem temp      = m_mlt.rstateCurr;
-      m_mlt.rstateCurr = m_mlt.rstateNew;
-      m_mlt.rstateNew  = temp;
-    }
+  {
+    cl_mem temp      = m_mlt.rstateCurr;
+    m_mlt.rstateCurr = m_mlt.rstateNew;
+    m_mlt.rstateNew  = temp;
+  }
 
-    clFinish(m_globals.cmdQueue);
+  if(iter%16 == 0)
+  {
+    std::cout << "MMLT Burning in, progress = " << 100.0f*float(iter)/float(m_mlt.lastBurnIters) << "% \r";
+    std::cout.flush();
+  }
+}
 
-    if(measureTime)
-    {
-      avgTimeSel += timer.getElapsed();
-      timer.start();
-    }     
-    
-    if(iter%16 == 0)
-    {
-      std::cout << "MMLT Burning in, progress = " << 100.0f*float(iter)/float(BURN_ITERS) << "% \r";
-      std::cout.flush();
-    }
+/**
+\brief Get number of threads that are active at each bounce for chains sorted by depth in descending order.
+*/
+static void MMLTActiveThreadsFromChainsPerDepth(const std::vector<int>& a_chainsPerDepth, int minBounce, size_t a_totalThreads, 
+                                                std::vector<int>& out_activeThreads)
+{
+  for(int i=0;i<=minBounce;i++)
+    out_activeThreads[i] = int(a_totalThreads);
 
-    //AddContributionToScreen(m_rays.pathAccColor, nullptr);
-  }
-  std::cout << std::endl;
-  
-  if(measureTime)
+  size_t summ = 0;
+  for(int i=int(a_chainsPerDepth.size())-1;i>minBounce;i--)
   {
-    std::cout.flush();
-    std::cout << "[MakeProposal]: avgTime = " <<  avgTimeMk *1000.0/double(BURN_ITERS) << "\t ms" << std::endl;
-    std::cout << "[EvalSBDPT   ]: avgTime = " <<  avgTimeEv *1000.0/double(BURN_ITERS) << "\t ms" << std::endl;
-    std::cout << "[ContribFunc ]: avgTime = " <<  avgTimeCt *1000.0/double(BURN_ITERS) << "\t ms" << std::endl;
-    std::cout << "[SelectSampls]: avgTime = " <<  avgTimeSel*1000.0/double(BURN_ITERS) << "\t ms" << std::endl;
-    std::cout.flush();
+    summ += a_chainsPerDepth[i];
+    out_activeThreads[i] = int(summ);
   }
+}
+
+float GPUOCLLayer::MMLT_BurningInEnd(int minBounce, int maxBounce,
+                                     cl_mem out_rstate, cl_mem out_dsplit, cl_mem out_split2, cl_mem out_normC, std::vector<int>& out_activeThreads)
+{
+  std::cout << std::endl;
+
+  const double avgBrightness = m_mlt.burnBrightness/double(m_mlt.lastBurnIters);
 
   // sort all selected pairs of (m_mlt.rstateOld, dOld) by d and screen (x,y) => (out_rstate, out_dsplit)
   //
@@ -789,87 +895,49 @@ float GPUOCLLayer::MMLT_BurningIn(int minBounce, int maxBounce, int BURN_ITERS,
   for(auto& N : threadsNumCopy)
     N = 0;
   
-  std::cout << std::endl;
-  int old_d = -1;
   for(size_t i=0;i<depthCPU.size();i++)
-  {
-    const int d = abs(depthCPU[i]);
-    threadsNumCopy[d]++;
-    if(d!=old_d)
-    {
-      //std::cout << "[chnge]: d = " << i << ", N = " << d << std::endl;
-      old_d = d;
-    }
-  }
+    threadsNumCopy[abs(depthCPU[i])]++;
 
   std::cout << std::endl;
   std::cout << "[BurningIn] dd per_depth:" << std::endl;
   for(int i=0;i<threadsNumCopy.size();i++)
      std::cout << "[d = " << i << ", N = " << threadsNumCopy[i] << ", coeff = 1]" << std::endl;
   
-  // init per bounce arrays for future normalisation constants rectification
+  // init per bounce arrays for future chains rebalancing and normalisation constants rectification
   //
   {
     m_mlt.perBounceThreads = threadsNumCopy;
-    m_mlt.avgBrightnessCPU.resize(threadsNumCopy.size());
-    for(auto& val : m_mlt.avgBrightnessCPU)
-      val = 0;
+    m_mlt.avgBrightnessCPU.assign(threadsNumCopy.size(), 0.0);
+    m_mlt.avgAcceptanceCPU.assign(threadsNumCopy.size(), 0.0);
     m_mlt.avgBrightnessSamples = 0;
   }
   // \\
 
-  for(int i=0;i<=minBounce;i++)
-    out_activeThreads[i] = int(m_rays.MEGABLOCKSIZE);
-
   // now get get active bounce threads number from 'threads per depth'
   //
-  size_t summ = 0;
-  for(int i=threadsNumCopy.size()-1;i>minBounce;i--)
-  {
-    summ += threadsNumCopy[i];
-    out_activeThreads[i] = summ;
-  }
+  MMLTActiveThreadsFromChainsPerDepth(threadsNumCopy, minBounce, m_rays.MEGABLOCKSIZE, 
+                                      out_activeThreads);
 
   std::cout << std::endl;
   std::cout << "[BurningIn] dd final:" << std::endl;
   for(int i=0;i<out_activeThreads.size();i++)
      std::cout << "[d = " << i << ", N = " << out_activeThreads[i] << ", coeff = 1]" << std::endl;
 
-  // get average brightness
-  //
-  //float avgBrightness = 0.0f;
-  //{
-  //  std::vector<float> avgB(maxBounce+1);
-  //  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, avgBTableGPU, CL_TRUE, 0, avgB.size()*sizeof(float), (void*)avgB.data(), 0, NULL, NULL));
-  //
-  //  const float scaleInv = 1.0f/float(BURN_ITERS*m_rays.MEGABLOCKSIZE);
-  //
-  //  for(int i=0;i<avgB.size();i++)
-  //  {
-  //    const float avgBPerBounce = avgB[i]*scaleInv;
-  //    std::cout << "[d = " << i << ", avgB = " << avgBPerBounce << ", coeff = " << float(i + 1) << "]" << std::endl;
-  //    avgBrightness += avgBPerBounce;
-  //  }
-  //  std::cout << "[d = a, avgB = " << avgBrightness << "]" << std::endl;
-  //}
-
   std::cout << "[d = a, avgB = " << avgBrightness << "]" << std::endl;
-  //clReleaseMemObject(avgBTableGPU); avgBTableGPU = nullptr;
 
   std::vector<float> scale(maxBounce+1);
   for(int i=0;i<scale.size();i++)
-  {
-    //scale[i] = 1.0f;
     scale[i] = float(i+1)*( float(m_rays.MEGABLOCKSIZE) / fmax(float(threadsNumCopy[i]), 2.0f) );
-  }
   CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, out_normC, CL_TRUE, 0, scale.size()*sizeof(float), (void*)scale.data(), 0, NULL, NULL));
-  
+  m_mlt.scaleTableCPU = scale;
+
   // init m_mlt.scaleTable2
   // 
   scale.resize(256);
   for(auto& x : scale)
     x = 1.0f;
   CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_mlt.scaleTable2, CL_TRUE, 0, scale.size()*sizeof(float), (void*)scale.data(), 0, NULL, NULL));
+  m_mlt.scaleTable2CPU = scale;
 
   return float(avgBrightness);
 }
@@ -879,71 +947,240 @@ float GPUOCLLayer::MMLT_BurningIn(int minBounce, int maxBounce, int BURN_ITERS,
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void GPUOCLLayer::MMLTUpdateAverageBrightnessConstants(int minBounce, cl_mem in_color, size_t a_size)
+/**
+\brief Evaluate contrib function of all chains, summ it over chains of each depth on device and start non blocking read of depthNum summs;
+       MMLTUpdateDepthStat waits for the result. 
+\param in_color - input samples color
+\param a_statId - 0 for brightness of large steps, 1 for contribution of accepted small steps
+*/
+void GPUOCLLayer::MMLTReadDepthStat(cl_mem in_color, int a_statId)
+{
+  cl_mem temp_f1 = m_mlt.dNew; // is free after burning in. Queue is in order, so next kernel will not overwrite it until reduction is finished.
+
+  runKernel_MLTEvalContribFunc(in_color, 0, m_rays.MEGABLOCKSIZE,
+                               temp_f1);
+
+  const std::vector<int>& perBounceThreads = m_mlt.perBounceThreads;
+  const int depthNum = int(perBounceThreads.size());
+  if (depthNum == 0 || depthNum > 256)
+    return;
+
+  if (a_statId == 0) // chains layout is the same for both stats of a pass; previous write is finished since MMLTUpdateDepthStat waited for reads after it
+  {
+    int offset = 0;
+    for (int bounce = depthNum - 1; bounce >= 0; bounce--) // chains are sorted by depth in descending order
+    {
+      m_mlt.depthRangesCPU[bounce] = make_int2(offset, perBounceThreads[bounce]);
+      offset += perBounceThreads[bounce];
+    }
+    CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_mlt.depthRanges, CL_FALSE, 0, depthNum*sizeof(int2), (void*)m_mlt.depthRangesCPU.data(), 0, NULL, NULL));
+  }
+
+  cl_kernel kern        = m_progs.screen.kernel("ReductionFloatRangesSum256");
+  size_t localWorkSize  = 256;
+  size_t globalWorkSize = 256*size_t(depthNum);
+  int    outOffset      = a_statId*256;
+
+  CHECK_CL(clSetKernelArg(kern, 0, sizeof(cl_mem), (void*)&temp_f1));
+  CHECK_CL(clSetKernelArg(kern, 1, sizeof(cl_mem), (void*)&m_mlt.depthRanges));
+  CHECK_CL(clSetKernelArg(kern, 2, sizeof(cl_mem), (void*)&m_mlt.depthStat));
+  CHECK_CL(clSetKernelArg(kern, 3, sizeof(cl_int), (void*)&outOffset));
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kern, 1, NULL, &globalWorkSize, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+
+  cl_event& readEvent = m_mlt.depthStatEvents[a_statId];
+  if (readEvent != 0)
+  {
+    CHECK_CL(clWaitForEvents(1, &readEvent));
+    clReleaseEvent(readEvent);
+    readEvent = 0;
+  }
+
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_mlt.depthStat, CL_FALSE, outOffset*sizeof(float), depthNum*sizeof(float), (void*)(m_mlt.depthStatCPU.data() + outOffset), 0, NULL, &readEvent));
+}
+
+/**
+\brief Accumulate per depth average brightness (from large step samples) and acceptance rate (from accepted small step splats). 
+       Chains are sorted by depth, so each depth is a contiguous range of chains.
+*/
+void GPUOCLLayer::MMLTUpdateDepthStat(int minBounce)
 {
-  std::vector<int>  & perBounceThreads = m_mlt.perBounceThreads;
-  cl_mem temp_f1                       = m_mlt.dNew;
+  if (m_mlt.depthStatEvents[0] == 0 || m_mlt.depthStatEvents[1] == 0) // both stats are needed
+    return;
 
-  // std::cout << std::endl;
-  // for(size_t i = 0; i < m_mlt.perBounceThreads.size(); i++)
-  //   std::cout << "N(threads) = " << perBounceThreads[i] << ",\t" << "coeff = " << perBounceCoeff[i] << std::endl;
+  CHECK_CL(clWaitForEvents(2, m_mlt.depthStatEvents)); // wait for MMLTReadDepthStat
+  for (int i = 0; i < 2; i++)
+  {
+    clReleaseEvent(m_mlt.depthStatEvents[i]);
+    m_mlt.depthStatEvents[i] = 0;
+  }
 
+  const std::vector<int>& perBounceThreads = m_mlt.perBounceThreads;
   const double alpha = 1.0/double(m_mlt.avgBrightnessSamples + 1);
 
-  int currOffset = 0;
-  for(int bounce = minBounce; bounce < perBounceThreads.size(); bounce++)
+  for(int bounce = int(perBounceThreads.size()) - 1; bounce >= 0; bounce--)
   {
-    int currSize = perBounceThreads[bounce];
+    const size_t currSize = size_t(perBounceThreads[bounce]);
+    const double summB    = double(m_mlt.depthStatCPU[bounce]);
+    const double summA    = double(m_mlt.depthStatCPU[256 + bounce]);
+
+    if(currSize == 0 || bounce < minBounce)
+      continue;
 
-    // (1) Evaluate contrib func from in_color to temp_buffer1f
+    // (1) EvalSBDPT multiply sample by scaleTable[d] = (d+1)*N/N(d); brightness of depth should not depend on chains number
     //
-    runKernel_MLTEvalContribFunc(in_color, currOffset, currSize,
-                                 temp_f1);
+    const double avgBrightness = (summB/double(currSize))*double(bounce + 1)/double(m_mlt.scaleTableCPU[bounce]);
 
-    // (2) Reduce contrib func
+    // (2) accepted splat has contrib = alpha*coeff
     //
-    const double avgBrightness     = reduce_avg1f(temp_f1, currSize);
+    const double coeff         = double(m_mlt.scaleTable2CPU[bounce])*((bounce == 3) ? 2.0 : 1.0); // see MMLTAcceptReject
+    const double avgAcceptance = fmin((summA/double(currSize))/fmax(coeff, 1e-10), 1.0);
+
     m_mlt.avgBrightnessCPU[bounce] = avgBrightness*alpha + (1.0 - alpha)*m_mlt.avgBrightnessCPU[bounce];
-    currOffset += currSize;
+    m_mlt.avgAcceptanceCPU[bounce] = avgAcceptance*alpha + (1.0 - alpha)*m_mlt.avgAcceptanceCPU[bounce];
   }
-  
-  if(m_mlt.avgBrightnessSamples % 128 == 0 && m_mlt.avgBrightnessSamples > 0)
+
+  m_mlt.avgBrightnessSamples++; 
+}
+
+constexpr static int    MMLT_REBALANCE_MIN_STAT   = 4;     ///< calls of MMLT_Pass before statistics is used
+constexpr static double MMLT_REBALANCE_MIN_ACCEPT = 0.05;  ///< clamp acceptance rate to limit chains of depths with very bad mutations
+constexpr static double MMLT_REBALANCE_MIN_MOVED  = 0.01;  ///< don't restart chains if less than 1% of them will move to other depth
+constexpr static int    MMLT_REBALANCE_MIN_DEPTH  = 8;     ///< each depth keeps at least 1/(8*depthNum) of chains
+
+/**
+\brief Move chains to depths according to their brightness and acceptance rate and update per depth normalisation constants (scaleTable2).
+       Chains of bright depths and depths where chains are stuck (low acceptance rate) are needed more. 
+*/
+void GPUOCLLayer::MMLTRebalanceChains(int minBounce)
+{
+  if(m_mlt.avgBrightnessSamples < MMLT_REBALANCE_MIN_STAT)
+    return;
+
+  const std::vector<int>& perBounceThreads = m_mlt.perBounceThreads;
+  const int depthNum = int(perBounceThreads.size());
+
+  // (1) get target chains number for each depth
+  //
+  std::vector<double> weights(depthNum, 0.0);
+  double totalWeight     = 0.0;
+  double totalBrightness = 0.0;
+  int    depthUsed       = 0;
+  int    chainsNum       = 0;
+
+  for(int bounce = minBounce; bounce < depthNum; bounce++)
+  {
+    if(perBounceThreads[bounce] == 0) // no paths of this depth were found during burning in
+      continue;
+
+    const double acceptance = fmin(fmax(m_mlt.avgAcceptanceCPU[bounce], MMLT_REBALANCE_MIN_ACCEPT), 1.0);
+    weights[bounce]  = m_mlt.avgBrightnessCPU[bounce]/sqrt(acceptance);
+    totalWeight     += weights[bounce];
+    totalBrightness += m_mlt.avgBrightnessCPU[bounce];
+    chainsNum       += perBounceThreads[bounce];
+    depthUsed++;
+  }
+
+  if(depthUsed == 0 || totalWeight <= 0.0 || totalBrightness <= 0.0)
+    return;
+
+  const double minChains  = double(chainsNum)/double(MMLT_REBALANCE_MIN_DEPTH*depthUsed);
+  const double freeChains = double(chainsNum) - minChains*double(depthUsed);
+
+  std::vector<int> chainsPerDepth = perBounceThreads;
+  int summ    = 0;
+  int moved   = 0;
+  int largest = -1;
+
+  for(int bounce = minBounce; bounce < depthNum; bounce++)
+  {
+    if(perBounceThreads[bounce] == 0)
+      continue;
+
+    const double target    = minChains + freeChains*weights[bounce]/totalWeight;
+    chainsPerDepth[bounce] = int(double(perBounceThreads[bounce]) + 0.5*(target - double(perBounceThreads[bounce]))); // move half way, estimates are noisy
+    summ += chainsPerDepth[bounce];
+
+    if(largest < 0 || chainsPerDepth[bounce] > chainsPerDepth[largest])
+      largest = bounce;
+  }
+  chainsPerDepth[largest] += (chainsNum - summ);
+
+  for(int bounce = minBounce; bounce < depthNum; bounce++)
+    moved += abs(chainsPerDepth[bounce] - perBounceThreads[bounce]);
+  moved /= 2;
+
+  if(double(moved) >= MMLT_REBALANCE_MIN_MOVED*double(chainsNum))
+  {
+    MMLTWriteChainsLayout(minBounce, chainsPerDepth, m_mlt.perBounceActiveThreads);
+
+    std::cout << "[MMLT]: chains rebalanced, moved = " << moved << std::endl;
+  }
+
+  // (2) splats of depth 'd' should have total brightness avgB(d); MMLTAcceptReject normalize each splat to coeff(d)
+  //
+  std::vector<float>& coeffs = m_mlt.scaleTable2CPU;
+  for(int bounce = minBounce; bounce < depthNum; bounce++)
+  {
+    if(perBounceThreads[bounce] == 0)
+      continue;
+
+    const double fractionB = m_mlt.avgBrightnessCPU[bounce]/totalBrightness;
+    const double fractionN = double(perBounceThreads[bounce])/double(chainsNum);
+    coeffs[bounce]         = float(fractionB/fractionN);
+
+    if(bounce == 3)            // MMLTAcceptReject multiply it by 2
+      coeffs[bounce] *= 0.5f;  // THIS IS IN UNKNOWN (bounce==3) ISSUE/BUG !!!!
+  }
+
+  // non blocking; coeffs are not changed until the next MMLTUpdateDepthStat, which waits for reads enqueued after this write
+  //
+  CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_mlt.scaleTable2, CL_FALSE, 0, depthNum*sizeof(float), (void*)coeffs.data(), 0, NULL, NULL));
+}
+
+/**
+\brief Write new chains to depth distribution. Chains stay sorted by depth in descending order, so only chains near borders of depth ranges 
+       change their depth; their color is cleared, so they accept the next proposal and restart at new depth.
+\param minBounce          - min bounce
+\param a_chainsPerDepth   - new chains number for each depth
+\param out_activeThreads  - active threads number for each bounce
+*/
+void GPUOCLLayer::MMLTWriteChainsLayout(int minBounce, const std::vector<int>& a_chainsPerDepth, std::vector<int>& out_activeThreads)
+{
+  std::vector<int2> splitDataCPU(m_rays.MEGABLOCKSIZE);
+  std::vector<int>  oldDepth(m_rays.MEGABLOCKSIZE);
   {
-    double summ = 0.0;
-    int iters = 0;
-    //std::cout << std::endl;
-    for(int bounce = minBounce; bounce < m_mlt.avgBrightnessCPU.size(); bounce++)
+    size_t posNew = 0, posOld = 0;
+    for(int bounce = int(a_chainsPerDepth.size()) - 1; bounce >= 0; bounce--)
     {
-      summ += double(m_mlt.avgBrightnessCPU[bounce]);
-      iters++;
-      //std::cout << "avgB(" << bounce << ") = " << m_mlt.avgBrightnessCPU[bounce] << "\tthreads = " << perBounceThreads[bounce] << std::endl;
+      for(int i = 0; i < a_chainsPerDepth[bounce] && posNew < splitDataCPU.size(); i++)
+        splitDataCPU[posNew++] = make_int2(bounce, bounce);
+      for(int i = 0; i < m_mlt.perBounceThreads[bounce] && posOld < oldDepth.size(); i++)
+        oldDepth[posOld++] = bounce;
     }
-    //std::cout << std::endl;
+  }
 
-    if(1.8f*m_mlt.avgBrightnessCPU[3] < m_mlt.avgBrightnessCPU[4]) // strange 3 bounce bug.
+  for(size_t i = 0; i < splitDataCPU.size();)
+  {
+    if(splitDataCPU[i].x == oldDepth[i])
     {
-      std::cout << std::endl;
-      std::cout << "3 bounce bug happened!" << std::endl;
-      m_mlt.avgBrightnessCPU[3] *= 2.0f;
+      i++;
+      continue;
     }
 
-    std::vector<float> coeffs(m_mlt.avgBrightnessCPU.size());
+    size_t j = i;
+    while(j < splitDataCPU.size() && splitDataCPU[j].x != oldDepth[j])
+      j++;
 
-    if(m_mlt.avgBrightnessSamples > m_mlt.lastBurnIters)
-    {
-      std::cout << std::endl;
-      for(int bounce = minBounce; bounce < m_mlt.avgBrightnessCPU.size(); bounce++)
-      {
-        coeffs[bounce] = float(iters)*m_mlt.avgBrightnessCPU[bounce] / float(summ);
-        std::cout << "coef(" << bounce << ") = " << coeffs[bounce] << "\tthreads = " << perBounceThreads[bounce] << std::endl;
-      }
-     
-      CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_mlt.scaleTable2, CL_TRUE, 0, coeffs.size()*sizeof(float), (void*)coeffs.data(), 0, NULL, NULL));
-      std::cout << "coeff has updated" << std::endl;
-    }
+    memsetf4(m_mlt.xColor, float4(0,0,0,0), j - i, i);
+    i = j;
   }
 
-  m_mlt.avgBrightnessSamples++; 
+  CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_mlt.splitData, CL_TRUE, 0, splitDataCPU.size()*sizeof(int2), (void*)splitDataCPU.data(), 0, NULL, NULL));
+
+  m_mlt.perBounceThreads = a_chainsPerDepth;
+  MMLTActiveThreadsFromChainsPerDepth(a_chainsPerDepth, minBounce, m_rays.MEGABLOCKSIZE, 
+                                      out_activeThreads);
 }
 
 void GPUOCLLayer::EvalSBDPT(cl_mem in_xVector, int minBounce, int maxBounce, size_t a_size,
@@ -45,7 +45,7 @@ void GPUOCLLayer::trace1D_Rev(int a_minBounce, int a_maxBounce, cl_mem a_rpos, c
     }
 
     runKernel_Trace(a_rpos, a_rdir, a_size,
-                    m_rays.hits);
+                    m_rays.hits, bounce);
 
     if (m_vars.m_varsI[HRT_ENABLE_MRAYS_COUNTERS] && measureThisBounce)
     {
@@ -157,7 +157,7 @@ void GPUOCLLayer::trace1D_Fwd(int a_minBounce, int a_maxBounce, cl_mem a_rpos, c
   for (int bounce = 0; bounce < a_maxBounce - 1; bounce++)
   {
     runKernel_Trace(a_rpos, a_rdir, a_size,
-                    m_rays.hits);
+                    m_rays.hits, bounce);
 
     runKernel_ComputeHit(a_rpos, a_rdir, m_rays.hits, a_size, a_size,
                          m_rays.hitSurfaceAll, m_rays.hitProcTexData);
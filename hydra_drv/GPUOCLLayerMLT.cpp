@@ -35,21 +35,25 @@ void GPUOCLLayer::CL_MLT_DATA::free()
   if (cameraVertexHit)       { clReleaseMemObject(cameraVertexHit);   cameraVertexHit = 0; }
   if (pdfArray)              { clReleaseMemObject(pdfArray);          pdfArray        = 0; }
 
-  if (pathAuxColor)          { clReleaseMemObject(pathAuxColor);      pathAuxColor     = 0;}
-  if (pathAuxColorCPU)       { clReleaseMemObject(pathAuxColorCPU);   pathAuxColorCPU  = 0;}
-  if (pathAuxColor2)         { clReleaseMemObject(pathAuxColor2);     pathAuxColor2    = 0;}
-  if (pathAuxColorCPU2)      { clReleaseMemObject(pathAuxColorCPU2);  pathAuxColorCPU2 = 0;}
-
   if (yMultAlpha)            { clReleaseMemObject(yMultAlpha);        yMultAlpha = 0;}
   if (xMultOneMinusAlpha)    { clReleaseMemObject(xMultOneMinusAlpha);xMultOneMinusAlpha = 0;}
 
   if (splitData)             { clReleaseMemObject(splitData);         splitData       = 0; }
   if (scaleTable)            { clReleaseMemObject(scaleTable);        scaleTable      = 0; }
   if (scaleTable2)           { clReleaseMemObject(scaleTable2);       scaleTable2     = 0; }
+  if (depthRanges)           { clReleaseMemObject(depthRanges);       depthRanges     = 0; }
+  if (depthStat)             { clReleaseMemObject(depthStat);         depthStat       = 0; }
+
+  for (int i = 0; i < 2; i++)
+  {
+    if (depthStatEvents[i])  { clWaitForEvents(1, &depthStatEvents[i]); clReleaseEvent(depthStatEvents[i]); depthStatEvents[i] = 0; }
+  }
+  if (colorDevice)           { clReleaseMemObject(colorDevice);       colorDevice     = 0; }
 
-  rstateCurr = 0;
-  memTaken   = 0;
-  currVec    = 0;
+  rstateCurr       = 0;
+  memTaken         = 0;
+  currVec          = 0;
+  passesNotFlushed = 0;
 }
 
 void GPUOCLLayer::CL_KMLT_DATA::free()
@@ -179,7 +183,7 @@ size_t GPUOCLLayer::MLT_Alloc(int a_maxBounce)
   runKernel_InitRandomGen(m_mlt.rstateOld,             m_rays.MEGABLOCKSIZE, rand()*GetTickCount());
   runKernel_InitRandomGen(m_mlt.rstateNew,             m_rays.MEGABLOCKSIZE, rand()*GetTickCount());
 
-  const int MLT_RAND_NUMBERS_PER_BOUNCE = MMLT_HEAD_TOTAL_SIZE + MMLT_COMPRESSED_F_PERB*a_maxBounce; //randArraySizeOfDepthMMLT(a_maxBounce);
+  const int MLT_RAND_NUMBERS_PER_BOUNCE = MMLT_HEAD_COMPRESSED_SIZE + MMLT_COMPRESSED_F_PERB*a_maxBounce; //randArraySizeOfDepthMMLT(a_maxBounce);
   m_vars.m_varsI[HRT_MLT_MAX_NUMBERS]   = MLT_RAND_NUMBERS_PER_BOUNCE;
 
   // init big buffers for path space state // (MLT_RAND_NUMBERS_PER_BOUNCE / MLT_PROPOSALS)
@@ -198,7 +202,11 @@ size_t GPUOCLLayer::MLT_Alloc(int a_maxBounce)
     RUN_TIME_ERROR("[cl_core.MLT_Alloc]: Failed to alloc yVector ");
 #endif
 
-  m_mlt.memTaken += MLT_RAND_NUMBERS_PER_BOUNCE*sizeof(float)*m_rays.MEGABLOCKSIZE + 2 * sizeof(RandomGen)*m_rays.MEGABLOCKSIZE;
+#ifdef MCMC_LAZY
+  m_mlt.memTaken += MLT_RAND_NUMBERS_PER_BOUNCE*sizeof(float)*m_rays.MEGABLOCKSIZE;
+#else
+  m_mlt.memTaken += 2*MLT_RAND_NUMBERS_PER_BOUNCE*sizeof(float)*m_rays.MEGABLOCKSIZE;
+#endif
 
   m_mlt.xColor = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(float4)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
   m_mlt.yColor = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, sizeof(float4)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
@@ -217,7 +225,7 @@ size_t GPUOCLLayer::MLT_Alloc(int a_maxBounce)
 
   m_mlt.memTaken      += pathVertexSizeHit;
   m_mlt.memTaken      += pathVertexSizeSup;
-  m_mlt.memTaken      += 2*sizeof(float) *m_rays.MEGABLOCKSIZE*a_maxBounce;
+  m_mlt.memTaken      += 2*sizeof(float) *m_rays.MEGABLOCKSIZE*(a_maxBounce+1);
   
   if (ciErr1 != CL_SUCCESS)
     RUN_TIME_ERROR("[cl_core.MLT_Alloc]: Failed to alloc vertex storage and pdf array ");
@@ -238,22 +246,30 @@ size_t GPUOCLLayer::MLT_Alloc(int a_maxBounce)
   if (ciErr1 != CL_SUCCESS) 
     RUN_TIME_ERROR("Error in clCreateBuffer");
 
+  m_mlt.depthRanges = clCreateBuffer(m_globals.ctx, CL_MEM_READ_ONLY,  256*sizeof(int2),   NULL, &ciErr1);
+  if (ciErr1 != CL_SUCCESS) 
+    RUN_TIME_ERROR("Error in clCreateBuffer");
+  m_mlt.depthStat   = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 2*256*sizeof(float), NULL, &ciErr1);
+  if (ciErr1 != CL_SUCCESS) 
+    RUN_TIME_ERROR("Error in clCreateBuffer");
+  m_mlt.depthRangesCPU.resize(256);
+  m_mlt.depthStatCPU.resize(2*256);
+
   if(!scan_alloc_internal(m_rays.MEGABLOCKSIZE, m_globals.ctx))
     RUN_TIME_ERROR("Error in scan_alloc_internal");
 
-  m_mlt.pathAuxColor     = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE,                         4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
-  m_mlt.pathAuxColorCPU  = clCreateBuffer(m_globals.ctx, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);  
-  m_mlt.pathAuxColor2    = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE,                         4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
-  m_mlt.pathAuxColorCPU2 = clCreateBuffer(m_globals.ctx, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);  
+  m_mlt.yMultAlpha         = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
+  m_mlt.xMultOneMinusAlpha = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
   if (ciErr1 != CL_SUCCESS) 
     RUN_TIME_ERROR("Error in clCreateBuffer");
   m_mlt.memTaken += 8*sizeof(float)*m_rays.MEGABLOCKSIZE; 
 
-  m_mlt.yMultAlpha         = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
-  m_mlt.xMultOneMinusAlpha = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 4 * sizeof(cl_float)*m_rays.MEGABLOCKSIZE, NULL, &ciErr1);
+  m_mlt.colorDevice = clCreateBuffer(m_globals.ctx, CL_MEM_READ_WRITE, 4 * sizeof(cl_float)*m_width*m_height, NULL, &ciErr1);
   if (ciErr1 != CL_SUCCESS) 
-    RUN_TIME_ERROR("Error in clCreateBuffer");
-  m_mlt.memTaken += 4*sizeof(float)*m_rays.MEGABLOCKSIZE; 
+    RUN_TIME_ERROR("[cl_core.MLT_Alloc]: Failed to alloc colorDevice ");
+  m_mlt.memTaken += 4*sizeof(float)*m_width*m_height;
+
+  memsetf4(m_mlt.colorDevice, float4(0,0,0,0), m_width*m_height, 0);
 
   return m_mlt.memTaken;if(!scan_alloc_internal(m_rays.MEGABLOCKSIZE, m_globals.ctx))
     RUN_TIME_ERROR("Error in scan_alloc_internal");
@@ -475,6 +491,69 @@ void GPUOCLLayer::runKernel_AcceptReject(cl_mem a_xVector, cl_mem a_yVector, cl_
 }
 
 
+void GPUOCLLayer::runKernel_SplatSamplesAtomic(cl_mem in_color, size_t a_size, int a_width, int a_height,
+                                               cl_mem out_color, float a_mult)
+{
+  cl_kernel kernX      = m_progs.screen.kernel("SplatSamplesAtomic");
+
+  size_t localWorkSize = 256;
+  int            isize = int(a_size);
+  a_size               = roundBlocks(a_size, int(localWorkSize));
+
+  CHECK_CL(clSetKernelArg(kernX, 0, sizeof(cl_mem), (void*)&in_color));
+  CHECK_CL(clSetKernelArg(kernX, 1, sizeof(cl_int), (void*)&isize));
+  CHECK_CL(clSetKernelArg(kernX, 2, sizeof(cl_int), (void*)&a_width));
+  CHECK_CL(clSetKernelArg(kernX, 3, sizeof(cl_int), (void*)&a_height));
+  CHECK_CL(clSetKernelArg(kernX, 4, sizeof(cl_float), (void*)&a_mult));
+  CHECK_CL(clSetKernelArg(kernX, 5, sizeof(cl_mem), (void*)&out_color));
+
+  CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, kernX, 1, NULL, &a_size, &localWorkSize, 0, NULL, NULL));
+  waitIfDebug(__FILE__, __LINE__);
+}
+
+/**
+\brief Move indirect light accumulated on device to shared image and clear device image. Spp is not published here, MMLT image is normalized by average brightness.
+*/
+void GPUOCLLayer::MMLT_FlushSplats()
+{
+  if (m_mlt.colorDevice == nullptr || m_pExternalImage == nullptr || m_mlt.passesNotFlushed == 0)
+    return;
+
+  std::vector<float4, aligned16<float4> > temp(m_width*m_height);
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_mlt.colorDevice, CL_TRUE, 0, temp.size()*sizeof(cl_float4), temp.data(), 0, NULL, NULL));
+
+  if (ContribToSharedImage(m_pExternalImage, 0, temp.data(), 0.0f, 250)) // if image is locked, splats stay on device until the next flush
+  {
+    memsetf4(m_mlt.colorDevice, float4(0,0,0,0), m_width*m_height, 0);
+    m_mlt.passesNotFlushed = 0;
+  }
+}
+
+/**
+\brief Get indirect light image of MMLT: device accumulation image plus the part that was already flushed to host frame buffer.
+\param a_temp - temporary storage for device data
+\return pointer to image of m_width*m_height size
+*/
+const float4* GPUOCLLayer::MMLT_IndirectImage(std::vector<float4>& a_temp) const
+{
+  int width, height;
+  const float4* color0 = GetCPUScreenBuffer(0, width, height);
+  if (m_mlt.colorDevice == nullptr || m_mlt.passesNotFlushed == 0)
+    return color0;
+
+  a_temp.resize(m_width*m_height);
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_mlt.colorDevice, CL_TRUE, 0, a_temp.size()*sizeof(cl_float4), a_temp.data(), 0, NULL, NULL));
+
+  if (color0 != nullptr)
+  {
+    #pragma omp parallel for
+    for (int i = 0; i < int(a_temp.size()); i++)
+      a_temp[i] = a_temp[i] + color0[i];
+  }
+
+  return a_temp.data();
+}
+
 void GPUOCLLayer::runKernel_MMLTInitSplitAndCamV(cl_mem a_flags, cl_mem a_color, cl_mem a_split, cl_mem a_hitSup,
                                                  size_t a_size)
 {
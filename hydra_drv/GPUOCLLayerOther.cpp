@@ -18,7 +18,7 @@ void GPUOCLLayer::AddContributionToScreen(cl_mem& in_color, cl_mem in_indices, b
     assert(resultPtr != nullptr);
 
     AddContributionToScreenCPU(in_color, int(m_rays.MEGABLOCKSIZE), width, height,
-                               resultPtr, a_repackIndex);
+                               resultPtr, a_layerId, a_repackIndex);
   }
   else
   {
@@ -36,6 +36,65 @@ void GPUOCLLayer::AddContributionToScreen(cl_mem& in_color, cl_mem in_indices, b
   m_passNumber++;
 }
 
+void GPUOCLLayer::AddPerPixelContributionToScreen(cl_mem in_color)
+{
+  const int pixelsNum = m_width*m_height;
+
+  if (m_screen.m_cpuFrameBuffer)
+  {
+    int width, height;
+    float4* resultPtr = const_cast<float4*>( GetCPUScreenBuffer(0, width, height) );
+
+    assert(resultPtr != nullptr);
+
+    if (m_dlres.colorCPU.size() != size_t(pixelsNum))
+      m_dlres.colorCPU.resize(pixelsNum);
+
+    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, in_color, CL_TRUE, 0, pixelsNum*sizeof(cl_float4), m_dlres.colorCPU.data(), 0, NULL, NULL));
+
+    float4* colors = m_dlres.colorCPU.data();
+
+    float4* target = (m_pExternalImage != nullptr) ? SharedImageStaging(0) : resultPtr; // shared image is locked only to move staged samples
+
+    #pragma omp parallel for
+    for (int i = 0; i < pixelsNum; i++) // only color is accumulated, alpha may hold other data
+    {
+      target[i].x += colors[i].x;
+      target[i].y += colors[i].y;
+      target[i].z += colors[i].z;
+    }
+
+    if (m_pExternalImage != nullptr)
+      FlushSharedImageStaging(0, 1.0f, 250);
+
+    m_sppDone += 1.0f;
+  }
+  else
+  {
+    cl_kernel contribKern      = m_progs.screen.kernel("ContribPerPixelToScreen");
+    size_t global_item_size[2] = { size_t(m_width), size_t(m_height) };
+    size_t local_item_size[2]  = { 16, 16 };
+
+    RoundBlocks2D(global_item_size, local_item_size);
+
+    const float invGamma = 1.0f/m_globsBuffHeader.varsF[HRT_IMAGE_GAMMA];
+    const float scale    = 1.0f/(m_spp + 1.0f);
+
+    CHECK_CL(clSetKernelArg(contribKern, 0, sizeof(cl_mem),   (void*)&in_color));
+    CHECK_CL(clSetKernelArg(contribKern, 1, sizeof(cl_float), (void*)&scale));
+    CHECK_CL(clSetKernelArg(contribKern, 2, sizeof(cl_float), (void*)&invGamma));
+    CHECK_CL(clSetKernelArg(contribKern, 3, sizeof(cl_int),   (void*)&m_width));
+    CHECK_CL(clSetKernelArg(contribKern, 4, sizeof(cl_int),   (void*)&m_height));
+    CHECK_CL(clSetKernelArg(contribKern, 5, sizeof(cl_mem),   (void*)&m_screen.color0));
+    CHECK_CL(clSetKernelArg(contribKern, 6, sizeof(cl_mem),   (void*)&m_screen.pbo));
+
+    CHECK_CL(clEnqueueNDRangeKernel(m_globals.cmdQueue, contribKern, 2, NULL, global_item_size, local_item_size, 0, NULL, NULL));
+    waitIfDebug(__FILE__, __LINE__);
+  }
+
+  m_passNumber++;
+}
+
 /**
 \brief Add contribution
 \param out_color  - out float4 image of size a_width*a_height
@@ -99,72 +158,7 @@ void AddSamplesContributionS(float4* out_color, const float4* colors, const unsi
 }
 
 
-void GPUOCLLayer::AddContributionToScreenCPU2(cl_mem& in_color, cl_mem& in_color2, int a_size, int a_width, int a_height, float4* out_color)
-{
-  clFlush(m_globals.cmdQueue);
-
-  // (2) sync copy of data (sync asyncronious call in future, pin pong) and eval contribution
-  //
-  if (m_passNumber != 0)
-  {
-    clEnqueueCopyBuffer(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColor,  m_mlt.pathAuxColorCPU,  0, 0, a_size * sizeof(float4), 0, nullptr, nullptr);
-    clEnqueueCopyBuffer(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColor2, m_mlt.pathAuxColorCPU2, 0, 0, a_size * sizeof(float4), 0, nullptr, nullptr);
-
-    cl_int ciErr1  = 0;
-    float4* colors1 = (float4*)clEnqueueMapBuffer(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColorCPU,  CL_TRUE, CL_MAP_READ, 0, a_size * sizeof(float4), 0, 0, 0, &ciErr1);
-    float4* colors2 = (float4*)clEnqueueMapBuffer(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColorCPU2, CL_TRUE, CL_MAP_READ, 0, a_size * sizeof(float4), 0, 0, 0, &ciErr1);
-
-    const float contribSPP = float(double(a_size) / double(a_width*a_height));
-
-    bool lockSuccess = (m_pExternalImage == nullptr);
-    if (m_pExternalImage != nullptr)
-      lockSuccess = m_pExternalImage->Lock(500); // can wait 500 ms for success lock
-
-    if (lockSuccess)
-    {
-      AddSamplesContribution(out_color, colors1, int(a_size), a_width, a_height);
-      AddSamplesContribution(out_color, colors2, int(a_size), a_width, a_height);
-
-      if (m_pExternalImage != nullptr)
-      {
-        m_pExternalImage->Header()->counterRcv++;
-        m_pExternalImage->Unlock();
-      }
-    }
-    else
-    {
-      std::cerr << "AddContributionToScreenCPU2, failed to lock image!" << std::endl;
-      std::cerr.flush();
-    }
-    m_sppDone += contribSPP;
-
-    clEnqueueUnmapMemObject(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColorCPU,  colors1, 0, 0, 0);
-    clEnqueueUnmapMemObject(m_globals.cmdQueueDevToHost, m_mlt.pathAuxColorCPU2, colors2, 0, 0, 0);
-  }
-
-  clFinish(m_globals.cmdQueueDevToHost);
-  clFinish(m_globals.cmdQueue);
-
-  //memsetf4(m_mlt.pathAuxColor,  float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
-  //memsetf4(m_mlt.pathAuxColor2, float4(0,0,0,0), m_rays.MEGABLOCKSIZE, 0);
-  //clFinish(m_globals.cmdQueue);
-
-  // (3) swap color buffers
-  //
-  {
-    cl_mem temp         = m_mlt.pathAuxColor;
-    m_mlt.pathAuxColor  = in_color;
-    in_color            = temp;
-
-    temp                = m_mlt.pathAuxColor2;
-    m_mlt.pathAuxColor2 = in_color2;
-    in_color2           = temp;
-  }
-
-  m_passNumber++;
-}
-
-void GPUOCLLayer::AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a_width, int a_height, float4* out_color, bool repackIndex)
+void GPUOCLLayer::AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a_width, int a_height, float4* out_color, int a_layerId, bool repackIndex)
 {
   // (1) compute compressed index in color.w; use runKernel_MakeEyeRaysAndClearUnified for that task if CPU FB is enabled!!!
   //
@@ -217,37 +211,21 @@ void GPUOCLLayer::AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a
 
     const float contribSPP = float(double(a_size) / double(a_width*a_height));
 
-    bool lockSuccess = (m_pExternalImage == nullptr);
-    if (m_pExternalImage != nullptr)
-      lockSuccess = m_pExternalImage->Lock(250); // can wait 250 ms for success lock
-
-    if (lockSuccess)
-    {
-      if (m_storeShadowInAlphaChannel)
-        AddSamplesContributionS(out_color, colors, (const unsigned char*)shadows, int(size), a_width, a_height);
-      else
-        AddSamplesContribution(out_color, colors, int(size), a_width, a_height);
+    // shared image may be updated by other processes at the same time, so samples are gathered to private image first
+    //
+    float4* target = (m_pExternalImage != nullptr) ? SharedImageStaging(a_layerId) : out_color;
 
-      if (m_pExternalImage != nullptr) //#TODO: if ((m_vars.m_flags & HRT_FORWARD_TRACING) == 0) IT IS DIFFERENT FOR LT !!!!!!!!!!
-      {
-        if (!ltPassOfIBPT) // don't update counters if this is only first pass of two-pass IBPT
-        {
-          m_pExternalImage->Header()->counterRcv++;
-          m_pExternalImage->Header()->spp += contribSPP;
-          m_sppContrib += contribSPP;
-        }
-        m_pExternalImage->Unlock();
-      }
-    }
+    if (m_storeShadowInAlphaChannel)
+      AddSamplesContributionS(target, colors, (const unsigned char*)shadows, int(size), a_width, a_height);
     else
-    {
-      std::cerr << "AddContributionToScreenCPU, failed to lock image!" << std::endl;
-      std::cerr.flush();
-    }
+      AddSamplesContribution(target, colors, int(size), a_width, a_height);
+
+    if (m_pExternalImage != nullptr) 
+      FlushSharedImageStaging(a_layerId, ltPassOfIBPT ? 0.0f : contribSPP, 250); // don't update spp if this is only first pass of two-pass IBPT
 
     m_sppDone += contribSPP;
 
-    if (measureTime && lockSuccess)
+    if (measureTime)
     {
       timeContrib = copyTimer.getElapsed();
       std::cout << "time copy    = " << timeCopy*1000.0f << std::endl;
@@ -285,6 +263,70 @@ void GPUOCLLayer::AddContributionToScreenCPU(cl_mem& in_color, int a_size, int a
   
 }
 
+/**
+\brief Add a_color to layer a_layerId of shared image under image lock and clear a_color.
+       Lock is held only for the add itself; samples are gathered to private image before, so other processes wait for a single pass over memory.
+       If image can't be locked, a_color is not changed and caller should keep it for the next attempt.
+\param a_pImage   - shared image
+\param a_layerId  - layer of shared image (0 - main, 1 - direct light of MMLT)
+\param a_color    - private image of m_width*m_height size
+\param a_spp      - samples per pixel in a_color; 'spp' and 'counterRcv' are not updated if it is 0
+\param a_lockTime - time in ms to wait for lock
+\return false if image was not locked
+*/
+bool GPUOCLLayer::ContribToSharedImage(IHRSharedAccumImage* a_pImage, int a_layerId, float4* a_color, float a_spp, int a_lockTime)
+{
+  if (!a_pImage->Lock(a_lockTime))
+  {
+    std::cerr << "GPUOCLLayer::ContribToSharedImage, failed to lock image!" << std::endl;
+    return false;
+  }
+
+  float* output      = a_pImage->ImageData(a_layerId);
+  float* input       = (float*)a_color;
+  const int size     = m_width*m_height;
+
+  #pragma omp parallel for
+  for (int i = 0; i < size; i++)
+  {
+    const __m128 color1 = _mm_load_ps(input  + i * 4);
+    const __m128 color2 = _mm_load_ps(output + i * 4);
+    _mm_store_ps(output + i * 4, _mm_add_ps(color1, color2));
+    _mm_store_ps(input  + i * 4, _mm_setzero_ps());
+  }
+
+  if (a_spp != 0.0f)
+  {
+    a_pImage->Header()->counterRcv++;
+    a_pImage->Header()->spp += a_spp;
+  }
+  a_pImage->Unlock();
+
+  m_sppContrib += a_spp;
+  return true;
+}
+
+/**
+\brief Private image where samples for layer a_layerId of shared image are gathered while shared image is locked by other processes.
+*/
+float4* GPUOCLLayer::SharedImageStaging(int a_layerId)
+{
+  auto& staging = (a_layerId == 0) ? m_screen.color0CPU : m_mlt.colorDLCPU;
+  if (staging.size() != size_t(m_width*m_height))
+    staging.resize(m_width*m_height);
+  return staging.data();
+}
+
+/**
+\brief Try to move staging image of layer a_layerId to shared image; spp of samples that were not moved yet is remembered until success.
+*/
+void GPUOCLLayer::FlushSharedImageStaging(int a_layerId, float a_spp, int a_lockTime)
+{
+  m_sharedSppPending[a_layerId] += a_spp;
+  if (ContribToSharedImage(m_pExternalImage, a_layerId, SharedImageStaging(a_layerId), m_sharedSppPending[a_layerId], a_lockTime))
+    m_sharedSppPending[a_layerId] = 0.0f;
+}
+
 void GPUOCLLayer::ContribToExternalImageAccumulator(IHRSharedAccumImage* a_pImage)
 {
   if (!m_screen.m_cpuFrameBuffer)
@@ -294,7 +336,7 @@ void GPUOCLLayer::ContribToExternalImageAccumulator(IHRSharedAccumImage* a_pImag
     CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_screen.color0, CL_TRUE, 0, m_width*m_height * sizeof(cl_float4), m_screen.color0CPU.data(), 0, NULL, NULL));
   }
 
-  float* input = (float*)m_screen.color0CPU.data();
+  float4* input = m_screen.color0CPU.data();
   if (input == nullptr)
   {
     std::cerr << "GPUOCLLayer::ContribToExternalImageAccumulator: nullptr internal image" << std::endl;
@@ -307,31 +349,11 @@ void GPUOCLLayer::ContribToExternalImageAccumulator(IHRSharedAccumImage* a_pImag
     return;
   }
 
-  const bool lockSuccess = a_pImage->Lock(100); // can wait 100 ms for success lock
-
-  if (lockSuccess)
+  if (ContribToSharedImage(a_pImage, 0, input, m_spp, 100)) // can wait 100 ms for success lock
   {
-    float* output  = a_pImage->ImageData(0);
-    const int size = m_width*m_height;
-
-    #pragma omp parallel for
-    for (int i = 0; i < size; i++)
-    {
-      const __m128 color1 = _mm_load_ps(input  + i * 4);
-      const __m128 color2 = _mm_load_ps(output + i * 4);
-      _mm_store_ps(output + i * 4, _mm_add_ps(color1, color2));
-    }
-
-    a_pImage->Header()->counterRcv++;
-    a_pImage->Header()->spp += m_spp;
-    a_pImage->Unlock();
-
+    m_sppDone += m_spp;
     ClearAccumulatedColor();
-
-    m_sppContrib += m_spp;
-    m_sppDone    += m_spp;
   }
-
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -341,7 +363,11 @@ void GPUOCLLayer::ContribToExternalImageAccumulator(IHRSharedAccumImage* a_pImag
 
 std::vector<int> GPUOCLLayer::MakeAllPixelsList()
 {
-  std::vector<int> allPixels(m_width*m_height);
+  const int4 crop     = m_vars.CropWindow(m_width, m_height); // whole screen if crop window is not set
+  const int  cropW    = crop.z - crop.x;
+  const int  cropH    = crop.w - crop.y;
+
+  std::vector<int> allPixels(cropW*cropH);
 
   //#pragma omp parallel for
   //for(int y=0;y<m_height;y++)
@@ -353,14 +379,14 @@ std::vector<int> GPUOCLLayer::MakeAllPixelsList()
 
   const int TILE_SIZE = 32;
 
-  const int maxXRounded = (int(m_width) / int(TILE_SIZE)) * TILE_SIZE;
-  const int maxYRounded = (int(m_height) / int(TILE_SIZE)) * TILE_SIZE;
+  const int maxXRounded = crop.x + (cropW / int(TILE_SIZE)) * TILE_SIZE;
+  const int maxYRounded = crop.y + (cropH / int(TILE_SIZE)) * TILE_SIZE;
 
   int top = 0;
 
-  for(int ty=0; ty<maxYRounded; ty+=TILE_SIZE)
+  for(int ty=crop.y; ty<maxYRounded; ty+=TILE_SIZE)
   {
-    for(int tx=0; tx<maxXRounded; tx+=TILE_SIZE)
+    for(int tx=crop.x; tx<maxXRounded; tx+=TILE_SIZE)
     {
       for(int y1=0;y1<TILE_SIZE;y1++)
       {
@@ -378,28 +404,25 @@ std::vector<int> GPUOCLLayer::MakeAllPixelsList()
 
   // push borders
   //
-  const int remX = m_width  - maxXRounded;
-  const int remY = m_height - maxYRounded;
-
-  for(int y = 0; y < m_height; y++)
+  for(int y = crop.y; y < crop.w; y++)
   {
-    for(int x = maxXRounded; x < m_width; x++)
+    for(int x = maxXRounded; x < crop.z; x++)
     {
       allPixels[top] = packXY1616(x,y);
       top++;
     }
   }
 
-  for(int x=0;x<maxXRounded;x++)
+  for(int x=crop.x;x<maxXRounded;x++)
   {
-    for(int y = maxYRounded; y < m_height; y++)
+    for(int y = maxYRounded; y < crop.w; y++)
     {
       allPixels[top] = packXY1616(x,y);
       top++;
     }
   }
 
-  assert(top == m_width*m_height);
+  assert(top == cropW*cropH);
 
   return allPixels;
 }
@@ -421,8 +444,8 @@ void GPUOCLLayer::RunProductionSamplingMode()
   //
   std::vector<int> allPixels = MakeAllPixelsList();
 
-  const int numPasses     = int( int64_t(m_width*m_height)*int64_t(PMPIX_SAMPLES) / int64_t(GetRayBuffSize()) );
   const int pixelsPerPass = GetRayBuffSize() / PMPIX_SAMPLES;
+  const int numPasses     = int( (allPixels.size() + pixelsPerPass - 1) / pixelsPerPass ); // crop window may be smaller than a single pass
 
   cl_int ciErr1 = CL_SUCCESS;
 
@@ -435,7 +458,7 @@ void GPUOCLLayer::RunProductionSamplingMode()
   std::vector<float4> pixColors(pixelsPerPass);
 
   CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, pixCoordGPU, CL_TRUE, 0, // CL_FALSECL_TRUE
-                                pixelsPerPass*sizeof(int), (void*)(allPixels.data() + 0), 0, NULL, NULL));
+                                std::min(pixelsPerPass, int(allPixels.size()))*sizeof(int), (void*)(allPixels.data() + 0), 0, NULL, NULL));
 
   int currPos = 0;
   bool earlyExit = false;
@@ -499,8 +522,9 @@ void GPUOCLLayer::RunProductionSamplingMode()
 
     if(pass < numPasses-1) // copy next pixels portion asynchronious
     {
+      const int pixelsInNextPass = std::min(pixelsPerPass, int(allPixels.size()) - (currPos + pixelsPerPass));
       CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, pixCoordGPU, CL_FALSE, 0,
-                                    pixelsInThisPass*sizeof(int), (void*)(allPixels.data() + currPos + pixelsPerPass), 0, NULL, NULL));
+                                    pixelsInNextPass*sizeof(int), (void*)(allPixels.data() + currPos + pixelsPerPass), 0, NULL, NULL));
       clFlush(m_globals.cmdQueue);
     }
 
@@ -538,37 +562,10 @@ void GPUOCLLayer::RunProductionSamplingMode()
 
   if(m_pExternalImage != nullptr && !earlyExit)
   {
-    float4* resultPtr = (float4*)m_pExternalImage->ImageData(0);
-    const int width   = m_pExternalImage->Header()->width;
-    const int height  = m_pExternalImage->Header()->height;
-
-    const bool lockSuccess = m_pExternalImage->Lock(1000); // can wait 1s for success lock
-
-    if (lockSuccess)
-    {
-      const int size = m_width*m_height;
-
-      #pragma omp parallel for
-      for(int i=0;i<size;i++)
-      {
-        const float4 color = m_screen.color0CPU[i];
-        resultPtr[i] += color;
-        m_screen.color0CPU[i] = float4(0,0,0,0);
-      }
-
-      m_pExternalImage->Header()->counterRcv++;
-      m_pExternalImage->Header()->spp += PMPIX_SAMPLES;
-      m_sppContrib                    += PMPIX_SAMPLES;
-
-      m_pExternalImage->Unlock();
+    FlushSharedImageStaging(0, PMPIX_SAMPLES, 1000); // can wait 1s for success lock
 
-      //std::cerr << "m_sppContrib        = " << m_sppContrib << std::endl;
-      //std::cerr << "HRT_CONTRIB_SAMPLES = " << m_vars.m_varsI[HRT_CONTRIB_SAMPLES] << std::endl;
-      //std::cerr << "flags.prod.mode     = " << (m_vars.m_flags & HRT_PRODUCTION_IMAGE_SAMPLING) << std::endl;
-
-      if(m_vars.m_varsI[HRT_BOX_MODE_ON] == 1 && m_sppContrib >= m_vars.m_varsI[HRT_CONTRIB_SAMPLES])  // to quit immediately
-        exit(0);
-    }
+    if(m_vars.m_varsI[HRT_BOX_MODE_ON] == 1 && m_sppContrib >= m_vars.m_varsI[HRT_CONTRIB_SAMPLES])  // to quit immediately
+      exit(0);
 
     m_sppDone += PMPIX_SAMPLES;
 
@@ -583,6 +580,18 @@ void GPUOCLLayer::RunProductionSamplingMode()
 
 void DebugSaveFuckingGBufferAsManyImages(int a_width, int a_height, const std::vector<GBufferAll>& gbuffer, const wchar_t* a_path);
 
+/**
+\brief Unlock shared image when G-buffer evaluation is finished or aborted by exception. 
+ Readers only know 'gbufferIsEmpty' values 1 and 0, so image stays locked during evaluation and 1 is kept if it was aborted.
+*/
+struct GBufferLockGuard
+{
+  GBufferLockGuard(IHRSharedAccumImage* a_pAccumImage) : pImage(a_pAccumImage) {}
+  ~GBufferLockGuard() { pImage->Unlock(); }
+
+  IHRSharedAccumImage* pImage;
+};
+
 void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vector<int32_t>& a_instIdByInstId)
 {
   // std::vector<float4> data1(m_width*m_height);
@@ -634,6 +643,7 @@ void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vec
   }
   /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// #TODO: refactor this
 
+  GBufferLockGuard lockGuard(a_pAccumImage);
 
   size_t  bufferSize = m_rays.MEGABLOCKSIZE;
   int32_t lineSize   = m_width * GBUFFER_SAMPLES;
@@ -645,12 +655,40 @@ void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vec
 
   int32_t linesPerBlock = int32_t(bufferSize / lineSize);
 
-  for (int32_t line = 0; line < m_height; line += linesPerBlock)
+  const int4 crop = m_vars.CropWindow(m_width, m_height); // eye rays are generated for whole lines, so only crop rows are evaluated
+
+  // without transparent materials alpha is known after the first hit, so there is no need to trace more bounces
+  //
+  int maxBounce = 2;
+  if ((m_vars.m_flags & HRT_SCENE_HAS_TRANSPARENCY) && m_vars.m_varsI[HRT_TRACE_DEPTH] > maxBounce)
+    maxBounce = m_vars.m_varsI[HRT_TRACE_DEPTH];
+
+  // remap instance id of finished lines on the host while GPU evaluates the next block
+  //
+  auto finishLines = [&](int32_t a_yBegin, int32_t a_yEnd)
+  {
+    #pragma omp parallel for
+    for (int32_t line = a_yBegin; line < a_yEnd; line++)
+    {
+      for (int x = 0; x < m_width; x++)
+      {
+        int oldInstId = as_int(data2[line*m_width + x].w);
+        if (oldInstId >= 0 && oldInstId < a_instIdByInstId.size())
+          data2[line*m_width + x].w = as_float(a_instIdByInstId[oldInstId]);
+      }
+    }
+  };
+
+  cl_event readEvents[2] = { nullptr, nullptr };
+  int32_t  prevBegin     = 0;
+  int32_t  prevEnd       = 0;
+
+  for (int32_t line = crop.y; line < crop.w; line += linesPerBlock)
   {
     int32_t yBegin = line;
     int32_t yEnd   = line + linesPerBlock;
-    if (yEnd > m_height)
-      yEnd = m_height;
+    if (yEnd > crop.w)
+      yEnd = crop.w;
 
     int32_t finalSize = (yEnd - yBegin)*lineSize;
 
@@ -674,13 +712,10 @@ void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vec
     //
     runKernel_GetGBufferSamples(m_rays.rayDir, m_rays.pathAccColor, m_rays.pathShadeColor, GBUFFER_SAMPLES, finalSize);
 
-    // (4) trace some more bounces to get alpha.
+    // (4) trace some more bounces to get alpha; first bounce hits are reused.
     //
     memsetf4(m_rays.pathThoroughput, make_float4(1, 1, 1, 1), finalSize);
 
-    int maxBounce = m_vars.m_varsI[HRT_TRACE_DEPTH];
-    if (maxBounce < 2)
-      maxBounce = 2;
     for (int bounce = 1; bounce < maxBounce; bounce++)
     {
       runKernel_NextTransparentBounce(m_rays.rayPos, m_rays.rayDir, m_rays.pathThoroughput, finalSize);
@@ -696,31 +731,35 @@ void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vec
 
     runKernel_PutAlphaToGBuffer(m_rays.pathThoroughput, m_rays.pathAccColor, finalSize);
 
-    // (5) pass them to the host mem
+    // (5) pass them to the host mem directly to the shared image
     //
-    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_rays.pathAccColor,    CL_FALSE, 0, (finalSize/GBUFFER_SAMPLES)*sizeof(float4), &data1[line*m_width], 0, NULL, NULL));
-    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_rays.pathShadeColor,  CL_FALSE, 0, (finalSize/GBUFFER_SAMPLES)*sizeof(float4), &data2[line*m_width], 0, NULL, NULL));
+    cl_event currEvents[2] = { nullptr, nullptr };
+    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_rays.pathAccColor,    CL_FALSE, 0, (finalSize/GBUFFER_SAMPLES)*sizeof(float4), &data1[line*m_width], 0, NULL, &currEvents[0]));
+    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_rays.pathShadeColor,  CL_FALSE, 0, (finalSize/GBUFFER_SAMPLES)*sizeof(float4), &data2[line*m_width], 0, NULL, &currEvents[1]));
+    clFlush(m_globals.cmdQueue);
 
-    for (int x = 0; x < m_width; x++)
+    // (6) finish previous block while current one is evaluated
+    //
+    if (readEvents[0] != nullptr)
     {
-      int* pInstId  = (int*)(&data2[line*m_width + x].w);
-      int oldInstId = (*pInstId);
-      if (oldInstId >= 0 && oldInstId <= a_instIdByInstId.size())
-        (*pInstId) = a_instIdByInstId[oldInstId];
+      CHECK_CL(clWaitForEvents(2, readEvents));
+      clReleaseEvent(readEvents[0]);
+      clReleaseEvent(readEvents[1]);
+      finishLines(prevBegin, prevEnd);
     }
-  }
 
-  clFinish(m_globals.cmdQueue);
+    readEvents[0] = currEvents[0];
+    readEvents[1] = currEvents[1];
+    prevBegin     = yBegin;
+    prevEnd       = yEnd;
+  }
 
-  #pragma omp parallel for
-  for (int32_t line = 0; line < m_height; line++)
+  if (readEvents[0] != nullptr)
   {
-    for (int x = 0; x < m_width; x++)
-    {
-      int oldInstId = as_int(data2[line*m_width + x].w);
-      if (oldInstId >= 0 && oldInstId < a_instIdByInstId.size())
-        data2[line*m_width + x].w = as_float(a_instIdByInstId[oldInstId]);
-    }
+    CHECK_CL(clWaitForEvents(2, readEvents));
+    clReleaseEvent(readEvents[0]);
+    clReleaseEvent(readEvents[1]);
+    finishLines(prevBegin, prevEnd);
   }
 
   // //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -736,9 +775,102 @@ void GPUOCLLayer::EvalGBuffer(IHRSharedAccumImage* a_pAccumImage, const std::vec
   // DebugSaveFuckingGBufferAsManyImages(m_width, m_height, gbuffer, L"gbufferout");
   // //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-  if (a_pAccumImage != nullptr)
+  a_pAccumImage->Header()->gbufferIsEmpty = 0; // image is still locked here
+}
+
+bool GPUOCLLayer::SaveCheckpoint(const char* a_fileName, uint64_t a_sceneHash)
+{
+  if (a_fileName == nullptr || m_checkpointWriter.IsBusy())
+    return false;
+
+  if (m_pExternalImage != nullptr) // shared image is owned and saved by main process
   {
-    a_pAccumImage->Header()->gbufferIsEmpty = 0;
-    a_pAccumImage->Unlock();
+    std::cerr << "GPUOCLLayer::SaveCheckpoint: checkpoints are not supported for shared image" << std::endl;
+    return false;
+  }
+
+  if (m_vars.m_flags & HRT_ENABLE_MMLT) // markov chains state is not stored
+  {
+    std::cerr << "GPUOCLLayer::SaveCheckpoint: checkpoints are not supported for MMLT" << std::endl;
+    return false;
   }
+
+  RenderCheckpoint checkpoint;
+  checkpoint.width         = m_width;
+  checkpoint.height        = m_height;
+  checkpoint.passNumberQMC = m_passNumberForQMC;
+  checkpoint.spp           = m_spp;
+  checkpoint.sppDL         = m_sppDL;
+  checkpoint.sceneHash     = a_sceneHash;
+  checkpoint.color.resize(m_width*m_height*4);
+  checkpoint.randState.resize(sizeof(RandomGen)*m_rays.MEGABLOCKSIZE);
+
+  // checkpoint vectors are staging buffers for non blocking reads; writer thread waits for them, so render thread never stalls on the copy.
+  // The queue is in order, so kernels enqueued after the reads can't change color0 and randGenState until they are finished.
+  //
+  std::vector<cl_event> readEvents;
+  readEvents.reserve(2);
+
+  if (m_screen.m_cpuFrameBuffer) // host image is accumulated by this thread, pipelined copy to it is already finished by AddContributionToScreenCPU
+    memcpy(checkpoint.color.data(), m_screen.color0CPU.data(), checkpoint.color.size()*sizeof(float));
+  else
+  {
+    cl_event readColor = 0;
+    CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_screen.color0, CL_FALSE, 0, checkpoint.color.size()*sizeof(float), checkpoint.color.data(), 0, NULL, &readColor));
+    readEvents.push_back(readColor);
+  }
+
+  cl_event readRand = 0;
+  CHECK_CL(clEnqueueReadBuffer(m_globals.cmdQueue, m_rays.randGenState, CL_FALSE, 0, checkpoint.randState.size(), checkpoint.randState.data(), 0, NULL, &readRand));
+  readEvents.push_back(readRand);
+  CHECK_CL(clFlush(m_globals.cmdQueue));
+
+  auto waitReads = [readEvents]() -> bool
+  {
+    const cl_int ciErr = clWaitForEvents(cl_uint(readEvents.size()), readEvents.data());
+    for (auto evt : readEvents)
+      clReleaseEvent(evt);
+    if (ciErr != CL_SUCCESS)
+      std::cerr << "GPUOCLLayer::SaveCheckpoint: failed to read device data, error = " << ciErr << std::endl;
+    return ciErr == CL_SUCCESS;
+  };
+
+  if (!m_checkpointWriter.Start(a_fileName, std::move(checkpoint), waitReads))
+  {
+    waitReads(); // reads must finish before staging buffers are freed
+    return false;
+  }
+
+  return true;
+}
+
+bool GPUOCLLayer::LoadCheckpoint(const char* a_fileName, uint64_t a_sceneHash)
+{
+  if (a_fileName == nullptr || m_pExternalImage != nullptr || (m_vars.m_flags & HRT_ENABLE_MMLT))
+    return false;
+
+  RenderCheckpoint checkpoint;
+  if (!LoadRenderCheckpoint(a_fileName, a_sceneHash, &checkpoint))
+    return false;
+
+  if (checkpoint.width != m_width || checkpoint.height != m_height || checkpoint.color.size() != size_t(m_width*m_height*4) ||
+      checkpoint.randState.size() != sizeof(RandomGen)*m_rays.MEGABLOCKSIZE)
+  {
+    std::cerr << "GPUOCLLayer::LoadCheckpoint: checkpoint does not match current resolution or device block size" << std::endl;
+    return false;
+  }
+
+  if (m_screen.m_cpuFrameBuffer)
+    memcpy(m_screen.color0CPU.data(), checkpoint.color.data(), checkpoint.color.size()*sizeof(float));
+  else
+    CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_screen.color0, CL_TRUE, 0, checkpoint.color.size()*sizeof(float), checkpoint.color.data(), 0, NULL, NULL));
+
+  CHECK_CL(clEnqueueWriteBuffer(m_globals.cmdQueue, m_rays.randGenState, CL_TRUE, 0, checkpoint.randState.size(), checkpoint.randState.data(), 0, NULL, NULL));
+
+  m_spp              = checkpoint.spp;
+  m_sppDL            = checkpoint.sppDL;
+  m_passNumberForQMC = checkpoint.passNumberQMC;
+
+  std::cout << "[cl_core]: continue from checkpoint, spp = " << int(m_spp) << std::endl;
+  return true;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "cglobals.h"
+#include <string>
 
 #define MAXBVHTREES 4
 
@@ -32,6 +33,18 @@ struct ConvertionResult
   int            treesNum;
 };
 
+/**
+\brief Layout queries for ConvertionResult::bvhType: "triangle4v" is a plain tree, "object" is a tree with instances; 
+       "_q8" suffix means compressed layout with 8-bit child boxes (see BVH4_QUANTIZED_LAYOUT_TAG).
+*/
+static inline bool BVHTypeIsQuantized(const char* a_bvhType)
+{
+  const std::string bvhType(a_bvhType);
+  return (bvhType.size() > 3) && (bvhType.substr(bvhType.size() - 3) == "_q8");
+}
+
+static inline bool BVHTypeHaveInst(const char* a_bvhType) { return (std::string(a_bvhType).find("triangle4v") != 0); }
+
 struct IBVHBuilder2 
 {
   IBVHBuilder2() {}
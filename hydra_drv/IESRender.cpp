@@ -26,11 +26,24 @@ namespace oldies
 
 enum IES_REFLECT { REFLECT4, REFLECT2, REFLECT0 };
 
-std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA, int* pW, int* pH);
+std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA, int* pW, int* pH, int* pPhiSym);
 std::vector<float> CreateTextureIESTypeB(oldies::IE_DATA, int* pW, int* pH);
 
-std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH)
+/**
+\brief  Rasterize IES profile to spherical texture.
+\param  a_iesData - path to ies file
+\param  pW        - out texture width  (phi)
+\param  pH        - out texture height (theta)
+\param  pPhiSym   - out lateral symmetry folding factor (1, 2 or 4). If it is not 1, texture covers only [0, 2*PI/(*pPhiSym)] range of phi 
+                     and it must be mirrored when read (see iesFoldTexCoordX in clight.h).
+\return single channel float texture of size (*pW)*(*pH).
+
+*/
+std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH, int* pPhiSym)
 {
+	if (pPhiSym != nullptr)
+		(*pPhiSym) = 1;
+
 	oldies::IE_DATA iesOldCrap;
 	memset(&iesOldCrap, 0, sizeof(oldies::IE_DATA));
 	bool read = (oldies::IE_ReadFile((char*)a_iesData.c_str(), &iesOldCrap) != 0);
@@ -49,7 +62,7 @@ std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, i
 	}
 	else if (iesOldCrap.photo.gonio_type == oldies::Type_C)
 	{
-		return CreateTextureIESTypeC(iesOldCrap, pW, pH);
+		return CreateTextureIESTypeC(iesOldCrap, pW, pH, pPhiSym);
 	}
 	else if (iesOldCrap.photo.gonio_type == oldies::Type_A)
 	{
@@ -241,7 +254,7 @@ std::vector<float> CreateTextureIESTypeB(oldies::IE_DATA iesOldCrap, int* pW, in
 	return resultData;
 }
 
-std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, int* pH)
+std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, int* pH, int* pPhiSym)
 {
 	int w = 0; // phi, 0-360
 	int h = 0; // theta, 0-180
@@ -262,6 +275,7 @@ std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, in
 		h = iesOldCrap.photo.num_vert_angles;
 
 	IES_REFLECT reflectType = REFLECT0;
+	int         phiSym      = 1;        // lateral symmetry of compact texture; 1 means full [0, 360] range of phi is stored
 
 	// The set of horizontal angles, listed in increasing order.The first angle must be 0�.
 	// The last angle determines the degree of lateral symmetry displayed by the intensity distribution.If it is 0�, the distribution is axially symmetric. 
@@ -274,13 +288,13 @@ std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, in
 		w = 1;
 	else if (fabs(horizontStart) < eps && fabs(horizontEnd - 90.0f) < eps) // 0-90, If it is 90�, the distribution is symmetric in each quadrant.
 	{
-		w = iesOldCrap.photo.num_horz_angles * 4;
-		reflectType = REFLECT4;
+		w      = iesOldCrap.photo.num_horz_angles; // store only first quadrant, mirror it on read
+		phiSym = 4;
 	}
 	else if (fabs(horizontStart) < eps && fabs(horizontEnd - 180.0f) < eps) // 0-180,  If it is 180�, the distribution is symmetric about a vertical plane.
 	{
-		w = iesOldCrap.photo.num_horz_angles * 2;
-		reflectType = REFLECT2;
+		w      = iesOldCrap.photo.num_horz_angles; // store only first half, mirror it on read
+		phiSym = 2;
 	}
 	else if (fabs(horizontStart - 90.0f) < eps && fabs(horizontEnd - 180.0f) < eps) // 90-180
 	{
@@ -315,7 +329,7 @@ std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, in
 		for (float phiGrad = horizontStart; (phiIndex < iesOldCrap.photo.num_horz_angles); phiGrad += stepPhi, phiIndex++)
 		{
 			float phi = DEG_TO_RAD * phiGrad;
-			int   iX = int((phi*0.5f*INV_PI)*float(w) + 0.5f);
+			int   iX = int((phi*0.5f*INV_PI)*float(w*phiSym) + 0.5f);
 			if (iX >= w)
 				iX = w - 1;
 
@@ -383,6 +397,7 @@ std::vector<float> CreateTextureIESTypeC(oldies::IE_DATA iesOldCrap, int* pW, in
 
 	if (pW != nullptr) (*pW) = w;
 	if (pH != nullptr) (*pH) = h;
+	if (pPhiSym != nullptr) (*pPhiSym) = phiSym;
 
 	oldies::IE_Flush(&iesOldCrap); // release resources
 
@@ -13,6 +13,7 @@
 #include "FastList.h"
 #include "IBVHBuilderAPI.h"
 #include "IMemoryStorage.h"
+#include "RenderCheckpoint.h"
 
 #include "../../HydraAPI/hydra_api/HydraAPI.h"
 #include "../../HydraAPI/hydra_api/HydraInternal.h"
@@ -31,6 +32,8 @@ struct AllRenderVarialbes
     m_varsF[HRT_ABLOW_SCALE_X]     = 1.0f;
     m_varsF[HRT_ABLOW_SCALE_Y]     = 1.0f;
     m_varsI[HRT_SHADOW_MATTE_BACK] = INVALID_TEXTURE;
+    m_varsF[HRT_CROP_MAX_X]        = 1.0f;
+    m_varsF[HRT_CROP_MAX_Y]        = 1.0f;
   }
 
   int          m_varsI[GMAXVARS];
@@ -42,6 +45,9 @@ struct AllRenderVarialbes
   void SetFlags(unsigned int bits, unsigned int a_value);
 
   bool shadePassEnable(int a_bounce, int a_minBounce, int a_maxBounce);
+
+  int4 CropWindow(int w, int h) const { return cropWindowPixels(m_varsF[HRT_CROP_MIN_X], m_varsF[HRT_CROP_MIN_Y], m_varsF[HRT_CROP_MAX_X], m_varsF[HRT_CROP_MAX_Y], w, h); } ///< crop window in pixels, (minX, minY, maxX, maxY)
+  bool CropEnabled(int w, int h) const { const int4 crop = CropWindow(w, h); return crop.x != 0 || crop.y != 0 || crop.z != w || crop.w != h; }
 };
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -165,6 +171,11 @@ public:
   virtual void SetNamedBuffer(const char* a_name, void* a_data, size_t a_size) {}
   virtual void CallNamedFunc(const char* a_name, const char* a_args) {}
 
+  // checkpoints of accumulated render state for preemptible machines
+  //
+  virtual bool SaveCheckpoint(const char* a_fileName, uint64_t a_sceneHash) { return false; } ///< copy state and write it in background; return false if not supported or previous checkpoint is still being written
+  virtual bool LoadCheckpoint(const char* a_fileName, uint64_t a_sceneHash) { return false; } ///< continue accumulation from checkpoint saved for the same a_sceneHash; call right after InitPathTracing
+
   virtual void RenderFullScreenBuffer(const char* a_dataName, float4* a_data, int width, int height, int a_spp) 
   {
     std::vector<ushort2> pixels(m_width*m_height);
@@ -191,6 +202,7 @@ public:
   // normalmap and aux computations
   //
   virtual std::vector<uchar4> NormalMapFromDisplacement(int w, int h, const uchar4* a_data, float bumpAmt, bool invHeight, float smoothLvl) { return std::vector<uchar4>(); }
+  virtual void DenoiseHDR(float4* a_color, const float4* a_gbuffer1, int w, int h, int a_windowRadius, float a_strength); ///< G-buffer guided filter for final frames; CPU implementation by default
 
   virtual void SetExternalImageAccumulator(IHRSharedAccumImage* a_pImage) { m_pExternalImage = a_pImage; } ///< pass accumulator to the HWLayer and contribute to implicit during each pass. for PT and MMLT.
 
@@ -276,6 +288,11 @@ public:
   void PrepareEngineGlobals();
   void PrepareEngineTables();
 
+  void CallNamedFunc(const char* a_name, const char* a_args) override;
+
+  bool SaveCheckpoint(const char* a_fileName, uint64_t a_sceneHash) override;
+  bool LoadCheckpoint(const char* a_fileName, uint64_t a_sceneHash) override;
+
   std::vector<uchar4> NormalMapFromDisplacement(int w, int h, const uchar4* a_data, float bumpAmt, bool invHeight, float smoothLvl);
 
 protected:
@@ -285,6 +302,8 @@ protected:
   Integrator*   m_pIntegrator;
   IBVHBuilder2* m_pBVHBuilder;
 
+  RenderCheckpointWriter m_checkpointWriter;
+
   const int32_t*     m_instLightInstId;
   const float4x4*    m_instMatrices;
   int32_t            m_instMatrixNum;
@@ -329,6 +348,13 @@ enum {GPU_RT_MEMORY_FULL_SIZE_MODE     = 2,
       GPU_MMLT_THREADS_131K            = 65536*2,
       GPU_MMLT_THREADS_65K             = 65536*4,
       GPU_MMLT_THREADS_16K             = 65536*8,
+      GPU_RT_QUANTIZED_BVH             = 65536*16, ///< build compressed BVH layout with 8-bit child boxes
+      GPU_RT_COMPACT_BVH_LEAVES        = 65536*32, ///< store leaf triangles with shared vertices; saves memory for huge scenes
+      GPU_RT_NATIVE_BVH_BUILDER        = 65536*64, ///< build BVH with built-in SAH builder instead of embree (converted layout only)
+      GPU_RT_RAY_REORDER               = 65536*128,///< sort rays by direction octant and origin before tracing of secondary bounces
+      GPU_RT_BVH_ANALYTICS             = 65536*256,///< save BVH quality report after scene commit and traversal heatmaps on the CPU path
+      GPU_RT_SHORT_STACK_TRAVERSAL     = 65536*512,///< closest hit traversal with short stack and restart trail instead of full private stack
+      GPU_RT_KEEP_SCENE_RESIDENT       = 65536*1024,///< keep geometry, textures and BVH between scene library sessions; upload only changed objects
       };
 
 #define RECOMPILE_PROCTEX_FROM_STRING 
@@ -479,7 +479,7 @@ void CPUSharedData::SetAllBVH4(const ConvertionResult& convertedData, IBVHBuilde
       if (convertedData.pTriangleAlpha[i] != nullptr)
         m_bvhTrees[i].m_atbl.assign(convertedData.pTriangleAlpha[i], convertedData.pTriangleAlpha[i] + convertedData.triAfNum[i]);
 
-      m_bvhTrees[i].haveInst       = (std::string(convertedData.bvhType[i]) == "object");
+      m_bvhTrees[i].haveInst       = BVHTypeHaveInst(convertedData.bvhType[i]);
       m_bvhTrees[i].smoothOpacity  = (a_flags & BVH_ENABLE_SMOOTH_OPACITY) != 0;
 
       totalmembvh += convertedData.nodesNum[i] * sizeof(BVHNode);
@@ -583,6 +583,43 @@ void CPUSharedData::PrepareEngineGlobals()
  
 }
 
+void CPUSharedData::CallNamedFunc(const char* a_name, const char* a_args)
+{
+  if (m_pIntegrator == nullptr || a_name == nullptr)
+    return;
+
+  if (std::string(a_name) == "SaveTraversalHeatmaps" && a_args != nullptr)
+  {
+    const std::string path(a_args);
+    m_pIntegrator->DebugSaveTraversalHeatmaps(std::wstring(path.begin(), path.end()).c_str());
+  }
+}
+
+bool CPUSharedData::SaveCheckpoint(const char* a_fileName, uint64_t a_sceneHash)
+{
+  if (m_pIntegrator == nullptr || a_fileName == nullptr || m_checkpointWriter.IsBusy())
+    return false;
+
+  RenderCheckpoint checkpoint;
+  if (!m_pIntegrator->SaveCheckpoint(&checkpoint))
+    return false;
+  checkpoint.sceneHash = a_sceneHash;
+
+  return m_checkpointWriter.Start(a_fileName, std::move(checkpoint));
+}
+
+bool CPUSharedData::LoadCheckpoint(const char* a_fileName, uint64_t a_sceneHash)
+{
+  if (m_pIntegrator == nullptr || a_fileName == nullptr)
+    return false;
+
+  RenderCheckpoint checkpoint;
+  if (!LoadRenderCheckpoint(a_fileName, a_sceneHash, &checkpoint))
+    return false;
+
+  return m_pIntegrator->LoadCheckpoint(checkpoint);
+}
+
 SceneGeomPointers CPUSharedData::CollectPointersForCPUIntegrator()
 {
   SceneGeomPointers ptrs;
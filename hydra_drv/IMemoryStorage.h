@@ -27,6 +27,7 @@ struct IMemoryStorage
 
   virtual int32_t Update(int32_t id, const void* a_data, uint64_t a_sizeInBytes);                                  ///< can do realloc
   virtual void    UpdatePartial(int32_t id, const void* a_data, uint64_t a_offsetInBytes, uint64_t a_sizeInBytes); ///< in place update only
+  virtual void    Remove(int32_t id);                                                                               ///< drop id from table; its chunk is not reused until Clear()
 
   virtual std::vector<int32_t> GetTable();
 
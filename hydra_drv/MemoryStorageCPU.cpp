@@ -2,6 +2,7 @@
 #include <fstream>
 #include <assert.h>
 #include <cstring>
+#include <algorithm>
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -110,6 +111,16 @@ void IMemoryStorage::UpdatePartial(int32_t id, const void* a_data, uint64_t a_of
   MemCopyAt(offset, a_data, a_sizeInBytes);
 }
 
+void IMemoryStorage::Remove(int32_t id)
+{
+  if (objects.erase(id) == 0 || id != maxId)
+    return;
+
+  maxId = 0;
+  for (auto p = objects.begin(); p != objects.end(); ++p)
+    maxId = std::max(maxId, p->first);
+}
+
 std::vector<int32_t> IMemoryStorage::GetTable()
 {
   const int bytesPerBlock = GetAlignSizeInBytes();
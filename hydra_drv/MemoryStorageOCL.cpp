@@ -5,6 +5,8 @@ void MemoryStorageOCL::Clear()
 {
   m_currSize  = 0;
   m_totalSize = 0;
+  objects     = std::unordered_map<int, LChunk>();
+  maxId       = 0;
 }
 
 size_t MemoryStorageOCL::Reserve(uint64_t a_totalSize)
@@ -78,6 +80,8 @@ void MemoryStorageBothCPUAndGPU::Clear()
 {
   if(m_pStorageCPU != nullptr) m_pStorageCPU->Clear();
   if(m_pStorageGPU != nullptr) m_pStorageGPU->Clear();
+  objects = std::unordered_map<int, LChunk>();
+  maxId   = 0;
 }
 
 size_t MemoryStorageBothCPUAndGPU::Reserve(uint64_t a_totalSize) 
@@ -762,6 +762,7 @@ public:
     ((int*)m_plain.data)[MESH_LIGHT_MESH_OFFSET_ID]  = meshVerId;
     ((int*)m_plain.data)[MESH_LIGHT_TABLE_OFFSET_ID] = meshPdfId;
     ((int*)m_plain.data)[MESH_LIGHT_TRI_NUM]         = pLMesh->tIndicesNum / 3;
+    ((int*)m_plain.data)[MESH_LIGHT_EMISSION_TABLE_ID] = 0; // is set later by RenderDriverRTE::UpdateMeshLightEmissionTable if light has texture
 
     m_plain.data[PLIGHT_SURFACE_AREA]  = float(surfaceAreaTotal);
     ((int*)m_plain.data)[PLIGHT_TYPE]  = PLAIN_LIGHT_TYPE_MESH;
@@ -804,6 +805,20 @@ public:
     return 1;
   }
 
+  void SetPdfTableId(int32_t a_tableOrder, int32_t a_id) override
+  {
+    if (a_tableOrder == 0)
+      ((int*)m_plain.data)[MESH_LIGHT_EMISSION_TABLE_ID] = a_id;
+  }
+
+  int32_t GetPdfTableId(int32_t a_tableOrder) const override
+  {
+    if (a_tableOrder != 0)
+      return -1;
+    else
+      return ((int*)m_plain.data)[MESH_LIGHT_EMISSION_TABLE_ID];
+  }
+
   PlainLight Transform(const float4x4 a_matrix) const
   {
     PlainLight copy = m_plain; // apply matrix to copy
@@ -1609,6 +1609,11 @@ bool RenderDriverRTE::PutAbstractMaterialToStorage(const int32_t a_matId, std::s
     (*pTableOffset)   = oldSize * PLAIN_MATERIAL_DATA_SIZE;
   }
 
+  if (materialHasTransparency(&mdata[0]))
+    m_transparentMaterials.insert(a_matId);
+  else
+    m_transparentMaterials.erase(a_matId);
+
   // (3) send plain data to device 
   //
   m_pMaterialStorage->Update(a_matId, &mdata[0], mdata.size() * sizeof(PlainMaterial));
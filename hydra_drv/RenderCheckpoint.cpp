@@ -0,0 +1,145 @@
+#include "RenderCheckpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <memory>
+
+#include "../../HydraAPI/hydra_api/xxhash.h"
+
+constexpr static int RENDER_CHECKPOINT_VERSION = 2;
+
+struct RenderCheckpointFileHeader
+{
+  char     magic[8];
+  int32_t  version;
+  int32_t  width;
+  int32_t  height;
+  int32_t  passNumberQMC;
+  float    spp;
+  float    sppDL;
+  uint64_t colorNum;
+  uint64_t randStateSize;
+  uint64_t sceneHash;
+  uint64_t payloadHash;    ///< detects checkpoint written partially when process was killed
+};
+
+static uint64_t CheckpointPayloadHash(const RenderCheckpoint& a_data)
+{
+  uint64_t hash = XXH64(a_data.color.data(), a_data.color.size()*sizeof(float), RENDER_CHECKPOINT_VERSION);
+  return XXH64(a_data.randState.data(), a_data.randState.size(), hash);
+}
+
+bool SaveRenderCheckpoint(const std::string& a_path, const RenderCheckpoint& a_data)
+{
+  RenderCheckpointFileHeader header;
+  memcpy(header.magic, "HRCKPT\0\0", 8);
+  header.version       = RENDER_CHECKPOINT_VERSION;
+  header.width         = a_data.width;
+  header.height        = a_data.height;
+  header.passNumberQMC = a_data.passNumberQMC;
+  header.spp           = a_data.spp;
+  header.sppDL         = a_data.sppDL;
+  header.colorNum      = a_data.color.size();
+  header.randStateSize = a_data.randState.size();
+  header.sceneHash     = a_data.sceneHash;
+  header.payloadHash   = CheckpointPayloadHash(a_data);
+
+  // write to temporary file and rename it, so the previous checkpoint stays valid until the new one is complete
+  //
+  const std::string tmpPath = a_path + ".tmp";
+  {
+    std::ofstream fout(tmpPath.c_str(), std::ios::binary);
+    if (!fout.is_open())
+    {
+      std::cerr << "SaveRenderCheckpoint: can't open file " << tmpPath.c_str() << std::endl;
+      return false;
+    }
+
+    fout.write((const char*)&header, sizeof(header));
+    fout.write((const char*)a_data.color.data(), a_data.color.size()*sizeof(float));
+    fout.write((const char*)a_data.randState.data(), a_data.randState.size());
+
+    if (!fout.good())
+    {
+      std::cerr << "SaveRenderCheckpoint: can't write file " << tmpPath.c_str() << std::endl;
+      return false;
+    }
+  }
+
+  std::remove(a_path.c_str()); // rename does not overwrite existing file on windows
+  return std::rename(tmpPath.c_str(), a_path.c_str()) == 0;
+}
+
+bool LoadRenderCheckpoint(const std::string& a_path, uint64_t a_sceneHash, RenderCheckpoint* a_pData)
+{
+  std::ifstream fin(a_path.c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return false;
+
+  RenderCheckpointFileHeader header;
+  fin.read((char*)&header, sizeof(header));
+
+  if (!fin.good() || memcmp(header.magic, "HRCKPT\0\0", 8) != 0 || header.version != RENDER_CHECKPOINT_VERSION)
+  {
+    std::cerr << "LoadRenderCheckpoint: bad checkpoint file " << a_path.c_str() << std::endl;
+    return false;
+  }
+
+  if (header.sceneHash != a_sceneHash)
+  {
+    std::cerr << "LoadRenderCheckpoint: checkpoint " << a_path.c_str() << " was saved for other scene or render settings" << std::endl;
+    return false;
+  }
+
+  a_pData->width         = header.width;
+  a_pData->height        = header.height;
+  a_pData->passNumberQMC = header.passNumberQMC;
+  a_pData->spp           = header.spp;
+  a_pData->sppDL         = header.sppDL;
+  a_pData->sceneHash     = header.sceneHash;
+
+  a_pData->color.resize(header.colorNum);
+  a_pData->randState.resize(header.randStateSize);
+
+  fin.read((char*)a_pData->color.data(), a_pData->color.size()*sizeof(float));
+  fin.read((char*)a_pData->randState.data(), a_pData->randState.size());
+
+  if (!fin.good() || CheckpointPayloadHash(*a_pData) != header.payloadHash)
+  {
+    std::cerr << "LoadRenderCheckpoint: damaged checkpoint file " << a_path.c_str() << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool RenderCheckpointWriter::IsBusy() const
+{
+  return m_job.valid() && m_job.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+bool RenderCheckpointWriter::Start(const std::string& a_path, RenderCheckpoint&& a_data, std::function<bool()> a_waitData)
+{
+  if (IsBusy())
+    return false;
+
+  Wait(); // get result of previous job to release it
+
+  auto pData = std::make_shared<RenderCheckpoint>(std::move(a_data)); // vectors storage is moved, so pending reads to it are still valid
+  m_job      = std::async(std::launch::async, [a_path, pData, a_waitData]() 
+  { 
+    if (a_waitData != nullptr && !a_waitData())
+      return false;
+    return SaveRenderCheckpoint(a_path, *pData); 
+  });
+  return true;
+}
+
+void RenderCheckpointWriter::Wait()
+{
+  if (m_job.valid() && !m_job.get())
+    std::cerr << "RenderCheckpointWriter: failed to write checkpoint" << std::endl;
+}
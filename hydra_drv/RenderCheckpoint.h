@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <future>
+#include <functional>
+
+/**
+\brief Compact binary checkpoint of accumulated render state. Allows restarted process to continue rendering on preemptible machines.
+       Random generator states and QMC pass number are stored as well, so continued render gets the same sample sequences as uninterrupted one.
+*/
+struct RenderCheckpoint
+{
+  RenderCheckpoint() : width(0), height(0), passNumberQMC(0), spp(0.0f), sppDL(0.0f), sceneHash(0) {}
+
+  int32_t  width;
+  int32_t  height;
+  int32_t  passNumberQMC;
+  float    spp;                   ///< samples per pixel that are already in 'color'
+  float    sppDL;
+  uint64_t sceneHash;             ///< hash of scene and render settings the checkpoint was rendered with
+
+  std::vector<float>   color;     ///< accumulated image, 4 floats per pixel
+  std::vector<uint8_t> randState; ///< raw random generator states; layout is defined by the HW layer or integrator that saved them
+};
+
+bool SaveRenderCheckpoint(const std::string& a_path, const RenderCheckpoint& a_data);
+bool LoadRenderCheckpoint(const std::string& a_path, uint64_t a_sceneHash, RenderCheckpoint* a_pData); ///< return false if file is damaged or was saved for other scene
+
+/**
+\brief Write checkpoints in a background thread. If previous checkpoint is still being written, the new one is skipped, so render never waits for disk.
+*/
+struct RenderCheckpointWriter
+{
+  ~RenderCheckpointWriter() { Wait(); }
+
+  bool IsBusy() const;
+  bool Start(const std::string& a_path, RenderCheckpoint&& a_data, std::function<bool()> a_waitData = nullptr); ///< return false if previous checkpoint is not finished yet; a_waitData is called in background thread before writing, i.e. to wait for async device reads to a_data
+  void Wait();
+
+protected:
+
+  std::future<bool> m_job;
+};
@@ -1,4 +1,7 @@
 #include "RenderDriverRTE.h"
+#include "BVHBuilderNative.h"
+#include "CPUImageOutput.h"
+#include "cdenoise.h"
 #pragma warning(disable:4996) // for wcsncpy to be ok
 
 #include <iostream>
@@ -6,11 +9,13 @@
 #include <string>
 #include <regex>
 #include <chrono>
+#include <algorithm>
 
 #include "../../HydraAPI/hydra_api/HydraXMLHelpers.h"
 #include "../../HydraAPI/hydra_api/HydraInternal.h"
 
 #include "../../HydraAPI/hydra_api/vfloat4_x64.h"
+#include "../../HydraAPI/hydra_api/xxhash.h"
 
 #ifdef WIN32
 using cvex::operator-;
@@ -92,25 +97,34 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
   m_pHWLayer->SetProgressBarCallback(&UpdateProgress);
  
   m_firstResizeOfScreen = true;
+  if ((m_initFlags & GPU_RT_NATIVE_BVH_BUILDER) && m_useConvertedLayout) // native builder can't trace rays on CPU, so it is used for converted layout only
+    m_pBVH = CreateNativeBVHBuilder(nullptr);
+  else
+  {
 #ifdef WIN32
-  m_pBVH = CreateBuilderFromDLL(L"bvh_builder.dll", "");
+    m_pBVH = CreateBuilderFromDLL(L"bvh_builder.dll", "");
 #else
-  m_pBVH = CreateBuilder2("");
+    m_pBVH = CreateBuilder2("");
 #endif
+  }
   
   if (m_pBVH != nullptr)
   {
-    if (m_useBvhInstInsert)
-      m_pBVH->Init("-allow_insert_copy 1");
-    else
-      m_pBVH->Init("-allow_insert_copy 0");
+    std::string bvhCfg = m_useBvhInstInsert ? "-allow_insert_copy 1" : "-allow_insert_copy 0";
+    if (m_initFlags & GPU_RT_QUANTIZED_BVH)
+      bvhCfg += " -quantized_bvh 1";
+    if (m_initFlags & GPU_RT_COMPACT_BVH_LEAVES)
+      bvhCfg += " -compact_leaves 1";
+    m_pBVH->Init(bvhCfg.c_str());
   }
   else
   {
     std::cerr << "can't load 'bvh_builder.dll' " << std::endl;
   }
 
-  m_needToFreeCPUMem = (m_devId >= 0); // not a CPU device!!!
+  m_needToFreeCPUMem = (m_devId >= 0) && !(m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT); // not a CPU device!!! resident scene needs host copy of meshes to rebuild BVH
+  m_bvhSceneHash     = 0;
+  m_dropStaleResident = false;
  
   //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
   ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -137,6 +151,15 @@ RenderDriverRTE::RenderDriverRTE(const wchar_t* a_options, int w, int h, int a_d
   }
   
   m_drawPassNumber       = 0;
+  m_saveTraversalHeatmaps = false;
+  m_checkpointInterval    = 300.0f;
+  m_denoise               = false;
+  m_denoiseRadius         = GUIDED_DEFAULT_RADIUS;
+  m_denoiseStrength       = GUIDED_DEFAULT_STRENGTH;
+  m_exrInterval           = 0.0f;
+  m_exrAOVs               = false;
+  m_exrFinalDone          = false;
+  m_lastExrTime           = std::chrono::steady_clock::now();
   m_maxRaysPerPixel      = 1000000;
   m_shadowMatteBackTexId = INVALID_TEXTURE;
   m_shadowMatteBackGamma = 2.2f;
@@ -156,8 +179,47 @@ void RenderDriverRTE::ExecuteCommand(const wchar_t* a_cmd, wchar_t* a_out)
 #endif
 }
 
+enum CHECKPOINT_KEY { CKPT_SETTINGS  = 0, 
+                      CKPT_CAMERA    = 1, 
+                      CKPT_TEXTURE   = 2,  // scene objects keys go after settings and camera, they are cleared in ClearAll
+                      CKPT_MATERIAL  = 3, 
+                      CKPT_LIGHT     = 4, 
+                      CKPT_MESH      = 5, 
+                      CKPT_INSTANCES = 6,  // cleared in BeginScene
+};
+
+static uint64_t XmlNodeHash(pugi::xml_node a_node, uint64_t a_seed)
+{
+  std::wstringstream nodeText;
+  a_node.print(nodeText);
+  const std::wstring str = nodeText.str();
+  return XXH64(str.data(), str.size()*sizeof(wchar_t), a_seed);
+}
+
+/**
+\brief Combine hashes of settings, camera and all scene objects; mesh and texture data are identified by their xml (size, counts and file location).
+*/
+uint64_t RenderDriverRTE::CheckpointSceneHash() const
+{
+  uint64_t hash = 0;
+  for (const auto& key : m_checkpointKeys)
+  {
+    const uint64_t data[3] = { uint64_t(key.first.first), uint64_t(key.first.second), key.second };
+    hash = XXH64(data, sizeof(data), hash);
+  }
+  return hash;
+}
+
 bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
 {
+  {
+    pugi::xml_document settingsCopy; // checkpoint file and interval don't change the image
+    pugi::xml_node     settingsNode = settingsCopy.append_copy(a_settingsNode);
+    settingsNode.remove_child(L"checkpoint_file");
+    settingsNode.remove_child(L"checkpoint_interval");
+    m_checkpointKeys[std::make_pair(int32_t(CKPT_SETTINGS), 0)] = XmlNodeHash(settingsNode, 0);
+  }
+
   const int oldWidth  = m_width;
   const int oldHeight = m_height;
 
@@ -330,6 +392,31 @@ bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
   if (a_settingsNode.child(L"seed") != nullptr)
     m_legacy.m_lastSeed = a_settingsNode.child(L"seed").text().as_int();
 
+  if (a_settingsNode.child(L"checkpoint_file") != nullptr)
+  {
+    const std::wstring path = a_settingsNode.child(L"checkpoint_file").text().as_string();
+    m_checkpointPath        = std::string(path.begin(), path.end());
+  }
+  if (a_settingsNode.child(L"checkpoint_interval") != nullptr)
+    m_checkpointInterval = a_settingsNode.child(L"checkpoint_interval").text().as_float();
+
+  if (a_settingsNode.child(L"denoise") != nullptr)
+    m_denoise = (a_settingsNode.child(L"denoise").text().as_int() != 0);
+  if (a_settingsNode.child(L"denoise_radius") != nullptr)
+    m_denoiseRadius = a_settingsNode.child(L"denoise_radius").text().as_int();
+  if (a_settingsNode.child(L"denoise_strength") != nullptr)
+    m_denoiseStrength = a_settingsNode.child(L"denoise_strength").text().as_float();
+
+  if (a_settingsNode.child(L"output_exr") != nullptr)
+  {
+    const std::wstring path = a_settingsNode.child(L"output_exr").text().as_string();
+    m_exrPath               = std::string(path.begin(), path.end());
+  }
+  if (a_settingsNode.child(L"output_exr_interval") != nullptr)
+    m_exrInterval = a_settingsNode.child(L"output_exr_interval").text().as_float();
+  if (a_settingsNode.child(L"output_exr_aovs") != nullptr)
+    m_exrAOVs = (a_settingsNode.child(L"output_exr_aovs").text().as_int() != 0);
+
   if(m_initFlags & GPU_RT_DO_NOT_PRINT_PASS_NUMBER)
     vars.m_varsI[HRT_SILENT_MODE] = 1;
 
@@ -369,6 +456,73 @@ bool RenderDriverRTE::UpdateSettings(pugi::xml_node a_settingsNode)
   else  
     vars.m_varsI[HRT_QMC_VARIANT] = 0;
 
+  // blue noise screen space sampler for low spp preview
+  //
+  if(a_settingsNode.child(L"blue_noise") != nullptr && a_settingsNode.child(L"blue_noise").text().as_int() == 1)
+    vars.m_flags |= HRT_ENABLE_BLUE_NOISE;
+  else
+    vars.m_flags = vars.m_flags & ~HRT_ENABLE_BLUE_NOISE;
+
+  // direct light preview with reservoir resampling
+  //
+  if(a_settingsNode.child(L"dl_reservoirs") != nullptr && a_settingsNode.child(L"dl_reservoirs").text().as_int() == 1)
+    vars.m_flags |= HRT_ENABLE_DL_RESERVOIRS;
+  else
+    vars.m_flags = vars.m_flags & ~HRT_ENABLE_DL_RESERVOIRS;
+
+  if(a_settingsNode.child(L"dl_reservoirs_candidates") != nullptr)
+    vars.m_varsI[HRT_DLRES_CANDIDATES] = std::max(a_settingsNode.child(L"dl_reservoirs_candidates").text().as_int(), 1);
+  else
+    vars.m_varsI[HRT_DLRES_CANDIDATES] = 32;
+
+  if(a_settingsNode.child(L"dl_reservoirs_spatial_taps") != nullptr)
+    vars.m_varsI[HRT_DLRES_SPATIAL_TAPS] = std::max(a_settingsNode.child(L"dl_reservoirs_spatial_taps").text().as_int(), 0);
+  else
+    vars.m_varsI[HRT_DLRES_SPATIAL_TAPS] = 4;
+
+  if(a_settingsNode.child(L"dl_reservoirs_temporal_max") != nullptr)
+    vars.m_varsI[HRT_DLRES_TEMPORAL_MAX] = std::max(a_settingsNode.child(L"dl_reservoirs_temporal_max").text().as_int(), 0);
+  else
+    vars.m_varsI[HRT_DLRES_TEMPORAL_MAX] = 20;
+
+  if(a_settingsNode.child(L"dl_reservoirs_radius") != nullptr)
+    vars.m_varsF[HRT_DLRES_SPATIAL_RADIUS] = std::max(a_settingsNode.child(L"dl_reservoirs_radius").text().as_float(), 1.0f);
+  else
+    vars.m_varsF[HRT_DLRES_SPATIAL_RADIUS] = 16.0f;
+
+  // crop window in pixels "minX minY maxX maxY" (max is exclusive); only unified path tracing samples inside it,
+  // light tracing and MMLT splat contribution to the whole frame, so they always render it entirely
+  //
+  vars.m_varsF[HRT_CROP_MIN_X] = 0.0f;
+  vars.m_varsF[HRT_CROP_MIN_Y] = 0.0f;
+  vars.m_varsF[HRT_CROP_MAX_X] = 1.0f;
+  vars.m_varsF[HRT_CROP_MAX_Y] = 1.0f;
+
+  const bool cropAllowed = (m_renderMethod == RENDER_METHOD_PT) && !(vars.m_flags & HRT_ENABLE_DL_RESERVOIRS);
+  if (a_settingsNode.child(L"crop_window") != nullptr && m_width > 0 && m_height > 0)
+  {
+    int minX = 0, minY = 0, maxX = m_width, maxY = m_height;
+    std::wstringstream inStr(a_settingsNode.child(L"crop_window").text().as_string());
+    inStr >> minX >> minY >> maxX >> maxY;
+
+    minX = std::max(minX, 0);
+    minY = std::max(minY, 0);
+    maxX = std::min(maxX, m_width);
+    maxY = std::min(maxY, m_height);
+
+    if (!cropAllowed)
+      std::cerr << "RenderDriverRTE: crop_window is supported for path tracing only, render whole frame" << std::endl;
+    else if (maxX <= minX || maxY <= minY)
+      std::cerr << "RenderDriverRTE: empty crop_window, render whole frame" << std::endl;
+    else
+    {
+      vars.m_varsF[HRT_CROP_MIN_X] = float(minX) / float(m_width);
+      vars.m_varsF[HRT_CROP_MIN_Y] = float(minY) / float(m_height);
+      vars.m_varsF[HRT_CROP_MAX_X] = float(maxX) / float(m_width);
+      vars.m_varsF[HRT_CROP_MAX_Y] = float(maxY) / float(m_height);
+    }
+  }
+
   m_pHWLayer->SetAllFlagsAndVars(vars);
 
   return true;
@@ -420,7 +574,9 @@ void RenderDriverRTE::ClearAll()
   /////////////////////////////////////////////////////////////////////////////////////////////////////////////
   /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-  if (m_pTexStorage != nullptr)
+  const bool keepResident = (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT) != 0; // geometry and textures are diffed against the next scene in UpdateMesh/UpdateImage
+
+  if (m_pTexStorage != nullptr && !keepResident)
   {
     delete m_pTexStorage;
     m_pTexStorage = nullptr;
@@ -432,7 +588,7 @@ void RenderDriverRTE::ClearAll()
     m_pTexStorageAux = nullptr;
   }
 
-  if (m_pGeomStorage != nullptr)
+  if (m_pGeomStorage != nullptr && !keepResident)
   {
     delete m_pGeomStorage;
     m_pGeomStorage = nullptr;
@@ -461,6 +617,7 @@ void RenderDriverRTE::ClearAll()
   m_iesCache.clear();
   m_materialUpdated.clear();
   m_materialNodes.clear();
+  m_transparentMaterials.clear();
   m_blendsToUpdate.clear();
   m_texturesProcessedNM.clear();
   m_procTextures.clear();
@@ -474,8 +631,19 @@ void RenderDriverRTE::ClearAll()
   m_auxImageNumber = 0;
   m_auxTexNormalsPerMat.clear();
 
+  m_pendingInstances.clear();
+  m_materialHash.clear();
+  if (!keepResident)
+  {
+    m_meshHash.clear();
+    m_texHash.clear();
+    m_bvhSceneHash = 0;
+  }
+
   m_haveAtLeastOneAOMat  = false;
   m_haveAtLeastOneAOMat2 = false;
+
+  m_checkpointKeys.erase(m_checkpointKeys.lower_bound(std::make_pair(int32_t(CKPT_TEXTURE), -1)), m_checkpointKeys.end());
 }
 
 std::shared_ptr<RAYTR::IMaterial> CreateDiffuseWhiteMaterial();
@@ -584,9 +752,12 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
 {
   m_libPath = std::wstring(a_info.libraryPath);
 
+  bool reuseResident = (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT) && m_pGeomStorage != nullptr && m_pTexStorage != nullptr;
+  const size_t residentMem = reuseResident ? (m_pGeomStorage->GetCapacity() + m_pTexStorage->GetCapacity()) : 0;
+
   const size_t maxBufferSize = m_pHWLayer->GetMaxBufferSizeInBytes();
   const size_t totalMem      = m_pHWLayer->GetAvaliableMemoryAmount(true);
-  const size_t freeMem       = m_pHWLayer->GetAvaliableMemoryAmount(false);
+  const size_t freeMem       = m_pHWLayer->GetAvaliableMemoryAmount(false) + residentMem; // resident storages will be reused or freed
   const size_t memUsedByR    = totalMem - freeMem;
   const size_t MB            = size_t(1024 * 1024);
 
@@ -681,9 +852,40 @@ HRDriverAllocInfo RenderDriverRTE::AllocAll(HRDriverAllocInfo a_info)
   newMemForMat       = std::min<size_t>(newMemForMat,  maxBufferSize);
   newMemForTab       = std::min<size_t>(newMemForTab,  maxBufferSize);
 
-  m_pTexStorage      = m_pHWLayer->CreateMemStorage(newMemForTex1, "textures");     // #TODO:  estimate this more carefully pls.
+  // storages are append-only: changed objects are put to the end and old chunks are never reclaimed;
+  // so resident storage is reused only if the whole new scene fits to its free tail
+  //
+  const bool reuseGeom = reuseResident && (m_pGeomStorage->GetSize() + newMemForGeo  <= m_pGeomStorage->GetCapacity());
+  const bool reuseTex  = reuseResident && (m_pTexStorage->GetSize()  + newMemForTex1 <= m_pTexStorage->GetCapacity());
+
+  if (reuseResident && !reuseGeom)
+  {
+    std::cout << "[AllocAll]: resident geometry storage is full, upload all meshes again" << std::endl;
+    delete m_pGeomStorage; m_pGeomStorage = nullptr;
+    m_meshHash.clear();
+    m_bvhSceneHash = 0;
+  }
+
+  if (reuseResident && !reuseTex)
+  {
+    std::cout << "[AllocAll]: resident texture storage is full, upload all textures again" << std::endl;
+    delete m_pTexStorage; m_pTexStorage = nullptr;
+    m_texHash.clear();
+    m_bvhSceneHash = 0;
+  }
+
+  if (reuseGeom || reuseTex)
+    std::cout << "[AllocAll]: reuse resident geometry (" << m_meshHash.size() << " meshes) and textures (" << m_texHash.size() << ")" << std::endl;
+
+  if (!reuseTex)
+    m_pTexStorage    = m_pHWLayer->CreateMemStorage(newMemForTex1, "textures");     // #TODO:  estimate this more carefully pls.
+  if (!reuseGeom)
+    m_pGeomStorage   = m_pHWLayer->CreateMemStorage(newMemForGeo,  "geom");         // #TODO:  estimate this more carefully pls.
+
+  m_meshSeen.clear();
+  m_texSeen.clear();
+  m_dropStaleResident = (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT) != 0;
   m_pTexStorageAux   = m_pHWLayer->CreateMemStorage(newMemForTex2, "textures_aux"); // #TODO:  estimate this more carefully pls.
-  m_pGeomStorage     = m_pHWLayer->CreateMemStorage(newMemForGeo,  "geom");         // #TODO:  estimate this more carefully pls.
   m_pMaterialStorage = m_pHWLayer->CreateMemStorage(newMemForMat,  "materials");
   m_pPdfStorage      = m_pHWLayer->CreateMemStorage(newMemForTab,  "pdfs");         // #TODO:  estimate this more carefully pls.
 
@@ -732,6 +934,9 @@ void RenderDriverRTE::GetLastErrorW(wchar_t a_msg[256])
 
 bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t bpp, const void* a_data, pugi::xml_node a_texNode)
 {
+  const int32_t texSize[3] = { w, h, bpp };
+  m_checkpointKeys[std::make_pair(int32_t(CKPT_TEXTURE), a_texId)] = XmlNodeHash(a_texNode, XXH64(texSize, sizeof(texSize), 0));
+
   std::wstring type = a_texNode.attribute(L"type").as_string();
 
   if (type == L"proc")
@@ -740,6 +945,24 @@ bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t
   if (a_data == nullptr)
     return false;
 
+  // skip texture if exactly the same one is already resident; target resolution is a part of the key
+  //
+  uint64_t texHash = 0;
+  if (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT)
+  {
+    auto pInfo = m_allTexInfo.find(a_texId);
+    const int32_t key[5] = { w, h, bpp,
+                             (pInfo != m_allTexInfo.end()) ? pInfo->second.aw : a_texNode.attribute(L"rwidth").as_int(),
+                             (pInfo != m_allTexInfo.end()) ? pInfo->second.ah : a_texNode.attribute(L"rheight").as_int() };
+
+    texHash = XXH64(a_data, size_t(w)*size_t(h)*size_t(bpp), XXH64(key, sizeof(key), 0));
+    m_texSeen.insert(a_texId);
+
+    auto pResident = m_texHash.find(a_texId);
+    if (pResident != m_texHash.end() && pResident->second == texHash)
+      return true;
+  }
+
   std::vector<uint32_t> dataResizedI;
   HDRImage4f dst;
 
@@ -810,6 +1033,9 @@ bool RenderDriverRTE::UpdateImage(int32_t a_texId, int32_t w, int32_t h, int32_t
   m_pTexStorage->UpdatePartial(a_texId, &texheader, 0, sizeof(SWTextureHeader));
   m_pTexStorage->UpdatePartial(a_texId, a_data, headerSize, inDataBSz);
 
+  if (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT)
+    m_texHash[a_texId] = texHash;
+
   return true;
 }
 
@@ -888,8 +1114,17 @@ bool RenderDriverRTE::UpdateMaterial(int32_t a_matId, pugi::xml_node a_materialN
   }
 
   m_materialUpdated[a_matId] = pMaterial; // remember that we have updates this material in current update phase (between BeginMaterialUpdate and EndMaterialUpdate)
+  m_checkpointKeys[std::make_pair(int32_t(CKPT_MATERIAL), a_matId)] = XmlNodeHash(a_materialNode, 0);
   m_materialNodes  [a_matId] = a_materialNode;
 
+  if (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT)
+  {
+    std::wstringstream nodeText;
+    a_materialNode.print(nodeText);
+    const std::wstring str = nodeText.str();
+    m_materialHash[a_matId] = XXH64(str.data(), str.size()*sizeof(wchar_t), 0);
+  }
+
   if (mtype == L"hydra_blend")  // put blend material to storage later
   {
     m_blendsToUpdate[a_matId] = DefferedMaterialDataTuple(pMaterial, a_materialNode);
@@ -904,6 +1139,8 @@ std::shared_ptr<RAYTR::ILight> CreateLightFromXmlNode(pugi::xml_node a_node, IMe
 
 bool RenderDriverRTE::UpdateLight(int32_t a_lightId, pugi::xml_node a_lightNode)
 {
+  m_checkpointKeys[std::make_pair(int32_t(CKPT_LIGHT), a_lightId)] = XmlNodeHash(a_lightNode, 0);
+
   const std::wstring ltype  = a_lightNode.attribute(L"type").as_string();
   const std::wstring lshape = a_lightNode.attribute(L"shape").as_string();
 
@@ -919,6 +1156,8 @@ bool RenderDriverRTE::UpdateLight(int32_t a_lightId, pugi::xml_node a_lightNode)
 
   if (ltype == L"sky" || (ltype == L"area" && lshape == L"cylinder"))
     UpdatePdfTablesForLight(a_lightId);
+  else if (lshape == L"mesh")
+    UpdateMeshLightEmissionTable(a_lightId, pLightMeshHeader);
 
   if (ltype == L"sky")
     m_skyLightsId.insert(a_lightId);
@@ -1011,8 +1250,37 @@ std::vector<float> CalcAuxShadowRaysOffsets(const HRMeshDriverInput& a_input)
 
 
 
+static uint64_t HashMeshInput(const HRMeshDriverInput& a_input)
+{
+  const size_t vertNum = size_t(a_input.vertNum);
+  const size_t triNum  = size_t(a_input.triNum);
+
+  uint64_t hash = XXH64(&a_input.vertNum, sizeof(a_input.vertNum), triNum);
+  hash = XXH64(a_input.pos4f,         vertNum*sizeof(float)*4, hash);
+  hash = XXH64(a_input.norm4f,        vertNum*sizeof(float)*4, hash);
+  hash = XXH64(a_input.tan4f,         vertNum*sizeof(float)*4, hash);
+  hash = XXH64(a_input.texcoord2f,    vertNum*sizeof(float)*2, hash);
+  hash = XXH64(a_input.indices,       triNum*sizeof(int)*3,    hash);
+  hash = XXH64(a_input.triMatIndices, triNum*sizeof(int),      hash);
+  return hash;
+}
+
 bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, const HRMeshDriverInput& a_input, const HRBatchInfo* a_batchList, int32_t listSize)
 {
+  const int32_t meshSize[2] = { a_input.vertNum, a_input.triNum };
+  m_checkpointKeys[std::make_pair(int32_t(CKPT_MESH), a_meshId)] = XmlNodeHash(a_meshNode, XXH64(meshSize, sizeof(meshSize), 0));
+
+  uint64_t meshHash = 0;
+  if (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT) // skip mesh if exactly the same one is already resident
+  {
+    meshHash = HashMeshInput(a_input);
+    m_meshSeen.insert(a_meshId);
+
+    auto pResident = m_meshHash.find(a_meshId);
+    if (pResident != m_meshHash.end() && pResident->second == meshHash)
+      return true;
+  }
+
   const int align     = int(m_pGeomStorage->GetAlignSizeInBytes());
   const int alignOffs = sizeof(int) * 4;
 
@@ -1109,6 +1377,9 @@ bool RenderDriverRTE::UpdateMesh(int32_t a_meshId, pugi::xml_node a_meshNode, co
   m_pGeomStorage->UpdatePartial(a_meshId, a_input.indices,       triIndOffset,   a_input.triNum  * 3 * sizeof(int));
   m_pGeomStorage->UpdatePartial(a_meshId, a_input.triMatIndices, triMIndOffset,  a_input.triNum  * sizeof(int));
   m_pGeomStorage->UpdatePartial(a_meshId, &shadowOffsets[0],     triSOffOffset,  a_input.triNum  * sizeof(float));
+
+  if (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT)
+    m_meshHash[a_meshId] = meshHash;
   
   return true;
 }
@@ -1128,6 +1399,8 @@ bool RenderDriverRTE::UpdateCamera(pugi::xml_node a_camNode)
   if (a_camNode == nullptr)
     return true;
 
+  m_checkpointKeys[std::make_pair(int32_t(CKPT_CAMERA), 0)] = XmlNodeHash(a_camNode, 0);
+
   m_camera.mUseMatrices = false;
 
   if (std::wstring(a_camNode.attribute(L"type").as_string()) == L"two_matrices")
@@ -1250,13 +1523,54 @@ void RenderDriverRTE::CalcCameraMatrices(float4x4* a_pModelViewMatrixInv, float4
   (*a_projMatrix)              = transpose(projTransposed);
 }
 
+void RenderDriverRTE::DropStaleResidentObjects()
+{
+  int meshNum = 0, texNum = 0;
+
+  for (auto p = m_meshHash.begin(); p != m_meshHash.end();)
+  {
+    if (m_meshSeen.find(p->first) == m_meshSeen.end())
+    {
+      m_pGeomStorage->Remove(p->first);
+      p = m_meshHash.erase(p);
+      meshNum++;
+    }
+    else
+      ++p;
+  }
+
+  for (auto p = m_texHash.begin(); p != m_texHash.end();)
+  {
+    if (m_texSeen.find(p->first) == m_texSeen.end())
+    {
+      m_pTexStorage->Remove(p->first);
+      p = m_texHash.erase(p);
+      texNum++;
+    }
+    else
+      ++p;
+  }
+
+  if (meshNum + texNum > 0)
+  {
+    std::cout << "[BeginScene]: drop " << meshNum << " stale resident meshes and " << texNum << " textures" << std::endl;
+    if (!m_texTable.empty())
+      m_texTable = m_pTexStorage->GetTable();
+  }
+}
+
 void RenderDriverRTE::BeginScene(pugi::xml_node a_sceneNode)
 {
-  if (m_pBVH != nullptr)
-    m_pBVH->ClearScene();
- 
+  if (m_dropStaleResident) // only first scene after AllocAll has all its meshes and textures passed to UpdateMesh/UpdateImage
+  {
+    DropStaleResidentObjects();
+    m_dropStaleResident = false;
+  }
+
   m_geomTable = m_pGeomStorage->GetTable();
 
+  m_pendingInstances.clear(); // BVH builder is cleared in EndScene, only if scene geometry was changed
+  m_checkpointKeys.erase(m_checkpointKeys.lower_bound(std::make_pair(int32_t(CKPT_INSTANCES), -1)), m_checkpointKeys.end());
   m_instMatricesInv.resize(0);
   m_lightsInstanced.resize(0);
   m_instLightInstId.resize(0);
@@ -1322,18 +1636,68 @@ size_t EstimateBVHSize(const ConvertionResult& a_bvh)
 }
 
 
-void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only those things that were changed
+/**
+\brief Hash of everything resident BVH depends on: instanced meshes, their matrices and alpha test materials/textures.
+\return 0 if some mesh is not known (i.e. was not put to storage via UpdateMesh in GPU_RT_KEEP_SCENE_RESIDENT mode)
+*/
+uint64_t RenderDriverRTE::CalcBVHSceneHash() const
 {
-  if (m_pBVH == nullptr)
-    return;
-  
-  auto timeBeg  = std::chrono::system_clock::now();
-  
-  std::cout << "[EndScene]: BVH wait ... " << std::endl;
-  if(m_pSysMutex != nullptr)
-    hr_lock_system_mutex(m_pSysMutex, 5000); // don't allow simultanoius bvh building in several processes
-  
-  std::cout << "[EndScene]: BVH build ... " << std::endl;
+  std::vector<uint64_t> keys;
+  keys.reserve(m_pendingInstances.size()*3 + m_materialHash.size()*2 + m_texHash.size()*2);
+
+  for (const auto& inst : m_pendingInstances)
+  {
+    auto p = m_meshHash.find(inst.meshId);
+    if (p == m_meshHash.end())
+      return 0;
+
+    keys.push_back(p->second);
+    keys.push_back(uint64_t(inst.treeId));
+    keys.push_back(XXH64(inst.matrices.data(), inst.matrices.size()*sizeof(float), 0));
+  }
+
+  std::vector< std::pair<int32_t, uint64_t> > sorted(m_materialHash.begin(), m_materialHash.end());
+  std::sort(sorted.begin(), sorted.end());
+  for (const auto& mat : sorted)
+  {
+    keys.push_back(uint64_t(mat.first));
+    keys.push_back(mat.second);
+  }
+
+  sorted.assign(m_texHash.begin(), m_texHash.end());
+  std::sort(sorted.begin(), sorted.end());
+  for (const auto& tex : sorted)
+  {
+    keys.push_back(uint64_t(tex.first));
+    keys.push_back(tex.second);
+  }
+
+  return XXH64(keys.data(), keys.size()*sizeof(uint64_t), 0) | 1; // never 0
+}
+
+void RenderDriverRTE::BuildBVHFromPendingInstances()
+{
+  m_pBVH->ClearScene();
+
+  const int4* ldata = (const int4*)m_pGeomStorage->GetBegin();
+
+  for (const auto& inst : m_pendingInstances)
+  {
+    const PlainMesh* pHeader = (const PlainMesh*)(ldata + m_geomTable[inst.meshId]);
+
+    IBVHBuilder2::InstanceInputData input;
+
+    input.vert4f     = (const float*)meshVerts(pHeader);
+    input.indices    = meshTriIndices(pHeader);
+    input.numVert    = pHeader->vPosNum;
+    input.numIndices = pHeader->tIndicesNum;
+
+    input.meshId     = inst.meshId;
+    input.matrices   = inst.matrices.data();
+    input.numInst    = int(inst.matrices.size() / 16);
+
+    m_pBVH->InstanceTriangleMeshes(input, inst.treeId, inst.instIdBase);
+  }
 
   m_pBVH->CommitScene();
   
@@ -1362,6 +1726,12 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
     //DebugSaveBVH("D:/temp/bvh_layers2", convertedData);
     //DebugPrintBVHInfo(convertedData, "z_bvhinfo.txt");
 
+    if (m_initFlags & GPU_RT_BVH_ANALYTICS)
+    {
+      DebugAnalyzeBVH(convertedData, "z_bvh_analytics.txt");
+      m_saveTraversalHeatmaps = true;
+    }
+
     m_pBVH->ConvertUnmap();
     
 
@@ -1389,6 +1759,30 @@ void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only th
  
 
   m_pBVH->GetBounds(&m_sceneBoundingBoxMin.x, &m_sceneBoundingBoxMax.x);
+}
+
+void RenderDriverRTE::EndScene() // #TODO: add dirty flags (?) to update only those things that were changed
+{
+  if (m_pBVH == nullptr)
+    return;
+  
+  auto timeBeg  = std::chrono::system_clock::now();
+  
+  std::cout << "[EndScene]: BVH wait ... " << std::endl;
+  if(m_pSysMutex != nullptr)
+    hr_lock_system_mutex(m_pSysMutex, 5000); // don't allow simultanoius bvh building in several processes
+  
+  std::cout << "[EndScene]: BVH build ... " << std::endl;
+
+  const uint64_t sceneHash = (m_initFlags & GPU_RT_KEEP_SCENE_RESIDENT) ? CalcBVHSceneHash() : 0;
+
+  if (sceneHash != 0 && sceneHash == m_bvhSceneHash)
+    std::cout << "[EndScene]: scene geometry is unchanged, reuse resident BVH" << std::endl;
+  else
+  {
+    BuildBVHFromPendingInstances();
+    m_bvhSceneHash = sceneHash;
+  }
 
   const float3 halfSize = 0.5f*(m_sceneBoundingBoxMax - m_sceneBoundingBoxMin);
   const float3 center   = 0.5f*(m_sceneBoundingBoxMax + m_sceneBoundingBoxMin);
@@ -1648,6 +2042,12 @@ void RenderDriverRTE::Draw()
   m_pHWLayer->SetCamMatrices(m_projInv.L(), m_modelViewInv.L(), mProj.L(), mWorldView.L(), aspect, DEG_TO_RAD*m_camera.fov);
   m_pHWLayer->PrepareEngineGlobals();
 
+  if (m_saveTraversalHeatmaps)
+  {
+    m_pHWLayer->CallNamedFunc("SaveTraversalHeatmaps", "z_bvh_heatmap");
+    m_saveTraversalHeatmaps = false;
+  }
+
   const int NUM_PASS = 1;
 
   // (2) run rendering pass (depends on enabled algorithm)
@@ -1735,6 +2135,10 @@ void RenderDriverRTE::Draw()
 
       m_pHWLayer->SetAllFlagsAndVars(flagsAndVars);
       m_drawPassNumber = 0;
+
+      if (!m_checkpointPath.empty()) // continue interrupted render if checkpoint exists
+        m_pHWLayer->LoadCheckpoint(m_checkpointPath.c_str(), CheckpointSceneHash());
+      m_lastCheckpointTime = std::chrono::steady_clock::now();
     }
 
     if (m_renderMethod == RENDER_METHOD_IBPT)
@@ -1810,6 +2214,25 @@ void RenderDriverRTE::Draw()
   }
 
 
+  if (!m_checkpointPath.empty() && m_renderMethod != RENDER_METHOD_RT && m_renderMethod != RENDER_METHOD_MMLT)
+  {
+    const auto  timeNow = std::chrono::steady_clock::now();
+    const float elapsed = std::chrono::duration<float>(timeNow - m_lastCheckpointTime).count();
+    if (elapsed >= m_checkpointInterval && m_pHWLayer->SaveCheckpoint(m_checkpointPath.c_str(), CheckpointSceneHash()))
+      m_lastCheckpointTime = timeNow;
+  }
+
+  if (!m_exrPath.empty() && m_exrInterval > 0.0f && m_renderMethod != RENDER_METHOD_RT)
+  {
+    const auto  timeNow = std::chrono::steady_clock::now();
+    const float elapsed = std::chrono::duration<float>(timeNow - m_lastExrTime).count();
+    if (elapsed >= m_exrInterval && !m_exrWriter.IsBusy())
+    {
+      SaveFrameEXR(false);
+      m_lastExrTime = timeNow;
+    }
+  }
+
   if (MEASURE_RAYS && m_renderMethod != RENDER_METHOD_RT)
   {
     auto stats = m_pHWLayer->GetRaysStat();
@@ -1823,6 +2246,8 @@ void RenderDriverRTE::Draw()
     std::cout << std::endl << std::fixed;
     std::cout << "[stat]: MRays/sec  = " << mrays << std::endl;
     std::cout << "[stat]: traversal  = " << m_avgStats.traversalTimeMs << "\t ms" << std::endl;
+    if (m_avgStats.reorderTimeMs > 0.0f)
+      std::cout << "[stat]: reorder    = " << m_avgStats.reorderTimeMs   << "\t ms (included in traversal)" << std::endl;
     std::cout << "[stat]: sam_light  = " << m_avgStats.samLightTimeMs  << "\t ms" << std::endl;
     std::cout << "[stat]: shadow     = " << m_avgStats.shadowTimeMs    << "\t ms" << std::endl;
     std::cout << "[stat]: shade      = " << m_avgStats.shadeTimeMs     << "\t ms" << std::endl;
@@ -1858,6 +2283,10 @@ void RenderDriverRTE::Draw()
 
 void RenderDriverRTE::EvalGBuffer()
 {
+  auto flagsAndVars = m_pHWLayer->GetAllFlagsAndVars();
+  flagsAndVars.SetFlags(HRT_SCENE_HAS_TRANSPARENCY, m_transparentMaterials.empty() ? 0 : 1);
+  m_pHWLayer->SetAllFlagsAndVars(flagsAndVars);
+
   if(m_pAccumImage != nullptr)
     m_pHWLayer->EvalGBuffer(m_pAccumImage, m_instIdByInstId);
   else
@@ -1890,24 +2319,22 @@ void RenderDriverRTE::InstanceMeshes(int32_t a_mesh_id, const float* a_matrices,
     return;
   }
 
-  IBVHBuilder2::InstanceInputData input;
-
   const int4* ldata        = (const int4*)m_pGeomStorage->GetBegin();
   const PlainMesh* pHeader = (const PlainMesh*)(ldata + offset);
-  
-  input.vert4f     = (const float*)meshVerts(pHeader);
-  input.indices    = meshTriIndices(pHeader);
-  input.numVert    = pHeader->vPosNum;
-  input.numIndices = pHeader->tIndicesNum;
 
-  input.meshId     = meshId;
-  input.matrices   = a_matrices;
-  input.numInst    = a_instNum;
+  uint64_t& instHash = m_checkpointKeys[std::make_pair(int32_t(CKPT_INSTANCES), meshId)]; // mesh may be instanced by several calls
+  instHash = XXH64(a_matrices, size_t(a_instNum)*16*sizeof(float), instHash);
+  if (a_remapId != nullptr)
+    instHash = XXH64(a_remapId, size_t(a_instNum)*sizeof(int), instHash);
 
   const bool useEmbreeCPU = !(m_initFlags & GPU_RT_HW_LAYER_OCL);
-  const int treeId        = (!useEmbreeCPU && MeshHaveOpacity(pHeader)) ? 1 : 0;
 
-  m_pBVH->InstanceTriangleMeshes(input, treeId, int(m_meshIdByInstId.size()));
+  PendingInstances pending;
+  pending.meshId     = meshId;
+  pending.treeId     = (!useEmbreeCPU && MeshHaveOpacity(pHeader)) ? 1 : 0;
+  pending.instIdBase = int(m_meshIdByInstId.size());
+  pending.matrices.assign(a_matrices, a_matrices + 16*a_instNum);
+  m_pendingInstances.push_back(pending);
 
   // (1) Remember matrices id for further usage if external CPU impl of BVH is used
   // (2) Also create light-inst id from inst id table
@@ -2002,14 +2429,83 @@ HRRenderUpdateInfo RenderDriverRTE::HaveUpdateNow(int a_maxRaysperPixel)
   
   res.progress    = spp/float(a_maxRaysperPixel);
   res.finalUpdate = (res.progress >= 1.0f); 
+
+  if (!m_exrPath.empty() && res.finalUpdate && !m_exrFinalDone)
+    SaveFrameEXR(true);
+  m_exrFinalDone = res.finalUpdate;
  
   return res;
 }
 
+void RenderDriverRTE::SaveFrameEXR(bool a_finalFrame)
+{
+  if (m_pHWLayer->GetSPP() <= 0.0f)
+    return;
+
+  if (a_finalFrame)
+    m_exrWriter.Wait();          // final frame is never skipped
+  else if (m_exrWriter.IsBusy()) // progressive snapshot is skipped instead of waiting for disk
+    return;
+
+  const bool    denoise   = a_finalFrame && m_denoise;
+  const float4* gbuffer1  = (m_exrAOVs || denoise) ? GBufferLayer1() : nullptr; // G-buffer is also a guide for denoiser
+  const bool    writeAOVs = m_exrAOVs && (gbuffer1 != nullptr);
+  const int     layersNum = writeAOVs ? 3 : 1;
+  const int     size      = m_width*m_height;
+
+  float4* layers = m_exrWriter.FrontBuffer(m_width, m_height, layersNum);
+  m_pHWLayer->GetHDRImage(layers, m_width, m_height);
+
+  if (denoise && gbuffer1 != nullptr)
+    m_pHWLayer->DenoiseHDR(layers, gbuffer1, m_width, m_height, m_denoiseRadius, m_denoiseStrength);
+  else if (denoise)
+    std::cerr << "RenderDriverRTE::SaveFrameEXR: G-buffer was not evaluated, final frame is written without denoising" << std::endl;
+
+  std::vector<std::string> channels = { "R", "G", "B", "shadow" };
+
+  if (writeAOVs)
+  {
+    float4* normDepth = layers + size;
+    float4* albedo    = layers + 2*size;
+
+    #pragma omp parallel for
+    for (int i = 0; i < size; i++)
+    {
+      const GBuffer1 gbuff = unpackGBuffer1(gbuffer1[i]);
+      normDepth[i] = to_float4(gbuff.norm, gbuff.depth);
+      albedo[i]    = make_float4(gbuff.rgba.x, gbuff.rgba.y, gbuff.rgba.z, gbuff.coverage);
+    }
+
+    const char* aovNames[8] = { "N.X", "N.Y", "N.Z", "Z", "albedo.R", "albedo.G", "albedo.B", "coverage" };
+    channels.insert(channels.end(), aovNames, aovNames + 8);
+  }
+
+  m_exrWriter.Start(m_exrPath, m_width, m_height, channels);
+}
+
+const float4* RenderDriverRTE::GBufferLayer1()
+{
+  if (m_pAccumImage != nullptr && m_pAccumImage->Header()->gbufferIsEmpty == 0) // please look at GPUOCLLayer::EvalGBuffer
+  {
+    const int layer = (m_pAccumImage->Header()->depth == 4) ? 2 : 1;
+    return (const float4*)m_pAccumImage->ImageData(layer);
+  }
+
+  if (m_gbufferImage.ImageData(1) != nullptr && m_gbufferImage.Header()->gbufferIsEmpty == 0 &&
+      m_gbufferImage.Header()->width == m_width && m_gbufferImage.Header()->height == m_height)
+    return (const float4*)m_gbufferImage.ImageData(1);
+
+  return nullptr;
+}
+
 void RenderDriverRTE::GetFrameBufferHDR(int32_t w, int32_t h, float*   a_out, const wchar_t* a_layerName)
 {
   m_pHWLayer->GetHDRImage((float4*)a_out, w, h);
 
+  const float4* gbuffer1 = GBufferLayer1();
+  if (m_denoise && gbuffer1 != nullptr && w == m_width && h == m_height)
+    m_pHWLayer->DenoiseHDR((float4*)a_out, gbuffer1, w, h, m_denoiseRadius, m_denoiseStrength);
+
   if(m_gbufferImage.Header()->width == w && m_gbufferImage.Header()->height == h) // save shadow values in separate buffer
   {
     if(m_gbufferImage.shadowCopy.size() != w*h)
@@ -2022,7 +2518,19 @@ void RenderDriverRTE::GetFrameBufferHDR(int32_t w, int32_t h, float*   a_out, co
 
 void RenderDriverRTE::GetFrameBufferLDR(int32_t w, int32_t h, int32_t* a_out)
 {
-  m_pHWLayer->GetLDRImage((uint32_t*)a_out, w, h);
+  const float4* gbuffer1 = GBufferLayer1();
+  if (!m_denoise || gbuffer1 == nullptr || w != m_width || h != m_height)
+  {
+    m_pHWLayer->GetLDRImage((uint32_t*)a_out, w, h);
+    return;
+  }
+
+  std::vector<float4> hdrImage(w*h);
+  m_pHWLayer->GetHDRImage(hdrImage.data(), w, h);
+  m_pHWLayer->DenoiseHDR(hdrImage.data(), gbuffer1, w, h, m_denoiseRadius, m_denoiseStrength);
+
+  const float gammaInv = 1.0f / m_pHWLayer->GetAllFlagsAndVars().m_varsF[HRT_IMAGE_GAMMA];
+  HDRImageToLDR(hdrImage.data(), 1.0f, nullptr, 0.0f, w*h, gammaInv, (uint*)a_out);
 }
 
 static inline void decodeNormal2(unsigned int a_data, float a_norm[3])
@@ -10,10 +10,13 @@
 #include <tuple>
 #include <unordered_set>
 #include <unordered_map>
+#include <map>
 #include <memory>
+#include <chrono>
 
 #include "IBVHBuilderAPI.h"
 #include "IHWLayer.h"
+#include "AsyncImageWriter.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -183,6 +186,7 @@ protected:
   std::unordered_map<std::wstring, int2>                      m_iesCache;
   std::unordered_map<int, std::shared_ptr<RAYTR::IMaterial> > m_materialUpdated;
   std::unordered_map<int, pugi::xml_node >                    m_materialNodes;
+  std::unordered_set<int>                                     m_transparentMaterials; ///< materials with PLAIN_MATERIAL_HAS_TRANSPARENCY
   std::unordered_map<int32_t, HRTexResInfo>                   m_allTexInfo;
   std::unordered_map<std::wstring, int32_t>                   m_texturesProcessedNM;
   std::unordered_map<int, ProcTexInfo>                        m_procTextures;
@@ -192,6 +196,29 @@ protected:
 
   IHRSharedAccumImage* m_pAccumImage;
   int m_drawPassNumber;
+  bool m_saveTraversalHeatmaps; ///< GPU_RT_BVH_ANALYTICS: save heatmaps on the first Draw after scene commit
+
+  std::string m_checkpointPath;     ///< empty if render state checkpoints are disabled
+  float       m_checkpointInterval; ///< seconds between checkpoints
+  std::chrono::steady_clock::time_point m_lastCheckpointTime;
+  std::map<std::pair<int32_t, int32_t>, uint64_t> m_checkpointKeys; ///< hash of settings, camera and each scene object by (CHECKPOINT_KEY, id); checkpoint is loaded only for the same scene
+
+  uint64_t CheckpointSceneHash() const;
+
+  bool  m_denoise;         ///< apply G-buffer guided filter to frames returned by GetFrameBufferHDR/LDR
+  int   m_denoiseRadius;
+  float m_denoiseStrength;
+
+  std::string      m_exrPath;      ///< half float EXR output of HDR frame and AOVs; empty if disabled
+  float            m_exrInterval;  ///< seconds between progressive snapshots; 0 means final frame only
+  bool             m_exrAOVs;      ///< add G-buffer channels (normal, depth, albedo, coverage) if G-buffer was evaluated
+  bool             m_exrFinalDone;
+  AsyncImageWriter m_exrWriter;
+  std::chrono::steady_clock::time_point m_lastExrTime;
+
+  void SaveFrameEXR(bool a_finalFrame);
+
+  const float4* GBufferLayer1();       ///< packed G-buffer (see packGBuffer1) if it was already evaluated, nullptr otherwise
 
   float4x4 m_modelViewInv;
   float4x4 m_projInv;
@@ -213,6 +240,27 @@ protected:
   float3 m_sceneBoundingBoxMin;
   float3 m_sceneBoundingBoxMax;
 
+  struct PendingInstances ///< InstanceMeshes input; BVH is built from it in EndScene
+  {
+    int32_t            meshId;
+    int32_t            treeId;
+    int32_t            instIdBase;
+    std::vector<float> matrices;
+  };
+
+  std::vector<PendingInstances>         m_pendingInstances;
+  std::unordered_map<int32_t, uint64_t> m_meshHash;      ///< GPU_RT_KEEP_SCENE_RESIDENT: content hash of each mesh resident in m_pGeomStorage
+  std::unordered_map<int32_t, uint64_t> m_texHash;       ///< GPU_RT_KEEP_SCENE_RESIDENT: content hash of each texture resident in m_pTexStorage
+  std::unordered_map<int32_t, uint64_t> m_materialHash;  ///< GPU_RT_KEEP_SCENE_RESIDENT: hash of material xml; alpha test table depends on it
+  uint64_t                              m_bvhSceneHash;  ///< hash of the scene that resident BVH was built for; 0 if unknown
+  std::unordered_set<int32_t>           m_meshSeen;      ///< GPU_RT_KEEP_SCENE_RESIDENT: meshes passed to UpdateMesh since AllocAll
+  std::unordered_set<int32_t>           m_texSeen;       ///< GPU_RT_KEEP_SCENE_RESIDENT: textures passed to UpdateImage since AllocAll
+  bool                                  m_dropStaleResident; ///< remove resident objects that are absent in new scene at next BeginScene
+
+  uint64_t CalcBVHSceneHash() const;
+  void     BuildBVHFromPendingInstances();
+  void     DropStaleResidentObjects();
+
   void Error(const wchar_t* a_msg);
 
   template<class T>
@@ -262,6 +310,7 @@ protected:
   int32_t AuxNormalTexPerMaterial(const int32_t matId, const int32_t texId);
 
   void          UpdatePdfTablesForLight(int32_t a_lightId);
+  void          UpdateMeshLightEmissionTable(int32_t a_lightId, const PlainMesh* pLMesh);
   const uchar4* GetAuxNormalMapFromDisaplacement(std::vector<uchar4>& normal, const PlainMaterial& mat, int textureIdNM, pugi::xml_node a_node, int* pW, int* pH);
   std::wstring  GetNormalMapParameterStringForCache(int textureIdNM, pugi::xml_node a_materialNode);
   int32_t       GetCachedAuxNormalMatId(int32_t a_matId, const PlainMaterial& a_mat, int textureIdNM, pugi::xml_node a_materialNode);
@@ -302,6 +351,7 @@ protected:
   void DebugSaveBVH(const std::string& a_folderName, const ConvertionResult& a_inBVH);
   void PrintBVHStat(const ConvertionResult& a_inBVH, bool traverseThem);
   void DebugPrintBVHInfo(const ConvertionResult& a_inBVH, const char* a_fileName);
+  void DebugAnalyzeBVH(const ConvertionResult& a_inBVH, const char* a_fileName);
   void DebugTestAlphaTestTable(const std::vector<uint2>& a_alphaTable, int a_trif4Num);
 
   bool  m_alreadyDeleted;
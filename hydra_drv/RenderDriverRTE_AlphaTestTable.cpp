@@ -2,6 +2,7 @@
 
 #include <iostream>
 #include <string>
+#include <algorithm>
 
 int RenderDriverRTE::CountMaterialsWithAlphaTest()
 {
@@ -72,6 +73,187 @@ bool RenderDriverRTE::MeshHaveOpacity(const PlainMesh* pHeader) const
   return meshHaveOpacity;
 }
 
+/**
+\brief Plain leaves use triangle offsets as alpha table offsets, compact leaves have their records after the end of triangle data.
+*/
+static int AlphaTableRecordsNum(const int4* a_triData, const int a_trif4Num)
+{
+  int recordsNum = a_trif4Num;
+  for (int offset = 0; offset < a_trif4Num;)
+  {
+    const int4 header = a_triData[offset];
+    if (header.z == -1 && header.w == -1)
+      offset++;
+    else if (IsCompactLeaf(header))
+    {
+      recordsNum = std::max(recordsNum, header.x + 3 * header.y);
+      offset    += CompactLeafSizeInF4(header);
+    }
+    else
+      offset += 3;
+  }
+  return recordsNum;
+}
+
+static inline float2 DecompressTexCoord16(unsigned int packed)
+{
+  const float fx = (1.0f / 65535.0f)*float(packed & 0x0000FFFF);
+  const float fy = (1.0f / 65535.0f)*float((packed & 0xFFFF0000) >> 16);
+  return float2(2.0f*fx - 1.0f, 2.0f*fy - 1.0f);
+}
+
+constexpr int OMM_MAX_TEXELS = 1024; ///< sub-triangles that cover more texels are left OMM_STATE_UNKNOWN
+
+struct OpacityMicromapJob
+{
+  int          triOffset;
+  int          samplerId;
+  bool         smooth;
+  unsigned int texCoords[3];
+  int          state;
+  uint2        words[OMM_WORDS_PER_TRI];
+};
+
+/**
+\brief Get conservative bounds of texture opacity inside texel rect [x0,x1]x[y0,y1] with the same wrap/clamp rules as read_imagef_sw4.
+       Lower bound is taken per channel because bilinear filtering is applied before max(r,g,b).
+*/
+static void OpacityBoundsInRect(const int4* a_pHeader, const int a_flags, const int x0, const int x1, const int y0, const int y1, 
+                                float* pLower, float* pUpper)
+{
+  const int w   = a_pHeader->x;
+  const int h   = a_pHeader->y;
+  const int bpp = a_pHeader->w;
+
+  float4 chMin(1e38f, 1e38f, 1e38f, 1e38f);
+  float  upper = -1e38f;
+
+  for (int y = y0; y <= y1; y++)
+  {
+    int py = (a_flags & TEX_CLAMP_V) ? std::max(0, std::min(y, h - 1)) : (y % h);
+    py     = (py < 0) ? py + h : py;
+
+    for (int x = x0; x <= x1; x++)
+    {
+      int px = (a_flags & TEX_CLAMP_U) ? std::max(0, std::min(x, w - 1)) : (x % w);
+      px     = (px < 0) ? px + w : px;
+
+      float4 texel;
+      if (bpp == 4)
+      {
+        const uchar4 c = ((const uchar4*)(a_pHeader + 1))[py*w + px];
+        texel = 0.003921568f*float4(float(c.x), float(c.y), float(c.z), float(c.w));
+      }
+      else
+        texel = ((const float4*)(a_pHeader + 1))[py*w + px];
+
+      if (a_flags & TEX_ALPHASRC_W)
+        texel = float4(texel.w, texel.w, texel.w, texel.w);
+
+      chMin.x = fminf(chMin.x, texel.x);
+      chMin.y = fminf(chMin.y, texel.y);
+      chMin.z = fminf(chMin.z, texel.z);
+      upper   = fmaxf(upper, fmaxf(texel.x, fmaxf(texel.y, texel.z)));
+    }
+  }
+
+  (*pLower) = fmaxf(chMin.x, fmaxf(chMin.y, chMin.z));
+  (*pUpper) = upper;
+}
+
+/**
+\brief Classify sub-triangles of OMM_LEVEL subdivision as opaque, transparent or unknown for both alpha test kernels.
+       Binary test is (selector > 0.5) with and without gamma; smooth test is (rnd < selector).
+       Write OMM_STATE_MAP and 2 bits per sub-triangle to a_pJob->words if states differ, common state otherwise.
+*/
+static void BuildOpacityMicromap(const SWTexSampler& a_sampler, const int4* a_pHeader, OpacityMicromapJob* a_pJob)
+{
+  a_pJob->state = OMM_STATE_UNKNOWN;
+  for (int i = 0; i < OMM_WORDS_PER_TRI; i++)
+    a_pJob->words[i] = uint2(0, 0);
+
+  const int w   = a_pHeader->x;
+  const int h   = a_pHeader->y;
+  const int bpp = a_pHeader->w;
+
+  if (w <= 0 || h <= 0 || (bpp != 4 && bpp != 16) || !(a_sampler.gamma > 0.0f))
+    return;
+
+  const float gamma     = (a_sampler.flags & TEX_ALPHASRC_W) ? 1.0f : a_sampler.gamma;
+  const float threshold = powf(0.5f, 1.0f / gamma);  // pow(x, gamma) > 0.5
+  const float transpMax = a_pJob->smooth ? 0.0f : fminf(0.5f, threshold);
+
+  const float2 A_tex = DecompressTexCoord16(a_pJob->texCoords[0]);
+  const float2 B_tex = DecompressTexCoord16(a_pJob->texCoords[1]);
+  const float2 C_tex = DecompressTexCoord16(a_pJob->texCoords[2]);
+
+  const int subTriNum = 1 << (2 * OMM_LEVEL);
+  int statesMask      = 0;
+
+  for (int subId = 0; subId < subTriNum; subId++)
+  {
+    float3 b[3];
+    subTriangleBary(subId, OMM_LEVEL, &b[0], &b[1], &b[2]);
+
+    float2 fMin(1e38f, 1e38f), fMax(-1e38f, -1e38f);
+    for (int k = 0; k < 3; k++)
+    {
+      const float2 texCoord  = b[k].x*A_tex + b[k].y*B_tex + b[k].z*C_tex;
+      const float2 texCoordT = mul2x4(a_sampler.row0, a_sampler.row1, texCoord);
+      float ffx = texCoordT.x*float(w) - 0.5f;
+      float ffy = texCoordT.y*float(h) - 0.5f;
+      if ((a_sampler.flags & TEX_CLAMP_U) != 0 && ffx < 0) ffx = 0.0f;
+      if ((a_sampler.flags & TEX_CLAMP_V) != 0 && ffy < 0) ffy = 0.0f;
+      fMin = float2(fminf(fMin.x, ffx), fminf(fMin.y, ffy));
+      fMax = float2(fmaxf(fMax.x, ffx), fmaxf(fMax.y, ffy));
+    }
+
+    int state = OMM_STATE_UNKNOWN;
+
+    // (int)(ffx) rounds to zero and the second texel is taken in direction of sign(ffx), so add one texel of margin to floor
+    //
+    if (fabsf(fMin.x) < 1e6f && fabsf(fMin.y) < 1e6f && fabsf(fMax.x) < 1e6f && fabsf(fMax.y) < 1e6f)
+    {
+      int x0 = int(floorf(fMin.x)) - 1, x1 = int(floorf(fMax.x)) + 2;
+      int y0 = int(floorf(fMin.y)) - 1, y1 = int(floorf(fMax.y)) + 2;
+
+      if (a_sampler.flags & TEX_CLAMP_U)  { x0 = std::max(0, std::min(x0, w - 1)); x1 = std::max(0, std::min(x1, w - 1)); }
+      else if (x1 - x0 + 1 >= w)          { x0 = 0; x1 = w - 1; }
+
+      if (a_sampler.flags & TEX_CLAMP_V)  { y0 = std::max(0, std::min(y0, h - 1)); y1 = std::max(0, std::min(y1, h - 1)); }
+      else if (y1 - y0 + 1 >= h)          { y0 = 0; y1 = h - 1; }
+
+      if ((x1 - x0 + 1)*(y1 - y0 + 1) <= OMM_MAX_TEXELS)
+      {
+        float lower, upper;
+        OpacityBoundsInRect(a_pHeader, a_sampler.flags, x0, x1, y0, y1, &lower, &upper);
+
+        const bool opaque = a_pJob->smooth ? (lower > 0.5f && powf(lower, gamma) >= 0.9999f) : (lower > fmaxf(0.5f, threshold));
+
+        if (opaque)
+          state = OMM_STATE_OPAQUE;
+        else if (upper <= transpMax)
+          state = OMM_STATE_TRANSPARENT;
+      }
+    }
+
+    statesMask |= (1 << state);
+
+    const int bit = (subId & 31) * 2;
+    if (bit < 32)
+      a_pJob->words[subId >> 5].x |= (unsigned int)(state) << bit;
+    else
+      a_pJob->words[subId >> 5].y |= (unsigned int)(state) << (bit - 32);
+  }
+
+  if (statesMask == (1 << OMM_STATE_OPAQUE))
+    a_pJob->state = OMM_STATE_OPAQUE;
+  else if (statesMask == (1 << OMM_STATE_TRANSPARENT))
+    a_pJob->state = OMM_STATE_TRANSPARENT;
+  else if (statesMask != (1 << OMM_STATE_UNKNOWN))
+    a_pJob->state = OMM_STATE_MAP;
+}
+
 void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuffers& a_outBuffers, bool& a_smoothOpacity)
 {
   const int maxSamplers = CountMaterialsWithAlphaTest();
@@ -88,31 +270,24 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
   const float4* geomStorage = (const float4*)m_pGeomStorage->GetBegin();
   auto geomTable = m_pGeomStorage->GetTable();
 
+  const int4* texData = (const int4*)m_pTexStorage->GetBegin();
+  const std::vector<int32_t> texOffsets = m_pTexStorage->GetTable();
+
   bool haveAtLeastOneSmoothOpacity = false;
 
   for (int treeId = 0; treeId < a_cnvRes.treesNum; treeId++)
   {
     std::vector<uint2>& a_otrData = a_outBuffers.buf[treeId];
 
-    const int numPrims = a_cnvRes.trif4Num[treeId];
+    const int4* i4data   = (const int4*)a_cnvRes.pTriangleData[treeId];
+    const int   numPrims = AlphaTableRecordsNum(i4data, a_cnvRes.trif4Num[treeId]);
     a_otrData.resize(numPrims + auxSize); 
 
     bool haveAtLeastOneOpacityMesh = false;
-    const int4* i4data = (const int4*)a_cnvRes.pTriangleData[treeId];
+    std::vector<OpacityMicromapJob> ommJobs;
 
-    for (int triOffset = 0; triOffset < a_cnvRes.trif4Num[treeId];)
+    auto fillTriangleRecords = [&](const int triOffset, const int primId, const int geomId)
     {
-      const int4 test = i4data[triOffset];
-      if (test.z == -1 && test.w == -1)    // skip object list header
-      {
-        a_otrData[triOffset] = uint2(-1,-1);
-        triOffset++;
-        continue;
-      }
-
-      const int primId = i4data[triOffset + 0].w;
-      const int geomId = i4data[triOffset + 1].w;
-    
       const PlainMesh* mesh = (const PlainMesh*)(geomStorage + geomTable[geomId]);
 
       const int*    vertIndices  = meshTriIndices(mesh);
@@ -157,9 +332,12 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
           const int offs = numPrims + int(relativeOffset) * mult;
 
           a_otrData[triOffset + 0].x = (texId != INVALID_TEXTURE) ? offs : INVALID_TEXTURE;
-          a_otrData[triOffset + 1].x = p->second->smoothOpacity   ? 1 : 0;  // (!) <== look here please.
+          a_otrData[triOffset + 1].x = p->second->smoothOpacity   ? 1 : 0;  // (!) <== look here please. opacity micromap state is added later
           a_otrData[triOffset + 2].x = p->second->skipShadow      ? 1 : 0;  // (!) <== look here please.
 
+          if (texId == INVALID_TEXTURE)
+            a_otrData[triOffset + 1].x |= (OMM_STATE_OPAQUE << 1);
+
           {
             const int offset = primId * 3;
 
@@ -175,21 +353,55 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
             a_otrData[triOffset + 1].y = CompressTexCoord16(B_tex);
             a_otrData[triOffset + 2].y = CompressTexCoord16(C_tex);
           }
+
+          if (texId != INVALID_TEXTURE)
+          {
+            OpacityMicromapJob job;
+            job.triOffset    = triOffset;
+            job.samplerId    = int(relativeOffset);
+            job.smooth       = p->second->smoothOpacity;
+            job.texCoords[0] = a_otrData[triOffset + 0].y;
+            job.texCoords[1] = a_otrData[triOffset + 1].y;
+            job.texCoords[2] = a_otrData[triOffset + 2].y;
+            job.state        = OMM_STATE_UNKNOWN;
+            ommJobs.push_back(job);
+          }
         }
         else
         {
           a_otrData[triOffset + 0] = uint2(INVALID_TEXTURE, -1);
-          a_otrData[triOffset + 1] = uint2(INVALID_TEXTURE, -1);
+          a_otrData[triOffset + 1] = uint2(OMM_STATE_OPAQUE << 1, -1);
           a_otrData[triOffset + 2] = uint2(INVALID_TEXTURE, -1);
         }
       }
       else
       {
         a_otrData[triOffset+0] = uint2(INVALID_TEXTURE, -1);
-        a_otrData[triOffset+1] = uint2(INVALID_TEXTURE, -1);
+        a_otrData[triOffset+1] = uint2(OMM_STATE_OPAQUE << 1, -1);
         a_otrData[triOffset+2] = uint2(INVALID_TEXTURE, -1);
       }
+    };
 
+    for (int triOffset = 0; triOffset < a_cnvRes.trif4Num[treeId];)
+    {
+      const int4 test = i4data[triOffset];
+      if (test.z == -1 && test.w == -1)    // skip object list header
+      {
+        a_otrData[triOffset] = uint2(-1,-1);
+        triOffset++;
+        continue;
+      }
+      else if (IsCompactLeaf(test))        // compact leaf keeps its records at test.x
+      {
+        const int* pRecords = (const int*)(i4data + triOffset + 1);
+        for (int triId = 0; triId < test.y; triId++)
+          fillTriangleRecords(test.x + 3 * triId, pRecords[triId * 2 + 0], test.w);
+
+        triOffset += CompactLeafSizeInF4(test);
+        continue;
+      }
+
+      fillTriangleRecords(triOffset, i4data[triOffset + 0].w, i4data[triOffset + 1].w);
       triOffset+=3;
     }
 
@@ -202,6 +414,35 @@ void RenderDriverRTE::CreateAlphaTestTable(ConvertionResult& a_cnvRes, AlphaBuff
     if (samplers.size() > 0 && a_otrData.size() > 0)
       memcpy(&a_otrData[0] + numPrims, &samplers[0], samplers.size() * sizeof(SWTexSampler));
 
+    // build opacity micromaps and put them after samplers; traversal samples texture only for OMM_STATE_UNKNOWN
+    //
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int jobId = 0; jobId < int(ommJobs.size()); jobId++)
+    {
+      OpacityMicromapJob& job     = ommJobs[jobId];
+      const SWTexSampler& sampler = samplers[job.samplerId];
+
+      if (sampler.texId == 0)
+        job.state = OMM_STATE_OPAQUE;
+      else if (texData != nullptr && sampler.texId > 0 && sampler.texId < int(texOffsets.size()) && texOffsets[sampler.texId] >= 0)
+        BuildOpacityMicromap(sampler, texData + texOffsets[sampler.texId], &job);
+    }
+
+    std::vector<uint2> ommWords;
+    for (const auto& job : ommJobs)
+    {
+      unsigned int ommOffset = 0;
+      if (job.state == OMM_STATE_MAP)
+      {
+        ommOffset = (unsigned int)(a_otrData.size() + ommWords.size());
+        ommWords.insert(ommWords.end(), job.words, job.words + OMM_WORDS_PER_TRI);
+      }
+      a_otrData[job.triOffset + 1].x = (ommOffset << 3) | (job.state << 1) | (job.smooth ? 1 : 0);
+    }
+
+    assert(a_otrData.size() + ommWords.size() < size_t(1 << 29));
+    a_otrData.insert(a_otrData.end(), ommWords.begin(), ommWords.end());
+
     if (haveAtLeastOneOpacityMesh)
     {
       a_cnvRes.pTriangleAlpha[treeId] = &a_otrData[0];    
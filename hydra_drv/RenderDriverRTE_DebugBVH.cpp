@@ -1,10 +1,14 @@
 #include "RenderDriverRTE.h"
 
 #include <iostream>
+#include <fstream>
 #include <queue>
 #include <string>
 #include <vector>
 #include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
 
 
 /////////////////////////////////////////////////////////////////////////////////////////////////// Test & Debug
@@ -167,6 +171,12 @@ void BFSTravsersal(NodeWithMatrix a_root, const char* a_path, int a_depth, std::
 
 void RenderDriverRTE::DebugSaveBVH(const std::string& a_folderName, const ConvertionResult& a_inBVH)
 {
+  if (a_inBVH.treesNum > 0 && BVHTypeIsQuantized(a_inBVH.bvhType[0]))
+  {
+    std::cout << "[DebugSaveBVH]: compressed BVH layout is not supported" << std::endl;
+    return;
+  }
+
   std::deque<NodeWithMatrix> nodes, leafes;
   nodes.push_back(NodeWithMatrix(a_inBVH.pBVH[0]));
   
@@ -252,7 +262,7 @@ void RenderDriverRTE::PrintBVHStat(const ConvertionResult& a_inBVH, bool travers
     stat.bytesForBoxes   += double(a_inBVH.nodesNum[bvhId]*sizeof(BVHNode));
     stat.bytesForTriList += double(a_inBVH.trif4Num[bvhId]*sizeof(float4)) + double(a_inBVH.triAfNum[bvhId]*2*sizeof(int));
 
-    if(traverseThem)
+    if(traverseThem && !BVHTypeIsQuantized(a_inBVH.bvhType[bvhId]))
       ScanBVH(&stat, a_inBVH.pBVH[bvhId], a_inBVH.pBVH[bvhId], (const float4*)a_inBVH.pTriangleData[bvhId], 0);
   }
 
@@ -265,7 +275,7 @@ void RenderDriverRTE::PrintBVHStat(const ConvertionResult& a_inBVH, bool travers
   std::vector<std::string> treeTypes;
   for (int bvhId = 0; bvhId < a_inBVH.treesNum; bvhId++)
   {
-    const bool plain     = (std::string(a_inBVH.bvhType[bvhId]) == "triangle4v");
+    const bool plain     = !BVHTypeHaveInst(a_inBVH.bvhType[bvhId]);
     const bool haveAlpha = (a_inBVH.pTriangleAlpha[bvhId] != nullptr);
 
     if (plain && haveAlpha)
@@ -429,8 +439,9 @@ void RenderDriverRTE::DebugPrintBVHInfo(const ConvertionResult& a_inBVH, const c
     std::vector<float4x4> instMat;
     std::vector<int>      instId;
     std::vector<int>      meshId;
-    ScanBVHToListAllInstances(instMat, instId, meshId, 
-                              a_inBVH.pBVH[treeId], (const float4*)a_inBVH.pTriangleData[treeId], a_inBVH.pBVH[treeId], 0);
+    if (!BVHTypeIsQuantized(a_inBVH.bvhType[treeId]))
+      ScanBVHToListAllInstances(instMat, instId, meshId, 
+                                a_inBVH.pBVH[treeId], (const float4*)a_inBVH.pTriangleData[treeId], a_inBVH.pBVH[treeId], 0);
 
     fout << "  nodes_num     = " << a_inBVH.nodesNum[treeId] << std::endl;
     fout << "  tri_data_size = " << a_inBVH.trif4Num[treeId] << std::endl;
@@ -455,6 +466,201 @@ void RenderDriverRTE::DebugPrintBVHInfo(const ConvertionResult& a_inBVH, const c
   fout.close();
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////////////// BVH analytics
+
+constexpr double BVH_SAH_NODE_COST = 1.0; ///< cost of ray vs 4-wide node test
+constexpr double BVH_SAH_TRI_COST  = 1.0; ///< cost of ray vs triangle test
+
+struct BVHSubtreeStat
+{
+  BVHSubtreeStat() : meshId(-1), nodesNum(0), leafesNum(0), trianglesNum(0), maxDeep(0), innerNum(0), sahCost(0.0), overlapSum(0.0) {}
+
+  int    meshId;
+  int    nodesNum;      ///< 4-wide nodes
+  int    leafesNum;
+  int    trianglesNum;
+  int    maxDeep;
+  int    innerNum;
+  double sahCost;       ///< SAH cost relative to the root box of subtree
+  double overlapSum;    ///< sum of (pairwise overlap area of children / node area) for inner nodes
+
+  std::map<int, int> leafHist;
+  std::vector<int>   instIds;
+};
+
+static inline float BoxSurfaceArea(const float3 a_boxMin, const float3 a_boxMax)
+{
+  const float3 d = a_boxMax - a_boxMin;
+  if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f)
+    return 0.0f;
+  return 2.0f*(d.x*d.y + d.y*d.z + d.z*d.x);
+}
+
+static inline float BoxOverlapArea(const BVHNode& a, const BVHNode& b)
+{
+  const float3 boxMin = make_float3(fmaxf(a.m_boxMin.x, b.m_boxMin.x), fmaxf(a.m_boxMin.y, b.m_boxMin.y), fmaxf(a.m_boxMin.z, b.m_boxMin.z));
+  const float3 boxMax = make_float3(fminf(a.m_boxMax.x, b.m_boxMax.x), fminf(a.m_boxMax.y, b.m_boxMax.y), fminf(a.m_boxMax.z, b.m_boxMax.z));
+  return BoxSurfaceArea(boxMin, boxMax);
+}
+
+/**
+\brief Accumulate SAH cost, overlap and leaf sizes of a subtree. Instance nodes are treated as leafes with (node cost + SAH of bottom level tree).
+       Bottom level trees are analyzed once in their local space and cached by their first child offset.
+*/
+static void AnalyzeBVHNode(const BVHNode* a_root, const BVHNode* node, const float4* a_objList, const float a_rootArea, const int a_currLevel,
+                           BVHSubtreeStat* a_out, std::unordered_map<unsigned int, BVHSubtreeStat>* a_subtrees)
+{
+  if (!IsValidNode(*node))
+    return;
+
+  const double relArea = double(BoxSurfaceArea(node->m_boxMin, node->m_boxMax)) / double(a_rootArea);
+  a_out->maxDeep       = std::max(a_out->maxDeep, a_currLevel);
+
+  if (node->Leaf() && !node->Instance())
+  {
+    if (node->m_leftOffsetAndLeaf == 0xFFFFFFFF)
+      return;
+
+    const int triNum = getLeafHeader(EXTRACT_OFFSET(node->m_leftOffsetAndLeaf), a_objList).y;
+
+    a_out->sahCost      += BVH_SAH_TRI_COST*double(triNum)*relArea;
+    a_out->leafesNum    += 1;
+    a_out->trianglesNum += triNum;
+    a_out->leafHist[triNum]++;
+  }
+  else if (node->Instance())
+  {
+    const BVHNode* child0 = a_root + node->GetLeftOffset() * 4 + 0;
+    const int*     pIds   = (const int*)(child0 + 3); // (realInstId, meshId)
+
+    auto p = a_subtrees->find(child0->m_leftOffsetAndLeaf);
+    if (p == a_subtrees->end())
+    {
+      BVHSubtreeStat subtree;
+      subtree.meshId        = pIds[1];
+      const float localArea = BoxSurfaceArea(child0->m_boxMin, child0->m_boxMax);
+      AnalyzeBVHNode(a_root, child0, a_objList, (localArea > 0.0f) ? localArea : 1.0f, 0, &subtree, a_subtrees);
+      p = a_subtrees->insert(std::make_pair(child0->m_leftOffsetAndLeaf, subtree)).first;
+    }
+
+    p->second.instIds.push_back(pIds[0]);
+    a_out->sahCost += relArea*(BVH_SAH_NODE_COST + p->second.sahCost);
+  }
+  else
+  {
+    const BVHNode* children = a_root + node->GetLeftOffset() * 4;
+
+    a_out->sahCost  += BVH_SAH_NODE_COST*relArea;
+    a_out->nodesNum += 1;
+
+    const float nodeArea = BoxSurfaceArea(node->m_boxMin, node->m_boxMax);
+    if (nodeArea > 0.0f)
+    {
+      float overlap = 0.0f;
+      for (int i = 0; i < 4; i++)
+        for (int j = i + 1; j < 4; j++)
+          if (IsValidNode(children[i]) && IsValidNode(children[j]))
+            overlap += BoxOverlapArea(children[i], children[j]);
+
+      a_out->overlapSum += double(overlap / nodeArea);
+      a_out->innerNum   += 1;
+    }
+
+    for (int i = 0; i < 4; i++)
+      AnalyzeBVHNode(a_root, children + i, a_objList, a_rootArea, a_currLevel + 1, a_out, a_subtrees);
+  }
+}
+
+static void PrintLeafHistogram(std::ostream& out, const std::map<int, int>& a_hist)
+{
+  out << "[";
+  for (auto p : a_hist)
+    out << p.first << ":" << p.second << ", ";
+  out << "]";
+}
+
+void RenderDriverRTE::DebugAnalyzeBVH(const ConvertionResult& a_inBVH, const char* a_fileName)
+{
+  std::ofstream fout(a_fileName);
+
+  fout << "bvhtrees num = " << a_inBVH.treesNum << std::endl;
+  fout << "sah costs    = (node: " << BVH_SAH_NODE_COST << ", tri: " << BVH_SAH_TRI_COST << ")" << std::endl;
+
+  for (int treeId = 0; treeId < a_inBVH.treesNum; treeId++)
+  {
+    fout << std::endl;
+    fout << "bvh[" << treeId << "] = {" << std::endl;
+    fout << "  type          = " << ((a_inBVH.bvhType[treeId] != nullptr) ? a_inBVH.bvhType[treeId] : "unknown") << std::endl;
+    fout << "  nodes_mem     = " << double(a_inBVH.nodesNum[treeId]*sizeof(BVHNode)) / double(1024 * 1024) << " MB" << std::endl;
+    fout << "  tri_data_mem  = " << double(a_inBVH.trif4Num[treeId]*sizeof(float4)) / double(1024 * 1024) << " MB" << std::endl;
+
+    if (BVHTypeIsQuantized(a_inBVH.bvhType[treeId]))
+    {
+      fout << "  compressed BVH layout is not supported" << std::endl << "}" << std::endl;
+      continue;
+    }
+
+    const BVHNode* root    = a_inBVH.pBVH[treeId];
+    const float4*  objList = (const float4*)a_inBVH.pTriangleData[treeId];
+    const float rootArea   = BoxSurfaceArea(root->m_boxMin, root->m_boxMax);
+
+    BVHSubtreeStat top;
+    std::unordered_map<unsigned int, BVHSubtreeStat> subtrees;
+    AnalyzeBVHNode(root, root, objList, (rootArea > 0.0f) ? rootArea : 1.0f, 0, &top, &subtrees);
+
+    // merge bottom level trees to get per tree totals; each bottom level tree is taken once
+    //
+    BVHSubtreeStat total = top;
+    int instancesNum     = 0;
+    for (const auto& p : subtrees)
+    {
+      total.nodesNum     += p.second.nodesNum;
+      total.leafesNum    += p.second.leafesNum;
+      total.trianglesNum += p.second.trianglesNum;
+      total.innerNum     += p.second.innerNum;
+      total.overlapSum   += p.second.overlapSum;
+      for (auto q : p.second.leafHist)
+        total.leafHist[q.first] += q.second;
+      instancesNum += int(p.second.instIds.size());
+    }
+
+    fout << "  sah_cost      = " << top.sahCost << std::endl;
+    fout << "  nodes_num     = " << total.nodesNum << std::endl;
+    fout << "  leafes_num    = " << total.leafesNum << std::endl;
+    fout << "  tri_num       = " << total.trianglesNum << std::endl;
+    fout << "  top_max_deep  = " << top.maxDeep << std::endl;
+    fout << "  avg_overlap   = " << ((total.innerNum > 0) ? total.overlapSum / double(total.innerNum) : 0.0) << std::endl;
+    fout << "  leaf_hist     = ";
+    PrintLeafHistogram(fout, total.leafHist);
+    fout << std::endl;
+    fout << "  instances_num = " << instancesNum << std::endl;
+    fout << "  meshes_num    = " << subtrees.size() << std::endl;
+
+    // most expensive bottom level trees first
+    //
+    std::vector<const BVHSubtreeStat*> sorted;
+    for (const auto& p : subtrees)
+      sorted.push_back(&p.second);
+    std::sort(sorted.begin(), sorted.end(), [](const BVHSubtreeStat* a, const BVHSubtreeStat* b) { return a->sahCost > b->sahCost; });
+
+    fout << "  meshes = [" << std::endl;
+    for (const BVHSubtreeStat* pStat : sorted)
+    {
+      fout << "    { mesh_id = " << pStat->meshId << ", inst_num = " << pStat->instIds.size() << ", sah_cost = " << pStat->sahCost;
+      fout << ", nodes = " << pStat->nodesNum << ", leafes = " << pStat->leafesNum << ", tris = " << pStat->trianglesNum << ", max_deep = " << pStat->maxDeep;
+      fout << ", avg_overlap = " << ((pStat->innerNum > 0) ? pStat->overlapSum / double(pStat->innerNum) : 0.0) << ", leaf_hist = ";
+      PrintLeafHistogram(fout, pStat->leafHist);
+      fout << " }" << std::endl;
+    }
+    fout << "  ]" << std::endl;
+    fout << "}" << std::endl;
+
+    std::cout << "[DebugAnalyzeBVH]: bvh[" << treeId << "]: sah = " << top.sahCost << ", nodes = " << total.nodesNum << ", meshes = " << subtrees.size() << ", instances = " << instancesNum << std::endl;
+  }
+
+  fout.close();
+}
+
 void RenderDriverRTE::DebugTestAlphaTestTable(const std::vector<uint2>& a_alphaTable, int a_trif4Num)
 {
   m_pHWLayer->PrepareEngineGlobals();
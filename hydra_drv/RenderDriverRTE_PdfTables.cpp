@@ -6,8 +6,17 @@
 #include <string>
 #include <vector>
 #include <string>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#ifdef WIN32
+  #include <direct.h>
+#else
+  #include <sys/stat.h>
+#endif
 
 #include "HDRImageLite.h"
+#include "../../HydraAPI/hydra_api/xxhash.h"
 
 HDRImageLite::HDRImageLite() : m_width(0), m_height(0), m_channels(4)
 {
@@ -370,7 +379,167 @@ std::vector<float> PrefixSumm(const std::vector<float>& a_vec)
 }
 
 std::string ws2s(const std::wstring& s);
-std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH);
+std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, int* pW, int* pH, int* pPhiSym);
+
+static const uint32_t IES_DISK_CACHE_VERSION = 1; ///< increment it each time IES rasterization or tables layout is changed
+
+/**
+\brief  Create IES texture and pdf table in the same layout they are stored in IMemoryStorage (4 floats header + data).
+\param  a_path     - full path to ies file
+\param  a_texData  - out texture: (w, h, phiSym, size+1) + normalized intensity
+\param  a_pdfData  - out pdf table: (w, h, phiSym, size) + prefix summ of blured intensity
+\return false if IES file is broken
+
+*/
+static bool CreateIESTables(const std::string& a_path, std::vector<float>& a_texData, std::vector<float>& a_pdfData)
+{
+  int w, h, phiSym;
+  std::vector<float> sphericalTexture = CreateSphericalTextureFromIES(a_path, &w, &h, &phiSym);
+    
+  if(sphericalTexture.size() == 1)
+    return false;
+
+  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
+  float maxVal = 0.0f;
+  for (auto i = 0; i < sphericalTexture.size(); i++)
+    maxVal = fmax(maxVal, sphericalTexture[i]);
+
+  if(maxVal == 0.0f)
+  {
+    std::cerr << "[ERROR]: broken IES file (maxVal = 0.0): " << a_path.c_str() << std::endl;
+    return false;
+  }
+
+  float invMax = 1.0f / maxVal;
+  for (auto i = 0; i < sphericalTexture.size(); i++)
+  {
+    float val = invMax*sphericalTexture[i];
+    sphericalTexture[i] = val;
+  }
+  //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
+
+  std::vector<float>& data2 = a_texData;
+  data2.resize(sphericalTexture.size() + 5);
+
+  data2[0] = as_float(w);
+  data2[1] = as_float(h);
+  data2[2] = as_float(phiSym);
+  data2[3] = as_float(int(sphericalTexture.size() + 1));
+
+  double avgVal = 0.0f;
+  for (size_t i = 0; i < sphericalTexture.size(); i++)
+  {
+    avgVal      += double(sphericalTexture[i]);
+    data2[i + 4] = sphericalTexture[i];
+  }
+  avgVal /= double(sphericalTexture.size());
+
+  ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+  HDRImageLite tempImage(w, h, 1, &sphericalTexture[0]);
+  tempImage.gaussBlur(2, 1.5f);
+  for (int i = 0; i < tempImage.width()*tempImage.height(); i++) // prevent pixels with zero pdf
+    sphericalTexture[i] = tempImage.data()[i] + 0.05f*float(avgVal);
+    
+  const std::vector<float> prefixSumm = PrefixSumm(sphericalTexture);
+    
+  std::vector<float>& data3 = a_pdfData;
+  data3.resize(prefixSumm.size() + 4);
+    
+  data3[0] = as_float(w);
+  data3[1] = as_float(h);
+  data3[2] = as_float(phiSym);
+  data3[3] = as_float(int(prefixSumm.size()));
+  for (size_t i = 0; i < prefixSumm.size(); i++)
+    data3[i + 4] = prefixSumm[i];
+
+  return true;
+}
+
+static std::string IESDiskCacheDir() { return HydraInstallPath() + "iescache"; }
+
+/**
+\brief  Get path of IES tables in persistent disk cache. Key is the hash of ies file content, so cache is valid for any scene and any process. 
+\param  a_path - full path to ies file
+\return path to cache file or empty string if ies file can't be read
+
+*/
+static std::string IESDiskCachePath(const std::string& a_path)
+{
+  std::ifstream fin(a_path.c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return "";
+
+  const std::vector<char> fileData((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+  const uint64_t hashVal = XXH64(fileData.data(), fileData.size(), uint64_t(IES_DISK_CACHE_VERSION));
+
+  std::stringstream ss;
+  ss << IESDiskCacheDir() << "/" << std::hex << std::setw(16) << std::setfill('0') << hashVal << ".bin";
+  return ss.str();
+}
+
+static bool LoadIESTablesFromDiskCache(const std::string& a_cachePath, std::vector<float>& a_texData, std::vector<float>& a_pdfData)
+{
+  std::ifstream fin(a_cachePath.c_str(), std::ios::binary);
+  if (!fin.is_open())
+    return false;
+
+  uint32_t header[3] = { 0, 0, 0 }; // (version, texSize, pdfSize)
+  fin.read((char*)header, sizeof(header));
+
+  if (!fin.good() || header[0] != IES_DISK_CACHE_VERSION || header[1] <= 4 || header[2] <= 4)
+    return false;
+
+  a_texData.resize(header[1]);
+  a_pdfData.resize(header[2]);
+
+  fin.read((char*)a_texData.data(), a_texData.size()*sizeof(float));
+  fin.read((char*)a_pdfData.data(), a_pdfData.size()*sizeof(float));
+
+  if (!fin.good())
+    return false;
+
+  const size_t texels = size_t(as_int(a_texData[0]))*size_t(as_int(a_texData[1]));
+  return (a_texData.size() == texels + 5) && (a_pdfData.size() == texels + 5);
+}
+
+/**
+\brief  Save IES tables to disk cache. Write to temporary file and then rename it, so other processes never see partially written file.
+
+*/
+static void SaveIESTablesToDiskCache(const std::string& a_cachePath, const std::vector<float>& a_texData, const std::vector<float>& a_pdfData)
+{
+  std::stringstream tmpName;
+  tmpName << a_cachePath << "." << std::hex << uint64_t(std::chrono::high_resolution_clock::now().time_since_epoch().count()) << ".tmp";
+  const std::string tmpPath = tmpName.str();
+
+  #ifdef WIN32
+  _mkdir(IESDiskCacheDir().c_str());     // fails if directory already exists, that's ok
+  #else
+  mkdir(IESDiskCacheDir().c_str(), 0777);
+  #endif
+
+  {
+    std::ofstream fout(tmpPath.c_str(), std::ios::binary);
+    if (!fout.is_open()) // no cache directory or it is read only; just don't use disk cache
+      return;
+
+    const uint32_t header[3] = { IES_DISK_CACHE_VERSION, uint32_t(a_texData.size()), uint32_t(a_pdfData.size()) };
+    fout.write((const char*)header, sizeof(header));
+    fout.write((const char*)a_texData.data(), a_texData.size()*sizeof(float));
+    fout.write((const char*)a_pdfData.data(), a_pdfData.size()*sizeof(float));
+
+    if (!fout.good())
+    {
+      fout.close();
+      std::remove(tmpPath.c_str());
+      return;
+    }
+  }
+
+  if (std::rename(tmpPath.c_str(), a_cachePath.c_str()) != 0) // other process may already put same file to cache
+    std::remove(tmpPath.c_str());
+}
 
 /**
 \brief  Create 2 tables from ies file in single float1 storage and return pair of their ids.
@@ -380,6 +549,8 @@ std::vector<float> CreateSphericalTextureFromIES(const std::string& a_iesData, i
 \param  a_libPath  - input path to scene library; used to get full path of ies.
 \return pair of (texTableId, pdfTbaleId)
 
+  Tables are also stored in persistent disk cache (HydraInstallPath()/iescache) to skip IES rasterization and pdf evaluation on next load.
+
 */
 
 int2 AddIesTexTableToStorage(const std::wstring pathW, IMemoryStorage* a_storage, 
@@ -394,73 +565,25 @@ int2 AddIesTexTableToStorage(const std::wstring pathW, IMemoryStorage* a_storage
   auto p = a_iesCache.find(pathW);
   if (p == a_iesCache.end())
   {
-    int w, h;
-    std::vector<float> sphericalTexture;
-    
-    iesTexId         = a_storage->GetMaxObjectId() + 1;
-    sphericalTexture = CreateSphericalTextureFromIES(pathA1, &w, &h);
-    
-    if(sphericalTexture.size() == 1)
-      return int2(-1,-1);
-
-    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
-    float maxVal = 0.0f;
-    for (auto i = 0; i < sphericalTexture.size(); i++)
-      maxVal = fmax(maxVal, sphericalTexture[i]);
+    std::vector<float> texData, pdfData;
 
-    if(maxVal == 0.0f)
-    {
-      std::cerr << "[ERROR]: broken IES file (maxVal = 0.0): " << pathA1.c_str() << std::endl;
-      return int2(-1, -1);
-    }
+    const std::string cachePath = IESDiskCachePath(pathA1);
+    const bool fromDiskCache    = (cachePath != "") && LoadIESTablesFromDiskCache(cachePath, texData, pdfData);
 
-    float invMax = 1.0f / maxVal;
-    for (auto i = 0; i < sphericalTexture.size(); i++)
+    if (!fromDiskCache)
     {
-      float val = invMax*sphericalTexture[i];
-      sphericalTexture[i] = val;
-    }
-    //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////// 
-
-    std::vector<float> data2(sphericalTexture.size() + 5);
+      if (!CreateIESTables(pathA1, texData, pdfData))
+        return int2(-1, -1);
 
-    data2[0] = as_float(w);
-    data2[1] = as_float(h);
-    data2[2] = as_float(1);
-    data2[3] = as_float(int(sphericalTexture.size() + 1));
-
-    double avgVal = 0.0f;
-    for (size_t i = 0; i < sphericalTexture.size(); i++)
-    {
-      avgVal      += double(sphericalTexture[i]);
-      data2[i + 4] = sphericalTexture[i];
+      if (cachePath != "")
+        SaveIESTablesToDiskCache(cachePath, texData, pdfData);
     }
-    avgVal /= double(sphericalTexture.size());
-
-    a_storage->Update(iesTexId, &data2[0], data2.size() * sizeof(float));
-
-    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-    HDRImageLite tempImage(w, h, 1, &sphericalTexture[0]);
-    tempImage.gaussBlur(2, 1.5f);
-    for (int i = 0; i < tempImage.width()*tempImage.height(); i++) // prevent pixels with zero pdf
-      sphericalTexture[i] = tempImage.data()[i] + 0.05f*float(avgVal);
-    
-    data2 = PrefixSumm(sphericalTexture);
-    
-    std::vector<float> data3(data2.size() + 4);
     
-    data3[0] = as_float(w);
-    data3[1] = as_float(h);
-    data3[2] = as_float(1);
-    data3[3] = as_float(int(data2.size()));
-    for (size_t i = 0; i < data2.size(); i++)
-      data3[i + 4] = data2[i];
-    
-    iesPdfId = a_storage->GetMaxObjectId() + 1;
-    a_storage->Update(iesPdfId, &data3[0], data3.size() * sizeof(float));
+    iesTexId = a_storage->GetMaxObjectId() + 1;
+    a_storage->Update(iesTexId, &texData[0], texData.size() * sizeof(float));
 
-    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    iesPdfId = a_storage->GetMaxObjectId() + 1;
+    a_storage->Update(iesPdfId, &pdfData[0], pdfData.size() * sizeof(float));
 
     a_iesCache[pathW] = int2(iesTexId, iesPdfId);
   }
@@ -671,6 +794,170 @@ std::vector<float> CalcTrianglePickProbTable(const PlainMesh* pLMesh, double* a_
   return PrefixSumm(triangleSurfaceArea);
 }
 
+static const int MESH_LIGHT_EMISSION_MAX_LEVEL = 5;      ///< max midpoint subdivision level of a triangle in mesh light emission table (1024 sub-triangles)
+static const int MESH_LIGHT_EMISSION_MAX_ELEMS = 262144; ///< max number of (triangle, sub-triangle) pairs in mesh light emission table
+static const int MESH_LIGHT_EMISSION_SS_LEVEL  = 2;      ///< each sub-triangle emission is averaged over 4^MESH_LIGHT_EMISSION_SS_LEVEL points
+
+static float LumImageFetch(const std::vector<float>& a_lum, const int w, const int h, const SWTexSampler& a_sampler, const float2 a_texCoord)
+{
+  const float2 texCoordT = mul2x4(a_sampler.row0, a_sampler.row1, a_texCoord);
+
+  int px = int(floorf(texCoordT.x*float(w)));
+  int py = int(floorf(texCoordT.y*float(h)));
+
+  if (a_sampler.flags & TEX_CLAMP_U)
+    px = std::max(std::min(px, w - 1), 0);
+  else
+    px = ((px % w) + w) % w;
+
+  if (a_sampler.flags & TEX_CLAMP_V)
+    py = std::max(std::min(py, h - 1), 0);
+  else
+    py = ((py % h) + h) % h;
+
+  return powf(a_lum[py*w + px], a_sampler.gamma);
+}
+
+/**
+\brief  Create (triangle, sub-triangle) pick table for mesh light with emission texture; each triangle is splitted to 4^level sub-triangles by midpoint subdivision (see subTriangleBary).
+\param  pLMesh    - light mesh
+\param  a_sampler - sampler of light color texture
+\param  a_lum     - luminance image of light color texture; must not have zero pixels
+\param  w         - luminance image width
+\param  h         - luminance image height
+\param  pLevel    - out subdivision level
+\return prefix summ of area*average_emission for all sub-triangles
+
+*/
+std::vector<float> CalcTriangleEmissionPickProbTable(const PlainMesh* pLMesh, const SWTexSampler& a_sampler, const std::vector<float>& a_lum, const int w, const int h, int* pLevel)
+{
+  const float4* vpos     = meshVerts(pLMesh);
+  const float4* vnorm    = meshNorms(pLMesh);
+  const int32_t* indices = meshTriIndices(pLMesh);
+  const int triNum       = pLMesh->tIndicesNum / 3;
+
+  // (1) select subdivision level so that sub-triangle covers a few texels of the largest triangle footprint
+  //
+  float maxTexelArea = 0.0f;
+  for (int triId = 0; triId < triNum; triId++)
+  {
+    const int iA = indices[triId * 3 + 0];
+    const int iB = indices[triId * 3 + 1];
+    const int iC = indices[triId * 3 + 2];
+
+    const float2 tA = mul2x4(a_sampler.row0, a_sampler.row1, float2(vpos[iA].w, vnorm[iA].w));
+    const float2 tB = mul2x4(a_sampler.row0, a_sampler.row1, float2(vpos[iB].w, vnorm[iB].w));
+    const float2 tC = mul2x4(a_sampler.row0, a_sampler.row1, float2(vpos[iC].w, vnorm[iC].w));
+
+    const float2 d1 = tB - tA;
+    const float2 d2 = tC - tA;
+    maxTexelArea = fmax(maxTexelArea, 0.5f*fabs(d1.x*d2.y - d1.y*d2.x)*float(w)*float(h));
+  }
+
+  int level = 0;
+  while (level < MESH_LIGHT_EMISSION_MAX_LEVEL && maxTexelArea > 4.0f*float(1 << (2 * level)) && 
+         int64_t(triNum) << (2 * (level + 1)) <= int64_t(MESH_LIGHT_EMISSION_MAX_ELEMS))
+    level++;
+
+  // (2) integrate emission over each sub-triangle footprint
+  //
+  const int subNum = (1 << (2 * level));
+  const int ssNum  = (1 << (2 * MESH_LIGHT_EMISSION_SS_LEVEL));
+
+  std::vector<float> weights(size_t(triNum)*size_t(subNum));
+
+  #pragma omp parallel for
+  for (int triId = 0; triId < triNum; triId++)
+  {
+    const int iA = indices[triId * 3 + 0];
+    const int iB = indices[triId * 3 + 1];
+    const int iC = indices[triId * 3 + 2];
+
+    const float3 A  = to_float3(vpos[iA]);
+    const float3 B  = to_float3(vpos[iB]);
+    const float3 C  = to_float3(vpos[iC]);
+
+    const float2 tA = float2(vpos[iA].w, vnorm[iA].w);
+    const float2 tB = float2(vpos[iB].w, vnorm[iB].w);
+    const float2 tC = float2(vpos[iC].w, vnorm[iC].w);
+
+    const float subArea = 0.5f*length(cross(B - A, C - A)) / float(subNum);
+
+    for (int subId = 0; subId < subNum; subId++)
+    {
+      float3 b0, b1, b2;
+      subTriangleBary(subId, level, &b0, &b1, &b2);
+
+      float avgLum = 0.0f;
+      for (int ssId = 0; ssId < ssNum; ssId++)
+      {
+        float3 c0, c1, c2;
+        subTriangleBary(ssId, MESH_LIGHT_EMISSION_SS_LEVEL, &c0, &c1, &c2);
+        const float3 c    = (c0 + c1 + c2)*(1.0f / 3.0f); // centroid of sub-sub-triangle in sub-triangle barycentrics
+        const float3 bary = b0*c.x + b1*c.y + b2*c.z;
+        avgLum += LumImageFetch(a_lum, w, h, a_sampler, tA*bary.x + tB*bary.y + tC*bary.z);
+      }
+      avgLum *= (1.0f / float(ssNum));
+
+      weights[size_t(triId)*size_t(subNum) + size_t(subId)] = subArea*avgLum;
+    }
+  }
+
+  (*pLevel) = level;
+  return PrefixSumm(weights);
+}
+
+void RenderDriverRTE::UpdateMeshLightEmissionTable(int32_t a_lightId, const PlainMesh* pLMesh)
+{
+  // (1) get light texture; constant emission is already handled by area table of MeshLight
+  //
+  int32_t a_outIds[2] = { -1,-1 };
+  const int32_t texturesNum = m_lights[a_lightId]->RelatedTextureIds(a_outIds, 2);
+  const int32_t texId       = a_outIds[0];
+
+  const int4* texData = (const int4*)m_pTexStorage->GetBegin();
+  const std::vector<int32_t> texOffsets = m_pTexStorage->GetTable();
+
+  if (pLMesh == nullptr || texturesNum == 0 || texId == INVALID_TEXTURE || texData == nullptr || texId >= int32_t(texOffsets.size()))
+    return;
+
+  // (2) calc lum image
+  //
+  const int4* pHeader = texData + texOffsets[texId];
+  int w         = pHeader->x;
+  int h         = pHeader->y;
+  const int bpp = pHeader->w;
+
+  std::vector<float> lumImage;
+  if (bpp == 4)
+    lumImage = LuminanceFromUchar4Image((const uchar4*)(pHeader + 1), w, h);
+  else if (bpp == 16)
+    lumImage = LuminanceFromFloat4Image((const float4*)(pHeader + 1), w, h);
+  else
+    return;
+
+  // (3) calc (triangle, sub-triangle) table and put it to storage in the same way as other pdf tables: (triNum, level, 1, size) + data
+  //
+  const PlainLight plain     = m_lights[a_lightId]->ConvertToPlainLight();
+  const SWTexSampler sampler = *((const SWTexSampler*)(plain.data + MESH_LIGHT_TEX_SAMPLER));
+
+  int level = 0;
+  const std::vector<float> table = CalcTriangleEmissionPickProbTable(pLMesh, sampler, lumImage, w, h, &level);
+
+  std::vector<float> data(table.size() + 4);
+  data[0] = as_float(pLMesh->tIndicesNum / 3);
+  data[1] = as_float(level);
+  data[2] = as_float(1);
+  data[3] = as_float(int(table.size()));
+  for (size_t i = 0; i < table.size(); i++)
+    data[i + 4] = table[i];
+
+  const int32_t pdfTabId = m_pPdfStorage->GetMaxObjectId() + 1;
+  m_pPdfStorage->Update(pdfTabId, &data[0], data.size() * sizeof(float));
+
+  m_lights[a_lightId]->SetPdfTableId(0, pdfTabId);
+}
+
 
 
 
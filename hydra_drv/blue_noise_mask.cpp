@@ -0,0 +1,173 @@
+#include <cmath>
+#include <vector>
+
+#include "crandom.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//  @inproceedings{Ulichney93:VoidAndCluster,
+//    author = "R. Ulichney",
+//    title  = "The void-and-cluster method for dither array generation",
+//    booktitle = "Proc. SPIE 1913, Human Vision, Visual Processing, and Digital Display IV",
+//    year   = "1993" }
+////////////////////////////////////////////////////////////////////////////////
+
+constexpr static int    BN_SIZE  = BLUE_NOISE_SIZE;
+constexpr static int    BN_TOTAL = BLUE_NOISE_SIZE*BLUE_NOISE_SIZE;
+constexpr static double BN_SIGMA = 1.5;
+
+/**
+\brief energy of toroidal gaussian filter applied to binary pattern. Filter is precomputed for all offsets,
+       so adding or removing a single point costs one pass over the mask.
+*/
+struct VoidAndClusterField
+{
+  VoidAndClusterField() : filter(BN_TOTAL), energy(BN_TOTAL, 0.0)
+  {
+    for (int y = 0; y < BN_SIZE; y++)
+    {
+      for (int x = 0; x < BN_SIZE; x++)
+      {
+        const int dx = (x <= BN_SIZE/2) ? x : BN_SIZE - x;
+        const int dy = (y <= BN_SIZE/2) ? y : BN_SIZE - y;
+        filter[y*BN_SIZE + x] = exp(-double(dx*dx + dy*dy)/(2.0*BN_SIGMA*BN_SIGMA));
+      }
+    }
+  }
+
+  void Splat(int a_pos, double a_sign)
+  {
+    const int px = a_pos % BN_SIZE;
+    const int py = a_pos / BN_SIZE;
+    for (int y = 0; y < BN_SIZE; y++)
+    {
+      const int fy = ((y - py) & (BN_SIZE - 1))*BN_SIZE;
+      for (int x = 0; x < BN_SIZE; x++)
+        energy[y*BN_SIZE + x] += a_sign*filter[fy + ((x - px) & (BN_SIZE - 1))];
+    }
+  }
+
+  int TightestCluster(const std::vector<char>& a_pattern, char a_value) const ///< max energy among points equal to a_value
+  {
+    int best = -1;
+    for (int i = 0; i < BN_TOTAL; i++)
+      if (a_pattern[i] == a_value && (best < 0 || energy[i] > energy[best]))
+        best = i;
+    return best;
+  }
+
+  int LargestVoid(const std::vector<char>& a_pattern, char a_value) const ///< min energy among points equal to a_value
+  {
+    int best = -1;
+    for (int i = 0; i < BN_TOTAL; i++)
+      if (a_pattern[i] == a_value && (best < 0 || energy[i] < energy[best]))
+        best = i;
+    return best;
+  }
+
+  std::vector<double> filter;
+  std::vector<double> energy;
+};
+
+/**
+\brief Generate tileable blue noise dither mask with void-and-cluster method. Every value (rank + 0.5)/N appears exactly once.
+       Generation is deterministic, so CPU integrators and OpenCL kernels use the same mask.
+\param a_mask - out mask of BLUE_NOISE_SIZE*BLUE_NOISE_SIZE values in (0,1)
+*/
+extern "C" void initBlueNoiseMask(float a_mask[BLUE_NOISE_SIZE*BLUE_NOISE_SIZE])
+{
+  std::vector<int> rank(BN_TOTAL, 0);
+
+  // (1) initial binary pattern with ~10% of points, relaxed until tightest cluster is the same as largest void
+  //
+  std::vector<char> prototype(BN_TOTAL, 0);
+  VoidAndClusterField protoField;
+
+  unsigned int state = 0x2545F491;
+  int onesNum        = 0;
+  while (onesNum < BN_TOTAL/10)
+  {
+    state = state*1664525u + 1013904223u;
+    const int pos = int((state >> 8) % BN_TOTAL);
+    if (prototype[pos] == 0)
+    {
+      prototype[pos] = 1;
+      protoField.Splat(pos, 1.0);
+      onesNum++;
+    }
+  }
+
+  for (int iter = 0; iter < BN_TOTAL; iter++)
+  {
+    const int cluster = protoField.TightestCluster(prototype, 1);
+    prototype[cluster] = 0;
+    protoField.Splat(cluster, -1.0);
+
+    const int voidPos = protoField.LargestVoid(prototype, 0);
+    prototype[voidPos] = 1;
+    protoField.Splat(voidPos, 1.0);
+
+    if (voidPos == cluster)
+      break;
+  }
+
+  // (2) phase 1: remove points from prototype in tightest clusters, ranks go down
+  //
+  {
+    std::vector<char>   pattern = prototype;
+    VoidAndClusterField field   = protoField;
+    for (int r = onesNum - 1; r >= 0; r--)
+    {
+      const int cluster = field.TightestCluster(pattern, 1);
+      pattern[cluster]  = 0;
+      field.Splat(cluster, -1.0);
+      rank[cluster]     = r;
+    }
+  }
+
+  // (3) phase 2: fill largest voids up to half of the mask
+  //
+  std::vector<char>   pattern = prototype;
+  VoidAndClusterField field   = protoField;
+  int r = onesNum;
+  for (; r < BN_TOTAL/2; r++)
+  {
+    const int voidPos = field.LargestVoid(pattern, 0);
+    pattern[voidPos]  = 1;
+    field.Splat(voidPos, 1.0);
+    rank[voidPos]     = r;
+  }
+
+  // (4) phase 3: zeros are minority now, so fill tightest clusters of zeros
+  //
+  VoidAndClusterField zeroField;
+  for (int i = 0; i < BN_TOTAL; i++)
+    if (pattern[i] == 0)
+      zeroField.Splat(i, 1.0);
+
+  for (; r < BN_TOTAL; r++)
+  {
+    const int cluster = zeroField.TightestCluster(pattern, 0);
+    pattern[cluster]  = 1;
+    zeroField.Splat(cluster, -1.0);
+    rank[cluster]     = r;
+  }
+
+  for (int i = 0; i < BN_TOTAL; i++)
+    a_mask[i] = (float(rank[i]) + 0.5f)/float(BN_TOTAL);
+}
+
+/**
+\brief Get blue noise mask that is shared by all layers and integrators. Mask is generated on first call only, 
+       so nothing is computed until HRT_ENABLE_BLUE_NOISE is actually used. Safe to call from several threads.
+\return pointer to BLUE_NOISE_SIZE*BLUE_NOISE_SIZE values in (0,1)
+*/
+extern "C" const float* getBlueNoiseMask()
+{
+  static const std::vector<float> mask = []()
+  {
+    std::vector<float> res(BN_TOTAL);
+    initBlueNoiseMask(res.data());
+    return res;
+  }();
+  return mask.data();
+}
@@ -0,0 +1,17 @@
+#ifndef RTDENOISE
+#define RTDENOISE
+
+// constants of G-buffer guided NLM filter; shared by CPU (CPUGuidedFilter2D.cpp) and OpenCL (shaders/image.cl GuidedNLMFilter) implementations
+
+#define GUIDED_DEFAULT_RADIUS   5      // search window radius, 11x11 window is usually enough for 16-64 spp
+#define GUIDED_DEFAULT_STRENGTH 0.5f   // expected relative noise level (NLM sigma)
+
+#define GUIDED_NORMAL_K         32.0f  // penalty for (1 - dot(n1,n2))
+#define GUIDED_DEPTH_K          20.0f  // penalty for relative depth difference
+#define GUIDED_ALBEDO_K         50.0f  // penalty for squared albedo difference
+#define GUIDED_MAX_EXPONENT     8.0f   // neighbours with smaller weight (exp(-8)) are skipped
+#define GUIDED_MIN_ALBEDO       0.02f  // albedo is clamped before demodulation
+#define GUIDED_PATCH_EPS        1e-4f  // added to intensity in denominator of relative patch distance
+#define GUIDED_BACK_DEPTH       1e+5f  // pixels with greater depth are background
+
+#endif
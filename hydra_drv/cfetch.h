@@ -75,6 +75,29 @@ typedef struct GlobalRenderDataT
 
 } EngineGlobals;
 
+/**
+\brief remap screen part of lens sample to crop window, so eye rays are generated only inside it.
+\param a_lensOffs - in sample from rndLens; xy are normalized screen coordinates
+\param a_globals  - in engine globals with HRT_CROP_* variables
+
+\return lens sample with xy inside crop window
+*/
+static inline float4 cropLensSample(float4 a_lensOffs, __global const EngineGlobals* a_globals)
+{
+  const float minX = a_globals->varsF[HRT_CROP_MIN_X];
+  const float minY = a_globals->varsF[HRT_CROP_MIN_Y];
+  const float maxX = a_globals->varsF[HRT_CROP_MAX_X];
+  const float maxY = a_globals->varsF[HRT_CROP_MAX_Y];
+
+  if (maxX > minX && maxY > minY)
+  {
+    a_lensOffs.x = minX + a_lensOffs.x*(maxX - minX);
+    a_lensOffs.y = minY + a_lensOffs.y*(maxY - minY);
+  }
+
+  return a_lensOffs;
+}
+
 #ifndef OCL_COMPILER
 static inline void InitEngineGlobals(EngineGlobals* a_pGlobals)
 {
@@ -948,6 +971,54 @@ IDH_CALL int2 getObjectList(unsigned int offset, __read_only image1d_buffer_t ob
   return res;
 }
 
+IDH_CALL int4 getLeafHeader(unsigned int offset, __read_only image1d_buffer_t objListTex)
+{
+  const float4 tmp = read_imagef(objListTex, offset);
+  return make_int4(as_int(tmp.x), as_int(tmp.y), as_int(tmp.z), as_int(tmp.w));
+}
+
+static inline float objListFloat(int a_floatId, __read_only image1d_buffer_t objListTex)
+{
+  const float4 tmp = read_imagef(objListTex, a_floatId >> 2);
+  const int    c   = a_floatId & 3;
+  return (c == 0) ? tmp.x : ((c == 1) ? tmp.y : ((c == 2) ? tmp.z : tmp.w));
+}
+
+static inline int4 fetchLeafTriangle(const int a_leafOffset, const int4 a_header, const int a_triId, __read_only image1d_buffer_t objListTex,
+                                     __private float3* pA, __private float3* pB, __private float3* pC)
+{
+  if (IsCompactLeaf(a_header))
+  {
+    const float4 rec    = read_imagef(objListTex, a_leafOffset + 1 + (a_triId >> 1));
+    const int    primId = (a_triId & 1) ? as_int(rec.z) : as_int(rec.x);
+    const int    packed = (a_triId & 1) ? as_int(rec.w) : as_int(rec.y);
+    const int    vBase  = 4 * (a_leafOffset + CompactLeafVertOffset(a_header));
+
+    const int iA = vBase + 3 * ((packed >> 0)  & 0xFF);
+    const int iB = vBase + 3 * ((packed >> 8)  & 0xFF);
+    const int iC = vBase + 3 * ((packed >> 16) & 0xFF);
+
+    (*pA) = make_float3(objListFloat(iA + 0, objListTex), objListFloat(iA + 1, objListTex), objListFloat(iA + 2, objListTex));
+    (*pB) = make_float3(objListFloat(iB + 0, objListTex), objListFloat(iB + 1, objListTex), objListFloat(iB + 2, objListTex));
+    (*pC) = make_float3(objListFloat(iC + 0, objListTex), objListFloat(iC + 1, objListTex), objListFloat(iC + 2, objListTex));
+
+    return make_int4(primId, a_header.w, -1, a_header.x + 3 * a_triId);
+  }
+  else
+  {
+    const int    triAddress = a_header.x + 3 * a_triId;
+    const float4 data1      = read_imagef(objListTex, triAddress + 0);
+    const float4 data2      = read_imagef(objListTex, triAddress + 1);
+    const float4 data3      = read_imagef(objListTex, triAddress + 2);
+
+    (*pA) = to_float3(data1);
+    (*pB) = to_float3(data2);
+    (*pC) = to_float3(data3);
+
+    return make_int4(as_int(data1.w), as_int(data2.w), as_int(data3.w), triAddress);
+  }
+}
+
 IDH_CALL BVHNode GetBVHNode(unsigned int offset, __read_only image1d_buffer_t bvhTex)
 {
   float4 nodeHalf1 = read_imagef(bvhTex, (int)(2 * offset + 0));
@@ -979,6 +1050,63 @@ IDH_CALL int2 getObjectList(unsigned int offset, __global const float4* objListT
 }
 
 
+/**
+\brief Read leaf header; (start, triNum, -1, -1) for plain leaf and see BVH_COMPACT_LEAF_TAG for compact one.
+*/
+IDH_CALL int4 getLeafHeader(unsigned int offset, __global const float4* objListTex)
+{
+  const float4 tmp = objListTex[offset];
+  return make_int4(as_int(tmp.x), as_int(tmp.y), as_int(tmp.z), as_int(tmp.w));
+}
+
+/**
+\brief Fetch triangle from leaf of any format (plain or compact).
+\param a_leafOffset - leaf offset in object list
+\param a_header     - leaf header, see getLeafHeader
+\param a_triId      - triangle index inside leaf
+\param objListTex   - object list (triangle data)
+\param pA           - out vertex A
+\param pB           - out vertex B
+\param pC           - out vertex C
+\return (primId, geomId, instId, alphaAddress); alphaAddress is the offset of 3 triangle records in alpha test table
+*/
+static inline int4 fetchLeafTriangle(const int a_leafOffset, const int4 a_header, const int a_triId, __global const float4* objListTex,
+                                     __private float3* pA, __private float3* pB, __private float3* pC)
+{
+  if (IsCompactLeaf(a_header))
+  {
+    const float4 rec    = objListTex[a_leafOffset + 1 + (a_triId >> 1)];
+    const int    primId = (a_triId & 1) ? as_int(rec.z) : as_int(rec.x);
+    const int    packed = (a_triId & 1) ? as_int(rec.w) : as_int(rec.y);
+
+    __global const float* pVerts = (__global const float*)(objListTex + a_leafOffset + CompactLeafVertOffset(a_header));
+
+    const int iA = 3 * ((packed >> 0)  & 0xFF);
+    const int iB = 3 * ((packed >> 8)  & 0xFF);
+    const int iC = 3 * ((packed >> 16) & 0xFF);
+
+    (*pA) = make_float3(pVerts[iA + 0], pVerts[iA + 1], pVerts[iA + 2]);
+    (*pB) = make_float3(pVerts[iB + 0], pVerts[iB + 1], pVerts[iB + 2]);
+    (*pC) = make_float3(pVerts[iC + 0], pVerts[iC + 1], pVerts[iC + 2]);
+
+    return make_int4(primId, a_header.w, -1, a_header.x + 3 * a_triId);
+  }
+  else
+  {
+    const int    triAddress = a_header.x + 3 * a_triId;
+    const float4 data1      = objListTex[triAddress + 0];
+    const float4 data2      = objListTex[triAddress + 1];
+    const float4 data3      = objListTex[triAddress + 2];
+
+    (*pA) = to_float3(data1);
+    (*pB) = to_float3(data2);
+    (*pC) = to_float3(data3);
+
+    return make_int4(as_int(data1.w), as_int(data2.w), as_int(data3.w), triAddress);
+  }
+}
+
+
 IDH_CALL BVHNode GetBVHNode(int offset, __global const float4* bvhTex)
 {
   const int    offset2   = (offset >= 0) ? offset : 0;
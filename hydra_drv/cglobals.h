@@ -115,6 +115,7 @@
 #define MMLT_FLOATS_PER_SAMPLE 3
 #define MMLT_FLOATS_PER_BOUNCE (MMLT_FLOATS_PER_SAMPLE + MMLT_FLOATS_PER_MLAYER)
 #define MMLT_COMPRESSED_F_PERB 6
+#define MMLT_HEAD_COMPRESSED_SIZE 8 ///< GPU MMLT head: packBounceGroup(scr_x, scr_y, lgt_x, lgt_y | dof_x, dof_y) and packBounceGroup(lgt_z, lgt_w, lgt_x1, lgt_y1 | lgt_n, split)
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -408,10 +409,11 @@ enum FLAG_BITS{HRT_COMPUTE_SHADOWS                 = 1,
                HRT_INDIRECT_LIGHT_MODE             = 65536,
                HRT_STUPID_PT_MODE                  = 65536*8,
                HRT_NO_RANDOM_LIGHTS_SELECT         = 65536*16,
-               HRT_DUMMY5                          = 65536*32, // 
+               HRT_ENABLE_DL_RESERVOIRS            = 65536*32, // direct light only preview with per pixel reservoir resampling (temporal and spatial reuse)
                HRT_DUMMY6                          = 65536*64, // tracing photons to form spetial photonmap to speed-up direct light sampling
-               HRT_DUMMY7                          = 65536*128,
-               HRT_DUMMY8                          = 65536*256,
+               HRT_SCENE_HAS_TRANSPARENCY          = 65536*128, // at least one material has PLAIN_MATERIAL_HAS_TRANSPARENCY; G-buffer alpha needs more than one bounce
+               HRT_ENABLE_BLUE_NOISE               = 65536*256, // one sample per pixel per pass with blue noise distributed screen and lens offsets (low spp preview)
+               HRT_MESH_LIGHT_AREA_SAMPLING        = 65536*512, // sample mesh lights by area only; set by bidirectional CPU integrators, see meshLightUseEmissionTable
              
                HRT_ENABLE_PT_CAUSTICS              = 65536*2048,
                HRT_USE_BOTH_PHOTON_MAPS            = 65536*4096,
@@ -463,6 +465,10 @@ enum VARIABLE_NAMES { // int vars
 
                       HRT_KMLT_OR_QMC_LGT_BOUNCES  = 39,
                       HRT_KMLT_OR_QMC_MAT_BOUNCES  = 40,
+
+                      HRT_DLRES_CANDIDATES         = 41, // number of initial light candidates per pixel for HRT_ENABLE_DL_RESERVOIRS
+                      HRT_DLRES_SPATIAL_TAPS       = 42, // number of spatial neighbours to merge
+                      HRT_DLRES_TEMPORAL_MAX       = 43, // temporal history length clamp, in units of HRT_DLRES_CANDIDATES
 };
 
 enum VARIABLE_FLOAT_NAMES{ // float vars
@@ -512,6 +518,11 @@ enum VARIABLE_FLOAT_NAMES{ // float vars
                            HRT_MLT_SCREEN_SCALE_X                  = 34,
                            HRT_MLT_SCREEN_SCALE_Y                  = 35,
                            HRT_BACK_TEXINPUT_GAMMA                 = 36,
+                           HRT_DLRES_SPATIAL_RADIUS                = 37, // spatial reuse radius in pixels for HRT_ENABLE_DL_RESERVOIRS
+                           HRT_CROP_MIN_X                          = 38, // crop window (region of interest) in normalized screen coordinates; (0,0)-(1,1) renders whole frame
+                           HRT_CROP_MIN_Y                          = 39,
+                           HRT_CROP_MAX_X                          = 40,
+                           HRT_CROP_MAX_Y                          = 41,
 };
 
 
@@ -533,6 +544,29 @@ enum RENDER_LAYER {
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+/**
+\brief convert crop window from normalized screen coordinates to pixels.
+\return (minX, minY, maxX, maxY), max is exclusive; whole screen if crop window is empty or not set
+
+*/
+IDH_CALL int4 cropWindowPixels(float a_minX, float a_minY, float a_maxX, float a_maxY, int w, int h)
+{
+  int minX = (int)(a_minX*(float)w + 0.5f); // driver sets crop from pixel coordinates, so rounding restores them exactly
+  int minY = (int)(a_minY*(float)h + 0.5f);
+  int maxX = (int)(a_maxX*(float)w + 0.5f);
+  int maxY = (int)(a_maxY*(float)h + 0.5f);
+
+  minX = (minX < 0) ? 0 : minX;
+  minY = (minY < 0) ? 0 : minY;
+  maxX = (maxX > w) ? w : maxX;
+  maxY = (maxY > h) ? h : maxY;
+
+  if (maxX <= minX || maxY <= minY)
+    return make_int4(0, 0, w, h);
+  else
+    return make_int4(minX, minY, maxX, maxY);
+}
+
 IDH_CALL uint ZIndex(ushort x, ushort y, __constant ushort* a_mortonTable256)
 {
   return	(a_mortonTable256[y >> 8]   << 17) |
@@ -660,6 +694,102 @@ IDH_CALL uint GetMortonNumber(int x, int y, int z)
   return SpreadBits(x, 0) | SpreadBits(y, 1) | SpreadBits(z, 2);
 }
 
+#define RAY_REORDER_INACTIVE_KEY 0x7FFFFFFF
+
+/**
+\brief Sort key for ray reordering: direction octant in bits 27-29, then Morton code of ray origin quantized to 9 bits per axis in scene box.
+       Inactive rays should use RAY_REORDER_INACTIVE_KEY to go to the end of sorted array.
+*/
+IDH_CALL int RayReorderKey(float3 a_pos, float3 a_dir, float3 a_boxMin, float3 a_boxInvSize)
+{
+  const float3 pos = (a_pos - a_boxMin)*a_boxInvSize*511.0f;
+
+  const int x = (pos.x <= 0.0f) ? 0 : ((pos.x >= 511.0f) ? 511 : (int)(pos.x));
+  const int y = (pos.y <= 0.0f) ? 0 : ((pos.y >= 511.0f) ? 511 : (int)(pos.y));
+  const int z = (pos.z <= 0.0f) ? 0 : ((pos.z >= 511.0f) ? 511 : (int)(pos.z));
+
+  const int octant = ((a_dir.x < 0.0f) ? 1 : 0) | ((a_dir.y < 0.0f) ? 2 : 0) | ((a_dir.z < 0.0f) ? 4 : 0);
+
+  return (octant << 27) | (int)GetMortonNumber(x, y, z);
+}
+
+/**
+\brief get barycentric coordinates of sub-triangle corners for the midpoint subdivision of a triangle.
+\param a_subId - sub-triangle index; each pair of bits (starting from the most significant) selects one of 4 children
+\param a_level - subdivision level; triangle is splitted to 4^a_level equal sub-triangles
+\param pB0     - out barycentric coordinates of the first  sub-triangle corner
+\param pB1     - out barycentric coordinates of the second sub-triangle corner
+\param pB2     - out barycentric coordinates of the third  sub-triangle corner
+
+*/
+static inline void subTriangleBary(const int a_subId, const int a_level,
+                                   __private float3* pB0, __private float3* pB1, __private float3* pB2)
+{
+  float3 b0 = make_float3(1, 0, 0);
+  float3 b1 = make_float3(0, 1, 0);
+  float3 b2 = make_float3(0, 0, 1);
+
+  for (int i = a_level - 1; i >= 0; i--)
+  {
+    const int    child = (a_subId >> (2 * i)) & 3;
+    const float3 m01   = 0.5f*(b0 + b1);
+    const float3 m12   = 0.5f*(b1 + b2);
+    const float3 m20   = 0.5f*(b2 + b0);
+
+    if (child == 0)      { b1 = m01; b2 = m20; }
+    else if (child == 1) { b0 = m01; b2 = m12; }
+    else if (child == 2) { b0 = m20; b1 = m12; }
+    else                 { b0 = m12; b1 = m20; b2 = m01; } // middle (inverted) child
+  }
+
+  (*pB0) = b0;
+  (*pB1) = b1;
+  (*pB2) = b2;
+}
+
+/**
+\brief inverse of subTriangleBary: find sub-triangle that contains point with barycentric coordinates a_bary.
+
+*/
+static inline int subTriangleId(float3 a_bary, const int a_level)
+{
+  int subId = 0;
+  for (int i = 0; i < a_level; i++)
+  {
+    int child = 3;
+    if (a_bary.x > 0.5f)
+    {
+      child  = 0;
+      a_bary = make_float3(2.0f*a_bary.x - 1.0f, 2.0f*a_bary.y, 2.0f*a_bary.z);
+    }
+    else if (a_bary.y > 0.5f)
+    {
+      child  = 1;
+      a_bary = make_float3(2.0f*a_bary.x, 2.0f*a_bary.y - 1.0f, 2.0f*a_bary.z);
+    }
+    else if (a_bary.z > 0.5f)
+    {
+      child  = 2;
+      a_bary = make_float3(2.0f*a_bary.x, 2.0f*a_bary.y, 2.0f*a_bary.z - 1.0f);
+    }
+    else
+      a_bary = make_float3(1.0f - 2.0f*a_bary.x, 1.0f - 2.0f*a_bary.y, 1.0f - 2.0f*a_bary.z);
+
+    subId = (subId << 2) | child;
+  }
+  return subId;
+}
+
+// opacity micromap: alpha table record1.x = (offset << 3) | (state << 1) | smoothOpacity;
+// for OMM_STATE_MAP offset points to 2 bits per sub-triangle of level OMM_LEVEL (2 uint2 per triangle) inside alpha table
+//
+#define OMM_STATE_UNKNOWN     0 // sample opacity texture
+#define OMM_STATE_TRANSPARENT 1
+#define OMM_STATE_OPAQUE      2
+#define OMM_STATE_MAP         3
+#define OMM_LEVEL             3
+#define OMM_WORDS_PER_TRI     2
+
 
 IDH_CALL float3 reflect(float3 dir, float3 normal) { return normalize((normal * dot(dir, normal) * (-2.0f)) + dir); }
 
@@ -1285,6 +1415,26 @@ typedef struct BVHNodeT BVHNode;
 
 IDH_CALL bool IsValidNode(const BVHNode a_node) { return !((a_node.m_leftOffsetAndLeaf == 0xffffffff) && (a_node.m_escapeIndex == 0xffffffff)); }
 
+/**
+\brief Compressed BVH4 layout (bvhType with "_q8" suffix). Each 4-wide node takes 4 float4 (64 bytes) instead of 4 BVHNode (128 bytes):
+       f0 = (origin.xyz, scale.x), f1 = (scale.y, scale.z, qMinX, qMaxX), f2 = (qMinY, qMaxY, qMinZ, qMaxZ), f3 = 4 child offsets.
+       Every q* field packs 4 bytes (one per child) of the child box quantized relative to the parent; 0xFFFFFFFF offset marks an empty child.
+       Node offsets are in 64 byte units; instance block takes 2 units; unit 0 is a header with BVH4_QUANTIZED_LAYOUT_TAG in its second float4 .w.
+*/
+#define BVH4_QUANTIZED_LAYOUT_TAG 0x51384234
+
+/**
+\brief Compact leaf with shared vertices. Header int4 is (alphaBase, triNum, BVH_COMPACT_LEAF_TAG | vertNum, geomId);
+       it is followed by (triNum+1)/2 float4 of (primId, packedIndices) pairs and by vertNum tightly packed float3 vertices.
+       The tag is a quiet NaN pattern, so it never matches a vertex coordinate of the plain leaf format.
+*/
+#define BVH_COMPACT_LEAF_TAG     0x7FC00000
+#define BVH_COMPACT_LEAF_MAXVERT 255
+
+IDH_CALL bool IsCompactLeaf(const int4 a_header)        { return ((a_header.z & 0xFFFFFF00) == BVH_COMPACT_LEAF_TAG); }
+IDH_CALL int  CompactLeafVertOffset(const int4 a_header) { return 1 + (a_header.y + 1) / 2; }
+IDH_CALL int  CompactLeafSizeInF4(const int4 a_header)   { return CompactLeafVertOffset(a_header) + (3 * (a_header.z & 0xFF) + 3) / 4; }
+
 struct _PACKED RayFlagsT
 {
   unsigned char  diffuseBounceNum;
@@ -2064,6 +2214,7 @@ static inline void initGBufferAll(__private GBufferAll* a_pElem)
 }
 
 #define GBUFFER_SAMPLES 16
+#define GBUFFER_CLUSTERS 4   // samples of a pixel are compared only with first samples of this number of clusters; other samples are outliers
 #define PMPIX_SAMPLES   256 // Production Mode Pixel Samples
 
 static inline float4 packGBuffer1(GBuffer1 a_input)
@@ -2183,6 +2334,26 @@ static inline float gbuffDiffObj(GBufferAll s1, GBufferAll s2, const float a_fov
   return objDiff + matDiff;
 }
 
+/**
+\brief check if two gbuffer samples are close enough to share direct light reservoirs.
+\param a_center - gbuffer sample of pixel that we are going to shade
+\param a_other  - gbuffer sample of pixel (neighbour or previous frame) which reservoir we want to reuse
+
+*/
+static inline bool gbuffSimilarForReuse(GBuffer1 a_center, GBuffer1 a_other)
+{
+  if (a_center.depth >= 1e+5f || a_other.depth >= 1e+5f)
+    return false;
+
+  if (a_center.matId != a_other.matId)
+    return false;
+
+  if (dot(a_center.norm, a_other.norm) < 0.9f)
+    return false;
+
+  return (fabs(a_center.depth - a_other.depth) <= 0.1f*a_center.depth);
+}
+
 
 // static inline int reverseBits(int a_input, int a_maxSize)
 // {
@@ -2452,6 +2623,92 @@ static inline void ReadShadowSample(const __global float4* a_in, int a_tid, int
 }
 
 
+/**
+\brief Weighted reservoir for direct light resampling (HRT_ENABLE_DL_RESERVOIRS).
+
+  Light sample is stored in primary sample space (3 rands + selected light) so it can be regenerated for any surface point.
+  This way reservoir may be reused by neighbour pixels and by next frame.
+
+*/
+typedef struct DLReservoirT
+{
+  float3 rands;       ///< rands that were passed to LightSampleRev
+  int    lightOffset; ///< selected light offset; -1 if reservoir is empty
+  float  wSum;        ///< sum of resampling weights
+  float  M;           ///< number of candidates that were seen by this reservoir
+  float  W;           ///< unbiased contribution weight of selected sample
+  float  targetPdf;   ///< target function of selected sample evaluated at pixel that own this reservoir
+
+} DLReservoir;
+
+static inline void InitDLReservoir(__private DLReservoir* a_pRes)
+{
+  a_pRes->rands       = make_float3(0, 0, 0);
+  a_pRes->lightOffset = -1;
+  a_pRes->wSum        = 0.0f;
+  a_pRes->M           = 0.0f;
+  a_pRes->W           = 0.0f;
+  a_pRes->targetPdf   = 0.0f;
+}
+
+/**
+\brief stream single candidate to reservoir; return true if candidate was selected.
+\param a_pRes       - reservoir
+\param a_rands      - candidate rands
+\param a_lightOffset - candidate light offset
+\param a_weight     - candidate resampling weight
+\param a_targetPdf  - candidate target function at current pixel
+\param a_rnd        - random number in range [0,1]
+
+*/
+static inline bool UpdateDLReservoir(__private DLReservoir* a_pRes, const float3 a_rands, const int a_lightOffset, 
+                                     const float a_weight, const float a_targetPdf, const float a_rnd)
+{
+  if (!(a_weight > 0.0f) || !isfinite(a_weight))
+    return false;
+
+  a_pRes->wSum += a_weight;
+
+  if (a_rnd*a_pRes->wSum < a_weight)
+  {
+    a_pRes->rands       = a_rands;
+    a_pRes->lightOffset = a_lightOffset;
+    a_pRes->targetPdf   = a_targetPdf;
+    return true;
+  }
+
+  return false;
+}
+
+static inline void FinalizeDLReservoir(__private DLReservoir* a_pRes)
+{
+  const float denom = a_pRes->M * a_pRes->targetPdf;
+  a_pRes->W = (denom > 0.0f && a_pRes->lightOffset >= 0) ? (a_pRes->wSum / denom) : 0.0f;
+  if (!isfinite(a_pRes->W))
+    a_pRes->W = 0.0f;
+}
+
+static inline void WriteDLReservoir(const __private DLReservoir* a_pRes, int a_tid, int a_threadNum,
+                                    __global float4* a_out)
+{
+  a_out[a_tid + a_threadNum*0] = make_float4(a_pRes->rands.x, a_pRes->rands.y, a_pRes->rands.z, as_float(a_pRes->lightOffset));
+  a_out[a_tid + a_threadNum*1] = make_float4(a_pRes->wSum,    a_pRes->M,       a_pRes->W,       a_pRes->targetPdf);
+}
+
+static inline void ReadDLReservoir(const __global float4* a_in, int a_tid, int a_threadNum,
+                                   __private DLReservoir* a_pRes)
+{
+  const float4 f0 = a_in[a_tid + a_threadNum*0];
+  const float4 f1 = a_in[a_tid + a_threadNum*1];
+
+  a_pRes->rands       = make_float3(f0.x, f0.y, f0.z);
+  a_pRes->lightOffset = as_int(f0.w);
+  a_pRes->wSum        = f1.x;
+  a_pRes->M           = f1.y;
+  a_pRes->W           = f1.z;
+  a_pRes->targetPdf   = f1.w;
+}
+
 /**
 \brief Per ray accumulated (for all bounces) data. 
 
@@ -70,18 +70,63 @@ static inline float3 lightNorm(__global const PlainLight* pLight) { return make_
 static inline float3 lightBaseColor(__global const PlainLight* pLight) { return make_float3(pLight->data[PLIGHT_COLOR_X], pLight->data[PLIGHT_COLOR_Y], pLight->data[PLIGHT_COLOR_Z]); }
 
 static inline __global const float* lightIESPdfTable(__global const PlainLight* pLight, __global const EngineGlobals* a_globals, __global const float4* a_tableStorage,
-                                                     __private int* pW, __private int* pH)
+                                                     __private int* pW, __private int* pH, __private int* pPhiSym)
 {
   const int texId     = as_int(pLight->data[IES_SPHERE_PDF_ID]);
   const int texOffset = pdfTableHeaderOffset(texId, a_globals);
   __global const float* pTexHeader = (__global const float*)(a_tableStorage + texOffset);
 
-  (*pW) = as_int(pTexHeader[0]);
-  (*pH) = as_int(pTexHeader[1]);
+  (*pW)      = as_int(pTexHeader[0]);
+  (*pH)      = as_int(pTexHeader[1]);
+  (*pPhiSym) = as_int(pTexHeader[2]);
 
   return pTexHeader + 4;
 }
 
+/**
+\brief  Map full sphere map tex coord x (phi) to compact IES table which stores only symmetric part of profile.
+\param  a_texX   - tex coord x for full [0, 2*PI] range of phi
+\param  a_phiSym - lateral symmetry of IES table: 1 (no symmetry), 2 (symmetric about vertical plane), 4 (symmetric in each quadrant)
+\return tex coord x in compact table
+
+*/
+static inline float iesFoldTexCoordX(const float a_texX, const int a_phiSym)
+{
+  if (a_phiSym == 2)
+  {
+    const float x = 2.0f*a_texX;
+    return (x <= 1.0f) ? x : 2.0f - x;
+  }
+  else if (a_phiSym == 4)
+  {
+    float x = 4.0f*a_texX;
+    x = (x <= 2.0f) ? x : 4.0f - x;
+    return (x <= 1.0f) ? x : 2.0f - x;
+  }
+  else
+    return a_texX;
+}
+
+/**
+\brief  Reverse to iesFoldTexCoordX; a_copyId in [0, a_phiSym-1] selects one of mirrored copies of compact table.
+
+*/
+static inline float iesUnfoldTexCoordX(const float a_texX, const int a_phiSym, const int a_copyId)
+{
+  if (a_phiSym == 2)
+    return (a_copyId == 0) ? 0.5f*a_texX : 1.0f - 0.5f*a_texX;
+  else if (a_phiSym == 4)
+  {
+    const float x = 0.25f*a_texX;
+    if (a_copyId == 0)      return x;
+    else if (a_copyId == 1) return 0.5f - x;
+    else if (a_copyId == 2) return 0.5f + x;
+    else                    return 1.0f - x;
+  }
+  else
+    return a_texX;
+}
+
 static inline float lightShadowRayMaxDistScale(__global const PlainLight* pLight)
 {
   float lightShadowDistScale = (as_int(pLight->data[PLIGHT_TYPE]) == PLAIN_LIGHT_TYPE_SKY_DOME) ? 2.0f : 0.995f;
@@ -169,6 +214,7 @@ static inline float lightShadowRayMaxDistScale(__global const PlainLight* pLight
 #define MESH_LIGHT_MESH_OFFSET_ID  14
 #define MESH_LIGHT_TABLE_OFFSET_ID 15
 #define MESH_LIGHT_TRI_NUM         16
+#define MESH_LIGHT_EMISSION_TABLE_ID 17 // (triangle, sub-triangle) pick table built from emission texture; 0 if light does not have texture
 #define MESH_LIGHT_MATRIX_E00      20
 
 #define MESH_LIGHT_TEX_ID          30
@@ -406,12 +452,21 @@ static inline Map2DPiecewiseSample sampleMap2D(float3 rands, __global const floa
 static inline void LightSampleIESSphere(__global const PlainLight* pLight, float3 rands, __global const EngineGlobals* a_globals, __global const float4* a_tableStorage,
                                         __private float3* a_outDir, __private float* a_outPdfW)
 {
-  int w, h;
+  int w, h, phiSym;
   __global const float* table = lightIESPdfTable(pLight, a_globals, a_tableStorage,
-                                                 &w, &h);
+                                                 &w, &h, &phiSym);
   
-  const Map2DPiecewiseSample sample = sampleMap2D(rands, table, w, h);
-  __global const float* pMatrix     = pLight->data + IES_INV_MATRIX_E00;
+  // select mirrored copy of compact table with rands.x and reuse the rest of it; 
+  // mapPdf is not changed because table is stretched in phiSym times and each copy is selected with 1/phiSym prob.
+  //
+  const float fSym   = (float)phiSym;
+  int copyId         = (int)(rands.x*fSym);
+  copyId             = (copyId >= phiSym) ? phiSym - 1 : copyId;
+  rands.x            = rands.x*fSym - (float)copyId;
+
+  Map2DPiecewiseSample sample   = sampleMap2D(rands, table, w, h);
+  sample.texCoord.x             = iesUnfoldTexCoordX(sample.texCoord.x, phiSym, copyId);
+  __global const float* pMatrix = pLight->data + IES_INV_MATRIX_E00;
 
   float sinTheta = 0.0f;
   float3 lsDir   = texCoord2DToSphereMap(sample.texCoord, &sinTheta);
@@ -467,9 +522,11 @@ static inline float3 lightDistributionMask(__global const PlainLight* pLight, fl
   if (as_int(pLight->data[PLIGHT_FLAGS]) & LIGHT_HAS_IES)
   {
     float sintheta = 0.0f;
-    const float2 texCoord = sphereMapTo2DTexCoord((-1.0f)*a_rayDir, &sintheta);
+    float2 texCoord     = sphereMapTo2DTexCoord((-1.0f)*a_rayDir, &sintheta);
     const int texId     = as_int(pLight->data[IES_SPHERE_TEX_ID]);
     const int texOffset = pdfTableHeaderOffset(texId, a_globals);
+    const int phiSym    = as_int(((__global const float*)(a_texStorage + texOffset))[2]);
+    texCoord.x          = iesFoldTexCoordX(texCoord.x, phiSym);
     const float val     = read_imagef_sw1((__global const int4*)(a_texStorage + texOffset), texCoord, (TEX_CLAMP_U | TEX_CLAMP_V));
     return make_float3(val, val, val);
   }
@@ -958,19 +1015,54 @@ static inline float3 meshLightGetIntensity(__global const PlainLight* pLight, fl
 }
 
 
-static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3 rands, __global const float4* a_tableStorage, __global const EngineGlobals* a_globals,
+static inline __global const PlainMesh* meshLightMesh(__global const PlainLight* pLight, __global const float4* a_tableStorage, __global const EngineGlobals* a_globals)
+{
+  const int meshId     = as_int(pLight->data[MESH_LIGHT_MESH_OFFSET_ID]);
+  const int meshOffset = pdfTableHeaderOffset(meshId, a_globals);
+  return (__global const PlainMesh*)(a_tableStorage + meshOffset);
+}
+
+/**
+\brief check if shadow rays to mesh light should be sampled with emission table (see MeshLightSamplePos).
+       Bidirectional MIS (lightPdfFwd) assumes that explicit light samples and light tracing have the same pdfA on light surface, 
+       and light tracing can't use emission table, so the table is used in pure PT only.
+
+*/
+static inline bool meshLightUseEmissionTable(__global const PlainLight* pLight, __global const EngineGlobals* a_globals)
+{
+  return (as_int(pLight->data[MESH_LIGHT_EMISSION_TABLE_ID]) > 0) && 
+         (a_globals->g_flags & (HRT_3WAY_MIS_WEIGHTS | HRT_ENABLE_MMLT | HRT_ENABLE_SBPT | HRT_MESH_LIGHT_AREA_SAMPLING)) == 0;
+}
+
+static inline float meshLightTriangleAreaWorld(__global const PlainLight* pLight, const float3 A, const float3 B, const float3 C)
+{
+  __global const float* pMatrix = pLight->data + MESH_LIGHT_MATRIX_E00;
+  const float3 edge1 = matrix3x3f_mult_float3(pMatrix, B - A);
+  const float3 edge2 = matrix3x3f_mult_float3(pMatrix, C - A);
+  return fmax(0.5f*length(cross(edge1, edge2)), DEPSILON2);
+}
+
+/**
+\brief sample point on mesh light in light local space.
+\param a_emissionImportance - if true and light has emission table, pick (triangle, sub-triangle) proportional to area*emission; else pick triangle proportional to area only.
+\param pdfA                 - out pdf with respect to world space area
+
+  Forward (light tracing) sampling always use area table because lightPdfFwd does not know which triangle was hit; 
+  shadow rays use emission table only if meshLightUseEmissionTable is true, so that MIS pdfs match the sampling.
+
+*/
+static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3 rands, __global const float4* a_tableStorage, __global const EngineGlobals* a_globals, const bool a_emissionImportance,
                                       __private float3* pPos, __private float3* pNorm, __private float2* pTexCoord, __private float* pdfA)
 {
   // extract mesh and table
   //
-  const int meshId = as_int(pLight->data[MESH_LIGHT_MESH_OFFSET_ID]);
   const int pdftId = as_int(pLight->data[MESH_LIGHT_TABLE_OFFSET_ID]);
   const int triNum = as_int(pLight->data[MESH_LIGHT_TRI_NUM]);
+  const int emtbId = as_int(pLight->data[MESH_LIGHT_EMISSION_TABLE_ID]);
 
-  const int meshOffset = pdfTableHeaderOffset(meshId, a_globals);
   const int pdftOffset = pdfTableHeaderOffset(pdftId, a_globals);
 
-  __global const PlainMesh* pMesh = (__global const PlainMesh*)(a_tableStorage + meshOffset);
+  __global const PlainMesh* pMesh = meshLightMesh(pLight, a_tableStorage, a_globals);
   __global const float*     table = (__global const float*)    (a_tableStorage + pdftOffset);
 
   __global const float4* vpos  = meshVerts(pMesh);
@@ -978,8 +1070,23 @@ static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3
   //__global const float2* texc  = meshTexCoords(pMesh);
   __global const int* indices  = meshTriIndices(pMesh);
 
+  const bool useEmission = a_emissionImportance && (emtbId > 0);
+
   float pickProb = 1.0f;
-  const int triangleId = SelectIndexPropToOpt(rands.z, table, triNum + 1, &pickProb);
+  int triangleId = 0;
+  int subId      = 0;
+  int level      = 0;
+
+  if (useEmission)
+  {
+    __global const float* pdfHeader = pdfTableHeader(emtbId, a_tableStorage, a_globals);
+    level = as_int(pdfHeader[1]);
+    const int elemId = SelectIndexPropToOpt(rands.z, pdfHeader + 4, (triNum << (2 * level)) + 1, &pickProb);
+    triangleId = elemId >> (2 * level);
+    subId      = elemId & ((1 << (2 * level)) - 1);
+  }
+  else
+    triangleId = SelectIndexPropToOpt(rands.z, table, triNum + 1, &pickProb);
 
   const int iA = indices[triangleId * 3 + 0];
   const int iB = indices[triangleId * 3 + 1];
@@ -1005,7 +1112,7 @@ static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3
   const float2 tB = make_float2(dataB.w, datanB.w); // texc[iB];
   const float2 tC = make_float2(dataC.w, datanC.w); // texc[iC];
   
-  // uniform barycentrics
+  // uniform barycentrics inside selected sub-triangle
   //
   float u = rands.x;
   float v = rands.y;
@@ -1016,10 +1123,70 @@ static inline void MeshLightSamplePos(__global const PlainLight* pLight, float3
   }
   const float w = 1.0f - u - v;
 
-  (*pPos)      = (A*u  + B*v  + C*w);
-  (*pNorm)     = (nA*u + nB*v + nC*w);
-  (*pTexCoord) = (tA*u + tB*v + tC*w);
-  (*pdfA)      = 1.0f/pLight->data[PLIGHT_SURFACE_AREA];
+  float3 b0, b1, b2;
+  subTriangleBary(subId, level, &b0, &b1, &b2);
+  const float3 bary = b0*u + b1*v + b2*w;
+
+  (*pPos)      = (A*bary.x  + B*bary.y  + C*bary.z);
+  (*pNorm)     = (nA*bary.x + nB*bary.y + nC*bary.z);
+  (*pTexCoord) = (tA*bary.x + tB*bary.y + tC*bary.z);
+
+  if (useEmission)
+    (*pdfA) = pickProb*(float)(1 << (2 * level)) / meshLightTriangleAreaWorld(pLight, A, B, C);
+  else
+    (*pdfA) = 1.0f/pLight->data[PLIGHT_SURFACE_AREA];
+}
+
+/**
+\brief evaluate pdfA of MeshLightSamplePos(..., a_emissionImportance = true, ...) for the point on triangle a_triId with texture coordinates a_texCoord.
+
+*/
+static inline float meshLightEmissionPdfA(__global const PlainLight* pLight, const float2 a_texCoord, const int a_triId,
+                                          __global const float4* a_tableStorage, __global const EngineGlobals* a_globals)
+{
+  const int triNum = as_int(pLight->data[MESH_LIGHT_TRI_NUM]);
+  const int emtbId = as_int(pLight->data[MESH_LIGHT_EMISSION_TABLE_ID]);
+
+  __global const PlainMesh* pMesh = meshLightMesh(pLight, a_tableStorage, a_globals);
+  __global const float4* vpos     = meshVerts(pMesh);
+  __global const float4* vnorm    = meshNorms(pMesh);
+  __global const int* indices     = meshTriIndices(pMesh);
+
+  const int iA = indices[a_triId * 3 + 0];
+  const int iB = indices[a_triId * 3 + 1];
+  const int iC = indices[a_triId * 3 + 2];
+
+  const float4 dataA = vpos[iA];
+  const float4 dataB = vpos[iB];
+  const float4 dataC = vpos[iC];
+
+  const float2 tA = make_float2(dataA.w, vnorm[iA].w);
+  const float2 tB = make_float2(dataB.w, vnorm[iB].w);
+  const float2 tC = make_float2(dataC.w, vnorm[iC].w);
+
+  // restore barycentrics from texture coordinates; if triangle is degenerate in uv space, emission is constant over it and any sub-triangle is fine
+  //
+  const float2 d1  = tB - tA;
+  const float2 d2  = tC - tA;
+  const float2 dp  = a_texCoord - tA;
+  const float  det = d1.x*d2.y - d1.y*d2.x;
+
+  float3 bary = make_float3(1.0f/3.0f, 1.0f/3.0f, 1.0f/3.0f);
+  if (fabs(det) > 1e-12f)
+  {
+    const float v = clamp((dp.x*d2.y - dp.y*d2.x) / det, 0.0f, 1.0f);
+    const float w = clamp((d1.x*dp.y - d1.y*dp.x) / det, 0.0f, 1.0f);
+    const float u = fmax(1.0f - v - w, 0.0f);
+    bary = make_float3(u, v, w)*(1.0f / fmax(u + v + w, DEPSILON2));
+  }
+
+  __global const float* pdfHeader = pdfTableHeader(emtbId, a_tableStorage, a_globals);
+  __global const float* table     = pdfHeader + 4;
+  const int level  = as_int(pdfHeader[1]);
+  const int elemId = (a_triId << (2 * level)) + subTriangleId(bary, level);
+  const float prob = (table[elemId + 1] - table[elemId]) / table[triNum << (2 * level)];
+
+  return prob*(float)(1 << (2 * level)) / meshLightTriangleAreaWorld(pLight, to_float3(dataA), to_float3(dataB), to_float3(dataC));
 }
 
 
@@ -1031,7 +1198,7 @@ static inline void MeshLightSampleForward(__global const PlainLight* pLight, flo
   float2 sampleTexCoord;
   float pdfA;
 
-  MeshLightSamplePos(pLight, make_float3(rands.x, rands.y, rands2.x), a_tableStorage, a_globals,
+  MeshLightSamplePos(pLight, make_float3(rands.x, rands.y, rands2.x), a_tableStorage, a_globals, false,
                      &samplePos, &sampleNorm, &sampleTexCoord, &pdfA);
 
   __global const float* pMatrix = pLight->data + MESH_LIGHT_MATRIX_E00;
@@ -1148,11 +1315,12 @@ static inline LightPdfFwd lightPdfFwd(__global const PlainLight* pLight, const f
     __global const float* pMatrix = pLight->data + IES_LIGHT_MATRIX_E00;
     const float3 rayDir = matrix3x3f_mult_float3(pMatrix, ray_dir);
 
-    int w, h;
+    int w, h, phiSym;
     __global const float* table = lightIESPdfTable(pLight, a_globals, a_tableStorage,
-                                                   &w, &h);
+                                                   &w, &h, &phiSym);
     float sintheta = 0.0f;
-    const float2 texCoord = sphereMapTo2DTexCoord((-1.0f)*rayDir, &sintheta);
+    float2 texCoord       = sphereMapTo2DTexCoord((-1.0f)*rayDir, &sintheta);
+    texCoord.x            = iesFoldTexCoordX(texCoord.x, phiSym);
     const float mapPdf    = evalMap2DPdf(texCoord, table, w, h);
     res.pdfW              = mapPdf / (2.f * M_PI * M_PI * fmax(sintheta, DEPSILON2));
   }
@@ -1513,7 +1681,7 @@ static inline void MeshLightSampleRev(__global const PlainLight* pLight, float3
   float2 sampleTexCoord;
   float pdfA;
 
-  MeshLightSamplePos(pLight, rands, a_tableStorage, a_globals,
+  MeshLightSamplePos(pLight, rands, a_tableStorage, a_globals, meshLightUseEmissionTable(pLight, a_globals),
                      &samplePos, &sampleNorm, &sampleTexCoord, &pdfA); 
 
   __global const float* pMatrix = pLight->data + MESH_LIGHT_MATRIX_E00;
@@ -1533,9 +1701,13 @@ static inline void MeshLightSampleRev(__global const PlainLight* pLight, float3
   a_out->cosAtLight = cosVal;
 }
 
-static inline float meshLightEvalPDF(__global const PlainLight* pLight, float3 rayDir, const float3 lnorm, float hitDist)
+static inline float meshLightEvalPDF(__global const PlainLight* pLight, float3 rayDir, const float3 lnorm, float hitDist, const float2 texCoord, const int a_primId,
+                                     __global const float4* a_pdfTable, __global const EngineGlobals* a_globals)
 {
-  const float pdfA   = 1.0f / fmax(pLight->data[PLIGHT_SURFACE_AREA], DEPSILON);
+  float pdfA = 1.0f / fmax(pLight->data[PLIGHT_SURFACE_AREA], DEPSILON);
+  if (meshLightUseEmissionTable(pLight, a_globals) && a_primId >= 0 && a_primId < as_int(pLight->data[MESH_LIGHT_TRI_NUM]))
+    pdfA = meshLightEmissionPdfA(pLight, texCoord, a_primId, a_pdfTable, a_globals);
+
   const float cosVal = fmax(dot(rayDir, -1.0f*lnorm), 0.0f);
   return PdfAtoW(pdfA, hitDist, cosVal);
 }
@@ -1605,7 +1777,7 @@ static inline void LightSampleRev(__global const PlainLight* pLight, float3 rand
 }
 
 
-static inline float lightEvalPDF(__global const PlainLight* pLight, float3 illuminatingPoint, float3 rayDir, float3 lpos, float3 lnorm, float2 texCoord, 
+static inline float lightEvalPDF(__global const PlainLight* pLight, float3 illuminatingPoint, float3 rayDir, float3 lpos, float3 lnorm, float2 texCoord, const int a_primId,
                                  __global const float4* a_pdfTable, __global const EngineGlobals* a_globals)
 {
   const float hitDist = length(illuminatingPoint - lpos);
@@ -1619,7 +1791,7 @@ static inline float lightEvalPDF(__global const PlainLight* pLight, float3 illum
   case PLAIN_LIGHT_TYPE_POINT_OMNI:   return pointLightEvalPDF(pLight, illuminatingPoint);  // #TODO: cosAtLight
   case PLAIN_LIGHT_TYPE_SPHERE:       return sphereLightEvalPDF(pLight, illuminatingPoint, lpos, lnorm); // #TODO: cosAtLight
   case PLAIN_LIGHT_TYPE_CYLINDER:     return cylinderLightEvalPDF(pLight, illuminatingPoint, lpos, lnorm, texCoord, a_pdfTable, a_globals); // #TODO: cosAtLight
-  case PLAIN_LIGHT_TYPE_MESH:         return meshLightEvalPDF(pLight, rayDir, lnorm, hitDist);
+  case PLAIN_LIGHT_TYPE_MESH:         return meshLightEvalPDF(pLight, rayDir, lnorm, hitDist, texCoord, a_primId, a_pdfTable, a_globals);
   case PLAIN_LIGHT_TYPE_AREA:        
   default:                            
                                       return areaDiffuseLightEvalPDF(pLight, rayDir, hitDist);
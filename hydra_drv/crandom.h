@@ -221,19 +221,106 @@ static inline float MutateKelemen(float valueX, float2 rands, float p2, float p1
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-#define QRNG_DIMENSIONS 11
+#define QRNG_DIMENSIONS 32
 #define QRNG_RESOLUTION 31
 #define INT_SCALE (1.0f / (float)0x80000001U)
 
-static inline float rndQmcSobolN(unsigned int pos, int dim, __constant unsigned int *c_Table)
+/**
+\brief raw 31 bit sobol-niederreiter number. Table has only QRNG_RESOLUTION direction numbers per dimension, 
+       so bit 31 of pos (possible for scrambled padded index or very large qmcPos) is ignored.
+*/
+static inline unsigned int qmcSobolRaw(unsigned int pos, int dim, __constant unsigned int *c_Table)
 {
   unsigned int result = 0;
-  unsigned int data   = pos;
+  __constant unsigned int* dirNumbers = c_Table + dim*QRNG_RESOLUTION;
+
+  for (pos &= 0x7FFFFFFF; pos != 0; pos >>= 1, dirNumbers++)
+    if (pos & 1) result ^= (*dirNumbers);
+
+  return result;
+}
+
+static inline float rndQmcSobolN(unsigned int pos, int dim, __constant unsigned int *c_Table)
+{
+  return (float)(qmcSobolRaw(pos, dim, c_Table) + 1) * INT_SCALE;
+}
+
+static inline unsigned int qmcReverseBits(unsigned int x)
+{
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+static inline unsigned int qmcHash(unsigned int x)
+{
+  x ^= x >> 16; x *= 0x7feb352du;
+  x ^= x >> 15; x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+/**
+\brief hash based nested uniform (Owen) scrambling of 32 bit fixed point number (Laine-Karras hash in bit reversed domain). 
+       Each output bit depends only on the same and higher input bits, so aligned blocks of 2^k numbers stay aligned blocks.
+*/
+static inline unsigned int qmcOwenScramble(unsigned int x, const unsigned int seed)
+{
+  x  = qmcReverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return qmcReverseBits(x);
+}
+
+/**
+\brief scrambled and padded sobol-niederreiter number.
+\param pos      - id of qmc number
+\param dim      - sobol dimension
+\param a_padId  - padding id (bounce number); points of non zero padding use shuffled index, so they are decorrelated from padding 0 
+                  and from each other while all dimensions of the same padding still form a single net. Thus deep bounces reuse low dimensions.
+\param c_Table  - qmc table for sobol-neideriter
+\return quasi random float in range [0,1)
+*/
+static inline float rndQmcSobolScrambled(unsigned int pos, int dim, int a_padId, __constant unsigned int *c_Table)
+{
+  const unsigned int index = (a_padId == 0) ? pos : qmcOwenScramble(pos, qmcHash((unsigned int)a_padId));
+  const unsigned int seed  = qmcHash((unsigned int)(a_padId*QRNG_DIMENSIONS + dim) ^ 0x68bc21ebu);
+  const unsigned int value = qmcOwenScramble(qmcSobolRaw(index, dim, c_Table) << 1, seed);
+  return (float)(value >> 8) * (1.0f / 16777216.0f);
+}
+
+#define BLUE_NOISE_SIZE 64 // must be power of 2
+
+/**
+\brief obtain 4 random numbers for camera\lens sampler of pixel (x,y) that form blue noise over screen for each sample id.
+       Tiled blue noise mask (see initBlueNoiseMask) gives per pixel Cranley-Patterson rotation of 4D rank-1 (Kronecker) sequence, 
+       so error of neighbour pixels is negatively correlated at any spp while each pixel still gets well stratified samples.
+\param x,y        - in pixel coordinates
+\param a_sampleId - in sample number inside pixel (i.e. pass number for one sample per pixel passes)
+\param a_mask     - in blue noise mask of BLUE_NOISE_SIZE*BLUE_NOISE_SIZE values
+\return 4 random numbers in [0,1) for using them in camera\lens sampler; xy is subpixel offset, zw is for DOF
+*/
+static inline float4 rndBlueNoiseLens(const int x, const int y, const unsigned int a_sampleId, __global const float* a_mask)
+{
+  const int mx = x & (BLUE_NOISE_SIZE - 1);
+  const int my = y & (BLUE_NOISE_SIZE - 1);
+
+  // toroidal shifts of the same mask for different dimensions; rank-1 steps are 2^32/g^i, g^5 = g + 1
+  //
+  const unsigned int m0 = (unsigned int)(a_mask[my*BLUE_NOISE_SIZE + mx]*4294967040.0f);
+  const unsigned int m1 = (unsigned int)(a_mask[((my + 32) & (BLUE_NOISE_SIZE - 1))*BLUE_NOISE_SIZE + ((mx + 16) & (BLUE_NOISE_SIZE - 1))]*4294967040.0f);
+  const unsigned int m2 = (unsigned int)(a_mask[((my + 16) & (BLUE_NOISE_SIZE - 1))*BLUE_NOISE_SIZE + ((mx + 48) & (BLUE_NOISE_SIZE - 1))]*4294967040.0f);
+  const unsigned int m3 = (unsigned int)(a_mask[((my + 48) & (BLUE_NOISE_SIZE - 1))*BLUE_NOISE_SIZE + ((mx + 32) & (BLUE_NOISE_SIZE - 1))]*4294967040.0f);
 
-  for (int bit = 0; bit < QRNG_RESOLUTION; bit++, data >>= 1)
-    if (data & 1) result ^= c_Table[bit + dim*QRNG_RESOLUTION];
+  const float scale = (1.0f / 16777216.0f);
 
-  return (float)(result + 1) * INT_SCALE;
+  return make_float4((float)((m0 + a_sampleId*0xdb4f0b91u) >> 8), (float)((m1 + a_sampleId*0xbbe05633u) >> 8),
+                     (float)((m2 + a_sampleId*0xa0f2ec75u) >> 8), (float)((m3 + a_sampleId*0x89e18285u) >> 8))*scale;
 }
 
 /**
@@ -243,18 +330,25 @@ static inline float rndQmcSobolN(unsigned int pos, int dim, __constant unsigned
 \param pos       - id of qmc number
 \param pickProb  - a_varName - name of qmc number
 \param c_Table   - qmc table for sobol-neideriter
-\return quasi random float in range [0,1]
+\return quasi random float in range [0,1)
 
+ rndQmcTabPadded takes bounce number; deep bounces use padded sequence of the same dimension instead of pseudo random.
 */
-static inline float rndQmcTab(__private RandomGen* pGen, __global const int* a_tab,
-                              unsigned int pos, int a_varName, __constant unsigned int *c_Table) // pre (a_tab != nullptr && c_Table != nullptr)
+static inline float rndQmcTabPadded(__private RandomGen* pGen, __global const int* a_tab,
+                                    unsigned int pos, int a_varName, int a_bounceId, __constant unsigned int *c_Table) // pre (a_tab != nullptr && c_Table != nullptr)
 {
   const int dim = a_tab[a_varName];
   
   if(dim < 0)
     return rndFloat1_Pseudo(pGen);
   else
-    return rndQmcSobolN(pos, dim, c_Table);
+    return rndQmcSobolScrambled(pos, dim, a_bounceId, c_Table);
+}
+
+static inline float rndQmcTab(__private RandomGen* pGen, __global const int* a_tab,
+                              unsigned int pos, int a_varName, __constant unsigned int *c_Table) // pre (a_tab != nullptr && c_Table != nullptr)
+{
+  return rndQmcTabPadded(pGen, a_tab, pos, a_varName, 0, c_Table);
 }
 
 static inline int rndMatOffsetMMLT(const int a_bounceId) { return a_bounceId*MMLT_FLOATS_PER_BOUNCE; }                          // relative offset, dont add MMLT_HEAD_TOTAL_SIZE!
@@ -404,12 +498,12 @@ static inline float4 rndLens(RandomGen* gen, __global const float* rptr, const f
 static inline float4 rndLight(RandomGen* gen, const int bounceId,
                               __global const int* a_tab, const unsigned int qmcPos, __constant unsigned int* a_qmcTable)
 {
-  if(bounceId == 0 && a_tab != 0 && a_qmcTable != 0)
+  if(a_tab != 0 && a_qmcTable != 0)
   {
     float4 res;
-    res.x = rndQmcTab(gen, a_tab, qmcPos, QMC_VAR_LGT_0, a_qmcTable);
-    res.y = rndQmcTab(gen, a_tab, qmcPos, QMC_VAR_LGT_1, a_qmcTable);
-    res.z = rndQmcTab(gen, a_tab, qmcPos, QMC_VAR_LGT_2, a_qmcTable);
+    res.x = rndQmcTabPadded(gen, a_tab, qmcPos, QMC_VAR_LGT_0, bounceId, a_qmcTable);
+    res.y = rndQmcTabPadded(gen, a_tab, qmcPos, QMC_VAR_LGT_1, bounceId, a_qmcTable);
+    res.z = rndQmcTabPadded(gen, a_tab, qmcPos, QMC_VAR_LGT_2, bounceId, a_qmcTable);
     res.w = rndFloat1_Pseudo(gen);
     return res;
   }
@@ -438,11 +532,11 @@ static inline float3 rndMat(RandomGen* gen, __global const float* rptr, const in
     float z = rptr[2];
     return make_float3(x, y, z);
   }
-  else if(bounceId == 0 && a_tab != 0 && a_qmcTable != 0)
+  else if(a_tab != 0 && a_qmcTable != 0)
   {
     float3 res;
-    res.x = rndQmcTab(gen, a_tab, qmcPos, QMC_VAR_MAT_0, a_qmcTable);
-    res.y = rndQmcTab(gen, a_tab, qmcPos, QMC_VAR_MAT_1, a_qmcTable);
+    res.x = rndQmcTabPadded(gen, a_tab, qmcPos, QMC_VAR_MAT_0, bounceId, a_qmcTable);
+    res.y = rndQmcTabPadded(gen, a_tab, qmcPos, QMC_VAR_MAT_1, bounceId, a_qmcTable);
     res.z = rndFloat1_Pseudo(gen);
     return res;
   }
@@ -468,8 +562,8 @@ static inline float rndMatLayer(RandomGen* gen, __global const float* rptr, cons
 {
   if (rptr != 0)                                                       // MCMC way; #NOTE: Lazy mutations is not needed due to small step
     return rptr[layerId];                                              // must never change material layer, no mutations is allowed!
-  else if(bounceId == 0 && a_tab != 0 && a_qmcTable != 0)              // QMC way;
-    return rndQmcTab(gen, a_tab, a_qmcPos, QMC_VAR_MAT_L, a_qmcTable);
+  else if(a_tab != 0 && a_qmcTable != 0)                               // QMC way; deep bounces use padded sequence
+    return rndQmcTabPadded(gen, a_tab, a_qmcPos, QMC_VAR_MAT_L, bounceId, a_qmcTable);
   else                                                                 // OMC way;
     return rndFloat1_Pseudo(gen);                                      
 }
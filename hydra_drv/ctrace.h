@@ -67,31 +67,16 @@ static inline Lite_Hit IntersectAllPrimitivesInLeaf1(const float3 ray_pos, const
                                                   #endif
                                                     )
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
-
-  const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
-  const int triAddressStart = objectListInfo.x; 
-  const int triAddressEnd   = triAddressStart + objectListInfo.y*NUM_FETCHES_TRI;
+  const int4 leafHeader = getLeafHeader(leaf_offset, a_objListTex);
  
-  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress += NUM_FETCHES_TRI)
+  for (int triId = 0; triId < leafHeader.y; triId++)
   {
-   #ifdef USE_1D_TEXTURES
-    const float4 data1 = read_imagef(a_objListTex, triAddress + 0);
-    const float4 data2 = read_imagef(a_objListTex, triAddress + 1);
-    const float4 data3 = read_imagef(a_objListTex, triAddress + 2);
-   #else
-    const float4 data1 = a_objListTex[triAddress + 0]; 
-    const float4 data2 = a_objListTex[triAddress + 1]; 
-    const float4 data3 = a_objListTex[triAddress + 2]; 
-   #endif
-
-    const float3 A_pos = to_float3(data1);
-    const float3 B_pos = to_float3(data2);
-    const float3 C_pos = to_float3(data3);
-
-    const int primId   = as_int(data1.w);
-    const int geomId   = as_int(data2.w);
-    const int instId   = as_int(data3.w);
+    float3 A_pos, B_pos, C_pos;
+    const int4 triIds = fetchLeafTriangle(leaf_offset, leafHeader, triId, a_objListTex, &A_pos, &B_pos, &C_pos);
+
+    const int primId   = triIds.x;
+    const int geomId   = triIds.y;
+    const int instId   = triIds.z;
 
     const float3 edge1 = B_pos - A_pos;
     const float3 edge2 = C_pos - A_pos;
@@ -127,31 +112,16 @@ static inline Lite_Hit IntersectAllPrimitivesInLeaf(const float3 ray_pos, const
                                                   #endif
                                                      const int a_instId)
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
-
-  const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
-  const int triAddressStart = objectListInfo.x; 
-  const int triAddressEnd   = triAddressStart + objectListInfo.y*NUM_FETCHES_TRI;
+  const int4 leafHeader = getLeafHeader(leaf_offset, a_objListTex);
  
-  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress += NUM_FETCHES_TRI)
+  for (int triId = 0; triId < leafHeader.y; triId++)
   {
-   #ifdef USE_1D_TEXTURES
-    const float4 data1 = read_imagef(a_objListTex, triAddress + 0);
-    const float4 data2 = read_imagef(a_objListTex, triAddress + 1);
-    const float4 data3 = read_imagef(a_objListTex, triAddress + 2);
-   #else
-    const float4 data1 = a_objListTex[triAddress + 0]; 
-    const float4 data2 = a_objListTex[triAddress + 1]; 
-    const float4 data3 = a_objListTex[triAddress + 2]; 
-   #endif
-
-    const float3 A_pos = to_float3(data1);
-    const float3 B_pos = to_float3(data2);
-    const float3 C_pos = to_float3(data3);
-
-    const int primId   = as_int(data1.w);
-    const int geomId   = as_int(data2.w);
-    //const int instId   = as_int(data3.w);
+    float3 A_pos, B_pos, C_pos;
+    const int4 triIds = fetchLeafTriangle(leaf_offset, leafHeader, triId, a_objListTex, &A_pos, &B_pos, &C_pos);
+
+    const int primId   = triIds.x;
+    const int geomId   = triIds.y;
+    //const int instId   = triIds.z;
 
     const float3 edge1 = B_pos - A_pos;
     const float3 edge2 = C_pos - A_pos;
@@ -189,6 +159,28 @@ static inline float2 decompressTexCoord16(unsigned int packed)
   return make_float2(2.0f*fx - 1.0f, 2.0f*fy - 1.0f);
 }
 
+/**
+\brief get opacity micromap state (OMM_STATE_UNKNOWN, OMM_STATE_TRANSPARENT or OMM_STATE_OPAQUE) of the hit point on triangle.
+\param a_record    - packed record1.x of triangle in alpha table
+\param u           - barycentric coordinate of hit, same as for texture coordinates interpolation
+\param v           - barycentric coordinate of hit, same as for texture coordinates interpolation
+\param a_alphaTable - alpha table
+
+*/
+static inline int ommState(const unsigned int a_record, const float u, const float v, __global const uint2* a_alphaTable)
+{
+  const int state = (a_record >> 1) & 3;
+  if (state != OMM_STATE_MAP)
+    return state;
+
+  const float3 bary = make_float3(fmax(1.0f - u - v, 0.0f), fmax(v, 0.0f), fmax(u, 0.0f));
+  const int subId   = subTriangleId(bary, OMM_LEVEL);
+  const uint2 word  = a_alphaTable[(a_record >> 3) + (subId >> 5)];
+  const int bit     = (subId & 31) * 2;
+
+  return (((bit < 32) ? word.x : word.y) >> (bit & 31)) & 3;
+}
+
 static inline Lite_Hit IntersectAllPrimitivesInLeafAlpha(const float3 ray_pos, const float3 ray_dir,
                                                          const int leaf_offset, const float t_min, 
                                                          Lite_Hit a_result,
@@ -200,31 +192,17 @@ static inline Lite_Hit IntersectAllPrimitivesInLeafAlpha(const float3 ray_pos, c
                                                          const int a_instId,
                                                          __global const uint2* a_alphaTable, __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
-
-  const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
-  const int triAddressStart = objectListInfo.x; 
-  const int triAddressEnd   = triAddressStart + objectListInfo.y*NUM_FETCHES_TRI;
+  const int4 leafHeader = getLeafHeader(leaf_offset, a_objListTex);
  
-  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress += NUM_FETCHES_TRI)
+  for (int triId = 0; triId < leafHeader.y; triId++)
   {
-   #ifdef USE_1D_TEXTURES
-    const float4 data1 = read_imagef(a_objListTex, triAddress + 0);
-    const float4 data2 = read_imagef(a_objListTex, triAddress + 1);
-    const float4 data3 = read_imagef(a_objListTex, triAddress + 2);
-   #else
-    const float4 data1 = a_objListTex[triAddress + 0]; 
-    const float4 data2 = a_objListTex[triAddress + 1]; 
-    const float4 data3 = a_objListTex[triAddress + 2]; 
-   #endif
-
-    const float3 A_pos = to_float3(data1);
-    const float3 B_pos = to_float3(data2);
-    const float3 C_pos = to_float3(data3);
-
-    const int primId   = as_int(data1.w);
-    const int geomId   = as_int(data2.w);
-    //const int instId   = as_int(data3.w);
+    float3 A_pos, B_pos, C_pos;
+    const int4 triIds     = fetchLeafTriangle(leaf_offset, leafHeader, triId, a_objListTex, &A_pos, &B_pos, &C_pos);
+    const int  triAddress = triIds.w; // alpha table offset
+
+    const int primId   = triIds.x;
+    const int geomId   = triIds.y;
+    //const int instId   = triIds.z;
 
     const float3 edge1 = B_pos - A_pos;
     const float3 edge2 = C_pos - A_pos;
@@ -239,19 +217,25 @@ static inline Lite_Hit IntersectAllPrimitivesInLeafAlpha(const float3 ray_pos, c
 
     if (v > -1e-6f && u > -1e-6f && (u + v < 1.0f + 1e-6f) && t > t_min && t < a_result.t)
     {
-      const uint2 alphaId0 = a_alphaTable[triAddress+0];
       const uint2 alphaId1 = a_alphaTable[triAddress+1];
-      const uint2 alphaId2 = a_alphaTable[triAddress+2];
-      
-      const float2 A_tex   = decompressTexCoord16(alphaId0.y);
-      const float2 B_tex   = decompressTexCoord16(alphaId1.y);
-      const float2 C_tex   = decompressTexCoord16(alphaId2.y);
-      
-      const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
-      const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0) ? INVALID_TEXTURE : 0;
+      const int   ommSt    = ommState(alphaId1.x, u, v, a_alphaTable);
 
-      const float3 alphaColor = sample2DLite(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
-      const float selector    = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
+      float selector = (ommSt == OMM_STATE_OPAQUE) ? 1.0f : 0.0f;
+      if (ommSt == OMM_STATE_UNKNOWN)
+      {
+        const uint2 alphaId0 = a_alphaTable[triAddress+0];
+        const uint2 alphaId2 = a_alphaTable[triAddress+2];
+
+        const float2 A_tex   = decompressTexCoord16(alphaId0.y);
+        const float2 B_tex   = decompressTexCoord16(alphaId1.y);
+        const float2 C_tex   = decompressTexCoord16(alphaId2.y);
+
+        const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
+        const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0) ? INVALID_TEXTURE : 0;
+
+        const float3 alphaColor = sample2DLite(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
+        selector                = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
+      }
 
       if (selector > 0.5f)
       {
@@ -280,31 +264,17 @@ static inline Lite_Hit IntersectAllPrimitivesInLeafAlphaS(const float3 ray_pos,
                                                           const int a_instId,
                                                           __global const uint2* a_alphaTable, __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
-
-  const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
-  const int triAddressStart = objectListInfo.x; 
-  const int triAddressEnd   = triAddressStart + objectListInfo.y*NUM_FETCHES_TRI;
+  const int4 leafHeader = getLeafHeader(leaf_offset, a_objListTex);
  
-  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress += NUM_FETCHES_TRI)
+  for (int triId = 0; triId < leafHeader.y; triId++)
   {
-   #ifdef USE_1D_TEXTURES
-    const float4 data1 = read_imagef(a_objListTex, triAddress + 0);
-    const float4 data2 = read_imagef(a_objListTex, triAddress + 1);
-    const float4 data3 = read_imagef(a_objListTex, triAddress + 2);
-   #else
-    const float4 data1 = a_objListTex[triAddress + 0]; 
-    const float4 data2 = a_objListTex[triAddress + 1]; 
-    const float4 data3 = a_objListTex[triAddress + 2]; 
-   #endif
-
-    const float3 A_pos = to_float3(data1);
-    const float3 B_pos = to_float3(data2);
-    const float3 C_pos = to_float3(data3);
-
-    const int primId   = as_int(data1.w);
-    const int geomId   = as_int(data2.w);
-    //const int instId   = as_int(data3.w);
+    float3 A_pos, B_pos, C_pos;
+    const int4 triIds     = fetchLeafTriangle(leaf_offset, leafHeader, triId, a_objListTex, &A_pos, &B_pos, &C_pos);
+    const int  triAddress = triIds.w; // alpha table offset
+
+    const int primId   = triIds.x;
+    const int geomId   = triIds.y;
+    //const int instId   = triIds.z;
 
     const float3 edge1 = B_pos - A_pos;
     const float3 edge2 = C_pos - A_pos;
@@ -319,23 +289,29 @@ static inline Lite_Hit IntersectAllPrimitivesInLeafAlphaS(const float3 ray_pos,
 
     if (v > -1e-6f && u > -1e-6f && (u + v < 1.0f + 1e-6f) && t > t_min && t < a_result.t)
     {
-      const uint2 alphaId0 = a_alphaTable[triAddress+0];
       const uint2 alphaId1 = a_alphaTable[triAddress+1];
-      const uint2 alphaId2 = a_alphaTable[triAddress+2];
+      const int   ommSt    = ommState(alphaId1.x, u, v, a_alphaTable);
 
-      const float2 A_tex = decompressTexCoord16(alphaId0.y);
-      const float2 B_tex = decompressTexCoord16(alphaId1.y);
-      const float2 C_tex = decompressTexCoord16(alphaId2.y);
-      
-      const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
-      const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0) ? INVALID_TEXTURE : 0;
-      const float3 alphaColor = sample2DUI2(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
+      bool acceptHit = (ommSt == OMM_STATE_OPAQUE);
+      if (ommSt == OMM_STATE_UNKNOWN)
+      {
+        const uint2 alphaId0 = a_alphaTable[triAddress+0];
+        const uint2 alphaId2 = a_alphaTable[triAddress+2];
+
+        const float2 A_tex = decompressTexCoord16(alphaId0.y);
+        const float2 B_tex = decompressTexCoord16(alphaId1.y);
+        const float2 C_tex = decompressTexCoord16(alphaId2.y);
 
-      const float selector = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
+        const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
+        const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0) ? INVALID_TEXTURE : 0;
+        const float3 alphaColor = sample2DUI2(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
 
-      bool acceptHit = (selector > 0.5f); 
-      if (alphaId1.x == 1) // smooth opacity enabled
-        acceptHit = (rndFloat1_Pseudo(pGen) < selector);
+        const float selector = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
+
+        acceptHit = (selector > 0.5f);
+        if ((alphaId1.x & 1) == 1) // smooth opacity enabled
+          acceptHit = (rndFloat1_Pseudo(pGen) < selector);
+      }
 
       if (acceptHit)
       {
@@ -364,31 +340,17 @@ static inline void IntersectAllPrimitivesInLeafShadowAlphaS(const float3 ray_pos
                                                             const int a_instId,
                                                             __global const uint2* a_alphaTable, __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
-  const int2 objectListInfo = getObjectList(leaf_offset, a_objListTex);
-
-  const int NUM_FETCHES_TRI = 3; // sizeof(struct ObjectListTriangle) / sizeof(float4);
-  const int triAddressStart = objectListInfo.x; 
-  const int triAddressEnd   = triAddressStart + objectListInfo.y*NUM_FETCHES_TRI;
+  const int4 leafHeader = getLeafHeader(leaf_offset, a_objListTex);
  
-  for (int triAddress = triAddressStart; triAddress < triAddressEnd; triAddress += NUM_FETCHES_TRI)
+  for (int triId = 0; triId < leafHeader.y; triId++)
   {
-   #ifdef USE_1D_TEXTURES
-    const float4 data1 = read_imagef(a_objListTex, triAddress + 0);
-    const float4 data2 = read_imagef(a_objListTex, triAddress + 1);
-    const float4 data3 = read_imagef(a_objListTex, triAddress + 2);
-   #else
-    const float4 data1 = a_objListTex[triAddress + 0]; 
-    const float4 data2 = a_objListTex[triAddress + 1]; 
-    const float4 data3 = a_objListTex[triAddress + 2]; 
-   #endif
-
-    const float3 A_pos = to_float3(data1);
-    const float3 B_pos = to_float3(data2);
-    const float3 C_pos = to_float3(data3);
-
-    const int primId   = as_int(data1.w);
-    const int geomId   = as_int(data2.w);
-    //const int instId   = as_int(data3.w);
+    float3 A_pos, B_pos, C_pos;
+    const int4 triIds     = fetchLeafTriangle(leaf_offset, leafHeader, triId, a_objListTex, &A_pos, &B_pos, &C_pos);
+    const int  triAddress = triIds.w; // alpha table offset
+
+    const int primId   = triIds.x;
+    const int geomId   = triIds.y;
+    //const int instId   = triIds.z;
 
     const float3 edge1 = B_pos - A_pos;
     const float3 edge2 = C_pos - A_pos;
@@ -403,23 +365,30 @@ static inline void IntersectAllPrimitivesInLeafShadowAlphaS(const float3 ray_pos
 
     if (v > -1e-6f && u > -1e-6f && (u + v < 1.0f + 1e-6f) && t > t_min && t < t_max)
     {
-      const uint2 alphaId0 = a_alphaTable[triAddress+0];
       const uint2 alphaId1 = a_alphaTable[triAddress+1];
       const uint2 alphaId2 = a_alphaTable[triAddress+2];
 
-      const float2 A_tex = decompressTexCoord16(alphaId0.y);
-      const float2 B_tex = decompressTexCoord16(alphaId1.y);
-      const float2 C_tex = decompressTexCoord16(alphaId2.y);
-      
-      const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
-      const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0 || alphaId2.x == 1) ? INVALID_TEXTURE : 0;
-      const float3 alphaColor = sample2DUI2(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
-
-      const float selector    = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
-
       if (alphaId2.x != 1)   // skip shadow
       {
-        if (alphaId1.x == 1) // smooth opacity enabled
+        const int ommSt = ommState(alphaId1.x, u, v, a_alphaTable);
+
+        float selector  = (ommSt == OMM_STATE_OPAQUE) ? 1.0f : 0.0f;
+        if (ommSt == OMM_STATE_UNKNOWN)
+        {
+          const uint2 alphaId0 = a_alphaTable[triAddress+0];
+
+          const float2 A_tex = decompressTexCoord16(alphaId0.y);
+          const float2 B_tex = decompressTexCoord16(alphaId1.y);
+          const float2 C_tex = decompressTexCoord16(alphaId2.y);
+
+          const float2 texCoord   = (1.0f - u - v)*A_tex + v*B_tex + u*C_tex;
+          const int samplerOffset = (alphaId0.x == 0xFFFFFFFF || alphaId0.x == INVALID_TEXTURE || (int)(alphaId0.x) <= 0) ? INVALID_TEXTURE : 0;
+          const float3 alphaColor = sample2DUI2(samplerOffset, texCoord, (a_alphaTable + alphaId0.x), a_texStorage, a_globals);
+
+          selector = fmax(alphaColor.x, fmax(alphaColor.y, alphaColor.z));
+        }
+
+        if ((alphaId1.x & 1) == 1) // smooth opacity enabled
           (*pShadow) *= (1.0f - selector);
         else
         {
@@ -437,6 +406,16 @@ static inline void IntersectAllPrimitivesInLeafShadowAlphaS(const float3 ray_pos
 
 #define STACK_SIZE 80
 
+// optional traversal counters for BVH analytics on CPU: x - visited 4-wide nodes, y - ray-triangle tests
+//
+#ifdef OCL_COMPILER
+  #define BVH_STAT_NODE(pStat)
+  #define BVH_STAT_LEAF(pStat, a_leafOffset, a_tris)
+#else
+  #define BVH_STAT_NODE(pStat)                       if ((pStat) != nullptr) { (pStat)->x++; }
+  #define BVH_STAT_LEAF(pStat, a_leafOffset, a_tris) if ((pStat) != nullptr) { (pStat)->y += getLeafHeader((a_leafOffset), (a_tris)).y; }
+#endif
+
 ID_CALL unsigned int BVHTraversal(float3 ray_pos, float3 ray_dir, float t_rayMin, __private Lite_Hit* pHit, 
 
                               #ifdef USE_1D_TEXTURES
@@ -528,10 +507,79 @@ ID_CALL unsigned int BVHTraversal(float3 ray_pos, float3 ray_dir, float t_rayMin
 #define MAXFLOAT 1e37f
 #endif
 
+/**
+\brief Check for compressed BVH4 layout (see BVH4_QUANTIZED_LAYOUT_TAG)
+*/
+static inline bool BVH4IsQuantized(__global const float4* a_bvh) { return (as_int(a_bvh[1].w) == BVH4_QUANTIZED_LAYOUT_TAG); }
+
+static inline float2 BVH4QuantChildIntersect(const int a_child, const int a_shift, const float3 ray_pos, const float3 invDir, 
+                                             const float3 a_origin, const float3 a_scale, const float4 f1, const float4 f2)
+{
+  if (a_child == -1)
+    return make_float2(MAXFLOAT, -MAXFLOAT);
+
+  const float3 qMin = make_float3((float)((as_int(f1.z) >> a_shift) & 0xFF), (float)((as_int(f2.x) >> a_shift) & 0xFF), (float)((as_int(f2.z) >> a_shift) & 0xFF));
+  const float3 qMax = make_float3((float)((as_int(f1.w) >> a_shift) & 0xFF), (float)((as_int(f2.y) >> a_shift) & 0xFF), (float)((as_int(f2.w) >> a_shift) & 0xFF));
+
+  return RayBoxIntersectionLite2(ray_pos, invDir, a_origin + a_scale*qMin, a_origin + a_scale*qMax);
+}
+
+/**
+\brief Fetch 4 children of BVH4 node and intersect their boxes with ray; works both for plain and compressed layouts.
+\param a_nodeOffset - node offset; in 128 byte blocks for plain layout and in 64 byte blocks for compressed one
+\param a_quantized  - layout type, see BVH4IsQuantized
+\param ray_pos      - ray origin
+\param invDir       - inverse ray direction
+\param a_bvh        - bvh data
+\param pTm0         - out hit interval of child 0; empty children get (MAXFLOAT, -MAXFLOAT) and never pass hit test
+\return children 'm_leftOffsetAndLeaf' values
+*/
+static inline int4 BVH4FetchChildren(const int a_nodeOffset, const bool a_quantized, const float3 ray_pos, const float3 invDir, __global const float4* a_bvh,
+                                     __private float2* pTm0, __private float2* pTm1, __private float2* pTm2, __private float2* pTm3)
+{
+  if (a_quantized)
+  {
+    const float4 f0 = a_bvh[4 * a_nodeOffset + 0];
+    const float4 f1 = a_bvh[4 * a_nodeOffset + 1];
+    const float4 f2 = a_bvh[4 * a_nodeOffset + 2];
+    const float4 f3 = a_bvh[4 * a_nodeOffset + 3];
+
+    const float3 origin = make_float3(f0.x, f0.y, f0.z);
+    const float3 scale  = make_float3(f0.w, f1.x, f1.y);
+    const int4 children = make_int4(as_int(f3.x), as_int(f3.y), as_int(f3.z), as_int(f3.w));
+
+    (*pTm0) = BVH4QuantChildIntersect(children.x, 0,  ray_pos, invDir, origin, scale, f1, f2);
+    (*pTm1) = BVH4QuantChildIntersect(children.y, 8,  ray_pos, invDir, origin, scale, f1, f2);
+    (*pTm2) = BVH4QuantChildIntersect(children.z, 16, ray_pos, invDir, origin, scale, f1, f2);
+    (*pTm3) = BVH4QuantChildIntersect(children.w, 24, ray_pos, invDir, origin, scale, f1, f2);
+
+    return children;
+  }
+  else
+  {
+    const BVHNode node0 = GetBVHNode(4 * a_nodeOffset + 0, a_bvh);
+    const BVHNode node1 = GetBVHNode(4 * a_nodeOffset + 1, a_bvh);
+    const BVHNode node2 = GetBVHNode(4 * a_nodeOffset + 2, a_bvh);
+    const BVHNode node3 = GetBVHNode(4 * a_nodeOffset + 3, a_bvh);
+
+    (*pTm0) = IsValidNode(node0) ? RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax) : make_float2(MAXFLOAT, -MAXFLOAT);
+    (*pTm1) = IsValidNode(node1) ? RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax) : make_float2(MAXFLOAT, -MAXFLOAT);
+    (*pTm2) = IsValidNode(node2) ? RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax) : make_float2(MAXFLOAT, -MAXFLOAT);
+    (*pTm3) = IsValidNode(node3) ? RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax) : make_float2(MAXFLOAT, -MAXFLOAT);
+
+    return make_int4(node0.m_leftOffsetAndLeaf, node1.m_leftOffsetAndLeaf, node2.m_leftOffsetAndLeaf, node3.m_leftOffsetAndLeaf);
+  }
+}
+
 static inline Lite_Hit BVH4Traverse(const float3 ray_pos, const float3 ray_dir, float t_rayMin, Lite_Hit a_hit, 
-                                    __global const float4* a_bvh, __global const float4* a_tris)
+                                    __global const float4* a_bvh, __global const float4* a_tris
+                                    #ifndef OCL_COMPILER
+                                    , int2* a_pStat = nullptr
+                                    #endif
+                                    )
 {
   const float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData+2;
@@ -545,32 +593,14 @@ static inline Lite_Hit BVH4Traverse(const float3 ray_pos, const float3 ray_dir,
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+      BVH_STAT_NODE(a_pStat);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -682,6 +712,7 @@ static inline Lite_Hit BVH4Traverse(const float3 ray_pos, const float3 ray_dir,
     //
     if (top >= 0)
     {
+      BVH_STAT_LEAF(a_pStat, leftNodeOffset, a_tris);
       a_hit = IntersectAllPrimitivesInLeaf1(ray_pos, ray_dir, leftNodeOffset, t_rayMin, a_hit, a_tris);
     }
 
@@ -701,9 +732,14 @@ static inline Lite_Hit BVH4Traverse(const float3 ray_pos, const float3 ray_dir,
 
 
 static inline Lite_Hit BVH4InstTraverse(float3 ray_pos, float3 ray_dir, float t_rayMin, Lite_Hit a_hit, 
-                                        __global const float4* a_bvh, __global const float4* a_tris)
+                                        __global const float4* a_bvh, __global const float4* a_tris
+                                        #ifndef OCL_COMPILER
+                                        , int2* a_pStat = nullptr
+                                        #endif
+                                        )
 {
   float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData + 2;
@@ -725,32 +761,14 @@ static inline Lite_Hit BVH4InstTraverse(float3 ray_pos, float3 ray_dir, float t_
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+      BVH_STAT_NODE(a_pStat);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -873,6 +891,7 @@ static inline Lite_Hit BVH4InstTraverse(float3 ray_pos, float3 ray_dir, float t_
     //
     if (top >= 0 && instDeep == 1)
     {
+      BVH_STAT_LEAF(a_pStat, leftNodeOffset, a_tris);
       a_hit = IntersectAllPrimitivesInLeaf(ray_pos, ray_dir, leftNodeOffset, t_rayMin, a_hit, a_tris, instId);
 
       top--;
@@ -886,15 +905,16 @@ static inline Lite_Hit BVH4InstTraverse(float3 ray_pos, float3 ray_dir, float t_
 
       // (1) read matrix and next offset
       //
-      const int nextOffset = as_int(a_bvh[leftNodeOffset * 8 + 0].w);
+      const int instBase   = leftNodeOffset * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
 
       float4x4 matrix;
-      matrix.row[0] = a_bvh[leftNodeOffset * 8 + 2];
-      matrix.row[1] = a_bvh[leftNodeOffset * 8 + 3];
-      matrix.row[2] = a_bvh[leftNodeOffset * 8 + 4];
-      matrix.row[3] = a_bvh[leftNodeOffset * 8 + 5];
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
 
-      instId = as_int(a_bvh[leftNodeOffset * 8 + 6].x);
+      instId = as_int(a_bvh[instBase + 6].x);
       //instId = leftNodeOffset * 8 + 2; // save instAddr instead of instId
 
       // (2) mult ray with matrix
@@ -924,10 +944,209 @@ static inline Lite_Hit BVH4InstTraverse(float3 ray_pos, float3 ray_dir, float t_
 }
 
 
+#define SHORT_STACK_SIZE  8
+#define TRAIL_WORDS       8  // 4 bits per level: 2 bits for index of child in sorted order + 'last child' bit; up to 64 levels (top + bottom)
+#define TRAIL_LAST_CHILD  4
+#define TRAIL_LEVELS      (TRAIL_WORDS*8)
+
+static inline int  trailGet(__private const uint* a_trail, const int a_level) { return (a_trail[a_level >> 3] >> ((a_level & 7) * 4)) & 0xF; }
+
+static inline void trailSet(__private uint* a_trail, const int a_level, const int a_val)
+{
+  const int shift       = (a_level & 7) * 4;
+  a_trail[a_level >> 3] = (a_trail[a_level >> 3] & ~(0xFu << shift)) | ((uint)(a_val) << shift);
+}
+
+static inline void trailClearDeeper(__private uint* a_trail, const int a_level) // reset all levels deeper than a_level
+{
+  const int word  = a_level >> 3;
+  const int shift = ((a_level & 7) + 1) * 4;
+  a_trail[word]   = (shift >= 32) ? a_trail[word] : (a_trail[word] & ((1u << shift) - 1u));
+  for (int i = word + 1; i < TRAIL_WORDS; i++)
+    a_trail[i] = 0;
+}
+
+/**
+\brief Stable sort of 4 children by entry distance. Stability matters for restart trail: when a_hit.t decreases, 
+       culled children go to the end and the order of remaining ones must not change.
+*/
+static inline int BVH4SortChildrenStable(__private int4* pChildren, __private float4* pHitMinD)
+{
+  int   ch[4] = { (*pChildren).x, (*pChildren).y, (*pChildren).z, (*pChildren).w };
+  float tm[4] = { (*pHitMinD).x,  (*pHitMinD).y,  (*pHitMinD).z,  (*pHitMinD).w  };
+
+  for (int i = 1; i < 4; i++)
+  {
+    const int   c = ch[i];
+    const float t = tm[i];
+    int j = i - 1;
+    while (j >= 0 && tm[j] > t)
+    {
+      ch[j + 1] = ch[j];
+      tm[j + 1] = tm[j];
+      j--;
+    }
+    ch[j + 1] = c;
+    tm[j + 1] = t;
+  }
+
+  (*pChildren) = make_int4(ch[0], ch[1], ch[2], ch[3]);
+  (*pHitMinD)  = make_float4(tm[0], tm[1], tm[2], tm[3]);
+
+  return (tm[0] < MAXFLOAT ? 1 : 0) + (tm[1] < MAXFLOAT ? 1 : 0) + (tm[2] < MAXFLOAT ? 1 : 0) + (tm[3] < MAXFLOAT ? 1 : 0);
+}
+
+/**
+\brief Same as BVH4InstTraverse, but with short stack of SHORT_STACK_SIZE entries and restart trail (2 bits + 'last' bit per level) 
+       instead of STACK_SIZE ints of private memory. When short stack overflows, oldest entries are dropped; 
+       when it becomes empty, traversal restarts from root and follows the trail to the next unvisited child. Enabled with BVH_SHORT_STACK.
+       If top and bottom trees together are deeper than TRAIL_LEVELS, traversal stops and (*pOverflow) is set; caller must finish such ray 
+       with full stack BVH4InstTraverse from the returned closest hit in a separate kernel (BVH4TraversalInstOverflowKernel), 
+       so full stack is not reserved in private memory of this one. BVHBuilderNative limits tree depth, so this is a cold path for its trees.
+*/
+static inline Lite_Hit BVH4InstTraverseShortStack(const float3 a_rayPos, const float3 a_rayDir, float t_rayMin, Lite_Hit a_hit, 
+                                                  __global const float4* a_bvh, __global const float4* a_tris, __private bool* pOverflow)
+{
+  const bool quantized = BVH4IsQuantized(a_bvh);
+
+  float3 ray_pos = a_rayPos;
+  float3 ray_dir = a_rayDir;
+  float3 invDir  = SafeInverse(ray_dir);
+
+  uint trail[TRAIL_WORDS];
+  for (int i = 0; i < TRAIL_WORDS; i++)
+    trail[i] = 0;
+
+  int2 stack[SHORT_STACK_SIZE];  // (node, level | (trail value << 8))
+  int  stackHead = 0;
+  int  stackNum  = 0;
+
+  int  node      = 1;            // root children
+  int  level     = 0;
+  int  instLevel = -1;           // level of instance subtree root; -1 for top level
+  int  instId    = -1;
+
+  while (true)
+  {
+    bool subtreeDone = false;
+
+    if (!IS_LEAF(node))
+    {
+      if (level >= TRAIL_LEVELS) // trail can't address this level; a_hit only gets closer, so it is still valid for restart
+      {
+        (*pOverflow) = true;
+        return a_hit;
+      }
+
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(EXTRACT_OFFSET(node), quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
+
+      float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
+                                   hitChild1 ? tm1.x : MAXFLOAT,
+                                   hitChild2 ? tm2.x : MAXFLOAT,
+                                   hitChild3 ? tm3.x : MAXFLOAT);
+
+      const int hitsNum = BVH4SortChildrenStable(&children, &hitMinD);
+      const int index   = trailGet(trail, level) & 3; // 0 for a fresh node, next child to visit after restart
+
+      if (index >= hitsNum)
+        subtreeDone = true;
+      else
+      {
+        trailSet(trail, level, index | ((index == hitsNum - 1) ? TRAIL_LAST_CHILD : 0));
+
+        // push far siblings; on overflow the oldest entry is overwritten, restart trail will find it later
+        //
+        const int ch[4] = { children.x, children.y, children.z, children.w };
+        for (int i = hitsNum - 1; i > index; i--)
+        {
+          stack[stackHead] = make_int2(ch[i], (level + 1) | ((i | ((i == hitsNum - 1) ? TRAIL_LAST_CHILD : 0)) << 8));
+          stackHead        = (stackHead + 1) % SHORT_STACK_SIZE;
+          stackNum         = (stackNum < SHORT_STACK_SIZE) ? stackNum + 1 : SHORT_STACK_SIZE;
+        }
+
+        node  = ch[index];
+        level = level + 1;
+      }
+    }
+    else if (instLevel < 0) // top level leaf is an instance
+    {
+      const int instBase   = EXTRACT_OFFSET(node) * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
+
+      float4x4 matrix;
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
+
+      instId    = as_int(a_bvh[instBase + 6].x);
+      ray_pos   = mul4x3(matrix, a_rayPos);
+      ray_dir   = mul3x3(matrix, a_rayDir); // don't normalize, see BVH4InstTraverse
+      invDir    = SafeInverse(ray_dir);
+      instLevel = level;
+      node      = nextOffset;
+    }
+    else
+    {
+      a_hit       = IntersectAllPrimitivesInLeaf(ray_pos, ray_dir, EXTRACT_OFFSET(node), t_rayMin, a_hit, a_tris, instId);
+      subtreeDone = true;
+    }
+
+    if (!subtreeDone)
+      continue;
+
+    if (stackNum > 0) // pop next sibling from short stack
+    {
+      stackHead = (stackHead + SHORT_STACK_SIZE - 1) % SHORT_STACK_SIZE;
+      stackNum--;
+
+      const int2 entry = stack[stackHead];
+      node             = entry.x;
+      level            = entry.y & 0xFF;
+
+      trailSet(trail, level - 1, entry.y >> 8);
+      trailClearDeeper(trail, level - 1);
+    }
+    else              // restart: advance trail at the deepest level that still has unvisited children
+    {
+      int popLevel = level - 1;
+      while (popLevel >= 0 && (trailGet(trail, popLevel) & TRAIL_LAST_CHILD) != 0)
+        popLevel--;
+
+      if (popLevel < 0)
+        break;
+
+      trailSet(trail, popLevel, (trailGet(trail, popLevel) & 3) + 1);
+      trailClearDeeper(trail, popLevel);
+
+      node  = 1;
+      level = 0;
+    }
+
+    if (instLevel >= 0 && level <= instLevel) // left instance subtree
+    {
+      ray_pos   = a_rayPos;
+      ray_dir   = a_rayDir;
+      invDir    = SafeInverse(ray_dir);
+      instLevel = -1;
+    }
+  }
+
+  return a_hit;
+}
+
+
 static inline float3 BVH4InstTraverseShadow(float3 ray_pos, float3 ray_dir, float t_rayMin, Lite_Hit a_hit, 
                                             __global const float4* a_bvh, __global const float4* a_tris, const int a_targetInstId)
 {
   float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData + 2;
@@ -949,32 +1168,13 @@ static inline float3 BVH4InstTraverseShadow(float3 ray_pos, float3 ray_dir, floa
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -1119,15 +1319,16 @@ static inline float3 BVH4InstTraverseShadow(float3 ray_pos, float3 ray_dir, floa
       
       // (1) read matrix and next offset
       //
-      const int nextOffset = as_int(a_bvh[leftNodeOffset * 8 + 0].w);
+      const int instBase   = leftNodeOffset * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
       
       float4x4 matrix;
-      matrix.row[0] = a_bvh[leftNodeOffset * 8 + 2];
-      matrix.row[1] = a_bvh[leftNodeOffset * 8 + 3];
-      matrix.row[2] = a_bvh[leftNodeOffset * 8 + 4];
-      matrix.row[3] = a_bvh[leftNodeOffset * 8 + 5];
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
       
-      instId = as_int(a_bvh[leftNodeOffset * 8 + 6].x);
+      instId = as_int(a_bvh[instBase + 6].x);
       
       // (2) mult ray with matrix
       //    
@@ -1161,6 +1362,7 @@ static inline Lite_Hit BVH4InstTraverseAlpha(float3 ray_pos, float3 ray_dir, flo
                                              __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
   float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData + 2;
@@ -1182,32 +1384,13 @@ static inline Lite_Hit BVH4InstTraverseAlpha(float3 ray_pos, float3 ray_dir, flo
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -1343,15 +1526,16 @@ static inline Lite_Hit BVH4InstTraverseAlpha(float3 ray_pos, float3 ray_dir, flo
 
       // (1) read matrix and next offset
       //
-      const int nextOffset = as_int(a_bvh[leftNodeOffset * 8 + 0].w);
+      const int instBase   = leftNodeOffset * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
 
       float4x4 matrix;
-      matrix.row[0] = a_bvh[leftNodeOffset * 8 + 2];
-      matrix.row[1] = a_bvh[leftNodeOffset * 8 + 3];
-      matrix.row[2] = a_bvh[leftNodeOffset * 8 + 4];
-      matrix.row[3] = a_bvh[leftNodeOffset * 8 + 5];
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
 
-      instId = as_int(a_bvh[leftNodeOffset * 8 + 6].x);
+      instId = as_int(a_bvh[instBase + 6].x);
       //instId = leftNodeOffset * 8 + 2; // save instAddr instead of instId
 
       // (2) mult ray with matrix
@@ -1387,6 +1571,7 @@ static inline Lite_Hit BVH4InstTraverseAlphaS(float3 ray_pos, float3 ray_dir, fl
                                               __global const int4* a_texStorage, __global const EngineGlobals* a_globals)
 {
   float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData + 2;
@@ -1408,32 +1593,13 @@ static inline Lite_Hit BVH4InstTraverseAlphaS(float3 ray_pos, float3 ray_dir, fl
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= a_hit.t);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= a_hit.t);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= a_hit.t);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= a_hit.t);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -1569,15 +1735,16 @@ static inline Lite_Hit BVH4InstTraverseAlphaS(float3 ray_pos, float3 ray_dir, fl
 
       // (1) read matrix and next offset
       //
-      const int nextOffset = as_int(a_bvh[leftNodeOffset * 8 + 0].w);
+      const int instBase   = leftNodeOffset * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
 
       float4x4 matrix;
-      matrix.row[0] = a_bvh[leftNodeOffset * 8 + 2];
-      matrix.row[1] = a_bvh[leftNodeOffset * 8 + 3];
-      matrix.row[2] = a_bvh[leftNodeOffset * 8 + 4];
-      matrix.row[3] = a_bvh[leftNodeOffset * 8 + 5];
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
 
-      instId = as_int(a_bvh[leftNodeOffset * 8 + 6].x);
+      instId = as_int(a_bvh[instBase + 6].x);
       //instId = leftNodeOffset * 8 + 2; // save instAddr instead of instId
 
       // (2) mult ray with matrix
@@ -1612,6 +1779,7 @@ static inline float3 BVH4InstTraverseShadowAlphaS(float3 ray_pos, float3 ray_dir
                                                   __global const int4* a_texStorage, __global const EngineGlobals* a_globals, const int a_targetInstId)
 {
   float3 invDir = SafeInverse(ray_dir);
+  const bool quantized = BVH4IsQuantized(a_bvh);
 
   int  stackData[STACK_SIZE];
   int* stack = stackData + 2;
@@ -1635,32 +1803,13 @@ static inline float3 BVH4InstTraverseShadowAlphaS(float3 ray_pos, float3 ray_dir
 
     while (searchingForLeaf)
     {
-      const BVHNode node0 = GetBVHNode(4 * leftNodeOffset + 0, a_bvh);
-      const bool    vald0 = IsValidNode(node0);
-      const int     loal0 = node0.m_leftOffsetAndLeaf;
-      const float2  tm0   = RayBoxIntersectionLite2(ray_pos, invDir, node0.m_boxMin, node0.m_boxMax);
- 
-      const BVHNode node1 = GetBVHNode(4 * leftNodeOffset + 1, a_bvh);
-      const bool    vald1 = IsValidNode(node1);
-      const int     loal1 = node1.m_leftOffsetAndLeaf;
-      const float2  tm1   = RayBoxIntersectionLite2(ray_pos, invDir, node1.m_boxMin, node1.m_boxMax);
-     
-      const BVHNode node2 = GetBVHNode(4 * leftNodeOffset + 2, a_bvh);
-      const bool    vald2 = IsValidNode(node2);
-      const int     loal2 = node2.m_leftOffsetAndLeaf;
-      const float2  tm2   = RayBoxIntersectionLite2(ray_pos, invDir, node2.m_boxMin, node2.m_boxMax);
-
-      const BVHNode node3 = GetBVHNode(4 * leftNodeOffset + 3, a_bvh);
-      const bool    vald3 = IsValidNode(node3);
-      const int     loal3 = node3.m_leftOffsetAndLeaf;
-      const float2  tm3   = RayBoxIntersectionLite2(ray_pos, invDir, node3.m_boxMin, node3.m_boxMax);
-
-      int4 children = make_int4(loal0, loal1, loal2, loal3);
-
-      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= t_rayMax) && vald0;
-      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= t_rayMax) && vald1;
-      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= t_rayMax) && vald2;
-      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= t_rayMax) && vald3;
+      float2 tm0, tm1, tm2, tm3;
+      int4 children = BVH4FetchChildren(leftNodeOffset, quantized, ray_pos, invDir, a_bvh, &tm0, &tm1, &tm2, &tm3);
+
+      const bool hitChild0 = (tm0.x <= tm0.y) && (tm0.y >= t_rayMin) && (tm0.x <= t_rayMax);
+      const bool hitChild1 = (tm1.x <= tm1.y) && (tm1.y >= t_rayMin) && (tm1.x <= t_rayMax);
+      const bool hitChild2 = (tm2.x <= tm2.y) && (tm2.y >= t_rayMin) && (tm2.x <= t_rayMax);
+      const bool hitChild3 = (tm3.x <= tm3.y) && (tm3.y >= t_rayMin) && (tm3.x <= t_rayMax);
 
       float4 hitMinD = make_float4(hitChild0 ? tm0.x : MAXFLOAT,
                                    hitChild1 ? tm1.x : MAXFLOAT,
@@ -1801,15 +1950,16 @@ static inline float3 BVH4InstTraverseShadowAlphaS(float3 ray_pos, float3 ray_dir
       
       // (1) read matrix and next offset
       //
-      const int nextOffset = as_int(a_bvh[leftNodeOffset * 8 + 0].w);
+      const int instBase   = leftNodeOffset * (quantized ? 4 : 8);
+      const int nextOffset = as_int(a_bvh[instBase + 0].w);
       
       float4x4 matrix;
-      matrix.row[0] = a_bvh[leftNodeOffset * 8 + 2];
-      matrix.row[1] = a_bvh[leftNodeOffset * 8 + 3];
-      matrix.row[2] = a_bvh[leftNodeOffset * 8 + 4];
-      matrix.row[3] = a_bvh[leftNodeOffset * 8 + 5];
+      matrix.row[0] = a_bvh[instBase + 2];
+      matrix.row[1] = a_bvh[instBase + 3];
+      matrix.row[2] = a_bvh[instBase + 4];
+      matrix.row[3] = a_bvh[instBase + 5];
       
-      instId = as_int(a_bvh[leftNodeOffset * 8 + 6].x);
+      instId = as_int(a_bvh[instBase + 6].x);
       
       // (2) mult ray with matrix
       //    
@@ -1,3 +1,5 @@
+#include "cdenoise.h"
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -320,6 +322,100 @@ __kernel void NonLocalMeansFilter(write_only image2d_t a_outImage, image2d_t a_i
   write_imagef(a_outImage, make_int2(x, y), result);
 }
 
+inline float4 fetchClamped(__global const float4* a_data, int x, int y, int w, int h)
+{
+  x = clamp(x, 0, w - 1);
+  y = clamp(y, 0, h - 1);
+  return a_data[y*w + x];
+}
+
+inline float4 demodulate(const float4 a_color, const float4 a_albedo) { return make_float4(a_color.x/a_albedo.x, a_color.y/a_albedo.y, a_color.z/a_albedo.z, 0.0f); }
+
+/**
+\brief Feature guided non local means for noisy HDR frames; same algorithm as GuidedFilterNLM in CPUGuidedFilter2D.cpp.
+\param a_outColor  - filtered image
+\param a_inColor   - noisy HDR image
+\param a_normDepth - normal (xyz) and depth (w) guide
+\param a_albedo    - albedo (xyz) guide, background pixels have albedo 1
+\param w, h        - image size
+\param a_windowRadius - search window radius
+\param a_strength     - expected relative noise level
+
+*/
+__kernel void GuidedNLMFilter(__global float4* a_outColor, __global const float4* a_inColor, __global const float4* a_normDepth, __global const float4* a_albedo,
+                              int w, int h, int a_windowRadius, float a_strength)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if (x >= w || y >= h)
+    return;
+
+  const int    r          = max(a_windowRadius, 1);
+  const float  invH2      = 1.0f / fmax(a_strength*a_strength, 1e-6f);
+  const float  invSpatial = 1.0f / (float)(2*r*r);
+
+  const float4 normDepth  = a_normDepth[y*w + x];
+  const float4 albedo     = a_albedo[y*w + x];
+  const bool   isBack     = (normDepth.w >= GUIDED_BACK_DEPTH);
+  const float  invDepth   = 1.0f / fmax(normDepth.w, 1e-4f);
+
+  const float4 c0         = demodulate(a_inColor[y*w + x], albedo);
+  const float  c0Norm     = dot3(c0, c0);
+
+  float4 result = make_float4(0, 0, 0, 0);
+  float  fSum   = 0.0f;
+
+  for (int y1 = max(y - r, 0); y1 <= min(y + r, h - 1); y1++)
+  {
+    for (int x1 = max(x - r, 0); x1 <= min(x + r, w - 1); x1++)
+    {
+      const float4 nd1 = a_normDepth[y1*w + x1];
+      if (isBack != (nd1.w >= GUIDED_BACK_DEPTH))
+        continue;
+
+      const float4 a1  = a_albedo[y1*w + x1];
+      float exponent   = (float)((x1 - x)*(x1 - x) + (y1 - y)*(y1 - y))*invSpatial;
+      if (!isBack)
+      {
+        const float4 aDif = a1 - albedo;
+        exponent += GUIDED_NORMAL_K*fmax(1.0f - dot3(normDepth, nd1), 0.0f);
+        exponent += GUIDED_DEPTH_K*fabs(nd1.w - normDepth.w)*invDepth;
+        exponent += GUIDED_ALBEDO_K*dot3(aDif, aDif);
+      }
+
+      if (exponent > GUIDED_MAX_EXPONENT)
+        continue;
+
+      float patchDist = 0.0f;
+      for (int py = -1; py <= 1; py++)
+      {
+        for (int px = -1; px <= 1; px++)
+        {
+          const float4 p0   = demodulate(fetchClamped(a_inColor, x  + px, y  + py, w, h), fetchClamped(a_albedo, x  + px, y  + py, w, h));
+          const float4 p1   = demodulate(fetchClamped(a_inColor, x1 + px, y1 + py, w, h), fetchClamped(a_albedo, x1 + px, y1 + py, w, h));
+          const float4 dist = p0 - p1;
+          patchDist += dot3(dist, dist);
+        }
+      }
+
+      const float4 c1 = demodulate(a_inColor[y1*w + x1], a1);
+      exponent += invH2*(patchDist / 9.0f) / (GUIDED_PATCH_EPS + c0Norm + dot3(c1, c1));
+
+      if (exponent > GUIDED_MAX_EXPONENT)
+        continue;
+
+      const float weight = exp(-exponent);
+      result += c1*weight;
+      fSum   += weight;
+    }
+  }
+
+  result = result*(1.0f / fmax(fSum, 1e-6f));
+
+  a_outColor[y*w + x] = make_float4(result.x*albedo.x, result.y*albedo.y, result.z*albedo.z, a_inColor[y*w + x].w);
+}
+
 // change 17.07.2017 17:48;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -502,7 +502,7 @@ __kernel void HitEnvOrLightKernel(__global const float4*    restrict in_rpos,
           else if (unpackBounceNum(flags) > 0 && !(a_globals->g_flags & HRT_STUPID_PT_MODE) && (misPrev.isSpecular == 0)) // old MIS weights via pdfW
           {
             const float lgtPdf    = lightPdfSelectRev(pLight)*lightEvalPDF(pLight, ray_pos, ray_dir, 
-                                                                           surfHit.pos, surfHit.normal, surfHit.texCoord, in_pdfStorage, a_globals);
+                                                                           surfHit.pos, surfHit.normal, surfHit.texCoord, liteHit.primId, in_pdfStorage, a_globals);
             const float bsdfPdf   = misPrev.matSamplePdf;
             const float misWeight = misWeightHeuristic(bsdfPdf, lgtPdf); // (bsdfPdf*bsdfPdf) / (lgtPdf*lgtPdf + bsdfPdf*bsdfPdf);
             emissColor *= misWeight;
@@ -1414,37 +1414,49 @@ __kernel void GetGBufferSample(__global const float4*    a_rdir,
   const float a_width  = a_globals->varsF[HRT_WIDTH_F];
   const float a_height = a_globals->varsF[HRT_HEIGHT_F];
 
-  // now find the biggest cluster and take it's sample as the result;
+  // now find the biggest cluster and take it's first sample as the result; 
+  // each sample is compared only with first samples of clusters, so this is linear in samples number
   //
   if (LOCAL_ID_X == 0)
   {
-    float minDiff   = 100000000.0f;
-    int   minDiffId = 0;
+    int clusterFirst[GBUFFER_CLUSTERS];
+    int clusterSize [GBUFFER_CLUSTERS];
+    int clustersNum = 0;
 
     for (int i = 0; i < GBUFFER_SAMPLES; i++)
     {
-      float diff = 0.0f;
-      float coverage = 0.0f;
-      for (int j = 0; j < GBUFFER_SAMPLES; j++)
+      int found = -1;
+      for (int c = 0; c < clustersNum; c++)
       {
-        const float thisDiff = gbuffDiff(samples[i], samples[j], a_fov, a_width, a_height);
-        diff += thisDiff;
-        if (thisDiff < 1.0f)
-          coverage += 1.0f;
+        if (gbuffDiff(samples[clusterFirst[c]], samples[i], a_fov, a_width, a_height) < 1.0f)
+        {
+          found = c;
+          break;
+        }
       }
 
-      coverage *= (1.0f / (float)GBUFFER_SAMPLES);
-      samples[i].data1.coverage = coverage;
-
-      if (diff < minDiff)
+      if (found >= 0)
+        clusterSize[found]++;
+      else if (clustersNum < GBUFFER_CLUSTERS)
       {
-        minDiff   = diff;
-        minDiffId = i;
+        clusterFirst[clustersNum] = i;
+        clusterSize [clustersNum] = 1;
+        clustersNum++;
       }
     }
 
-    out_gbuff1[tid / GBUFFER_SAMPLES] = packGBuffer1(samples[minDiffId].data1);
-    out_gbuff2[tid / GBUFFER_SAMPLES] = packGBuffer2(samples[minDiffId].data2);
+    int biggest = 0;
+    for (int c = 1; c < clustersNum; c++)
+    {
+      if (clusterSize[c] > clusterSize[biggest])
+        biggest = c;
+    }
+
+    const int resId = clusterFirst[biggest];
+    samples[resId].data1.coverage = (float)clusterSize[biggest] * (1.0f / (float)GBUFFER_SAMPLES);
+
+    out_gbuff1[tid / GBUFFER_SAMPLES] = packGBuffer1(samples[resId].data1);
+    out_gbuff2[tid / GBUFFER_SAMPLES] = packGBuffer2(samples[resId].data2);
   }
 
 }
@@ -1487,6 +1499,384 @@ __kernel void PutAlphaToGBuffer(__global const float4* restrict in_thoroughput,
 
 
 
+/**
+\brief Evaluate unshadowed direct light contribution of light sample (stored in primary sample space) for surface hit.
+\param pLight       - light that was selected for this sample
+\param a_rands      - rands that were passed to LightSampleRev
+\param a_pSurfHit   - surface hit we are going to lit
+\param a_rayDir     - camera ray direction
+\param pHitMaterial - surface material
+\param a_pPtl       - proc textures of surface hit
+\param a_pOutSam    - out light sample that was regenerated for this surface hit
+\return one sample estimate (light color * bxdf / light pdf) without light pick probability and without shadow
+
+*/
+static inline float3 DLReservoirEvalSample(__global const PlainLight* pLight, const float3 a_rands, __private const SurfaceHit* a_pSurfHit, const float3 a_rayDir,
+                                           __global const PlainMaterial* pHitMaterial, __private const ProcTextureList* a_pPtl,
+                                           __global const float4* in_texStorage1, __global const float4* in_texStorage2, __global const float4* in_pdfStorage,
+                                           __global const EngineGlobals* a_globals, 
+                                           __private ShadowSample* a_pOutSam)
+{
+  LightSampleRev(pLight, a_rands, a_pSurfHit->pos, a_globals, in_pdfStorage, in_texStorage1,
+                 a_pOutSam);
+
+  const float3 shadowRayDir = normalize(a_pOutSam->pos - a_pSurfHit->pos);
+
+  ShadeContext sc;
+  sc.wp  = a_pSurfHit->pos;
+  sc.l   = shadowRayDir;
+  sc.v   = (-1.0f)*a_rayDir;
+  sc.n   = a_pSurfHit->normal;
+  sc.fn  = a_pSurfHit->flatNormal;
+  sc.tg  = a_pSurfHit->tangent;
+  sc.bn  = a_pSurfHit->biTangent;
+  sc.tc  = a_pSurfHit->texCoord;
+  sc.hfi = a_pSurfHit->hfi;
+
+  const BxDFResult evalData = materialEval(pHitMaterial, &sc, EVAL_FLAG_DEFAULT, /* global data --> */ a_globals, in_texStorage1, in_texStorage2, a_pPtl);
+
+  const float cosThetaOut1 = fmax(+dot(shadowRayDir, a_pSurfHit->normal), 0.0f);
+  const float cosThetaOut2 = fmax(-dot(shadowRayDir, a_pSurfHit->normal), 0.0f);
+  const float3 bxdfVal     = (evalData.brdf*cosThetaOut1 + evalData.btdf*cosThetaOut2);
+
+  const float3 res = (a_pOutSam->color * (1.0f / fmax(a_pOutSam->pdf, DEPSILON)))*bxdfVal;
+  return (isfinite(res.x) && isfinite(res.y) && isfinite(res.z)) ? res : make_float3(0,0,0);
+}
+
+/**
+\brief Generate initial reservoirs from a_candidates light samples and merge them with reservoirs of previous frame.
+
+  Must be launched with one thread per pixel (tid == y*width + x) right after ComputeHit for primary rays.
+  Gbuffer is read (previous frame) and then overwritten (current frame) by the same thread.
+
+*/
+__kernel void DLReservoirsInitial(__global const float4*    restrict in_rpos,
+                                  __global const float4*    restrict in_rdir,
+                                  __global const uint*      restrict in_flags,
+                                  __global const float4*    restrict in_surfaceHit,
+                                  __global const float4*    restrict in_procTexData,
+                                  __global RandomGen*       restrict a_gens,
+
+                                  __global const float4*    restrict in_resPrev,   // may be 0 if there is no history
+                                  __global float4*          restrict a_gbuffer,
+                                  __global float4*          restrict out_res,
+
+                                  __global const float4*    restrict in_texStorage1,
+                                  __global const float4*    restrict in_texStorage2,
+                                  __global const float4*    restrict in_mtlStorage,
+                                  __global const float4*    restrict in_pdfStorage,
+                                  __global const EngineGlobals* restrict a_globals,
+                                  int a_candidates, int a_maxHistory, int iNumElements)
+{
+  int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  const uint flags = in_flags[tid];
+
+  GBuffer1 gbPrev = unpackGBuffer1(a_gbuffer[tid]);
+  GBuffer1 gbCurr;
+  gbCurr.depth    = 1e+6f;
+  gbCurr.norm     = make_float3(0, 0, 0);
+  gbCurr.rgba     = make_float4(0, 0, 0, 0);
+  gbCurr.matId    = -1;
+  gbCurr.coverage = 0.0f;
+
+  DLReservoir res;
+  InitDLReservoir(&res);
+
+  SurfaceHit surfHit;
+  ReadSurfaceHit(in_surfaceHit, tid, iNumElements, 
+                 &surfHit);
+
+  __global const PlainMaterial* pHitMaterial = materialAt(a_globals, in_mtlStorage, surfHit.matId);
+
+  if (!rayIsActiveU(flags) || pHitMaterial == 0 || a_globals->lightsNum == 0)
+  {
+    a_gbuffer[tid] = packGBuffer1(gbCurr);
+    WriteDLReservoir(&res, tid, iNumElements, 
+                     out_res);
+    return;
+  }
+
+  const float3 ray_pos = to_float3(in_rpos[tid]);
+  const float3 ray_dir = to_float3(in_rdir[tid]);
+
+  gbCurr.depth = length(surfHit.pos - ray_pos);
+  gbCurr.norm  = surfHit.normal;
+  gbCurr.matId = surfHit.matId;
+
+  ProcTextureList ptl;
+  InitProcTextureList(&ptl);
+  ReadProcTextureList(in_procTexData, tid, iNumElements,
+                      &ptl);
+
+  RandomGen gen = a_gens[tid];
+
+  // (1) resampled importance sampling of a_candidates light samples
+  //
+  for (int i = 0; i < a_candidates; i++)
+  {
+    const float4 rands  = rndFloat4_Pseudo(&gen);
+    const float  rndSel = rndFloat1_Pseudo(&gen);
+
+    float lightPickProb   = 1.0f;
+    const int lightOffset = SelectRandomLightRev(rands.w, surfHit.pos, a_globals,
+                                                 &lightPickProb);
+    if (lightOffset < 0)
+      continue;
+
+    __global const PlainLight* pLight = lightAt(a_globals, lightOffset);
+
+    ShadowSample explicitSam;
+    const float3 contrib   = DLReservoirEvalSample(pLight, to_float3(rands), &surfHit, ray_dir, pHitMaterial, &ptl,
+                                                   in_texStorage1, in_texStorage2, in_pdfStorage, a_globals, 
+                                                   &explicitSam);
+    const float targetPdf  = contribFunc(contrib);
+
+    UpdateDLReservoir(&res, to_float3(rands), lightOffset, targetPdf / fmax(lightPickProb, DEPSILON2), targetPdf, rndSel);
+  }
+
+  res.M = (float)a_candidates;
+  FinalizeDLReservoir(&res);
+
+  // (2) temporal reuse; reservoir of previous frame is reevaluated at current surface point
+  //
+  if (in_resPrev != 0 && gbuffSimilarForReuse(gbCurr, gbPrev))
+  {
+    DLReservoir prev;
+    ReadDLReservoir(in_resPrev, tid, iNumElements,
+                    &prev);
+
+    prev.M = fmin(prev.M, (float)(a_maxHistory*a_candidates));
+
+    if (prev.lightOffset >= 0 && prev.W > 0.0f)
+    {
+      __global const PlainLight* pLight = lightAt(a_globals, prev.lightOffset);
+
+      ShadowSample explicitSam;
+      const float3 contrib  = DLReservoirEvalSample(pLight, prev.rands, &surfHit, ray_dir, pHitMaterial, &ptl,
+                                                    in_texStorage1, in_texStorage2, in_pdfStorage, a_globals, 
+                                                    &explicitSam);
+      const float targetPdf = contribFunc(contrib);
+
+      UpdateDLReservoir(&res, prev.rands, prev.lightOffset, targetPdf*prev.W*prev.M, targetPdf, rndFloat1_Pseudo(&gen));
+    }
+
+    res.M += prev.M;
+    FinalizeDLReservoir(&res);
+  }
+
+  a_gens[tid]    = gen;
+  a_gbuffer[tid] = packGBuffer1(gbCurr);
+  WriteDLReservoir(&res, tid, iNumElements, 
+                   out_res);
+}
+
+/**
+\brief Merge reservoir of each pixel with a_taps random neighbours in a_radius and generate the only shadow ray for the final sample.
+
+  Must be launched with one thread per pixel (tid == y*width + x).
+
+*/
+__kernel void DLReservoirsSpatial(__global const float4*    restrict in_rpos,
+                                  __global const float4*    restrict in_rdir,
+                                  __global const uint*      restrict in_flags,
+                                  __global const float4*    restrict in_surfaceHit,
+                                  __global const float4*    restrict in_procTexData,
+                                  __global RandomGen*       restrict a_gens,
+
+                                  __global const float4*    restrict in_gbuffer,
+                                  __global const float4*    restrict in_res,
+                                  __global float4*          restrict out_res,
+
+                                  __global float4*          restrict out_srpos,
+                                  __global float4*          restrict out_srdir,
+
+                                  __global const float4*    restrict in_texStorage1,
+                                  __global const float4*    restrict in_texStorage2,
+                                  __global const float4*    restrict in_mtlStorage,
+                                  __global const float4*    restrict in_pdfStorage,
+                                  __global const EngineGlobals* restrict a_globals,
+                                  int a_taps, float a_radius, int a_width, int a_height, int iNumElements)
+{
+  int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  DLReservoir center;
+  ReadDLReservoir(in_res, tid, iNumElements,
+                  &center);
+
+  const uint flags = in_flags[tid];
+  if (!rayIsActiveU(flags))
+  {
+    WriteDLReservoir(&center, tid, iNumElements, 
+                     out_res);
+    return;
+  }
+
+  SurfaceHit surfHit;
+  ReadSurfaceHit(in_surfaceHit, tid, iNumElements, 
+                 &surfHit);
+
+  __global const PlainMaterial* pHitMaterial = materialAt(a_globals, in_mtlStorage, surfHit.matId);
+  if (pHitMaterial == 0 || a_globals->lightsNum == 0)
+  {
+    WriteDLReservoir(&center, tid, iNumElements, 
+                     out_res);
+    return;
+  }
+
+  const float3 ray_dir = to_float3(in_rdir[tid]);
+  const GBuffer1 gbCenter = unpackGBuffer1(in_gbuffer[tid]);
+
+  ProcTextureList ptl;
+  InitProcTextureList(&ptl);
+  ReadProcTextureList(in_procTexData, tid, iNumElements,
+                      &ptl);
+
+  RandomGen gen = a_gens[tid];
+
+  // (1) center reservoir; its target function was already evaluated at this pixel
+  //
+  DLReservoir res;
+  InitDLReservoir(&res);
+  UpdateDLReservoir(&res, center.rands, center.lightOffset, center.targetPdf*center.W*center.M, center.targetPdf, rndFloat1_Pseudo(&gen));
+  res.M = center.M;
+
+  // (2) neighbours
+  //
+  const int y = tid / a_width;
+  const int x = tid - y*a_width;
+
+  for (int i = 0; i < a_taps; i++)
+  {
+    const float4 rands = rndFloat4_Pseudo(&gen);
+    const float  r     = a_radius*sqrt(rands.x);
+    const float  phi   = 2.0f*M_PI*rands.y;
+    const int    nx    = x + (int)(r*cos(phi));
+    const int    ny    = y + (int)(r*sin(phi));
+
+    if (nx < 0 || ny < 0 || nx >= a_width || ny >= a_height || (nx == x && ny == y))
+      continue;
+
+    const int nid = ny*a_width + nx;
+    if (!gbuffSimilarForReuse(gbCenter, unpackGBuffer1(in_gbuffer[nid])))
+      continue;
+
+    DLReservoir neighbour;
+    ReadDLReservoir(in_res, nid, iNumElements,
+                    &neighbour);
+
+    if (neighbour.lightOffset >= 0 && neighbour.W > 0.0f)
+    {
+      __global const PlainLight* pLight = lightAt(a_globals, neighbour.lightOffset);
+
+      ShadowSample explicitSam;
+      const float3 contrib  = DLReservoirEvalSample(pLight, neighbour.rands, &surfHit, ray_dir, pHitMaterial, &ptl,
+                                                    in_texStorage1, in_texStorage2, in_pdfStorage, a_globals, 
+                                                    &explicitSam);
+      const float targetPdf = contribFunc(contrib);
+
+      UpdateDLReservoir(&res, neighbour.rands, neighbour.lightOffset, targetPdf*neighbour.W*neighbour.M, targetPdf, rands.z);
+    }
+
+    res.M += neighbour.M;
+  }
+
+  FinalizeDLReservoir(&res);
+
+  a_gens[tid] = gen;
+  WriteDLReservoir(&res, tid, iNumElements, 
+                   out_res);
+
+  // (3) generate the only shadow ray for selected sample
+  //
+  if (res.lightOffset >= 0)
+  {
+    __global const PlainLight* pLight = lightAt(a_globals, res.lightOffset);
+
+    ShadowSample explicitSam;
+    LightSampleRev(pLight, res.rands, surfHit.pos, a_globals, in_pdfStorage, in_texStorage1,
+                   &explicitSam);
+
+    const float3 shadowRayDir = normalize(explicitSam.pos - surfHit.pos);
+    const float3 shadowRayPos = OffsShadowRayPos(surfHit.pos, surfHit.normal, shadowRayDir, surfHit.sRayOff);
+    const float  maxDist      = length(shadowRayPos - explicitSam.pos)*lightShadowRayMaxDistScale(pLight);
+
+    out_srpos[tid] = to_float4(shadowRayPos, maxDist);
+    out_srdir[tid] = to_float4(shadowRayDir, as_float(-1));
+  }
+  else
+  {
+    out_srpos[tid] = to_float4(surfHit.pos, 0.0f);
+    out_srdir[tid] = make_float4(0.0f, 0.0f, 1.0f, as_float(-1));
+  }
+}
+
+/**
+\brief Final direct light shading with resampled light sample; add result to a_color.
+
+*/
+__kernel void DLReservoirsShade(__global const float4*    restrict in_rdir,
+                                __global const uint*      restrict in_flags,
+                                __global const float4*    restrict in_surfaceHit,
+                                __global const float4*    restrict in_procTexData,
+                                __global const float4*    restrict in_res,
+                                __global const ushort4*   restrict in_shadow,
+                                __global float4*          restrict a_color,
+
+                                __global const float4*    restrict in_texStorage1,
+                                __global const float4*    restrict in_texStorage2,
+                                __global const float4*    restrict in_mtlStorage,
+                                __global const float4*    restrict in_pdfStorage,
+                                __global const EngineGlobals* restrict a_globals,
+                                int iNumElements)
+{
+  int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  const uint flags = in_flags[tid];
+  if (!rayIsActiveU(flags) || a_globals->lightsNum == 0)
+    return;
+
+  DLReservoir res;
+  ReadDLReservoir(in_res, tid, iNumElements,
+                  &res);
+
+  if (res.lightOffset < 0 || res.W <= 0.0f)
+    return;
+
+  SurfaceHit surfHit;
+  ReadSurfaceHit(in_surfaceHit, tid, iNumElements, 
+                 &surfHit);
+
+  __global const PlainMaterial* pHitMaterial = materialAt(a_globals, in_mtlStorage, surfHit.matId);
+  if (pHitMaterial == 0)
+    return;
+
+  ProcTextureList ptl;
+  InitProcTextureList(&ptl);
+  ReadProcTextureList(in_procTexData, tid, iNumElements,
+                      &ptl);
+
+  __global const PlainLight* pLight = lightAt(a_globals, res.lightOffset);
+
+  ShadowSample explicitSam;
+  const float3 contrib = DLReservoirEvalSample(pLight, res.rands, &surfHit, to_float3(in_rdir[tid]), pHitMaterial, &ptl,
+                                               in_texStorage1, in_texStorage2, in_pdfStorage, a_globals, 
+                                               &explicitSam);
+
+  const float3 shadow     = decompressShadow(in_shadow[tid]);
+  const float3 shadeColor = contrib*shadow*res.W;
+
+  const float4 oldColor = a_color[tid];
+  a_color[tid]          = make_float4(oldColor.x + shadeColor.x, oldColor.y + shadeColor.y, oldColor.z + shadeColor.z, oldColor.w);
+}
+
+
 // change 31.08.2018 13:55;
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
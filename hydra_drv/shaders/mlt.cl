@@ -201,6 +201,81 @@ inline int TabIndex(const int vertId, const int tid, const int iNumElements)
   return tid + vertId*iNumElements;
 }
 
+/**
+\brief Head of MMLT vector (lens, light and split) in compressed form; see MMLT_HEAD_COMPRESSED_SIZE.
+
+*/
+typedef struct MMLTHeadT
+{
+  float4 lens;   ///< screen x, screen y, dof x, dof y
+  float4 lsam1;  ///< MMLT_DIM_LGT_X .. MMLT_DIM_LGT_W
+  float2 lsam2;  ///< MMLT_DIM_LGT_X1, MMLT_DIM_LGT_Y1
+  float  lsamN;  ///< light selector
+  float  split;
+
+} MMLTHead;
+
+static inline uint4 MMLTReadWords4(__global const float* restrict in_numbers, int a_offset, int tid, int iNumElements)
+{
+  uint4 res;
+  res.x = as_int( in_numbers[TabIndex(a_offset + 0, tid, iNumElements)] );
+  res.y = as_int( in_numbers[TabIndex(a_offset + 1, tid, iNumElements)] );
+  res.z = as_int( in_numbers[TabIndex(a_offset + 2, tid, iNumElements)] );
+  res.w = as_int( in_numbers[TabIndex(a_offset + 3, tid, iNumElements)] );
+  return res;
+}
+
+static inline void MMLTWriteWords4(uint4 a_data, int a_offset, int tid, int iNumElements, __global float* restrict out_numbers)
+{
+  out_numbers[TabIndex(a_offset + 0, tid, iNumElements)] = as_float(a_data.x);
+  out_numbers[TabIndex(a_offset + 1, tid, iNumElements)] = as_float(a_data.y);
+  out_numbers[TabIndex(a_offset + 2, tid, iNumElements)] = as_float(a_data.z);
+  out_numbers[TabIndex(a_offset + 3, tid, iNumElements)] = as_float(a_data.w);
+}
+
+static inline float4 MMLTReadLens(__global const float* restrict in_numbers, int tid, int iNumElements)
+{
+  const float6_gr gr = unpackBounceGroup(MMLTReadWords4(in_numbers, 0, tid, iNumElements));
+  return make_float4(gr.group24.x, gr.group24.y, gr.group16.x, gr.group16.y);
+}
+
+static inline LightGroup2 MMLTReadLight(__global const float* restrict in_numbers, int tid, int iNumElements)
+{
+  const float6_gr gr1 = unpackBounceGroup(MMLTReadWords4(in_numbers, 0, tid, iNumElements));
+  const float6_gr gr2 = unpackBounceGroup(MMLTReadWords4(in_numbers, 4, tid, iNumElements));
+
+  LightGroup2 res;
+  res.group1 = make_float4(gr1.group24.z, gr1.group24.w, gr2.group24.x, gr2.group24.y);
+  res.group2 = make_float3(gr2.group24.z, gr2.group24.w, gr2.group16.x);
+  return res;
+}
+
+static inline MMLTHead MMLTReadHead(__global const float* restrict in_numbers, int tid, int iNumElements)
+{
+  const float6_gr gr1 = unpackBounceGroup(MMLTReadWords4(in_numbers, 0, tid, iNumElements));
+  const float6_gr gr2 = unpackBounceGroup(MMLTReadWords4(in_numbers, 4, tid, iNumElements));
+
+  MMLTHead res;
+  res.lens  = make_float4(gr1.group24.x, gr1.group24.y, gr1.group16.x, gr1.group16.y);
+  res.lsam1 = make_float4(gr1.group24.z, gr1.group24.w, gr2.group24.x, gr2.group24.y);
+  res.lsam2 = make_float2(gr2.group24.z, gr2.group24.w);
+  res.lsamN = gr2.group16.x;
+  res.split = gr2.group16.y;
+  return res;
+}
+
+static inline void MMLTWriteHead(const MMLTHead* a_head, int tid, int iNumElements, __global float* restrict out_numbers)
+{
+  float6_gr gr1, gr2;
+  gr1.group24 = make_float4(a_head->lens.x,  a_head->lens.y,  a_head->lsam1.x, a_head->lsam1.y);
+  gr1.group16 = make_float2(a_head->lens.z,  a_head->lens.w);
+  gr2.group24 = make_float4(a_head->lsam1.z, a_head->lsam1.w, a_head->lsam2.x, a_head->lsam2.y);
+  gr2.group16 = make_float2(a_head->lsamN,   a_head->split);
+
+  MMLTWriteWords4(packBounceGroup(gr1), 0, tid, iNumElements, out_numbers);
+  MMLTWriteWords4(packBounceGroup(gr2), 4, tid, iNumElements, out_numbers);
+}
+
 __kernel void MMLTAcceptReject(__global       float*         restrict a_xVector,
                                __global const float*         restrict a_yVector,
                                __global       float4*        restrict a_xColor,
@@ -248,12 +323,12 @@ __kernel void MMLTAcceptReject(__global       float*         restrict a_xVector,
   {
     a_xColor[tid] = yNewColor;
     
-    for(int i=0;i<MMLT_HEAD_TOTAL_SIZE;i++)
+    for(int i=0;i<MMLT_HEAD_COMPRESSED_SIZE;i++)
       a_xVector[TabIndex(i, tid, iNumElements)] = a_yVector[TabIndex(i, tid, iNumElements)];
     
     for(int bounce = 0; bounce < a_maxBounce; bounce++)
     {
-      const int bounceOffset = MMLT_HEAD_TOTAL_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
+      const int bounceOffset = MMLT_HEAD_COMPRESSED_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
       
       a_xVector[TabIndex(bounceOffset + 0, tid, iNumElements)] = a_yVector[TabIndex(bounceOffset + 0, tid, iNumElements)];
       a_xVector[TabIndex(bounceOffset + 1, tid, iNumElements)] = a_yVector[TabIndex(bounceOffset + 1, tid, iNumElements)];
@@ -360,117 +435,74 @@ __kernel void MMLTMakeProposal(__global int2*            restrict a_split,
 
   // gen head first
   //
-  
-  // lens
+  MMLTHead head;
+  if(largeStep)
   {
-    float4 lensOffs; 
-    
-    if(largeStep)
-    {
-      lensOffs = rndFloat4_Pseudo(&gen);
-    }
-    else if(in_numbers != 0)
+    head.lens  = rndFloat4_Pseudo(&gen);
+    head.lsam1 = rndFloat4_Pseudo(&gen);
+    head.lsam2 = rndFloat2_Pseudo(&gen);
+    head.lsamN = rndFloat1_Pseudo(&gen);
+    head.split = rndFloat1_Pseudo(&gen);
+  }
+  else if(in_numbers != 0)
+  {
+    head = MMLTReadHead(in_numbers, tid, iNumElements);
+
+    const float power = a_globals->varsF[HRT_MMLT_STEP_SIZE_POWER];
+    const float coeff = a_globals->varsF[HRT_MMLT_STEP_SIZE_COEFF];
+
+    // lens
+    //
+    if(smallStepType & MUTATE_CAMERA)
     {
       const float screenScaleX = a_globals->varsF[HRT_MLT_SCREEN_SCALE_X]; // #NOTE: be sure these variables are not zero !!! 
       const float screenScaleY = a_globals->varsF[HRT_MLT_SCREEN_SCALE_Y]; // #NOTE: be sure these variables are not zero !!! 
 
-      lensOffs.x = in_numbers[ TabIndex(MMLT_DIM_SCR_X, tid, iNumElements) ];
-      lensOffs.y = in_numbers[ TabIndex(MMLT_DIM_SCR_Y, tid, iNumElements) ];
-      lensOffs.z = in_numbers[ TabIndex(MMLT_DIM_DOF_X, tid, iNumElements) ];
-      lensOffs.w = in_numbers[ TabIndex(MMLT_DIM_DOF_Y, tid, iNumElements) ];
-      
-      if(smallStepType & MUTATE_CAMERA)
-      {
-        const float power = a_globals->varsF[HRT_MMLT_STEP_SIZE_POWER];
-        const float coeff = a_globals->varsF[HRT_MMLT_STEP_SIZE_COEFF];
-
-        lensOffs.x = MutateKelemen(lensOffs.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_SCREEN*screenScaleX, 1024.0f);
-        lensOffs.y = MutateKelemen(lensOffs.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_SCREEN*screenScaleY, 1024.0f);
-        lensOffs.z = MutateKelemen(lensOffs.z, rndFloat2_Pseudo(&gen), MUTATE_COEFF_BSDF, 1024.0f);
-        lensOffs.w = MutateKelemen(lensOffs.w, rndFloat2_Pseudo(&gen), MUTATE_COEFF_BSDF, 1024.0f);
-      }
+      head.lens.x = MutateKelemen(head.lens.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_SCREEN*screenScaleX, 1024.0f);
+      head.lens.y = MutateKelemen(head.lens.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_SCREEN*screenScaleY, 1024.0f);
+      head.lens.z = MutateKelemen(head.lens.z, rndFloat2_Pseudo(&gen), MUTATE_COEFF_BSDF, 1024.0f);
+      head.lens.w = MutateKelemen(head.lens.w, rndFloat2_Pseudo(&gen), MUTATE_COEFF_BSDF, 1024.0f);
     }
-    
-    if(out_numbers != 0)
+
+    // light
+    //
+    if(smallStepType & MUTATE_LIGHT)
     {
-      out_numbers[ TabIndex(MMLT_DIM_SCR_X, tid, iNumElements) ] = lensOffs.x;
-      out_numbers[ TabIndex(MMLT_DIM_SCR_Y, tid, iNumElements) ] = lensOffs.y;
-      out_numbers[ TabIndex(MMLT_DIM_DOF_X, tid, iNumElements) ] = lensOffs.z;
-      out_numbers[ TabIndex(MMLT_DIM_DOF_Y, tid, iNumElements) ] = lensOffs.w;
+      head.lsam1.x = MutateKelemen(head.lsam1.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
+      head.lsam1.y = MutateKelemen(head.lsam1.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
+      head.lsam1.z = MutateKelemen(head.lsam1.z, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
+      head.lsam1.w = MutateKelemen(head.lsam1.w, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
+      head.lsam2.x = MutateKelemen(head.lsam2.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
+      head.lsam2.y = MutateKelemen(head.lsam2.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power); 
+      
+      //#NOTE: do not mutate lsamN !!!
+      //#NOTE: do not mutate split !!!
     }
   }
 
-  // light, split
+  // split
   //
   int d,s;
   {
-    float4 lsam1; float2 lsam2; float lsamN; float split;
-    if(largeStep)
-    {
-      lsam1 = rndFloat4_Pseudo(&gen);
-      lsam2 = rndFloat2_Pseudo(&gen);
-      lsamN = rndFloat1_Pseudo(&gen);
-      split = rndFloat1_Pseudo(&gen);
-    }
-    else if(in_numbers != 0)
-    {
-      lsam1.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X, tid, iNumElements) ];
-      lsam1.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y, tid, iNumElements) ];
-      lsam1.z = in_numbers[ TabIndex(MMLT_DIM_LGT_Z, tid, iNumElements) ];
-      lsam1.w = in_numbers[ TabIndex(MMLT_DIM_LGT_W, tid, iNumElements) ];
-
-      lsam2.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X1, tid, iNumElements) ];
-      lsam2.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y1, tid, iNumElements) ];
-      lsamN   = in_numbers[ TabIndex(MMLT_DIM_LGT_N,  tid, iNumElements) ];
-      split   = in_numbers[ TabIndex(MMLT_DIM_SPLIT,  tid, iNumElements) ];
-   
-      if(smallStepType & MUTATE_LIGHT)
-      {
-        const float power = a_globals->varsF[HRT_MMLT_STEP_SIZE_POWER];
-        const float coeff = a_globals->varsF[HRT_MMLT_STEP_SIZE_COEFF];
-
-        lsam1.x = MutateKelemen(lsam1.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
-        lsam1.y = MutateKelemen(lsam1.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
-        lsam1.z = MutateKelemen(lsam1.z, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
-        lsam1.w = MutateKelemen(lsam1.w, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
-        lsam2.x = MutateKelemen(lsam2.x, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power);
-        lsam2.y = MutateKelemen(lsam2.y, rndFloat2_Pseudo(&gen), coeff*MUTATE_COEFF_BSDF, power); 
-      
-        //#NOTE: do not mutate lsamN !!!
-        //#NOTE: do not mutate split !!!
-      }
-    }
-
     const int2 oldSplit = a_split[tid];
-    d  = oldSplit.x;                    // MMLT_GPU_TEST_DEPTH;
-    s  = mapRndFloatToInt(split, 0, d); //(split, d, a_globals->varsF[HRT_MMLT_IMPLICIT_FIXED_PROB]); // mapRndFloatToInt(split, 0, d); 
+    d  = oldSplit.x;                         // MMLT_GPU_TEST_DEPTH;
+    s  = mapRndFloatToInt(head.split, 0, d); //(split, d, a_globals->varsF[HRT_MMLT_IMPLICIT_FIXED_PROB]); // mapRndFloatToInt(split, 0, d); 
 
     #ifdef SBDPT_DEBUG_SPLIT
     s = SBDPT_DEBUG_SPLIT;
     #endif
 
     a_split[tid] = make_int2(d,s);
-
-    if(out_numbers != 0)
-    {
-      out_numbers[TabIndex(MMLT_DIM_LGT_X, tid, iNumElements)]  = lsam1.x;
-      out_numbers[TabIndex(MMLT_DIM_LGT_Y, tid, iNumElements)]  = lsam1.y;
-      out_numbers[TabIndex(MMLT_DIM_LGT_Z, tid, iNumElements)]  = lsam1.z;
-      out_numbers[TabIndex(MMLT_DIM_LGT_W, tid, iNumElements)]  = lsam1.w;
-
-      out_numbers[TabIndex(MMLT_DIM_LGT_X1, tid, iNumElements)] = lsam2.x;
-      out_numbers[TabIndex(MMLT_DIM_LGT_Y1, tid, iNumElements)] = lsam2.y;
-      out_numbers[TabIndex(MMLT_DIM_LGT_N,  tid, iNumElements)] = lsamN;
-      out_numbers[TabIndex(MMLT_DIM_SPLIT,  tid, iNumElements)] = split;
-    }
-
   }
 
+  if(out_numbers != 0)
+    MMLTWriteHead(&head, tid, iNumElements, out_numbers);
+
   // gen tail (bounces) next
   //
   for(int bounce = 0; bounce < a_maxBounce; bounce++)
   {
-    const int bounceOffset = MMLT_HEAD_TOTAL_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
+    const int bounceOffset = MMLT_HEAD_COMPRESSED_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
    
     float6_gr gr1f;
     float4    gr2f;
@@ -636,7 +668,7 @@ __kernel void KMLTMakeProposal(__global const RandomGen* restrict in_gens,
 static inline MMLTReadMaterialBounceRands(__global const float* restrict in_numbers, int bounce, int tid, int iNumElements,
                                           __private float a_out[MMLT_FLOATS_PER_BOUNCE])
 {
-  const int bounceOffset = MMLT_HEAD_TOTAL_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
+  const int bounceOffset = MMLT_HEAD_COMPRESSED_SIZE + MMLT_COMPRESSED_F_PERB*bounce;
 
   uint4 gr1; uint2 gr2;
   gr1.x = as_int( in_numbers[TabIndex(bounceOffset + 0, tid, iNumElements)] );
@@ -678,11 +710,7 @@ __kernel void MMLTMakeEyeRays(__global const float*         restrict in_numbers,
   //const int2 sortedIndex = in_zind[tid];
   //const float4 lensOffs  = in_samples[sortedIndex.y]; 
   
-  float4 lensOffs;
-  lensOffs.x = in_numbers[ TabIndex(MMLT_DIM_SCR_X, tid, iNumElements) ];
-  lensOffs.y = in_numbers[ TabIndex(MMLT_DIM_SCR_Y, tid, iNumElements) ];
-  lensOffs.z = in_numbers[ TabIndex(MMLT_DIM_DOF_X, tid, iNumElements) ];
-  lensOffs.w = in_numbers[ TabIndex(MMLT_DIM_DOF_Y, tid, iNumElements) ];
+  const float4 lensOffs = MMLTReadLens(in_numbers, tid, iNumElements);
 
   //if(MCMC_LAZY == 1) // #TODO: implement mutate here
   //{
@@ -1088,14 +1116,7 @@ __kernel void MMLTLightSampleForward(__global   float4*        restrict a_rpos,
   /////////////////////////////////////////////////// #TODO: sample if (lightTraceDepth != 0); else return immediately
   //
   
-  LightGroup2 lightRands;  
-  lightRands.group1.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X, tid, iNumElements) ];
-  lightRands.group1.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y, tid, iNumElements) ];
-  lightRands.group1.z = in_numbers[ TabIndex(MMLT_DIM_LGT_Z, tid, iNumElements) ];
-  lightRands.group1.w = in_numbers[ TabIndex(MMLT_DIM_LGT_W, tid, iNumElements) ];
-  lightRands.group2.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X1,tid, iNumElements) ];
-  lightRands.group2.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y1,tid, iNumElements) ];
-  lightRands.group2.z = in_numbers[ TabIndex(MMLT_DIM_LGT_N, tid, iNumElements) ]; 
+  const LightGroup2 lightRands = MMLTReadLight(in_numbers, tid, iNumElements);
   
   float lightPickProb = 1.0f;
   const int lightId = SelectRandomLightFwd(lightRands.group2.z, a_globals,
@@ -1409,14 +1430,7 @@ __kernel void MMLTMakeShadowRay(__global const int2  *  restrict in_splitInfo,
     }
     else if (lightTraceDepth == 0)  // (3.3) connect camera vertex to light (shadow ray)
     {
-      LightGroup2 lightSelector;
-      lightSelector.group1.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X, tid, iNumElements) ];
-      lightSelector.group1.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y, tid, iNumElements) ];
-      lightSelector.group1.z = in_numbers[ TabIndex(MMLT_DIM_LGT_Z, tid, iNumElements) ];
-      lightSelector.group1.w = in_numbers[ TabIndex(MMLT_DIM_LGT_W, tid, iNumElements) ];
-      lightSelector.group2.x = in_numbers[ TabIndex(MMLT_DIM_LGT_X1,tid, iNumElements) ];
-      lightSelector.group2.y = in_numbers[ TabIndex(MMLT_DIM_LGT_Y1,tid, iNumElements) ];
-      lightSelector.group2.z = in_numbers[ TabIndex(MMLT_DIM_LGT_N, tid, iNumElements) ]; 
+      const LightGroup2 lightSelector = MMLTReadLight(in_numbers, tid, iNumElements);
 
       if (cv.valid && !wasSpecularOnly) // cv.wasSpecOnly exclude direct light actually
       {
@@ -133,8 +133,8 @@ __kernel void MakeEyeRaysQMC(__global RandomGen*           restrict out_gens,
   RandomGen gen             = out_gens[tid];
   const float2 mutateScale  = make_float2(a_globals->varsF[HRT_MLT_SCREEN_SCALE_X], a_globals->varsF[HRT_MLT_SCREEN_SCALE_Y]);
   const unsigned int qmcPos = tid + a_passNumberForQmc * a_size;
-  const float4 lensOffs     = rndLens(&gen, 0, mutateScale, 
-                                      a_globals->rmQMC, qmcPos, a_qmcTable);
+  const float4 lensOffs     = cropLensSample(rndLens(&gen, 0, mutateScale, 
+                                                     a_globals->rmQMC, qmcPos, a_qmcTable), a_globals);
 
   const float fwidth        = a_globals->varsF[HRT_WIDTH_F];
   const float fheight       = a_globals->varsF[HRT_HEIGHT_F];
@@ -176,7 +176,11 @@ __kernel void MakeEyeRaysQMC(__global RandomGen*           restrict out_gens,
     int top = 8;
     for(int lightB=1; lightB < a_globals->varsI[HRT_KMLT_OR_QMC_LGT_BOUNCES]; lightB += 4)
     {
-      const float4 data = rndFloat4_Pseudo(&gen);
+      float4 data;
+      data.x = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_LGT_0, lightB, a_qmcTable);
+      data.y = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_LGT_1, lightB, a_qmcTable);
+      data.z = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_LGT_2, lightB, a_qmcTable);
+      data.w = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_LGT_N, lightB, a_qmcTable);
       out_samples[vecSize*tid + top + 0] = data.x;
       out_samples[vecSize*tid + top + 1] = data.y;
       out_samples[vecSize*tid + top + 2] = data.z;
@@ -214,6 +218,10 @@ __kernel void MakeEyeRaysQMC(__global RandomGen*           restrict out_gens,
       gr1f.group16 = rndFloat2_Pseudo(&gen);
       float4  gr2f = rndFloat4_Pseudo(&gen);
 
+      gr1f.group24.x  = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_MAT_0, matB, a_qmcTable); // padded sequence instead of pseudo random for deep bounces
+      gr1f.group24.y  = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_MAT_1, matB, a_qmcTable);
+      gr1f.group24.w  = rndQmcTabPadded(&gen, a_globals->rmQMC, qmcPos, QMC_VAR_MAT_L, matB, a_qmcTable);
+
       uint4 gr1 = packBounceGroup(gr1f);
       uint2 gr2 = packBounceGroup2(gr2f);
 
@@ -248,8 +256,8 @@ __kernel void MakeEyeRaysSamplesOnly(__global RandomGen*           restrict out_
   RandomGen gen             = out_gens[tid];
   const float2 mutateScale  = make_float2(a_globals->varsF[HRT_MLT_SCREEN_SCALE_X], a_globals->varsF[HRT_MLT_SCREEN_SCALE_Y]);
   const unsigned int qmcPos = tid + a_passNumberForQmc * a_size;
-  const float4 lensOffs     = rndLens(&gen, 0, mutateScale, 
-                                      a_globals->rmQMC, qmcPos, a_qmcTable);
+  const float4 lensOffs     = cropLensSample(rndLens(&gen, 0, mutateScale, 
+                                                     a_globals->rmQMC, qmcPos, a_qmcTable), a_globals);
   out_gens[tid]             = gen;
 
   const float fwidth        = a_globals->varsF[HRT_WIDTH_F];
@@ -326,6 +334,86 @@ __kernel void MakeEyeRaysUnifiedSampling(__global float4*              restrict
   out_packXY[tid] = packXY1616(x, y);
 }
 
+/**
+\brief Same as MakeEyeRaysSamplesOnly, but samples go over pixels of crop window in scanline order, pass after pass, 
+       and subpixel and lens offsets are taken from blue noise rank-1 sequence (rndBlueNoiseLens). 
+
+*/
+__kernel void MakeEyeRaysSamplesBlueNoise(__global float4*              restrict out_samples,
+                                          __global int2*                restrict out_zind,
+                                          __global const EngineGlobals* restrict a_globals,
+                                          __constant ushort*            restrict a_mortonTable256,
+                                          __global const float*         restrict a_blueNoise,
+                                          int a_passNumber, int w, int h, int a_size)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= a_size)
+    return;
+
+  const int4 crop = cropWindowPixels(a_globals->varsF[HRT_CROP_MIN_X], a_globals->varsF[HRT_CROP_MIN_Y], 
+                                     a_globals->varsF[HRT_CROP_MAX_X], a_globals->varsF[HRT_CROP_MAX_Y], w, h);
+
+  const int   cropW     = crop.z - crop.x;
+  const ulong pixelsNum = (ulong)(cropW*(crop.w - crop.y));
+  const ulong linearId  = (ulong)a_passNumber*(ulong)a_size + (ulong)tid;
+  const int   pixelId   = (int)(linearId % pixelsNum);
+  const int   y         = crop.y + pixelId / cropW;
+  const int   x         = crop.x + pixelId % cropW;
+
+  const float4 rnd = rndBlueNoiseLens(x, y, (unsigned int)(linearId / pixelsNum), a_blueNoise);
+
+  float4 lensOffs;
+  lensOffs.x = (rnd.x + (float)x) / (float)w;
+  lensOffs.y = (rnd.y + (float)y) / (float)h;
+  lensOffs.z = rnd.z;
+  lensOffs.w = rnd.w;
+
+  int2 indexToSort;
+  indexToSort.x = ZIndex(x, y, a_mortonTable256);
+  indexToSort.y = tid;
+
+  out_samples[tid] = lensOffs;
+  out_zind   [tid] = indexToSort;
+}
+
+/**
+\brief Generate exactly one jittered eye ray per pixel; tid == y*w + x. Used by direct light reservoirs which need stable pixel <--> thread mapping.
+
+*/
+__kernel void MakeEyeRaysPerPixel(__global float4*              restrict out_pos, 
+                                  __global float4*              restrict out_dir, 
+                                  __global int*                 restrict out_packXY,
+                                  __global RandomGen*           restrict out_gens,
+                                  int w, int h,
+                                  __global const EngineGlobals* restrict a_globals)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= w*h)
+    return;
+
+  const int y = tid / w;
+  const int x = tid - y*w;
+
+  RandomGen gen     = out_gens[tid];
+  const float4 rnd  = rndFloat4_Pseudo(&gen);
+  out_gens[tid]     = gen;
+
+  float4 lensOffs;
+  lensOffs.x = (rnd.x + (float)x) / (float)w;
+  lensOffs.y = (rnd.y + (float)y) / (float)h;
+  lensOffs.z = rnd.z;
+  lensOffs.w = rnd.w;
+
+  float  fx, fy;
+  float3 ray_pos, ray_dir;
+  MakeEyeRayFromF4Rnd(lensOffs, a_globals,
+                      &ray_pos, &ray_dir, &fx, &fy);
+
+  out_pos   [tid] = to_float4(ray_pos, fx);
+  out_dir   [tid] = to_float4(ray_dir, fy);
+  out_packXY[tid] = packXY1616(x, y);
+}
+
 __kernel void ClearAllInternalTempBuffers(__global uint*      restrict out_flags,
                                           __global float4*    restrict out_color,
                                           __global float4*    restrict out_thoroughput,
@@ -354,6 +442,36 @@ __kernel void ClearAllInternalTempBuffers(__global uint*      restrict out_flags
 }
 
 
+/**
+\brief Splat samples with packed pixel index in color.w (x in low 16 bits, y in high 16 bits) to device accumulation image with float atomics.
+       Zero samples are skipped; MLT rejects many proposals, so a lot of them have zero weight.
+       a_mult scales samples; MMLT burn-in uses it to give its path samples the same average weight as MLT splats.
+*/
+__kernel void SplatSamplesAtomic(const __global float4* in_color, const int a_samplesNum, const int w, const int h, const float a_mult,
+                                 __global float4* out_color)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= a_samplesNum)
+    return;
+
+  const float4 color = in_color[tid];
+  if (color.x == 0.0f && color.y == 0.0f && color.z == 0.0f)
+    return;
+
+  const int packedIndex = as_int(color.w);
+  const int x           = (packedIndex & 0x0000FFFF);
+  const int y           = (packedIndex & 0xFFFF0000) >> 16;
+
+  if (x >= w || y >= h)
+    return;
+
+  __global float* ptr = (__global float*)(out_color + Index2D(x, y, w));
+
+  atomic_addf(ptr + 0, color.x*a_mult);
+  atomic_addf(ptr + 1, color.y*a_mult);
+  atomic_addf(ptr + 2, color.z*a_mult);
+}
+
 __kernel void ContribSampleToScreen(const __global float4* in_color, const __global int2* a_indices, __constant ushort* a_mortonTable256,
                                     const int a_samplesNum, const int w, const int h, const float a_spp, const float a_gammaInv,
                                     __global  float4* out_colorHDR, __global uint* out_colorLDR, const int alreadySorted)
@@ -429,6 +547,29 @@ __kernel void HDRToLDRWithScale(const __global float4* in_color, __global uint*
   out_colorLDR[Index2D(x, y, w)] = RealColorToUint32(ToneMapping4(color2));
 }
 
+__kernel void ContribPerPixelToScreen(const __global float4* in_color, const float a_scale, const float a_gammaInv, const int w, const int h,
+                                      __global float4* out_colorHDR, __global uint* out_colorLDR)
+{
+  const int x = GLOBAL_ID_X;
+  const int y = GLOBAL_ID_Y;
+
+  if (x >= w || y >= h)
+    return;
+
+  const float4 newColor = out_colorHDR[Index2D(x, y, w)] + in_color[Index2D(x, y, w)];
+  out_colorHDR[Index2D(x, y, w)] = newColor;
+
+  if (out_colorLDR != 0)
+  {
+    float4 color2;
+    color2.x = pow(a_scale*newColor.x, a_gammaInv);
+    color2.y = pow(a_scale*newColor.y, a_gammaInv);
+    color2.z = pow(a_scale*newColor.z, a_gammaInv);
+    color2.w = pow(a_scale*newColor.w, a_gammaInv);
+    out_colorLDR[Index2D(x, y, w)] = RealColorToUint32(ToneMapping4(color2));
+  }
+}
+
 __kernel void PackIndexToColorW(const __global int* a_packedId, __global float4* out_color, const int iNumElements)
 {
   int tid = GLOBAL_ID_X;
@@ -618,6 +759,39 @@ __kernel void ReductionFloat4Avg256(__global const float4* in_data, __global flo
 
 
 
+/**
+\brief Summ of each range of input array; one work group of 256 threads per range.
+\param in_data     - input array
+\param in_ranges   - (offset, size) of each range
+\param out_summ    - out summ of each range is written to out_summ[a_outOffset + get_group_id(0)]
+\param a_outOffset - offset in out_summ
+*/
+__kernel void ReductionFloatRangesSum256(__global const float* in_data, __global const int2* in_ranges, __global float* out_summ, int a_outOffset)
+{
+  const int2 range = in_ranges[get_group_id(0)];
+
+  float summ = 0.0f;
+  for (int i = LOCAL_ID_X; i < range.y; i += 256)
+  {
+    const float val = in_data[range.x + i];
+    summ += isfinite(val) ? val : 0.0f;
+  }
+
+  __local float sArray[256];
+  sArray[LOCAL_ID_X] = summ;
+  SYNCTHREADS_LOCAL;
+
+  for (uint c = 256 / 2; c>0; c /= 2)
+  {
+    if (LOCAL_ID_X < c)
+      sArray[LOCAL_ID_X] += sArray[LOCAL_ID_X + c];
+    SYNCTHREADS_LOCAL;
+  }
+
+  if (LOCAL_ID_X == 0)
+    out_summ[a_outOffset + get_group_id(0)] = sArray[0];
+}
+
 __kernel void ReductionFloat4Avg64(__global const float4* in_data, __global float4* out_data, int iNumElements)
 {
   int tid = GLOBAL_ID_X;
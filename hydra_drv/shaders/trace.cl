@@ -49,7 +49,8 @@ __kernel void BVH4TraversalKernel(__global const float4* restrict rpos,     __gl
 
 __kernel void BVH4TraversalInstKernel(__global const float4* restrict  rpos,     __global const float4* restrict  rdir, 
                                       __global const float4* restrict  a_bvh,    __global const float4* restrict  a_tris,
-                                      __global const uint*   restrict  in_flags, __global Lite_Hit*     restrict  out_hits, int iRunId, int iNumElements)
+                                      __global const uint*   restrict  in_flags, __global Lite_Hit*     restrict  out_hits, 
+                                      __global int*          restrict  out_overflow, int iRunId, int iNumElements)
 {
   const int tid     = GLOBAL_ID_X;
   const int tid2    = (tid < iNumElements) ? tid : iNumElements - 1;
@@ -64,13 +65,41 @@ __kernel void BVH4TraversalInstKernel(__global const float4* restrict  rpos,
     Lite_Hit liteHit = out_hits[tid];
 
     liteHit = (iRunId == 0) ? Make_Lite_Hit(MAXFLOAT, -1) : liteHit;
+  #ifdef BVH_SHORT_STACK
+    bool overflow = false;
+    liteHit = BVH4InstTraverseShortStack(ray_pos, ray_dir, 0.0f, liteHit, a_bvh, a_tris, &overflow);
+    if (overflow)                                          // finished by BVH4TraversalInstOverflowKernel
+      out_overflow[atomic_inc(out_overflow) + 1] = tid;
+  #else
     liteHit = BVH4InstTraverse(ray_pos, ray_dir, 0.0f, liteHit, a_bvh, a_tris);
+  #endif
 
     out_hits[tid] = liteHit;   // store final result
   }
 
 }
 
+/**
+\brief Finish rays that are too deep for restart trail of BVH4InstTraverseShortStack with full stack traversal. 
+       Separate kernel, so full stack does not limit occupancy of BVH4TraversalInstKernel.
+\param in_overflow - number of rays, then their ids; is filled by BVH4TraversalInstKernel
+\param out_hits    - closest hits found by short stack traversal; are updated
+*/
+__kernel void BVH4TraversalInstOverflowKernel(__global const float4* restrict  rpos,        __global const float4* restrict  rdir, 
+                                              __global const float4* restrict  a_bvh,       __global const float4* restrict  a_tris,
+                                              __global const int*    restrict  in_overflow, __global Lite_Hit*     restrict  out_hits, int iNumElements)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= min(in_overflow[0], iNumElements))
+    return;
+
+  const int    rayId   = in_overflow[tid + 1];
+  const float3 ray_pos = to_float3(rpos[rayId]); 
+  const float3 ray_dir = to_float3(rdir[rayId]); 
+
+  out_hits[rayId] = BVH4InstTraverse(ray_pos, ray_dir, 0.0f, out_hits[rayId], a_bvh, a_tris);
+}
+
 __kernel void BVH4TraversalInstKernelA(__global const float4* restrict  rpos,     __global const float4* restrict  rdir, 
                                        __global const float4* restrict  a_bvh,    __global const float4* restrict  a_tris, __global const uint2*  restrict a_alpha,  
                                        __global const float4* restrict  a_texStorage, __global const EngineGlobals* restrict a_globals,
@@ -126,6 +155,62 @@ __kernel void BVH4TraversalInstKernelAS(__global const float4* restrict  rpos,
 
 }
 
+__kernel void MakeRayReorderKeys(__global const float4* restrict rpos, __global const float4* restrict rdir, __global const uint* restrict in_flags,
+                                 __global int2* restrict out_index, float4 a_boxMin, float4 a_boxInvSize, int iNumElements, int iSortSize)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= iSortSize)
+    return;
+
+  int key = RAY_REORDER_INACTIVE_KEY;
+  if (tid < iNumElements && rayIsActiveU(in_flags[tid]))
+    key = RayReorderKey(to_float3(rpos[tid]), to_float3(rdir[tid]), to_float3(a_boxMin), to_float3(a_boxInvSize));
+
+  out_index[tid] = make_int2(key, tid);
+}
+
+__kernel void ReorderRaysByIndex(__global const int2*      restrict in_index,
+                                 __global const float4*    restrict in_rpos,  __global const float4*    restrict in_rdir,
+                                 __global const uint*      restrict in_flags, __global const RandomGen* restrict in_gens,
+                                 __global       float4*    restrict out_rpos, __global       float4*    restrict out_rdir,
+                                 __global       uint*      restrict out_flags,__global       RandomGen* restrict out_gens,
+                                 int iNumElements)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  const int2 index = in_index[tid];
+  const int  srcId = (index.y < iNumElements) ? index.y : 0;
+  const uint flags = (index.x == RAY_REORDER_INACTIVE_KEY) ? packRayFlags(0, RAY_IS_DEAD) : in_flags[srcId];
+
+  out_rpos [tid] = in_rpos[srcId];
+  out_rdir [tid] = in_rdir[srcId];
+  out_flags[tid] = flags;
+  if (in_gens != 0 && out_gens != 0)
+    out_gens[tid] = in_gens[srcId];
+}
+
+// #NOTE: reverse to ReorderRaysByIndex; only active rays write results back, hits of inactive rays are left untouched as for unsorted trace
+//
+__kernel void UnorderHitsByIndex(__global const int2*      restrict in_index,
+                                 __global const Lite_Hit*  restrict in_hits,  __global const RandomGen* restrict in_gens,
+                                 __global       Lite_Hit*  restrict out_hits, __global       RandomGen* restrict out_gens,
+                                 int iNumElements)
+{
+  const int tid = GLOBAL_ID_X;
+  if (tid >= iNumElements)
+    return;
+
+  const int2 index = in_index[tid];
+  if (index.x == RAY_REORDER_INACTIVE_KEY || index.y >= iNumElements)
+    return;
+
+  out_hits[index.y] = in_hits[tid];
+  if (in_gens != 0 && out_gens != 0)
+    out_gens[index.y] = in_gens[tid];
+}
+
 
 __kernel void ComputeHit(__global const float4*   restrict rpos, 
                          __global const float4*   restrict rdir, 